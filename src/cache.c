@@ -0,0 +1,270 @@
+#include "cache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#define CACHE_FORMAT 1
+#define CACHE_SUFFIX ".mcf"
+#define MAX_CACHE_LINE 1024
+#define FNV_PRIME_64 1099511628211ULL
+
+cacheStats cacheCounts;
+
+/* ---------- keys ---------- */
+
+cacheKey hashCacheBytes(cacheKey h, const void *bytes, size_t size) {
+    const unsigned char *b = (const unsigned char *) bytes;
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ b[i]) * FNV_PRIME_64;
+    return h;
+}
+
+cacheKey hashCacheInt(cacheKey h, long long value) {
+    return hashCacheBytes(h, &value, sizeof(value));
+}
+
+// The terminating zero keeps "ab" "c" apart from "a" "bc"
+cacheKey hashCacheString(cacheKey h, const char *s) {
+    return s ? hashCacheBytes(h, s, strlen(s) + 1) : hashCacheInt(h, -1);
+}
+
+cacheKey hashCacheTree(cacheKey h, tree *node, int withLines) {
+    if (!node)
+        return hashCacheInt(h, -1);
+    int fields[5] = {node->nodeKind, node->numChildren, node->val, node->type, withLines ? node->line : 0};
+    h = hashCacheBytes(h, fields, sizeof(fields));
+    h = hashCacheString(h, node->name);
+    for (int i = 0; i < node->numChildren; i++)
+        h = hashCacheTree(h, node->children[i], withLines);
+    return h;
+}
+
+// Size and time of the running executable where the system shows it
+cacheKey hashCompiler(cacheKey h) {
+    struct stat st;
+    h = hashCacheInt(h, CACHE_FORMAT);
+    if (stat("/proc/self/exe", &st) == 0) {
+        h = hashCacheInt(h, (long long) st.st_size);
+        h = hashCacheInt(h, (long long) st.st_mtime);
+    }
+    return h;
+}
+
+/* ---------- entries ---------- */
+
+static char *entryPath(const char *dir, cacheKey key) {
+    char *path = (char *) malloc(strlen(dir) + 32);
+    sprintf(path, "%s/%016llx%s", dir, key, CACHE_SUFFIX);
+    return path;
+}
+
+// Ln of the function is stored as @(n - base); any other label as it is
+static void writeLabel(FILE *out, const char *label, int base) {
+    int n;
+    char end;
+    if (sscanf(label, "L%d%c", &n, &end) == 1 && label[1] >= '0' && label[1] <= '9' && n > base)
+        fprintf(out, "@%d", n - base);
+    else
+        fprintf(out, "%s", label);
+}
+
+static char *readLabel(const char *text, int base) {
+    if (text[0] != '@')
+        return strdup(text);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "L%d", base + atoi(text + 1));
+    return strdup(buf);
+}
+
+// One instruction a line: kind, op, flags and weight, the three operands,
+// then "|" and the label or comment text when there is one
+static void writeInstr(FILE *out, instr *ins, int base) {
+    fprintf(out, "%d %d %d %d %d %.17g", ins->kind, ins->op, ins->cold, ins->tailCall, ins->pureCall, ins->weight);
+    for (int i = 0; i < 3; i++) {
+        operand *o = &ins->opnd[i];
+        fprintf(out, " %d %d %d ", o->kind, o->reg, o->imm);
+        if (o->label)
+            writeLabel(out, o->label, base);
+        else
+            fprintf(out, "-");
+    }
+    if (ins->text) {
+        fprintf(out, " |");
+        if (ins->kind == I_LABEL)
+            writeLabel(out, ins->text, base);
+        else
+            fprintf(out, "%s", ins->text);
+    }
+    fprintf(out, "\n");
+}
+
+static instr *readInstr(const char *line, int base) {
+    int kind, op, cold, tailCall, pureCall, n;
+    double weight;
+    if (sscanf(line, "%d %d %d %d %d %lg%n", &kind, &op, &cold, &tailCall, &pureCall, &weight, &n) != 6 ||
+        kind < I_OP || kind > I_BLANK || op < 0 || op >= NUM_OPCODES)
+        return NULL;
+    instr *ins = newInstr((instrKind) kind);
+    ins->op = (opcode) op;
+    ins->cold = cold;
+    ins->tailCall = tailCall;
+    ins->pureCall = pureCall;
+    ins->weight = weight;
+    line += n;
+    for (int i = 0; i < 3; i++) {
+        operand *o = &ins->opnd[i];
+        int okind;
+        char label[MAX_CACHE_LINE];
+        if (sscanf(line, " %d %d %d %1023s%n", &okind, &o->reg, &o->imm, label, &n) != 4 ||
+            okind < OPD_NONE || okind > OPD_LABEL) {
+            free(ins);
+            return NULL;
+        }
+        o->kind = (operandKind) okind;
+        o->label = strcmp(label, "-") == 0 ? NULL : readLabel(label, base);
+        line += n;
+    }
+    if (strncmp(line, " |", 2) == 0) {
+        char *text = strdup(line + 2);
+        text[strcspn(text, "\n")] = '\0';
+        ins->text = ins->kind == I_LABEL ? readLabel(text, base) : text;
+        if (ins->text != text)
+            free(text);
+    }
+    return ins;
+}
+
+int loadCachedFunction(const char *dir, cacheKey key, cacheEntry *entry) {
+    char *path = entryPath(dir, key);
+    FILE *in = fopen(path, "r");
+    cacheCounts.lookups++;
+    if (!in) {
+        free(path);
+        return -1;
+    }
+    char line[MAX_CACHE_LINE], name[MAX_CACHE_LINE];
+    int format, numInstrs, ok = 0;
+    codeFunc *func = (codeFunc *) calloc(1, sizeof(codeFunc));
+    if (fgets(line, sizeof(line), in) &&
+        sscanf(line, "mcc-cache %d %1023s %d %d %d %lg %d", &format, name, &entry->labels, &entry->registers,
+               &entry->boundsChecks, &entry->seconds, &numInstrs) == 7 && format == CACHE_FORMAT) {
+        ok = 1;
+        for (int i = 0; i < numInstrs && ok; i++) {
+            instr *ins = NULL;
+            if (fgets(line, sizeof(line), in) && strchr(line, '\n'))
+                ins = readInstr(line, entry->labelBase);
+            if (ins)
+                appendInstr(&func->code, ins);
+            ok = ins != NULL;
+        }
+    }
+    fclose(in);
+    if (!ok) {
+        // Left for storeCachedFunction to replace
+        free(func);
+        free(path);
+        return -1;
+    }
+    func->name = strdup(name);
+    func->calls = -1;
+    entry->func = func;
+    utime(path, NULL);
+    free(path);
+    cacheCounts.hits++;
+    return 0;
+}
+
+void storeCachedFunction(const char *dir, cacheKey key, cacheEntry *entry) {
+    int numInstrs = 0;
+    for (instr *ins = entry->func->code.head; ins; ins = ins->next) {
+        // Text the line format cannot hold stays out of the cache
+        if (ins->text && (strchr(ins->text, '\n') || strlen(ins->text) > MAX_CACHE_LINE / 2))
+            return;
+        numInstrs++;
+    }
+    mkdir(dir, 0777);
+    char *path = entryPath(dir, key);
+    // Written under a name of its own and renamed, so a compile running at
+    // the same time never reads half an entry
+    char *temp = (char *) malloc(strlen(path) + 16);
+    sprintf(temp, "%s.%d", path, (int) getpid());
+    FILE *out = fopen(temp, "w");
+    if (out) {
+        fprintf(out, "mcc-cache %d %s %d %d %d %.17g %d\n", CACHE_FORMAT, entry->func->name, entry->labels,
+                entry->registers, entry->boundsChecks, entry->seconds, numInstrs);
+        for (instr *ins = entry->func->code.head; ins; ins = ins->next)
+            writeInstr(out, ins, entry->labelBase);
+        if (fclose(out) != 0 || rename(temp, path) != 0)
+            remove(temp);
+    }
+    free(temp);
+    free(path);
+}
+
+/* ---------- eviction ---------- */
+
+typedef struct cacheFile {
+    char *path;
+    long long bytes;
+    long long used;             // modification time, renewed by every hit
+} cacheFile;
+
+// Least recently used first, then by name so the order is the same on
+// every run
+static int compareUse(const void *a, const void *b) {
+    const cacheFile *x = (const cacheFile *) a, *y = (const cacheFile *) b;
+    if (x->used != y->used)
+        return x->used < y->used ? -1 : 1;
+    return strcmp(x->path, y->path);
+}
+
+void trimCache(const char *dir, long long limit) {
+    DIR *d = opendir(dir);
+    if (!d)
+        return;
+    cacheFile *files = NULL;
+    int numFiles = 0;
+    long long total = 0;
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        size_t len = strlen(e->d_name), suffix = strlen(CACHE_SUFFIX);
+        if (len <= suffix || strcmp(e->d_name + len - suffix, CACHE_SUFFIX) != 0)
+            continue;
+        char *path = (char *) malloc(strlen(dir) + len + 2);
+        sprintf(path, "%s/%s", dir, e->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0) {
+            free(path);
+            continue;
+        }
+        files = (cacheFile *) realloc(files, (numFiles + 1) * sizeof(cacheFile));
+        files[numFiles].path = path;
+        files[numFiles].bytes = (long long) st.st_size;
+        files[numFiles].used = (long long) st.st_mtime;
+        total += files[numFiles++].bytes;
+    }
+    closedir(d);
+    qsort(files, numFiles, sizeof(cacheFile), compareUse);
+    for (int i = 0; i < numFiles; i++) {
+        if (total > limit && remove(files[i].path) == 0) {
+            total -= files[i].bytes;
+            cacheCounts.evicted++;
+            cacheCounts.evictedBytes += files[i].bytes;
+        }
+        free(files[i].path);
+    }
+    free(files);
+}
+
+void printCacheReport(FILE *out) {
+    fprintf(out, "cache: %d of %d functions reused", cacheCounts.hits, cacheCounts.lookups);
+    if (cacheCounts.lookups > 0)
+        fprintf(out, " (%.0f%%)", 100.0 * cacheCounts.hits / cacheCounts.lookups);
+    fprintf(out, ", %.2f ms of code generation saved\n", 1000 * cacheCounts.savedSeconds);
+    if (cacheCounts.evicted > 0)
+        fprintf(out, "cache: removed %d entries, %lld bytes, over the size limit\n", cacheCounts.evicted,
+                cacheCounts.evictedBytes);
+}
@@ -0,0 +1,68 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include "tree.h"
+#include "codegen.h"
+
+// Compile cache. With --cache=DIR the generated code of every function is
+// kept in DIR under a 64-bit key: an FNV-1a hash of the compiler, the
+// options, the function's tree and everything its code depends on, which
+// the code generator feeds in. A later compile that arrives at the same
+// key reads the instructions back instead of generating them again.
+//
+// The labels L1, L2, ... are numbered across the whole program, so an
+// entry stores those of its function relative to the first one and gets
+// them renumbered when it is read. Functions still come out in source
+// order, and the output is the same as without the cache.
+//
+// Each entry is one file, whose modification time a hit renews. Once a
+// compile is done the least recently used entries are removed until the
+// directory is within the size limit.
+
+typedef unsigned long long cacheKey;
+
+#define CACHE_KEY_START 14695981039346656037ULL
+
+// What a function took from the counters the code generator keeps for the
+// whole program
+typedef struct cacheEntry {
+    codeFunc *func;
+    int labelBase;              // labels given out before the function
+    int labels;                 // labels the function used
+    int registers;              // round robin registers handed out at -O0
+    int boundsChecks;
+    double seconds;             // time it took to generate the function
+} cacheEntry;
+
+typedef struct cacheStats {
+    int lookups;
+    int hits;
+    double savedSeconds;        // generation time of the hits, less reading them
+    int evicted;
+    long long evictedBytes;
+} cacheStats;
+
+extern cacheStats cacheCounts;
+
+cacheKey hashCacheBytes(cacheKey h, const void *bytes, size_t size);
+cacheKey hashCacheInt(cacheKey h, long long value);
+cacheKey hashCacheString(cacheKey h, const char *s);
+// Kinds, values, types and names of the tree; line numbers too with
+// withLines, for code that reports them
+cacheKey hashCacheTree(cacheKey h, tree *node, int withLines);
+// The compiler itself, so a rebuilt mcc does not reuse older code
+cacheKey hashCompiler(cacheKey h);
+
+// Reads the function stored under key, with its labels numbered from
+// entry->labelBase + 1. Returns 0 and fills in the rest of entry, or -1
+// when there is no usable entry.
+int loadCachedFunction(const char *dir, cacheKey key, cacheEntry *entry);
+// Stores entry->func under key; a directory that cannot be written only
+// means the next compile generates the function again
+void storeCachedFunction(const char *dir, cacheKey key, cacheEntry *entry);
+// Removes the least recently used entries until at most limit bytes remain
+void trimCache(const char *dir, long long limit);
+void printCacheReport(FILE *out);
+
+#endif
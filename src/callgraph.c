@@ -0,0 +1,254 @@
+#include "callgraph.h"
+#include <stdlib.h>
+#include <string.h>
+
+static cgNode *addFunction(callGraph *graph, char *name, tree *decl) {
+    cgNode *node = (cgNode *) calloc(1, sizeof(cgNode));
+    node->name = name;
+    node->decl = decl;
+    node->generic = 1;
+    cgNode **tail = &graph->funcs;
+    while (*tail) {
+        tail = &(*tail)->next;
+        node->index++;
+    }
+    *tail = node;
+    return node;
+}
+
+cgNode *findFunction(callGraph *graph, char *name) {
+    for (cgNode *node = graph->funcs; node; node = node->next)
+        if (strcmp(node->name, name) == 0)
+            return node;
+    return NULL;
+}
+
+static cgGlobal *findGlobal(callGraph *graph, char *name) {
+    for (cgGlobal *g = graph->globals; g; g = g->next)
+        if (strcmp(g->name, name) == 0)
+            return g;
+    return NULL;
+}
+
+int isGlobalUsed(callGraph *graph, char *name) {
+    cgGlobal *g = findGlobal(graph, name);
+    return g && g->used;
+}
+
+cgSite *findSite(callGraph *graph, tree *call) {
+    for (cgSite *site = graph->sites; site; site = site->next)
+        if (site->call == call)
+            return site;
+    return NULL;
+}
+
+// Collects functions and globals from the left-nested declList
+static void collectDecls(callGraph *graph, tree *node) {
+    if (!node)
+        return;
+    switch (node->nodeKind) {
+        case DECLLIST:
+        case DECL:
+            for (int i = 0; i < node->numChildren; i++)
+                collectDecls(graph, node->children[i]);
+            break;
+        case VARDECL: {
+            cgGlobal *g = (cgGlobal *) calloc(1, sizeof(cgGlobal));
+            g->name = node->children[1]->name;
+            cgGlobal **tail = &graph->globals;
+            while (*tail)
+                tail = &(*tail)->next;
+            *tail = g;
+            break;
+        }
+        case FUNDECL:
+            addFunction(graph, node->name, node);
+            break;
+        default:
+            break;
+    }
+}
+
+static void addCallee(cgNode *caller, cgNode *callee) {
+    for (int i = 0; i < caller->numCallees; i++)
+        if (caller->callees[i] == callee)
+            return;
+    caller->callees = (cgNode **) realloc(caller->callees, (caller->numCallees + 1) * sizeof(cgNode *));
+    caller->callees[caller->numCallees++] = callee;
+}
+
+static void findCalls(callGraph *graph, cgNode *caller, tree *node) {
+    if (!node)
+        return;
+    if (node->nodeKind == FUNCCALLEXPR) {
+        char *name = node->children[0]->name;
+        cgNode *callee = findFunction(graph, name);
+        if (!callee)
+            callee = addFunction(graph, name, NULL);
+        addCallee(caller, callee);
+    }
+    for (int i = 0; i < node->numChildren; i++)
+        findCalls(graph, caller, node->children[i]);
+}
+
+/* ---------- globals ---------- */
+
+// Parameter and local names, which hide globals of the same name
+int isLocalName(tree *decl, char *name) {
+    tree *formals = decl->children[1];
+    for (int i = 0; formals && i < formals->numChildren; i++)
+        if (strcmp(formals->children[i]->children[1]->name, name) == 0)
+            return 1;
+    tree *body = decl->children[2];
+    for (int i = 0; i < body->numChildren; i++) {
+        tree *child = body->children[i];
+        if (child->nodeKind != LOCALDECLLIST)
+            continue;
+        for (int j = 0; j < child->numChildren; j++)
+            if (strcmp(child->children[j]->children[1]->name, name) == 0)
+                return 1;
+    }
+    return 0;
+}
+
+static void markGlobals(callGraph *graph, tree *decl, tree *node) {
+    if (!node)
+        return;
+    if (node->nodeKind == VAR) {
+        char *name = node->children[0]->name;
+        cgGlobal *g = findGlobal(graph, name);
+        if (g && !isLocalName(decl, name))
+            g->used = 1;
+    }
+    for (int i = 0; i < node->numChildren; i++)
+        markGlobals(graph, decl, node->children[i]);
+}
+
+/* ---------- reachability ---------- */
+
+static void markReachable(cgNode *node) {
+    node->reachable = 1;
+    for (int i = 0; i < node->numCallees; i++)
+        if (!node->callees[i]->reachable)
+            markReachable(node->callees[i]);
+}
+
+static int reaches(cgNode *from, cgNode *target, char *visited) {
+    if (visited[from->index])
+        return 0;
+    visited[from->index] = 1;
+    for (int i = 0; i < from->numCallees; i++)
+        if (from->callees[i] == target || reaches(from->callees[i], target, visited))
+            return 1;
+    return 0;
+}
+
+static void countCallSites(callGraph *graph, tree *node) {
+    if (!node)
+        return;
+    if (node->nodeKind == FUNCCALLEXPR)
+        findFunction(graph, node->children[0]->name)->callSites++;
+    for (int i = 0; i < node->numChildren; i++)
+        countCallSites(graph, node->children[i]);
+}
+
+callGraph *buildCallGraph(tree *root) {
+    callGraph *graph = (callGraph *) calloc(1, sizeof(callGraph));
+    for (int i = 0; root && i < root->numChildren; i++)
+        collectDecls(graph, root->children[i]);
+
+    for (cgNode *node = graph->funcs; node; node = node->next)
+        if (node->decl)
+            findCalls(graph, node, node->decl->children[2]);
+
+    cgNode *main = findFunction(graph, "main");
+    if (main)
+        markReachable(main);
+
+    int numFuncs = 0;
+    for (cgNode *node = graph->funcs; node; node = node->next)
+        numFuncs++;
+    char *visited = (char *) malloc(numFuncs);
+    for (cgNode *node = graph->funcs; node; node = node->next) {
+        memset(visited, 0, numFuncs);
+        node->recursive = reaches(node, node, visited);
+        if (node->reachable && node->decl) {
+            countCallSites(graph, node->decl->children[2]);
+            markGlobals(graph, node->decl, node->decl->children[2]);
+        }
+    }
+    free(visited);
+    return graph;
+}
+
+void printCallGraph(FILE *out, callGraph *graph) {
+    fprintf(out, "Call graph:\n");
+    for (cgNode *node = graph->funcs; node; node = node->next) {
+        fprintf(out, "  %s", node->name);
+        if (!node->decl)
+            fprintf(out, " (builtin)");
+        if (!node->reachable)
+            fprintf(out, " (unreachable)");
+        if (node->recursive)
+            fprintf(out, " (recursive)");
+        if (node->foldable)
+            fprintf(out, " (foldable)");
+        else if (node->pure)
+            fprintf(out, " (pure)");
+        if (node->callSites > 0)
+            fprintf(out, " [%d call site%s]", node->callSites, node->callSites == 1 ? "" : "s");
+        if (node->numCallees > 0) {
+            fprintf(out, " ->");
+            for (int i = 0; i < node->numCallees; i++)
+                fprintf(out, " %s", node->callees[i]->name);
+        }
+        fprintf(out, "\n");
+        for (cgSpec *spec = node->specs; spec; spec = spec->next) {
+            tree *formals = node->decl->children[1];
+            fprintf(out, "    version %s:", spec->name);
+            for (int i = 0; i < formals->numChildren; i++)
+                if (spec->known[i])
+                    fprintf(out, " %s=%d", formals->children[i]->children[1]->name, spec->value[i]);
+            fprintf(out, "\n");
+        }
+    }
+    int unused = 0;
+    for (cgGlobal *g = graph->globals; g; g = g->next)
+        unused += !g->used;
+    if (unused) {
+        fprintf(out, "Unreferenced globals:");
+        for (cgGlobal *g = graph->globals; g; g = g->next)
+            if (!g->used)
+                fprintf(out, " %s", g->name);
+        fprintf(out, "\n");
+    }
+}
+
+void freeCallGraph(callGraph *graph) {
+    if (!graph)
+        return;
+    while (graph->funcs) {
+        cgNode *node = graph->funcs;
+        graph->funcs = node->next;
+        free(node->callees);
+        while (node->specs) {
+            cgSpec *spec = node->specs;
+            node->specs = spec->next;
+            free(spec->known);
+            free(spec->value);
+            free(spec);
+        }
+        free(node);
+    }
+    while (graph->sites) {
+        cgSite *site = graph->sites;
+        graph->sites = site->next;
+        free(site);
+    }
+    while (graph->globals) {
+        cgGlobal *g = graph->globals;
+        graph->globals = g->next;
+        free(g);
+    }
+    free(graph);
+}
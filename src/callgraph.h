@@ -0,0 +1,65 @@
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include <stdio.h>
+#include "tree.h"
+
+// Version of a function compiled with some parameters fixed to constants
+typedef struct cgSpec {
+    char *name;                 // label name, the function's own when it replaces it
+    int *known;                 // per parameter: fixed to value[i]
+    int *value;
+    struct cgSpec *next;
+} cgSpec;
+
+// One function of the program; output has no declaration and no body
+typedef struct cgNode {
+    char *name;
+    int index;                  // position in declaration order
+    tree *decl;                 // FUNDECL node, NULL for output
+    struct cgNode **callees;    // distinct functions called from the body
+    int numCallees;
+    int callSites;              // calls to this function from reachable code
+    int reachable;              // main calls it, directly or indirectly
+    int recursive;              // on a cycle of calls
+    int inlined;                // every call is expanded in place by the code generator
+    int pure;                   // stores to no global or array parameter and makes no output
+    int foldable;               // pure, reads no global and takes no array
+    int generic;                // some call needs the version without fixed parameters
+    cgSpec *specs;
+    struct cgNode *next;
+} cgNode;
+
+// Global variable and whether reachable code references it
+typedef struct cgGlobal {
+    char *name;
+    int used;
+    struct cgGlobal *next;
+} cgGlobal;
+
+// A call in reachable code and what the interprocedural analysis made of it
+typedef struct cgSite {
+    tree *call;                 // FUNCCALLEXPR node
+    int folded;                 // evaluated at compile time to value
+    int value;
+    cgSpec *spec;               // version of the callee it calls, NULL for the generic one
+    struct cgSite *next;
+} cgSite;
+
+typedef struct callGraph {
+    cgNode *funcs;              // in declaration order
+    cgGlobal *globals;
+    cgSite *sites;
+} callGraph;
+
+// Builds the whole-program call graph from the FUNCCALLEXPR nodes of
+// every function body and marks what is reachable from main
+callGraph *buildCallGraph(tree *root);
+cgNode *findFunction(callGraph *graph, char *name);
+int isGlobalUsed(callGraph *graph, char *name);
+int isLocalName(tree *decl, char *name);
+cgSite *findSite(callGraph *graph, tree *call);
+void printCallGraph(FILE *out, callGraph *graph);
+void freeCallGraph(callGraph *graph);
+
+#endif
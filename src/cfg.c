@@ -0,0 +1,245 @@
+#include "cfg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ---------- bitsets ---------- */
+
+bitset *bitsetNew(int size) {
+    bitset *set = (bitset *) malloc(sizeof(bitset));
+    set->size = size;
+    set->bits = (unsigned *) calloc((size + 31) / 32 + 1, sizeof(unsigned));
+    return set;
+}
+
+void bitsetFree(bitset *set) {
+    if (!set) return;
+    free(set->bits);
+    free(set);
+}
+
+void bitsetSet(bitset *set, int i) {
+    set->bits[i / 32] |= 1u << (i % 32);
+}
+
+void bitsetClear(bitset *set, int i) {
+    set->bits[i / 32] &= ~(1u << (i % 32));
+}
+
+int bitsetTest(bitset *set, int i) {
+    return (set->bits[i / 32] >> (i % 32)) & 1;
+}
+
+void bitsetCopy(bitset *dst, bitset *src) {
+    memcpy(dst->bits, src->bits, ((src->size + 31) / 32 + 1) * sizeof(unsigned));
+}
+
+// dst |= src; returns 1 if dst changed
+int bitsetUnion(bitset *dst, bitset *src) {
+    int changed = 0;
+    for (int i = 0; i < (src->size + 31) / 32 + 1; i++) {
+        unsigned merged = dst->bits[i] | src->bits[i];
+        if (merged != dst->bits[i]) {
+            dst->bits[i] = merged;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+/* ---------- control flow graph ---------- */
+
+static basicBlock *newBlock(cfg *graph, instr *first) {
+    basicBlock *block = (basicBlock *) calloc(1, sizeof(basicBlock));
+    block->id = graph->numBlocks;
+    block->first = first;
+    graph->blocks = (basicBlock **) realloc(graph->blocks, (graph->numBlocks + 1) * sizeof(basicBlock *));
+    graph->blocks[graph->numBlocks++] = block;
+    return block;
+}
+
+static basicBlock *findLabelBlock(cfg *graph, char *label) {
+    for (int i = 0; i < graph->numBlocks; i++) {
+        instr *first = graph->blocks[i]->first;
+        if (first->kind == I_LABEL && strcmp(first->text, label) == 0)
+            return graph->blocks[i];
+    }
+    return NULL;
+}
+
+static void addEdge(basicBlock *from, basicBlock *to) {
+    if (!to) return;
+    from->succs[from->numSuccs++] = to;
+    to->preds = (basicBlock **) realloc(to->preds, (to->numPreds + 1) * sizeof(basicBlock *));
+    to->preds[to->numPreds++] = from;
+}
+
+static instr *lastOp(basicBlock *block) {
+    for (instr *ins = block->last; ins; ins = ins->prev) {
+        if (ins->kind == I_OP)
+            return ins;
+        if (ins == block->first)
+            break;
+    }
+    return NULL;
+}
+
+// Splits the function at labels and after branches, then links the blocks
+cfg *buildCFG(codeFunc *func) {
+    cfg *graph = (cfg *) calloc(1, sizeof(cfg));
+    graph->func = func;
+    graph->numVregs = func->numVregs;
+
+    basicBlock *cur = NULL;
+    for (instr *ins = func->code.head; ins; ins = ins->next) {
+        if (!cur || ins->kind == I_LABEL)
+            cur = newBlock(graph, ins);
+        cur->last = ins;
+        if (isBranch(ins))
+            cur = NULL;
+    }
+
+    for (int i = 0; i < graph->numBlocks; i++) {
+        basicBlock *block = graph->blocks[i];
+        basicBlock *next = i + 1 < graph->numBlocks ? graph->blocks[i + 1] : NULL;
+        instr *term = lastOp(block);
+        if (!term || !isBranch(term)) {
+            addEdge(block, next);
+        } else if (term->op == OP_B || term->op == OP_J) {
+            addEdge(block, findLabelBlock(graph, term->opnd[0].label));
+        } else if (term->op == OP_BEQ || term->op == OP_BNE) {
+            addEdge(block, findLabelBlock(graph, term->opnd[2].label));
+            addEdge(block, next);
+        }
+
+        // A branch back to an earlier block closes a loop around the blocks in between
+        if (term && isBranch(term) && term->op != OP_JR) {
+            basicBlock *target = findLabelBlock(graph, term->opnd[term->op == OP_B || term->op == OP_J ? 0 : 2].label);
+            if (target && target->id <= block->id)
+                for (int j = target->id; j <= block->id; j++)
+                    graph->blocks[j]->loopDepth++;
+        }
+    }
+    return graph;
+}
+
+// Classic backwards dataflow over virtual registers
+void computeLiveness(cfg *graph) {
+    int n = graph->numVregs;
+    int regs[3];
+    for (int i = 0; i < graph->numBlocks; i++) {
+        basicBlock *block = graph->blocks[i];
+        block->use = bitsetNew(n);
+        block->def = bitsetNew(n);
+        block->liveIn = bitsetNew(n);
+        block->liveOut = bitsetNew(n);
+        for (instr *ins = block->first; ins; ins = ins->next) {
+            int numUses = instrUses(ins, regs);
+            for (int u = 0; u < numUses; u++)
+                if (isVirtualReg(regs[u]) && !bitsetTest(block->def, regs[u] - FIRST_VREG))
+                    bitsetSet(block->use, regs[u] - FIRST_VREG);
+            if (instrDefs(ins, regs) && isVirtualReg(regs[0]))
+                bitsetSet(block->def, regs[0] - FIRST_VREG);
+            if (ins == block->last)
+                break;
+        }
+    }
+
+    bitset *tmp = bitsetNew(n);
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = graph->numBlocks - 1; i >= 0; i--) {
+            basicBlock *block = graph->blocks[i];
+            for (int s = 0; s < block->numSuccs; s++)
+                changed |= bitsetUnion(block->liveOut, block->succs[s]->liveIn);
+
+            // in = use | (out - def)
+            for (int w = 0; w < (n + 31) / 32 + 1; w++)
+                tmp->bits[w] = block->use->bits[w] | (block->liveOut->bits[w] & ~block->def->bits[w]);
+            changed |= bitsetUnion(block->liveIn, tmp);
+        }
+    }
+    bitsetFree(tmp);
+}
+
+static void numberPostorder(basicBlock *block, int *visited, basicBlock **order, int *count) {
+    visited[block->id] = 1;
+    for (int s = 0; s < block->numSuccs; s++)
+        if (!visited[block->succs[s]->id])
+            numberPostorder(block->succs[s], visited, order, count);
+    order[(*count)++] = block;
+}
+
+static basicBlock *intersect(basicBlock *a, basicBlock *b) {
+    while (a != b) {
+        while (a->rpo > b->rpo)
+            a = a->idom;
+        while (b->rpo > a->rpo)
+            b = b->idom;
+    }
+    return a;
+}
+
+// Cooper, Harvey and Kennedy's iterative dominator algorithm. The entry
+// block is its own idom while iterating and reset to NULL afterwards.
+void computeDominators(cfg *graph) {
+    int n = graph->numBlocks;
+    if (n == 0)
+        return;
+    int *visited = (int *) calloc(n, sizeof(int));
+    basicBlock **post = (basicBlock **) malloc(n * sizeof(basicBlock *));
+    int count = 0;
+    numberPostorder(graph->blocks[0], visited, post, &count);
+    for (int i = 0; i < n; i++) {
+        graph->blocks[i]->rpo = -1;
+        graph->blocks[i]->idom = NULL;
+    }
+    for (int i = 0; i < count; i++)
+        post[i]->rpo = count - 1 - i;
+
+    basicBlock *entry = graph->blocks[0];
+    entry->idom = entry;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = count - 2; i >= 0; i--) {
+            basicBlock *block = post[i];
+            basicBlock *idom = NULL;
+            for (int p = 0; p < block->numPreds; p++) {
+                basicBlock *pred = block->preds[p];
+                if (pred->rpo < 0 || !pred->idom)
+                    continue;
+                idom = idom ? intersect(pred, idom) : pred;
+            }
+            if (idom != block->idom) {
+                block->idom = idom;
+                changed = 1;
+            }
+        }
+    }
+    entry->idom = NULL;
+    free(visited);
+    free(post);
+}
+
+int dominates(basicBlock *a, basicBlock *b) {
+    for (; b; b = b->idom)
+        if (a == b)
+            return 1;
+    return 0;
+}
+
+void freeCFG(cfg *graph) {
+    for (int i = 0; i < graph->numBlocks; i++) {
+        basicBlock *block = graph->blocks[i];
+        bitsetFree(block->use);
+        bitsetFree(block->def);
+        bitsetFree(block->liveIn);
+        bitsetFree(block->liveOut);
+        free(block->preds);
+        free(block);
+    }
+    free(graph->blocks);
+    free(graph);
+}
@@ -0,0 +1,52 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include "codegen.h"
+
+// Fixed size set of small integers (virtual register indices)
+typedef struct bitset {
+    int size;
+    unsigned *bits;
+} bitset;
+
+// Straight-line run of instructions with a single entry at the top
+typedef struct basicBlock {
+    int id;
+    instr *first;               // first instruction (inclusive)
+    instr *last;                // last instruction (inclusive)
+    int numSuccs;
+    struct basicBlock *succs[2];
+    int numPreds;
+    struct basicBlock **preds;
+    int loopDepth;              // number of loops enclosing the block
+    struct basicBlock *idom;    // immediate dominator, NULL for the entry and unreachable blocks
+    int rpo;                    // reverse postorder number, -1 if unreachable
+    bitset *use;                // vregs read before being written in the block
+    bitset *def;                // vregs written in the block
+    bitset *liveIn;
+    bitset *liveOut;
+} basicBlock;
+
+// Control flow graph of one generated function
+typedef struct cfg {
+    codeFunc *func;
+    int numBlocks;
+    basicBlock **blocks;        // in layout order
+    int numVregs;
+} cfg;
+
+bitset *bitsetNew(int size);
+void bitsetFree(bitset *set);
+void bitsetSet(bitset *set, int i);
+void bitsetClear(bitset *set, int i);
+int bitsetTest(bitset *set, int i);
+void bitsetCopy(bitset *dst, bitset *src);
+int bitsetUnion(bitset *dst, bitset *src);
+
+cfg *buildCFG(codeFunc *func);
+void computeLiveness(cfg *graph);
+void computeDominators(cfg *graph);
+int dominates(basicBlock *a, basicBlock *b);
+void freeCFG(cfg *graph);
+
+#endif
@@ -0,0 +1,3119 @@
+#include "codegen.h"
+#include "cache.h"
+#include "callgraph.h"
+#include "dce.h"
+#include "frame.h"
+#include "gvn.h"
+#include "ipa.h"
+#include "licm.h"
+#include "profile.h"
+#include "regalloc.h"
+#include "strtab.h"
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Global variables */
+codegenOptions cgOpts = {0, 0, 0, 0, 0, 0, 0, -1, 0, NULL, 0, 0, NULL, DEFAULT_CACHE_LIMIT};
+codeFunc *codeFuncs = NULL;
+
+/* mnemonic and whether the first operand is a register written by the op */
+static struct {
+    const char *name;
+    int defsFirst;
+} opTable[NUM_OPCODES] = {
+    [OP_ADD]   = {"add", 1},
+    [OP_ADDI]  = {"addi", 1},
+    [OP_SUB]   = {"sub", 1},
+    [OP_SUBI]  = {"subi", 1},
+    [OP_MUL]   = {"mul", 1},
+    [OP_DIV]   = {"div", 1},
+    [OP_SLL]   = {"sll", 1},
+    [OP_SRA]   = {"sra", 1},
+    [OP_SRL]   = {"srl", 1},
+    [OP_MULT]  = {"mult", 0},
+    [OP_MFHI]  = {"mfhi", 1},
+    [OP_SLT]   = {"slt", 1},
+    [OP_SLTI]  = {"slti", 1},
+    [OP_SLTU]  = {"sltu", 1},
+    [OP_SLTIU] = {"sltiu", 1},
+    [OP_XORI]  = {"xori", 1},
+    [OP_LI]    = {"li", 1},
+    [OP_LA]    = {"la", 1},
+    [OP_MOVE]  = {"move", 1},
+    [OP_LW]    = {"lw", 1},
+    [OP_SW]    = {"sw", 0},
+    [OP_LB]    = {"lb", 1},
+    [OP_SB]    = {"sb", 0},
+    [OP_BEQ]   = {"beq", 0},
+    [OP_BNE]   = {"bne", 0},
+    [OP_B]     = {"b", 0},
+    [OP_J]     = {"j", 0},
+    [OP_JAL]   = {"jal", 0},
+    [OP_JR]    = {"jr", 0},
+    [OP_SYSCALL] = {"syscall", 0},
+};
+
+/* $2 is spelled numerically, matching the expected output of the test suite */
+static char *regNames[32] = {
+    "$0", "$at", "$2", "$v1", "$a0", "$a1", "$a2", "$a3",
+    "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
+    "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
+    "$t8", "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra"
+};
+
+/* Where a variable lives at run time */
+typedef enum varStorage {
+    VAR_GLOBAL,
+    VAR_LOCAL,      // $sp relative slot in the local area
+    VAR_PARAM,      // $fp relative slot written by the caller
+    VAR_REF         // $sp relative slot holding the address of an array
+                    // passed to an inlined call
+} varStorage;
+
+typedef struct varInfo {
+    char *name;
+    varStorage storage;
+    dataType type;
+    int isArray;
+    int size;                   // number of elements for arrays
+    int width;                  // bytes per element or of the scalar, 1 for char
+    int offset;                 // slot offset for locals and parameters, from $gp for small globals
+    int small;                  // global in the small data area
+    int known;                  // parameter fixed to value by a specialized version
+    int value;
+    struct varInfo *next;
+} varInfo;
+
+// Pointer to array[iv] kept in step with an induction variable of an
+// enclosing while loop, so the element address needs no multiply
+typedef struct ivPointer {
+    varInfo *iv;
+    varInfo *array;
+    int reg;
+    struct ivPointer *next;
+} ivPointer;
+
+#define MAX_IV_POINTERS 4           // per loop, to bound register pressure
+
+#define DEFAULT_SMALL_DATA_LIMIT 8  // bytes, as gcc's -G default
+#define SMALL_DATA_MAX 32768        // reach of a signed 16-bit offset from $gp
+
+static varInfo *globals = NULL;
+static int smallDataBytes = 0;      // size of the $gp addressed area so far
+static callGraph *program = NULL;   // whole-program call graph, for stripping dead code
+static varInfo *frameVars = NULL;   // parameters and locals of the current function
+static ivPointer *ivPointers = NULL;
+
+static int loopNesting = 0;         // while loops enclosing the current statement
+static int inColdArm = 0;
+
+// Counted loop "while (iv rel bound) { ...; iv = iv + step; ... }"
+typedef struct countedLoop {
+    varInfo *iv;
+    int rel;                    // RELVAL_LT, LTE, GT or GTE
+    int step;
+    int tripCount;              // -1 unless the start and bound are constants
+} countedLoop;
+
+// Values an int expression or variable may hold, both ends included
+typedef struct valueRange {
+    long long lo;
+    long long hi;
+} valueRange;
+
+// What the bounds check elimination knows about a local or parameter at
+// the point being generated; a variable without a fact may hold anything
+typedef struct rangeFact {
+    varInfo *v;
+    valueRange range;
+} rangeFact;
+
+typedef struct rangeSet {
+    rangeFact *facts;
+    int count;
+} rangeSet;
+
+// A value kept in a register while more code is generated
+typedef struct heldValue {
+    int reg;
+    int handedOut;              // regCount when reg was handed out, at -O0
+    instr *after;               // last instruction once the value was made
+} heldValue;
+
+#define DEFAULT_UNROLL_FACTOR 4
+#define UNROLL_BUDGET 240           // AST nodes in one unrolled body
+#define FULL_UNROLL_MAX_TRIPS 16
+
+#define INLINE_SMALL_SIZE 60        // AST nodes of a body copied into every caller
+#define INLINE_SINGLE_SITE_SIZE 400 // AST nodes of a body moved into its only caller
+#define INLINE_HOT_SIZE 150         // AST nodes of a hot body copied into every caller
+#define INLINE_HOT_SHARE 10         // hot: called at least 1/10 as often as the busiest function
+#define INLINE_HOT_CALLS 100        // and often enough for the calls to matter
+
+static tree *prevStatement = NULL;  // statement generated just before the current one
+static int reportQuiet = 0;         // inside a duplicated loop body
+static char *inlineExit = NULL;     // label after the inlined body being generated
+static int inlineResult = 0;        // register receiving its return value
+static codeFunc *curFunc = NULL;
+static cgNode *curNode = NULL;      // call graph node of the function being generated
+static char *selfTailLabel = NULL;  // top of the body, where self tail calls loop back
+static int labelCount = 0;
+static int regCount = 0;
+
+#define MAX_SQUARE_ROOT 46340           // largest v with v * v inside an int
+#define BOUNDS_ERROR "boundserror"      // routine reporting a failed bounds check
+#define PROFILE_COUNTS "profilecounts"  // counter table in .data
+#define PROFILE_DUMP "profiledump"      // routine printing it after main returns
+
+static rangeSet ranges = {NULL, 0};
+static int numBoundsChecks = 0;     // checks emitted, which call BOUNDS_ERROR when they fail
+
+static profSite *profSites = NULL;
+static int numProfSites = 0;
+static int countersSmall = 0;       // counter table at the start of the $gp area
+static int *counterRegs = NULL;     // register holding each counter, 0 for memory
+
+#define MAX_HELD_COUNTERS 4         // per loop nest, to bound register pressure
+
+static int heldCounters[MAX_HELD_COUNTERS];
+static int numHeldCounters = 0;
+
+static profileData profile;         // counts read for --profile-use
+static int haveProfile = 0;
+static long long profCalls = -1;    // recorded calls of the function whose body is generated
+static double profScale = 1;        // runs of that body per call of the one it is expanded in
+static double curWeight = -1;       // runs per call of the code being emitted, -1 unknown
+
+/* ---------- instruction lists ---------- */
+
+operand regOpnd(int reg) {
+    operand o = {OPD_REG, reg, 0, NULL};
+    return o;
+}
+
+operand immOpnd(int imm) {
+    operand o = {OPD_IMM, 0, imm, NULL};
+    return o;
+}
+
+operand memOpnd(int offset, int reg) {
+    operand o = {OPD_MEM, reg, offset, NULL};
+    return o;
+}
+
+operand labelOpnd(char *label) {
+    operand o = {OPD_LABEL, 0, 0, label};
+    return o;
+}
+
+operand noOpnd(void) {
+    operand o = {OPD_NONE, 0, 0, NULL};
+    return o;
+}
+
+instr *newInstr(instrKind kind) {
+    instr *ins = (instr *) calloc(1, sizeof(instr));
+    if (!ins) {
+        fprintf(stderr, "Error: Memory allocation failed for instruction\n");
+        exit(1);
+    }
+    ins->kind = kind;
+    ins->weight = -1;
+    return ins;
+}
+
+instr *newOp(opcode op, operand a, operand b, operand c) {
+    instr *ins = newInstr(I_OP);
+    ins->op = op;
+    ins->opnd[0] = a;
+    ins->opnd[1] = b;
+    ins->opnd[2] = c;
+    return ins;
+}
+
+void insertBefore(instrList *list, instr *pos, instr *ins) {
+    if (!pos) {
+        appendInstr(list, ins);
+        return;
+    }
+    ins->next = pos;
+    ins->prev = pos->prev;
+    if (pos->prev)
+        pos->prev->next = ins;
+    else
+        list->head = ins;
+    pos->prev = ins;
+}
+
+void insertAfter(instrList *list, instr *pos, instr *ins) {
+    if (!pos) {
+        ins->prev = NULL;
+        ins->next = list->head;
+        if (list->head)
+            list->head->prev = ins;
+        else
+            list->tail = ins;
+        list->head = ins;
+        return;
+    }
+    ins->prev = pos;
+    ins->next = pos->next;
+    if (pos->next)
+        pos->next->prev = ins;
+    else
+        list->tail = ins;
+    pos->next = ins;
+}
+
+void appendInstr(instrList *list, instr *ins) {
+    insertAfter(list, list->tail, ins);
+}
+
+void removeInstr(instrList *list, instr *ins) {
+    if (ins->prev)
+        ins->prev->next = ins->next;
+    else
+        list->head = ins->next;
+    if (ins->next)
+        ins->next->prev = ins->prev;
+    else
+        list->tail = ins->prev;
+    ins->prev = ins->next = NULL;
+}
+
+const char *opcodeName(opcode op) {
+    return opTable[op].name;
+}
+
+int opDefinesFirst(opcode op) {
+    return opTable[op].defsFirst;
+}
+
+// Registers written by an instruction; returns how many were stored in regs
+int instrDefs(instr *ins, int *regs) {
+    if (ins->kind != I_OP || !opTable[ins->op].defsFirst || ins->opnd[0].kind != OPD_REG)
+        return 0;
+    regs[0] = ins->opnd[0].reg;
+    return 1;
+}
+
+// Registers read by an instruction (including memory base registers)
+int instrUses(instr *ins, int *regs) {
+    int n = 0;
+    if (ins->kind != I_OP)
+        return 0;
+    for (int i = 0; i < 3; i++) {
+        operand *o = &ins->opnd[i];
+        if (o->kind == OPD_REG && !(i == 0 && opTable[ins->op].defsFirst))
+            regs[n++] = o->reg;
+        else if (o->kind == OPD_MEM)
+            regs[n++] = o->reg;
+    }
+    return n;
+}
+
+int isBranch(instr *ins) {
+    if (ins->kind != I_OP)
+        return 0;
+    return ins->op == OP_BEQ || ins->op == OP_BNE || ins->op == OP_B ||
+           ins->op == OP_J || ins->op == OP_JR;
+}
+
+int isLoad(opcode op) {
+    return op == OP_LW || op == OP_LB;
+}
+
+int isStore(opcode op) {
+    return op == OP_SW || op == OP_SB;
+}
+
+// A global scalar, named by its symbol or by its offset in the small data area
+int isGlobalLocation(operand *o) {
+    return o->kind == OPD_LABEL || (o->kind == OPD_MEM && o->reg == REG_GP);
+}
+
+static void printReg(FILE *out, int reg) {
+    if (isVirtualReg(reg))
+        fprintf(out, "$vr%d", reg - FIRST_VREG);
+    else
+        fprintf(out, "%s", regNames[reg]);
+}
+
+static void printOperand(FILE *out, operand *o) {
+    switch (o->kind) {
+        case OPD_REG:
+            printReg(out, o->reg);
+            break;
+        case OPD_IMM:
+            fprintf(out, "%d", o->imm);
+            break;
+        case OPD_MEM:
+            if (o->imm != 0)
+                fprintf(out, "%d", o->imm);
+            fprintf(out, "(");
+            printReg(out, o->reg);
+            fprintf(out, ")");
+            break;
+        case OPD_LABEL:
+            fprintf(out, "%s", o->label);
+            break;
+        default:
+            break;
+    }
+}
+
+void printInstr(FILE *out, instr *ins) {
+    switch (ins->kind) {
+        case I_OP:
+            fprintf(out, "\t%s", opTable[ins->op].name);
+            for (int i = 0; i < 3 && ins->opnd[i].kind != OPD_NONE; i++) {
+                fprintf(out, i == 0 ? " " : ", ");
+                printOperand(out, &ins->opnd[i]);
+            }
+            fprintf(out, "\n");
+            break;
+        case I_LABEL:
+            fprintf(out, "%s:\n", ins->text);
+            break;
+        case I_COMMENT:
+            fprintf(out, "\t# %s\n", ins->text);
+            break;
+        case I_BLANK:
+            fprintf(out, "\n");
+            break;
+    }
+}
+
+/* ---------- emission into the current function ---------- */
+
+static char *formatString(const char *fmt, va_list args) {
+    char buf[256];
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    return strdup(buf);
+}
+
+static void emitComment(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    instr *ins = newInstr(I_COMMENT);
+    ins->text = formatString(fmt, args);
+    va_end(args);
+    appendInstr(&curFunc->code, ins);
+}
+
+static void emitLabel(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    instr *ins = newInstr(I_LABEL);
+    ins->text = formatString(fmt, args);
+    va_end(args);
+    appendInstr(&curFunc->code, ins);
+}
+
+static void emitBlank(void) {
+    appendInstr(&curFunc->code, newInstr(I_BLANK));
+}
+
+static void emit(opcode op, operand a, operand b, operand c) {
+    instr *ins = newOp(op, a, b, c);
+    ins->weight = curWeight;
+    appendInstr(&curFunc->code, ins);
+}
+
+static void emit2(opcode op, operand a, operand b) {
+    emit(op, a, b, noOpnd());
+}
+
+static void emit1(opcode op, operand a) {
+    emit(op, a, noOpnd(), noOpnd());
+}
+
+static char *labelName(int label) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "L%d", label);
+    return strdup(buf);
+}
+
+static char *prefixedName(const char *prefix, const char *name) {
+    char *s = (char *) malloc(strlen(prefix) + strlen(name) + 1);
+    strcpy(s, prefix);
+    strcat(s, name);
+    return s;
+}
+
+static int newLabel(void) {
+    return ++labelCount;
+}
+
+int newVirtualReg(codeFunc *func) {
+    return FIRST_VREG + func->numVregs++;
+}
+
+// Without optimization registers are handed out round robin from $s0-$s7
+static int nextRegister(void) {
+    if (cgOpts.optLevel == 0)
+        return REG_S0 + (regCount++ % NUM_SAVED_REGS);
+    return newVirtualReg(curFunc);
+}
+
+// Notes a value about to be kept while other code is generated
+static heldValue holdRegister(int reg) {
+    heldValue held = {reg, -1, curFunc->code.tail};
+    if (cgOpts.optLevel == 0 && reg >= REG_S0 && reg < REG_S0 + NUM_SAVED_REGS && regCount > 0)
+        held.handedOut = regCount - 1 - (regCount - 1 - (reg - REG_S0)) % NUM_SAVED_REGS;
+    return held;
+}
+
+// The register holding a held value where it is used. Once the round
+// robin has come back to its register, which takes more than eight
+// values live at once, the value is stored to a frame slot where it was
+// made and loaded into a fresh register here.
+static int keepRegister(heldValue held) {
+    if (held.handedOut < 0 || regCount <= held.handedOut + NUM_SAVED_REGS)
+        return held.reg;
+    codeFunc *func = curFunc;
+    int offset = 4 * (func->numLocalWords + func->numSpillSlots + 1);
+    func->numSpillSlots++;
+    insertAfter(&func->code, held.after, newOp(OP_SW, regOpnd(held.reg), memOpnd(offset, REG_SP), noOpnd()));
+    int reg = nextRegister();
+    emitComment("Reloading a value the registers ran out for");
+    emit2(OP_LW, regOpnd(reg), memOpnd(offset, REG_SP));
+    return reg;
+}
+
+// Where a profile counter is kept: an offset from $gp when the table is
+// in the small data area, and otherwise from its address, loaded first
+static operand counterLocation(int site) {
+    if (countersSmall)
+        return memOpnd(4 * site, REG_GP);
+    int base = nextRegister();
+    emit2(OP_LA, regOpnd(base), labelOpnd(PROFILE_COUNTS));
+    return memOpnd(4 * site, base);
+}
+
+// Adds amount to the profile counter of a site, in the register that
+// holds it inside a loop nest, or in memory
+static void emitCount(tree *node, profKind kind, int amount) {
+    int site = cgOpts.profile ? findProfileSite(profSites, numProfSites, node, kind) : -1;
+    if (site < 0 || !profSites[site].counted)
+        return;
+    emitComment("Profile counter %d", site);
+    if (counterRegs[site]) {
+        emit(OP_ADDI, regOpnd(counterRegs[site]), regOpnd(counterRegs[site]), immOpnd(amount));
+        return;
+    }
+    operand location = counterLocation(site);
+    int count = nextRegister();
+    emit2(OP_LW, regOpnd(count), location);
+    emit(OP_ADDI, regOpnd(count), regOpnd(count), immOpnd(amount));
+    emit2(OP_SW, regOpnd(count), location);
+}
+
+// Count --profile-use recorded for a site, or -1
+static long long siteCount(tree *node, profKind kind) {
+    return haveProfile ? profileCount(&profile, node, kind) : -1;
+}
+
+// Runs per call of the function being generated of code whose site
+// counted count runs, or -1
+static double runsPerCall(long long count) {
+    if (count < 0 || profCalls < 0 || profScale < 0)
+        return -1;
+    return profCalls == 0 ? 0 : profScale * count / profCalls;
+}
+
+/* ---------- variables ---------- */
+
+static varInfo *newVar(char *name, varStorage storage, dataType type, int isArray, int size) {
+    varInfo *v = (varInfo *) calloc(1, sizeof(varInfo));
+    v->name = name;
+    v->storage = storage;
+    v->type = type;
+    v->isArray = isArray;
+    v->size = size;
+    // char is stored as a byte except in parameter slots, which the
+    // caller fills with a word
+    v->width = type == DT_CHAR && (isArray || storage != VAR_PARAM) ? 1 : 4;
+    return v;
+}
+
+static void appendVar(varInfo **list, varInfo *v) {
+    while (*list)
+        list = &(*list)->next;
+    *list = v;
+}
+
+static varInfo *lookupVar(char *name) {
+    for (varInfo *v = frameVars; v; v = v->next)
+        if (strcmp(v->name, name) == 0)
+            return v;
+    for (varInfo *v = globals; v; v = v->next)
+        if (strcmp(v->name, name) == 0)
+            return v;
+    return NULL;
+}
+
+static opcode loadOp(varInfo *v) {
+    return v->width == 1 ? OP_LB : OP_LW;
+}
+
+static opcode storeOp(varInfo *v) {
+    return v->width == 1 ? OP_SB : OP_SW;
+}
+
+// Memory operand holding a scalar variable
+static operand varLocation(varInfo *v) {
+    switch (v->storage) {
+        case VAR_LOCAL:
+            return memOpnd(v->offset, REG_SP);
+        case VAR_PARAM:
+            return memOpnd(v->offset, REG_FP);
+        default:
+            if (v->small)
+                return memOpnd(v->offset, REG_GP);
+            return labelOpnd(prefixedName("var", v->name));
+    }
+}
+
+/* ---------- expressions ---------- */
+
+// Evaluates constant integer subtrees; returns 1 and stores the value if foldable
+static int constantValue(tree *node, int *value) {
+    int left, right;
+    if (!node)
+        return 0;
+    switch (node->nodeKind) {
+        case INTEGER:
+        case CHAR:
+            *value = node->val;
+            return 1;
+        case EXPRESSION:
+            return node->numChildren == 1 && constantValue(node->children[0], value);
+        case FACTOR:
+            return constantValue(node->children[0], value);
+        case VAR: {
+            varInfo *v = node->numChildren == 1 ? lookupVar(node->children[0]->name) : NULL;
+            if (!v || !v->known)
+                return 0;
+            *value = v->value;
+            return 1;
+        }
+        case FUNCCALLEXPR: {
+            cgSite *site = cgOpts.optLevel > 0 ? findSite(program, node) : NULL;
+            if (!site || !site->folded)
+                return 0;
+            *value = site->value;
+            return 1;
+        }
+        case ADDOP:
+        case MULOP:
+            if (!constantValue(node->children[0], &left) || !constantValue(node->children[1], &right))
+                return 0;
+            switch (node->val) {
+                case OPVAL_ADD: *value = left + right; return 1;
+                case OPVAL_SUB: *value = left - right; return 1;
+                case OPVAL_MUL: *value = left * right; return 1;
+                default:
+                    if (right == 0)
+                        return 0;
+                    *value = left / right;
+                    return 1;
+            }
+        default:
+            return 0;
+    }
+}
+
+static int containsCall(tree *node) {
+    if (!node)
+        return 0;
+    if (node->nodeKind == FUNCCALLEXPR)
+        return 1;
+    for (int i = 0; i < node->numChildren; i++)
+        if (containsCall(node->children[i]))
+            return 1;
+    return 0;
+}
+
+// Sethi-Ullman label: registers needed to evaluate a subtree without
+// holding more than necessary
+static int registerNeed(tree *node) {
+    int value;
+    switch (node->nodeKind) {
+        case EXPRESSION:
+        case FACTOR:
+            return registerNeed(node->children[0]);
+        case VAR:
+            if (node->numChildren > 1) {
+                int index = registerNeed(node->children[1]);
+                return index > 2 ? index : 2;
+            }
+            return 1;
+        case ADDOP:
+        case MULOP:
+        case RELOP: {
+            if (node->nodeKind != RELOP && constantValue(node, &value))
+                return 1;
+            int left = registerNeed(node->children[0]);
+            int right = registerNeed(node->children[1]);
+            if (left == right)
+                return left + 1;
+            return left > right ? left : right;
+        }
+        default:
+            return 1;
+    }
+}
+
+// Skips the EXPRESSION and FACTOR wrappers around a single operand
+static tree *stripWrappers(tree *node) {
+    while ((node->nodeKind == EXPRESSION || node->nodeKind == FACTOR) && node->numChildren == 1)
+        node = node->children[0];
+    return node;
+}
+
+// Scalar variable referenced by a bare "x" operand, or NULL
+static varInfo *scalarOperand(tree *node) {
+    node = stripWrappers(node);
+    if (node->nodeKind != VAR || node->numChildren != 1)
+        return NULL;
+    varInfo *v = lookupVar(node->children[0]->name);
+    return v && !v->isArray ? v : NULL;
+}
+
+static int genExpr(tree *node);
+
+// Evaluates the more demanding operand first so the other one is held for
+// as short a time as possible. Operands containing calls keep source order,
+// since a call may change a variable the other operand reads.
+static void genOperands(tree *node, int *left, int *right) {
+    tree *l = node->children[0];
+    tree *r = node->children[1];
+    heldValue first, second;
+    if (registerNeed(r) > registerNeed(l) && !containsCall(l) && !containsCall(r)) {
+        first = holdRegister(genExpr(r));
+        second = holdRegister(genExpr(l));
+        *right = keepRegister(first);
+        *left = keepRegister(second);
+    } else {
+        first = holdRegister(genExpr(l));
+        second = holdRegister(genExpr(r));
+        *left = keepRegister(first);
+        *right = keepRegister(second);
+    }
+}
+
+/* ---------- strength reduction ---------- */
+
+static int isPowerOfTwo(unsigned x) {
+    return x && !(x & (x - 1));
+}
+
+static int log2u(unsigned x) {
+    int k = 0;
+    while (x > 1) {
+        x >>= 1;
+        k++;
+    }
+    return k;
+}
+
+static int genNegate(int reg) {
+    int neg = nextRegister();
+    emit(OP_SUB, regOpnd(neg), regOpnd(REG_ZERO), regOpnd(reg));
+    return neg;
+}
+
+// reg << k, reusing reg itself when k is zero
+static int genShiftLeft(int reg, int k) {
+    if (k == 0)
+        return reg;
+    int shifted = nextRegister();
+    emit(OP_SLL, regOpnd(shifted), regOpnd(reg), immOpnd(k));
+    return shifted;
+}
+
+// reg * c using at most two shifts and an add or subtract, falling back
+// to mul when c has no such decomposition
+static int genMulConst(int reg, int c) {
+    unsigned m = c < 0 ? 0u - (unsigned) c : (unsigned) c;
+    int result;
+    if (m == 0) {
+        result = nextRegister();
+        emit2(OP_LI, regOpnd(result), immOpnd(0));
+        return result;
+    }
+    if (isPowerOfTwo(m)) {
+        result = genShiftLeft(reg, log2u(m));
+    } else if (isPowerOfTwo(m & (m - 1)) && isPowerOfTwo(m & -m)) {
+        // two bits set: (reg << a) + (reg << b)
+        int high = genShiftLeft(reg, log2u(m & (m - 1)));
+        int low = genShiftLeft(reg, log2u(m & -m));
+        result = nextRegister();
+        emit(OP_ADD, regOpnd(result), regOpnd(high), regOpnd(low));
+    } else if (m < 0x80000000u && isPowerOfTwo(m + (m & -m))) {
+        // a single run of ones: (reg << a) - (reg << b)
+        int high = genShiftLeft(reg, log2u(m + (m & -m)));
+        int low = genShiftLeft(reg, log2u(m & -m));
+        result = nextRegister();
+        emit(OP_SUB, regOpnd(result), regOpnd(high), regOpnd(low));
+    } else {
+        int factor = nextRegister();
+        emit2(OP_LI, regOpnd(factor), immOpnd(c));
+        result = nextRegister();
+        emit(OP_MUL, regOpnd(result), regOpnd(reg), regOpnd(factor));
+        return result;
+    }
+    return c < 0 ? genNegate(result) : result;
+}
+
+// Multiplier and shift for signed division by d with a multiply-high,
+// after Hacker's Delight section 10-4 (|d| >= 2, not a power of two)
+static void divisionMagic(int d, int *multiplier, int *shift) {
+    const unsigned two31 = 0x80000000u;
+    unsigned ad = d < 0 ? 0u - (unsigned) d : (unsigned) d;
+    unsigned t = two31 + ((unsigned) d >> 31);
+    unsigned anc = t - 1 - t % ad;
+    unsigned q1 = two31 / anc, r1 = two31 - q1 * anc;
+    unsigned q2 = two31 / ad, r2 = two31 - q2 * ad;
+    unsigned delta;
+    int p = 31;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    *multiplier = (int) (q2 + 1);
+    if (d < 0)
+        *multiplier = -*multiplier;
+    *shift = p - 32;
+}
+
+// reg / d truncating toward zero like div, without a divide instruction.
+// Returns -1 when d is better left to div.
+static int genDivConst(int reg, int d) {
+    unsigned ad = d < 0 ? 0u - (unsigned) d : (unsigned) d;
+    int q;
+    if (d == 0 || ad == 0x80000000u)
+        return -1;
+    if (ad == 1)
+        return d < 0 ? genNegate(reg) : reg;
+    if (isPowerOfTwo(ad)) {
+        // bias negative dividends by 2^k - 1 so the shift rounds toward zero
+        int k = log2u(ad);
+        int sign = reg;
+        if (k > 1) {
+            sign = nextRegister();
+            emit(OP_SRA, regOpnd(sign), regOpnd(reg), immOpnd(31));
+        }
+        int bias = nextRegister();
+        emit(OP_SRL, regOpnd(bias), regOpnd(sign), immOpnd(32 - k));
+        int biased = nextRegister();
+        emit(OP_ADD, regOpnd(biased), regOpnd(reg), regOpnd(bias));
+        q = nextRegister();
+        emit(OP_SRA, regOpnd(q), regOpnd(biased), immOpnd(k));
+        return d < 0 ? genNegate(q) : q;
+    }
+
+    int multiplier, shift;
+    divisionMagic(d, &multiplier, &shift);
+    int magic = nextRegister();
+    emit2(OP_LI, regOpnd(magic), immOpnd(multiplier));
+    emit2(OP_MULT, regOpnd(reg), regOpnd(magic));
+    q = nextRegister();
+    emit1(OP_MFHI, regOpnd(q));
+    if ((d > 0 && multiplier < 0) || (d < 0 && multiplier > 0)) {
+        int adjusted = nextRegister();
+        emit(d > 0 ? OP_ADD : OP_SUB, regOpnd(adjusted), regOpnd(q), regOpnd(reg));
+        q = adjusted;
+    }
+    if (shift > 0) {
+        int shifted = nextRegister();
+        emit(OP_SRA, regOpnd(shifted), regOpnd(q), immOpnd(shift));
+        q = shifted;
+    }
+    // add one when the estimate is negative to truncate toward zero
+    int sign = nextRegister();
+    emit(OP_SRL, regOpnd(sign), regOpnd(q), immOpnd(31));
+    int result = nextRegister();
+    emit(OP_ADD, regOpnd(result), regOpnd(q), regOpnd(sign));
+    return result;
+}
+
+// Multiplication or division with a constant operand; returns -1 when
+// the node has no constant operand to reduce
+static int genMulopConst(tree *node) {
+    int value, reg;
+    if (constantValue(node->children[1], &value)) {
+        reg = genExpr(node->children[0]);
+        emitComment("Arithmetic expression");
+        if (node->val == OPVAL_MUL)
+            return genMulConst(reg, value);
+        int q = genDivConst(reg, value);
+        if (q >= 0)
+            return q;
+        int divisor = nextRegister();
+        emit2(OP_LI, regOpnd(divisor), immOpnd(value));
+        q = nextRegister();
+        emit(OP_DIV, regOpnd(q), regOpnd(reg), regOpnd(divisor));
+        return q;
+    }
+    if (node->val == OPVAL_MUL && constantValue(node->children[0], &value)) {
+        reg = genExpr(node->children[1]);
+        emitComment("Arithmetic expression");
+        return genMulConst(reg, value);
+    }
+    return -1;
+}
+
+/* ---------- bounds checks ---------- */
+
+static int isAssignedIn(tree *node, char *name);
+
+static const int swappedRel[] = {RELVAL_GTE, RELVAL_GT, RELVAL_LT, RELVAL_LTE, RELVAL_EQ, RELVAL_NEQ};
+static const int negatedRel[] = {RELVAL_GT, RELVAL_GTE, RELVAL_LTE, RELVAL_LT, RELVAL_NEQ, RELVAL_EQ};
+
+// Facts are only gathered when they can remove checks
+static int rangesTracked(void) {
+    return cgOpts.boundsCheck && cgOpts.optLevel > 0;
+}
+
+static valueRange anyValue(void) {
+    valueRange r = {INT_MIN, INT_MAX};
+    return r;
+}
+
+// An empty interval, or one whose ends left the int range and may have
+// wrapped around, says nothing
+static valueRange makeRange(long long lo, long long hi) {
+    valueRange r = {lo, hi};
+    if (lo > hi || lo < INT_MIN || hi > INT_MAX)
+        return anyValue();
+    return r;
+}
+
+static rangeFact *findFact(varInfo *v) {
+    for (int i = 0; i < ranges.count; i++)
+        if (ranges.facts[i].v == v)
+            return &ranges.facts[i];
+    return NULL;
+}
+
+static valueRange varRange(varInfo *v) {
+    if (v->known)
+        return makeRange(v->value, v->value);
+    rangeFact *f = findFact(v);
+    return f ? f->range : anyValue();
+}
+
+// Records what v holds from here on. Globals get no facts, since any
+// call may change them.
+static void setRange(varInfo *v, valueRange r) {
+    if (!v || v->isArray || v->storage == VAR_GLOBAL)
+        return;
+    rangeFact *f = findFact(v);
+    if (r.lo == INT_MIN && r.hi == INT_MAX) {
+        if (f)
+            *f = ranges.facts[--ranges.count];
+    } else if (f) {
+        f->range = r;
+    } else {
+        ranges.facts = (rangeFact *) realloc(ranges.facts, (ranges.count + 1) * sizeof(rangeFact));
+        ranges.facts[ranges.count].v = v;
+        ranges.facts[ranges.count++].range = r;
+    }
+}
+
+static valueRange exprRange(tree *node) {
+    int value;
+    if (constantValue(node, &value))
+        return makeRange(value, value);
+    varInfo *v = scalarOperand(node);
+    if (v)
+        return varRange(v);
+    node = stripWrappers(node);
+    if (node->nodeKind == RELOP)
+        return makeRange(0, 1);
+    if (node->nodeKind != ADDOP && node->nodeKind != MULOP)
+        return anyValue();
+    valueRange a = exprRange(node->children[0]);
+    valueRange b = exprRange(node->children[1]);
+    switch (node->val) {
+        case OPVAL_ADD:
+            return makeRange(a.lo + b.lo, a.hi + b.hi);
+        case OPVAL_SUB:
+            if (v = scalarOperand(node->children[0]), v && v == scalarOperand(node->children[1]))
+                return makeRange(0, 0);
+            return makeRange(a.lo - b.hi, a.hi - b.lo);
+        case OPVAL_MUL:
+        case OPVAL_DIV: {
+            // Both are monotonic in each operand, for division once the
+            // divisor's sign is fixed, so the corners bound the result
+            if (node->val == OPVAL_DIV && b.lo <= 0)
+                return anyValue();
+            long long c[4] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+            if (node->val == OPVAL_DIV) {
+                c[0] = a.lo / b.lo;
+                c[1] = a.lo / b.hi;
+                c[2] = a.hi / b.lo;
+                c[3] = a.hi / b.hi;
+            }
+            valueRange r = {c[0], c[0]};
+            for (int i = 1; i < 4; i++) {
+                r.lo = c[i] < r.lo ? c[i] : r.lo;
+                r.hi = c[i] > r.hi ? c[i] : r.hi;
+            }
+            return makeRange(r.lo, r.hi);
+        }
+        default:
+            return anyValue();
+    }
+}
+
+// Narrows v to the values for which "v rel other" holds, and returns
+// whether there are any
+static int narrowRange(varInfo *v, int rel, valueRange other) {
+    if (!v)
+        return 1;
+    valueRange r = varRange(v);
+    if ((rel == RELVAL_LT || rel == RELVAL_LTE || rel == RELVAL_EQ) && other.hi - (rel == RELVAL_LT) < r.hi)
+        r.hi = other.hi - (rel == RELVAL_LT);
+    if ((rel == RELVAL_GT || rel == RELVAL_GTE || rel == RELVAL_EQ) && other.lo + (rel == RELVAL_GT) > r.lo)
+        r.lo = other.lo + (rel == RELVAL_GT);
+    // A path no value can take keeps what v had, so that where it meets
+    // the others it does not take v's fact away
+    if (r.lo > r.hi)
+        return 0;
+    setRange(v, makeRange(r.lo, r.hi));
+    return 1;
+}
+
+// Largest r with r * r <= n
+static long long squareRoot(long long n) {
+    long long lo = 0, hi = 46341;       // 46341 * 46341 > INT_MAX
+    while (lo < hi) {
+        long long mid = (lo + hi + 1) / 2;
+        if (mid * mid <= n)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+// Narrows the variable of "e rel other" where e is v, v + c, v - c, or
+// v * v with v not negative, as in "while (i * i < n)". Returns 0 when
+// no value of the variable makes it hold.
+static int narrowOperand(tree *e, int rel, valueRange other) {
+    int c;
+    varInfo *v = scalarOperand(e);
+    if (v)
+        return narrowRange(v, rel, other);
+    // Both rules hold only where the arithmetic does not wrap, so the
+    // operand's range must keep v + c, or v * v, inside an int
+    e = stripWrappers(e);
+    if (e->nodeKind == ADDOP && constantValue(e->children[1], &c)) {
+        long long step = e->val == OPVAL_SUB ? -(long long) c : c;
+        valueRange r = exprRange(e->children[0]);
+        valueRange shifted = {other.lo - step, other.hi - step};
+        if (r.lo + step < INT_MIN || r.hi + step > INT_MAX)
+            return 1;
+        return narrowOperand(e->children[0], rel, shifted);
+    } else if (e->nodeKind == MULOP && e->val == OPVAL_MUL && (v = scalarOperand(e->children[0])) &&
+               v == scalarOperand(e->children[1]) && varRange(v).lo >= 0 && varRange(v).hi <= MAX_SQUARE_ROOT &&
+               (rel == RELVAL_LT || rel == RELVAL_LTE || rel == RELVAL_EQ) && other.hi - (rel == RELVAL_LT) >= 0) {
+        long long root = squareRoot(other.hi - (rel == RELVAL_LT));
+        return narrowRange(v, RELVAL_LTE, makeRange(root, root));
+    }
+    return 1;
+}
+
+// Narrows the variables a condition compares to the values for which it
+// comes out as holds. Returns 0 when the facts show it never does.
+static int assumeCondition(tree *cond, int holds) {
+    if (!rangesTracked())
+        return 1;
+    cond = stripWrappers(cond);
+    if (cond->nodeKind != RELOP)
+        return 1;
+    int rel = holds ? cond->val : negatedRel[cond->val];
+    valueRange left = exprRange(cond->children[0]);
+    valueRange right = exprRange(cond->children[1]);
+    int can = narrowOperand(cond->children[0], rel, right);
+    return narrowOperand(cond->children[1], swappedRel[rel], left) && can;
+}
+
+static void trackAssignment(tree *assign) {
+    if (rangesTracked())
+        setRange(scalarOperand(assign->children[0]), exprRange(assign->children[1]));
+}
+
+static rangeSet saveRanges(void) {
+    rangeSet saved;
+    saved.count = ranges.count;
+    saved.facts = (rangeFact *) malloc((ranges.count + 1) * sizeof(rangeFact));
+    memcpy(saved.facts, ranges.facts, ranges.count * sizeof(rangeFact));
+    return saved;
+}
+
+// Takes over the saved facts
+static void restoreRanges(rangeSet saved) {
+    free(ranges.facts);
+    ranges = saved;
+}
+
+// Where two paths meet, a variable holds what either left it with
+static void joinRanges(rangeSet other) {
+    for (int i = 0; i < ranges.count; ) {
+        rangeFact *f = &ranges.facts[i];
+        rangeFact *g = NULL;
+        for (int j = 0; j < other.count && !g; j++)
+            if (other.facts[j].v == f->v)
+                g = &other.facts[j];
+        if (!g) {
+            *f = ranges.facts[--ranges.count];
+            continue;
+        }
+        f->range.lo = g->range.lo < f->range.lo ? g->range.lo : f->range.lo;
+        f->range.hi = g->range.hi > f->range.hi ? g->range.hi : f->range.hi;
+        i++;
+    }
+    free(other.facts);
+}
+
+// Whether the loop assigns a variable the expression reads
+static int readsLoopVariable(tree *loop, tree *expr) {
+    if (!expr)
+        return 0;
+    if (expr->nodeKind == VAR && isAssignedIn(loop, expr->children[0]->name))
+        return 1;
+    for (int i = 0; i < expr->numChildren; i++)
+        if (readsLoopVariable(loop, expr->children[i]))
+            return 1;
+    return 0;
+}
+
+#define STEPS_UP 1
+#define STEPS_DOWN 2
+#define STEPS_ANY 4
+
+// How the assignments to v under node change it, as STEPS_ flags:
+// "v = v + d" with d of one sign steps it up or down, and any other value
+// the loop cannot change widens *assigned
+static int loopSteps(tree *loop, tree *node, varInfo *v, valueRange *assigned) {
+    if (!node)
+        return 0;
+    if (node->nodeKind != ASSIGNSTMT || scalarOperand(node->children[0]) != v) {
+        int steps = 0;
+        for (int i = 0; i < node->numChildren; i++)
+            steps |= loopSteps(loop, node->children[i], v, assigned);
+        return steps;
+    }
+    tree *rhs = stripWrappers(node->children[1]);
+    if (readsLoopVariable(loop, rhs)) {
+        tree *step = NULL;
+        if (rhs->nodeKind == ADDOP && scalarOperand(rhs->children[0]) == v)
+            step = rhs->children[1];
+        else if (rhs->nodeKind == ADDOP && rhs->val == OPVAL_ADD && scalarOperand(rhs->children[1]) == v)
+            step = rhs->children[0];
+        if (!step || readsLoopVariable(loop, step))
+            return STEPS_ANY;
+        valueRange r = exprRange(step);
+        int up = rhs->val == OPVAL_ADD ? r.lo >= 0 : r.hi <= 0;
+        int down = rhs->val == OPVAL_ADD ? r.hi <= 0 : r.lo >= 0;
+        return up ? STEPS_UP : down ? STEPS_DOWN : STEPS_ANY;
+    }
+    valueRange r = exprRange(rhs);
+    assigned->lo = r.lo < assigned->lo ? r.lo : assigned->lo;
+    assigned->hi = r.hi > assigned->hi ? r.hi : assigned->hi;
+    return r.lo == INT_MIN && r.hi == INT_MAX ? STEPS_ANY : 0;
+}
+
+static tree *findAssignment(tree *node, varInfo *v);
+static void widenRanges(tree *loop, tree *cond, tree *body, int copies);
+
+// Tracks the ranges through the statements under node as generating
+// them would, without generating them
+static void followRanges(tree *node) {
+    if (!node)
+        return;
+    switch (node->nodeKind) {
+        case STATEMENTLIST:
+            for (int i = 0; i < node->numChildren; i++)
+                followRanges(node->children[i]);
+            break;
+        case ASSIGNSTMT:
+            trackAssignment(node);
+            break;
+        case CONDSTMT: {
+            rangeSet before = saveRanges();
+            assumeCondition(node->children[0], 1);
+            followRanges(node->children[1]);
+            rangeSet thenEnd = saveRanges();
+            restoreRanges(before);
+            assumeCondition(node->children[0], 0);
+            if (node->numChildren > 2)
+                followRanges(node->children[2]);
+            joinRanges(thenEnd);
+            break;
+        }
+        case LOOPSTMT:
+            widenRanges(node, node->children[0], node->children[1], 1);
+            assumeCondition(node->children[0], 0);
+            break;
+        default:
+            break;
+    }
+}
+
+// For a loop condition "v * v < e" or "v * v <= e" and a body that steps
+// v up once, the largest value v can have at a test: its value on entry,
+// or the largest the condition lets through plus the step. -1 when there
+// is none, or v * v could leave the int range before it.
+static long long squaredBound(tree *cond, tree *body, int copies, varInfo *v, valueRange entry) {
+    cond = stripWrappers(cond);
+    if (cond->nodeKind != RELOP || (cond->val != RELVAL_LT && cond->val != RELVAL_LTE))
+        return -1;
+    tree *square = stripWrappers(cond->children[0]);
+    if (square->nodeKind != MULOP || square->val != OPVAL_MUL || scalarOperand(square->children[0]) != v ||
+        scalarOperand(square->children[1]) != v)
+        return -1;
+    tree *stepStmt = findAssignment(body, v);
+    tree *rhs = stepStmt ? stripWrappers(stepStmt->children[1]) : NULL;
+    if (!rhs || rhs->nodeKind != ADDOP || rhs->val != OPVAL_ADD)
+        return -1;
+    valueRange step = exprRange(scalarOperand(rhs->children[0]) == v ? rhs->children[1] : rhs->children[0]);
+    long long limit = exprRange(cond->children[1]).hi - (cond->val == RELVAL_LT);
+    if (entry.lo < 0 || step.lo < 0 || limit < 0)
+        return -1;
+    long long hi = squareRoot(limit) + copies * step.hi;
+    hi = hi > entry.hi ? hi : entry.hi;
+    return hi <= MAX_SQUARE_ROOT ? hi : -1;
+}
+
+// Facts that hold on every iteration, and so after the loop too: a
+// variable the loop assigns takes in the values assigned to it, and keeps
+// only the bound its steps move away from. cond is tested before every
+// copies runs of body.
+//
+// A step can still wrap around to the other end of the int range, so the
+// facts are only kept once following one trip from them ends inside
+// them, or cond rules the trip out; any that does not is dropped and the
+// trip followed again. A
+// counter the condition squares is first tried with the bound
+// squaredBound gives it, without which nothing is known of v * v.
+static void widenRanges(tree *loop, tree *cond, tree *body, int copies) {
+    int count = ranges.count;
+    if (count == 0)
+        return;
+    int *steps = (int *) malloc((count + 1) * sizeof(int));
+    valueRange *assigned = (valueRange *) malloc((count + 1) * sizeof(valueRange));
+    char *squared = (char *) calloc(count + 1, 1);
+    rangeFact *facts = ranges.facts;
+    for (int i = 0; i < count; i++) {
+        assigned[i] = facts[i].range;
+        steps[i] = loopSteps(loop, loop, facts[i].v, &assigned[i]);
+    }
+    // Facts only go away once every one has been looked at
+    for (int i = 0; i < count; i++) {
+        valueRange r = assigned[i];
+        long long hi;
+        if (steps[i] == STEPS_UP && (hi = squaredBound(cond, body, copies, facts[i].v, r)) >= 0) {
+            r.hi = hi;
+            squared[i] = 1;
+        } else if (steps[i] & STEPS_UP) {
+            r.hi = INT_MAX;
+        }
+        if (steps[i] & STEPS_DOWN)
+            r.lo = INT_MIN;
+        if (steps[i] & STEPS_ANY)
+            r = anyValue();
+        facts[i].range = r;
+    }
+    for (int dropped = 1; dropped; ) {
+        dropped = 0;
+        rangeSet widened = saveRanges();
+        if (!assumeCondition(cond, 1)) {
+            restoreRanges(widened);
+            break;
+        }
+        for (int i = 0; i < copies; i++)
+            followRanges(body);
+        rangeSet end = saveRanges();
+        restoreRanges(widened);
+        facts = ranges.facts;
+        for (int i = 0; i < count; i++) {
+            valueRange r = facts[i].range, after = anyValue();
+            for (int j = 0; j < end.count; j++)
+                if (end.facts[j].v == facts[i].v)
+                    after = end.facts[j].range;
+            if ((r.lo == INT_MIN && r.hi == INT_MAX) || (after.lo >= r.lo && after.hi <= r.hi))
+                continue;
+            facts[i].range = squared[i] ? makeRange(r.lo, INT_MAX) : anyValue();
+            squared[i] = 0;
+            dropped = 1;
+        }
+        free(end.facts);
+    }
+    for (int i = 0; i < ranges.count; ) {
+        if (ranges.facts[i].range.lo == INT_MIN && ranges.facts[i].range.hi == INT_MAX)
+            ranges.facts[i] = ranges.facts[--ranges.count];
+        else
+            i++;
+    }
+    free(steps);
+    free(assigned);
+    free(squared);
+}
+
+// Every copy of an access is reported, since unrolled and inlined copies
+// see different facts
+static void reportBounds(tree *var, const char *fmt, ...) {
+    if (!cgOpts.boundsReport)
+        return;
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "bounds: %s: %s[] at line %d: ", curFunc->name, var->children[0]->name, var->line);
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+}
+
+// Elements a checked index must stay below, or 0 when that is unknown:
+// an array parameter carries no length
+static int checkedSize(varInfo *v) {
+    return v->storage == VAR_PARAM ? 0 : v->size;
+}
+
+// Whether the subscript of var needs a check at run time, that is the
+// facts do not place it inside the array
+static int needsBoundsCheck(tree *var, varInfo *v) {
+    if (!cgOpts.boundsCheck)
+        return 0;
+    int size = checkedSize(v);
+    if (size <= 0) {
+        reportBounds(var, "not checked, size unknown");
+        return 0;
+    }
+    valueRange r = rangesTracked() ? exprRange(var->children[1]) : anyValue();
+    if (r.lo >= 0 && r.hi < size) {
+        reportBounds(var, "check removed, index in [%lld, %lld]", r.lo, r.hi);
+        return 0;
+    }
+    reportBounds(var, "checked");
+    return 1;
+}
+
+// One unsigned comparison also catches negative indexes. A failure loads
+// the line into $a0 and jumps to BOUNDS_ERROR; with optimization that
+// path is placed past the epilogue.
+static void emitBoundsCheck(int index, varInfo *v, int line) {
+    emitComment("Bounds check");
+    int size = checkedSize(v);
+    // Without optimization $t registers are free, and taking more of the
+    // round robin would overwrite values still held
+    int inside = cgOpts.optLevel == 0 ? REG_T0 : nextRegister();
+    if (size <= SHRT_MAX) {
+        emit(OP_SLTIU, regOpnd(inside), regOpnd(index), immOpnd(size));
+    } else {
+        int limit = cgOpts.optLevel == 0 ? REG_T0 + 1 : nextRegister();
+        emit2(OP_LI, regOpnd(limit), immOpnd(size));
+        emit(OP_SLTU, regOpnd(inside), regOpnd(index), regOpnd(limit));
+    }
+    char *okLabel = labelName(newLabel());
+    if (cgOpts.optLevel == 0) {
+        emit(OP_BNE, regOpnd(inside), regOpnd(REG_ZERO), labelOpnd(okLabel));
+        emit2(OP_LI, regOpnd(REG_A0), immOpnd(line));
+        emit1(OP_J, labelOpnd(BOUNDS_ERROR));
+    } else {
+        char *failLabel = labelName(newLabel());
+        emit(OP_BEQ, regOpnd(inside), regOpnd(REG_ZERO), labelOpnd(failLabel));
+        emit1(OP_B, labelOpnd(okLabel));
+        emitLabel("%s", failLabel);
+        instr *first = curFunc->code.tail;
+        emit2(OP_LI, regOpnd(REG_A0), immOpnd(line));
+        emit1(OP_J, labelOpnd(BOUNDS_ERROR));
+        for (instr *ins = first; ins; ins = ins->next)
+            ins->cold = 1;
+    }
+    emitLabel("%s", okLabel);
+    numBoundsChecks++;
+}
+
+/* ---------- arrays ---------- */
+
+// Base address of an array variable
+static int genArrayBase(varInfo *v) {
+    int reg = nextRegister();
+    switch (v->storage) {
+        case VAR_LOCAL:
+            emit(OP_ADDI, regOpnd(reg), regOpnd(REG_SP), immOpnd(v->offset));
+            break;
+        case VAR_PARAM:
+            emit2(OP_LW, regOpnd(reg), memOpnd(v->offset, REG_FP));
+            break;
+        case VAR_REF:
+            emit2(OP_LW, regOpnd(reg), memOpnd(v->offset, REG_SP));
+            break;
+        default:
+            if (v->small)
+                emit(OP_ADDI, regOpnd(reg), regOpnd(REG_GP), immOpnd(v->offset));
+            else
+                emit2(OP_LA, regOpnd(reg), labelOpnd(prefixedName("var", v->name)));
+            break;
+    }
+    return reg;
+}
+
+static ivPointer *findIvPointer(varInfo *iv, varInfo *array) {
+    for (ivPointer *p = ivPointers; p; p = p->next)
+        if (p->iv == iv && p->array == array)
+            return p;
+    return NULL;
+}
+
+// Address of the element selected by a subscripted var node
+static int genElementAddress(tree *var, varInfo *v) {
+    int check = needsBoundsCheck(var, v);
+    if (cgOpts.optLevel > 0) {
+        varInfo *iv = scalarOperand(var->children[1]);
+        ivPointer *p = iv ? findIvPointer(iv, v) : NULL;
+        if (p) {
+            if (check)
+                emitBoundsCheck(genExpr(var->children[1]), v, var->line);
+            emitComment("Array element pointer");
+            return p->reg;
+        }
+    }
+    int index = genExpr(var->children[1]);
+    if (check)
+        emitBoundsCheck(index, v, var->line);
+    emitComment("Array element address");
+    int scaled;
+    if (v->width == 1) {
+        scaled = index;
+    } else if (cgOpts.optLevel > 0) {
+        scaled = genShiftLeft(index, 2);
+    } else {
+        int four = nextRegister();
+        emit2(OP_LI, regOpnd(four), immOpnd(4));
+        scaled = nextRegister();
+        emit(OP_MUL, regOpnd(scaled), regOpnd(index), regOpnd(four));
+    }
+    int base = genArrayBase(v);
+    int addr = nextRegister();
+    emit(OP_ADD, regOpnd(addr), regOpnd(scaled), regOpnd(base));
+    return addr;
+}
+
+static int genVar(tree *node) {
+    varInfo *v = lookupVar(node->children[0]->name);
+    int reg;
+    if (v->known) {
+        emitComment("Fixed parameter %s", v->name);
+        reg = nextRegister();
+        emit2(OP_LI, regOpnd(reg), immOpnd(v->value));
+    } else if (node->numChildren > 1) {
+        int addr = genElementAddress(node, v);
+        emitComment("Array expression");
+        reg = nextRegister();
+        emit2(loadOp(v), regOpnd(reg), memOpnd(0, addr));
+    } else if (v->isArray) {
+        // Arrays are passed by address
+        emitComment("Array address");
+        reg = genArrayBase(v);
+    } else {
+        emitComment("Variable expression");
+        reg = nextRegister();
+        emit2(loadOp(v), regOpnd(reg), varLocation(v));
+    }
+    return reg;
+}
+
+static int genInlineCall(tree *node, cgNode *callee);
+
+// Version of the callee chosen for a call by the interprocedural analysis
+static cgSpec *callSpec(tree *call) {
+    cgSite *site = cgOpts.optLevel > 0 ? findSite(program, call) : NULL;
+    return site ? site->spec : NULL;
+}
+
+static char *calleeLabel(tree *call) {
+    cgSpec *spec = callSpec(call);
+    return spec ? spec->name : call->children[0]->name;
+}
+
+// Arguments for parameters the callee fixes itself are not passed
+static int isFixedArg(cgSpec *spec, int i) {
+    return spec && spec->known[i];
+}
+
+static int genCall(tree *node) {
+    char *name = node->children[0]->name;
+    tree *args = node->children[1];
+    int numArgs = args ? args->numChildren : 0;
+    int value;
+
+    cgNode *callee = cgOpts.optLevel > 0 ? findFunction(program, name) : NULL;
+    if (callee && constantValue(node, &value)) {
+        emitComment("Call to %s evaluated at compile time", name);
+        int reg = nextRegister();
+        emit2(OP_LI, regOpnd(reg), immOpnd(value));
+        return reg;
+    }
+    if (callee && callee->inlined)
+        return genInlineCall(node, callee);
+    cgSpec *spec = callSpec(node);
+
+    emitBlank();
+    emitComment("Saving return address");
+    emit2(OP_SW, regOpnd(REG_RA), memOpnd(0, REG_SP));
+
+    if (numArgs > 0) {
+        emitBlank();
+        emitComment("Evaluating and storing arguments");
+
+        // Argument slots sit just below $sp, so a call nested inside an
+        // argument would overwrite them; evaluate everything first then.
+        int evaluateFirst = cgOpts.optLevel > 0;
+        for (int i = 0; i < numArgs; i++)
+            evaluateFirst |= containsCall(args->children[i]);
+
+        if (evaluateFirst) {
+            heldValue *regs = (heldValue *) malloc(numArgs * sizeof(heldValue));
+            for (int i = 0; i < numArgs; i++) {
+                if (isFixedArg(spec, i))
+                    continue;
+                emitBlank();
+                emitComment("Evaluating argument %d", i);
+                regs[i] = holdRegister(genExpr(args->children[i]));
+            }
+            for (int i = 0; i < numArgs; i++) {
+                if (isFixedArg(spec, i))
+                    continue;
+                emitBlank();
+                emitComment("Storing argument %d", i);
+                int reg = keepRegister(regs[i]);
+                emit2(OP_SW, regOpnd(reg), memOpnd(-4 * (i + 1), REG_SP));
+            }
+            free(regs);
+        } else {
+            for (int i = 0; i < numArgs; i++) {
+                emitBlank();
+                emitComment("Evaluating argument %d", i);
+                int reg = genExpr(args->children[i]);
+                emitBlank();
+                emitComment("Storing argument %d", i);
+                emit2(OP_SW, regOpnd(reg), memOpnd(-4 * (i + 1), REG_SP));
+            }
+        }
+    }
+    emit(OP_SUBI, regOpnd(REG_SP), regOpnd(REG_SP), immOpnd(4 * (numArgs + 1)));
+
+    emitBlank();
+    emitComment("Jump to callee");
+    emitBlank();
+    emitComment("jal will correctly set $ra as well");
+    emit1(OP_JAL, labelOpnd(prefixedName("start", spec ? spec->name : name)));
+    curFunc->code.tail->pureCall = callee && callee->pure;
+
+    if (numArgs > 0) {
+        emitBlank();
+        emitComment("Deallocating space for arguments");
+        emit(OP_ADDI, regOpnd(REG_SP), regOpnd(REG_SP), immOpnd(4 * numArgs));
+    }
+
+    emitBlank();
+    emitComment("Resetting return address");
+    emit(OP_ADDI, regOpnd(REG_SP), regOpnd(REG_SP), immOpnd(4));
+    emit2(OP_LW, regOpnd(REG_RA), memOpnd(0, REG_SP));
+
+    emitBlank();
+    emitBlank();
+    emitComment("Move return value into another reg");
+    int reg = nextRegister();
+    emit2(OP_MOVE, regOpnd(reg), regOpnd(REG_V0));
+    return reg;
+}
+
+static int genRelop(tree *node) {
+    static const char *relNames[] = {"LTE", "LT", "GT", "GTE", "EQ", "NEQ"};
+    int left, right;
+    genOperands(node, &left, &right);
+    emitComment("Relational comparison");
+    emitComment("%s", relNames[node->val]);
+
+    // When optimizing, the ordered relations compare the operands
+    // themselves, exactly as the interpreter, the x86-64 code and ipa.c
+    // do. -O0 keeps the subtraction its expected output was written
+    // with, which gets a - b wrong where it overflows.
+    int reg;
+    if (cgOpts.optLevel > 0 && node->val != RELVAL_EQ && node->val != RELVAL_NEQ) {
+        reg = nextRegister();
+        switch (node->val) {
+            case RELVAL_LT:
+                emit(OP_SLT, regOpnd(reg), regOpnd(left), regOpnd(right));
+                break;
+            case RELVAL_GT:
+                emit(OP_SLT, regOpnd(reg), regOpnd(right), regOpnd(left));
+                break;
+            default: {
+                // a <= b is !(b < a), and a >= b is !(a < b)
+                int less = nextRegister();
+                if (node->val == RELVAL_LTE)
+                    emit(OP_SLT, regOpnd(less), regOpnd(right), regOpnd(left));
+                else
+                    emit(OP_SLT, regOpnd(less), regOpnd(left), regOpnd(right));
+                emit(OP_XORI, regOpnd(reg), regOpnd(less), immOpnd(1));
+                break;
+            }
+        }
+        return reg;
+    }
+
+    int diff = nextRegister();
+    if (node->val == RELVAL_GTE)
+        emit(OP_SUB, regOpnd(diff), regOpnd(right), regOpnd(left));
+    else
+        emit(OP_SUB, regOpnd(diff), regOpnd(left), regOpnd(right));
+
+    reg = nextRegister();
+    switch (node->val) {
+        case RELVAL_LT:
+            emit(OP_SLT, regOpnd(reg), regOpnd(diff), regOpnd(REG_ZERO));
+            break;
+        case RELVAL_GT:
+            emit(OP_SLT, regOpnd(reg), regOpnd(REG_ZERO), regOpnd(diff));
+            break;
+        case RELVAL_LTE:
+        case RELVAL_GTE:
+            emit(OP_SLTI, regOpnd(reg), regOpnd(diff), immOpnd(1));
+            break;
+        case RELVAL_EQ:
+            emit(OP_SLTIU, regOpnd(reg), regOpnd(diff), immOpnd(1));
+            break;
+        default:
+            emit(OP_SLTU, regOpnd(reg), regOpnd(REG_ZERO), regOpnd(diff));
+            break;
+    }
+    return reg;
+}
+
+static int genExpr(tree *node) {
+    int value, reg;
+    switch (node->nodeKind) {
+        case EXPRESSION:
+        case FACTOR:
+            return genExpr(node->children[0]);
+        case VAR:
+            return genVar(node);
+        case FUNCCALLEXPR:
+            return genCall(node);
+        case RELOP:
+            return genRelop(node);
+        case CHAR:
+            emitComment("Character expression");
+            reg = nextRegister();
+            emit2(OP_LI, regOpnd(reg), immOpnd(node->val));
+            return reg;
+        case INTEGER:
+        case ADDOP:
+        case MULOP:
+            if (constantValue(node, &value)) {
+                emitComment("Integer expression");
+                reg = nextRegister();
+                emit2(OP_LI, regOpnd(reg), immOpnd(value));
+                return reg;
+            } else {
+                if (cgOpts.optLevel > 0 && node->nodeKind == MULOP &&
+                    (reg = genMulopConst(node)) >= 0)
+                    return reg;
+                int left, right;
+                genOperands(node, &left, &right);
+                emitComment("Arithmetic expression");
+                reg = nextRegister();
+                opcode op = node->val == OPVAL_ADD ? OP_ADD :
+                            node->val == OPVAL_SUB ? OP_SUB :
+                            node->val == OPVAL_MUL ? OP_MUL : OP_DIV;
+                emit(op, regOpnd(reg), regOpnd(left), regOpnd(right));
+                return reg;
+            }
+        default:
+            fprintf(stderr, "Error: Unexpected node kind %d in expression\n", node->nodeKind);
+            exit(1);
+    }
+}
+
+/* ---------- statements ---------- */
+
+static void genStatement(tree *node);
+
+/* ---------- induction variables ---------- */
+
+// Recognizes "v = v + c", "v = c + v" and "v = v - c"; stores c in step
+static int inductionStep(tree *assign, varInfo *v, int *step) {
+    tree *rhs = stripWrappers(assign->children[1]);
+    if (rhs->nodeKind != ADDOP)
+        return 0;
+    if (scalarOperand(rhs->children[0]) == v && constantValue(rhs->children[1], step)) {
+        if (rhs->val == OPVAL_SUB)
+            *step = -*step;
+        return 1;
+    }
+    return rhs->val == OPVAL_ADD && scalarOperand(rhs->children[1]) == v &&
+           constantValue(rhs->children[0], step);
+}
+
+// Counts assignments to v under node; returns -1 if any is not a constant step
+static int countSteps(tree *node, varInfo *v) {
+    int step, count = 0;
+    if (!node)
+        return 0;
+    if (node->nodeKind == ASSIGNSTMT && scalarOperand(node->children[0]) == v)
+        return inductionStep(node, v, &step) ? 1 : -1;
+    for (int i = 0; i < node->numChildren; i++) {
+        int n = countSteps(node->children[i], v);
+        if (n < 0)
+            return -1;
+        count += n;
+    }
+    return count;
+}
+
+// A local or parameter changed only by constant steps inside the loop.
+// Calls cannot reach it since mC has no way to take its address.
+static int isInductionVar(tree *loop, varInfo *v) {
+    if (v->storage == VAR_GLOBAL)
+        return 0;
+    return countSteps(loop->children[1], v) > 0;
+}
+
+// Gives each array[iv] subscript under node a pointer register, set up
+// before the loop is entered. Pointers of enclosing loops are reused.
+static void findIvPointers(tree *loop, tree *node, int *count) {
+    if (!node)
+        return;
+    if (node->nodeKind == VAR && node->numChildren > 1) {
+        varInfo *array = lookupVar(node->children[0]->name);
+        varInfo *iv = scalarOperand(node->children[1]);
+        if (iv && *count < MAX_IV_POINTERS && !findIvPointer(iv, array) && isInductionVar(loop, iv)) {
+            emitComment("Induction pointer for %s[%s]", array->name, iv->name);
+            int index = nextRegister();
+            emit2(loadOp(iv), regOpnd(index), varLocation(iv));
+            int scaled = array->width == 1 ? index : genShiftLeft(index, 2);
+            int base = genArrayBase(array);
+            ivPointer *p = (ivPointer *) calloc(1, sizeof(ivPointer));
+            p->iv = iv;
+            p->array = array;
+            p->reg = nextRegister();
+            emit(OP_ADD, regOpnd(p->reg), regOpnd(scaled), regOpnd(base));
+            p->next = ivPointers;
+            ivPointers = p;
+            (*count)++;
+        }
+    }
+    for (int i = 0; i < node->numChildren; i++)
+        findIvPointers(loop, node->children[i], count);
+}
+
+static void genAssign(tree *node) {
+    tree *var = node->children[0];
+    varInfo *v = lookupVar(var->children[0]->name);
+    int value = genExpr(node->children[1]);
+    if (var->numChildren > 1) {
+        heldValue held = holdRegister(value);
+        int addr = genElementAddress(var, v);
+        value = keepRegister(held);
+        emitComment("Assignment");
+        emit2(storeOp(v), regOpnd(value), memOpnd(0, addr));
+    } else {
+        emitComment("Assignment");
+        emit2(storeOp(v), regOpnd(value), varLocation(v));
+
+        // Keep the element pointers of an induction variable in step
+        int step;
+        for (ivPointer *p = ivPointers; p; p = p->next)
+            if (p->iv == v && inductionStep(node, v, &step))
+                emit(OP_ADDI, regOpnd(p->reg), regOpnd(p->reg), immOpnd(p->array->width * step));
+    }
+}
+
+static int containsKind(tree *node, NodeKind kind) {
+    if (!node)
+        return 0;
+    if (node->nodeKind == kind)
+        return 1;
+    for (int i = 0; i < node->numChildren; i++)
+        if (containsKind(node->children[i], kind))
+            return 1;
+    return 0;
+}
+
+// Static guess at how often an arm runs, after the Ball-Larus heuristics:
+// arms that return are rare, arms holding a loop are common, arms that
+// call out are less common than plain ones
+static int armWeight(tree *arm) {
+    if (containsKind(arm, RETURNSTMT))
+        return 0;
+    if (containsKind(arm, LOOPSTMT))
+        return 3;
+    if (containsCall(arm))
+        return 1;
+    return 2;
+}
+
+// Runs per call of the then or else arm of an if, or -1
+static double armRuns(tree *node, int thenArm) {
+    long long runs = siteCount(node, PROF_IF);
+    long long then = siteCount(node, PROF_THEN);
+    if (runs < 0 || then < 0)
+        return -1;
+    return runsPerCall(thenArm ? then : runs - then);
+}
+
+// Inside loops, and anywhere the profile has counts for the if, the
+// unlikely arm is placed out of line, so the likely path falls through
+// without a taken branch:
+//     b<cond> Lcold; likely arm; Lend: ...    Lcold: unlikely arm; b Lend
+static int genCondLaidOut(tree *node) {
+    tree *thenArm = node->children[1];
+    tree *elseArm = node->numChildren > 2 ? node->children[2] : NULL;
+    long long runs = siteCount(node, PROF_IF);
+    long long thenWeight = siteCount(node, PROF_THEN), elseWeight;
+    if (runs >= 0 && thenWeight >= 0) {
+        // An arm out of line costs a taken branch and a jump back; without
+        // an else that only pays once the skips outnumber it two to one,
+        // unless the arm returns and jumps away in either place
+        elseWeight = runs - thenWeight;
+        if (!elseArm && !containsKind(thenArm, RETURNSTMT))
+            thenWeight *= 2;
+    } else {
+        thenWeight = armWeight(thenArm);
+        elseWeight = elseArm ? armWeight(elseArm) : 2;
+    }
+    if (thenWeight == elseWeight || (!elseArm && thenWeight > elseWeight))
+        return 0;
+    int thenCold = thenWeight < elseWeight;
+    double outer = curWeight;
+
+    emitComment("Conditional statement");
+    int cond = genExpr(node->children[0]);
+    char *coldLabel = labelName(newLabel());
+    char *endLabel = labelName(newLabel());
+    emit(thenCold ? OP_BNE : OP_BEQ, regOpnd(cond), regOpnd(REG_ZERO), labelOpnd(coldLabel));
+    emitComment(thenCold ? "False case" : "True case");
+    if (!thenCold)
+        emitCount(node, PROF_THEN, 1);
+    curWeight = armRuns(node, !thenCold);
+    rangeSet before = saveRanges();
+    assumeCondition(node->children[0], !thenCold);
+    genStatement(thenCold ? elseArm : thenArm);
+    emit1(OP_B, labelOpnd(endLabel));
+    rangeSet likelyEnd = saveRanges();
+    restoreRanges(before);
+    assumeCondition(node->children[0], thenCold);
+
+    emitLabel("%s", coldLabel);
+    instr *first = curFunc->code.tail;
+    emitComment(thenCold ? "True case" : "False case");
+    if (thenCold)
+        emitCount(node, PROF_THEN, 1);
+    curWeight = armRuns(node, thenCold);
+    inColdArm = 1;
+    genStatement(thenCold ? thenArm : elseArm);
+    inColdArm = 0;
+    emit1(OP_B, labelOpnd(endLabel));
+    joinRanges(likelyEnd);
+    curWeight = outer;
+    for (instr *ins = first; ins; ins = ins->next)
+        ins->cold = 1;
+    emitLabel("%s", endLabel);
+    return 1;
+}
+
+static void genCond(tree *node) {
+    if (cgOpts.optLevel > 0 && (loopNesting > 0 || siteCount(node, PROF_IF) >= 0) && !inColdArm &&
+        genCondLaidOut(node))
+        return;
+    double outer = curWeight;
+    emitComment("Conditional statement");
+    int cond = genExpr(node->children[0]);
+    char *falseLabel = labelName(newLabel());
+    emit(OP_BEQ, regOpnd(cond), regOpnd(REG_ZERO), labelOpnd(falseLabel));
+    emitComment("True case");
+    emitCount(node, PROF_THEN, 1);
+    curWeight = armRuns(node, 1);
+    rangeSet before = saveRanges();
+    assumeCondition(node->children[0], 1);
+    genStatement(node->children[1]);
+    rangeSet thenEnd = saveRanges();
+    restoreRanges(before);
+    assumeCondition(node->children[0], 0);
+    if (node->numChildren > 2) {
+        char *endLabel = labelName(newLabel());
+        emit1(OP_B, labelOpnd(endLabel));
+        emitLabel("%s", falseLabel);
+        emitComment("False case");
+        curWeight = armRuns(node, 0);
+        genStatement(node->children[2]);
+        emitLabel("%s", endLabel);
+    } else {
+        emitLabel("%s", falseLabel);
+    }
+    joinRanges(thenEnd);
+    curWeight = outer;
+}
+
+// Generates one while loop whose body is repeated copies times per test.
+// iterations is how often the profile expects the body to run in it, or -1.
+static void genWhile(tree *loop, tree *cond, tree *body, int copies, long long iterations) {
+    double outerWeight = curWeight;
+    ivPointer *outer = ivPointers;
+    if (cgOpts.optLevel > 0) {
+        int count = 0;
+        findIvPointers(loop, cond, &count);
+        findIvPointers(loop, body, &count);
+    }
+    emitComment("Loop");
+    char *topLabel = labelName(newLabel());
+    char *exitLabel = labelName(newLabel());
+    loopNesting++;
+    widenRanges(loop, cond, body, copies);
+    rangeSet everyIteration = saveRanges();
+    if (cgOpts.optLevel > 0) {
+        // Rotated: a guard test on entry, then one conditional branch per
+        // iteration at the bottom
+        int reg = genExpr(cond);
+        emit(OP_BEQ, regOpnd(reg), regOpnd(REG_ZERO), labelOpnd(exitLabel));
+        emitLabel("%s", topLabel);
+        curWeight = iterations < 0 ? -1 : runsPerCall(iterations) / copies;
+        assumeCondition(cond, 1);
+        // Without a return every copy runs, so one add counts the trip
+        int batched = !containsKind(body, RETURNSTMT);
+        for (int i = 0; i < copies; i++) {
+            if (i > 0)
+                reportQuiet++;
+            if (!batched || i == 0)
+                emitCount(loop, PROF_ITERATIONS, batched ? copies : 1);
+            genStatement(body);
+            if (i > 0)
+                reportQuiet--;
+        }
+        emitComment("Loop condition");
+        reg = genExpr(cond);
+        emit(OP_BNE, regOpnd(reg), regOpnd(REG_ZERO), labelOpnd(topLabel));
+    } else {
+        emitLabel("%s", topLabel);
+        int reg = genExpr(cond);
+        emit(OP_BEQ, regOpnd(reg), regOpnd(REG_ZERO), labelOpnd(exitLabel));
+        emitCount(loop, PROF_ITERATIONS, 1);
+        genStatement(body);
+        emit1(OP_B, labelOpnd(topLabel));
+    }
+    curWeight = outerWeight;
+    restoreRanges(everyIteration);
+    assumeCondition(cond, 0);
+    loopNesting--;
+    emitLabel("%s", exitLabel);
+    while (ivPointers != outer) {
+        ivPointer *p = ivPointers;
+        ivPointers = p->next;
+        free(p);
+    }
+}
+
+static int treeSize(tree *node) {
+    if (!node)
+        return 0;
+    int size = 1;
+    for (int i = 0; i < node->numChildren; i++)
+        size += treeSize(node->children[i]);
+    return size;
+}
+
+// Whether stmt is one of the statements run unconditionally by body
+static int isTopLevelStatement(tree *body, tree *stmt) {
+    if (!body)
+        return 0;
+    if (body == stmt)
+        return 1;
+    if (body->nodeKind != STATEMENTLIST)
+        return 0;
+    for (int i = 0; i < body->numChildren; i++)
+        if (isTopLevelStatement(body->children[i], stmt))
+            return 1;
+    return 0;
+}
+
+// The single assignment to v under node, if it is the only one
+static tree *findAssignment(tree *node, varInfo *v) {
+    if (!node)
+        return NULL;
+    if (node->nodeKind == ASSIGNSTMT && scalarOperand(node->children[0]) == v)
+        return node;
+    for (int i = 0; i < node->numChildren; i++) {
+        tree *found = findAssignment(node->children[i], v);
+        if (found)
+            return found;
+    }
+    return NULL;
+}
+
+static int countTrips(countedLoop *info, int start, int bound) {
+    long long distance, step = info->step < 0 ? -(long long) info->step : info->step;
+    switch (info->rel) {
+        case RELVAL_LT:  distance = (long long) bound - start; break;
+        case RELVAL_LTE: distance = (long long) bound - start + 1; break;
+        case RELVAL_GT:  distance = (long long) start - bound; break;
+        default:         distance = (long long) start - bound + 1; break;
+    }
+    if (distance <= 0)
+        return 0;
+    long long trips = (distance + step - 1) / step;
+    return trips > INT_MAX ? INT_MAX : (int) trips;
+}
+
+// Recognizes a counted loop; on failure stores why in reason
+static int analyzeCountedLoop(tree *loop, tree *init, countedLoop *info, const char **reason) {
+    tree *cond = stripWrappers(loop->children[0]);
+    tree *body = loop->children[1];
+    int bound, start;
+    if (cond->nodeKind != RELOP || cond->val == RELVAL_EQ || cond->val == RELVAL_NEQ) {
+        *reason = "condition is not an ordered comparison";
+        return 0;
+    }
+    info->rel = cond->val;
+    info->iv = scalarOperand(cond->children[0]);
+    if (!info->iv || info->iv->storage == VAR_GLOBAL) {
+        *reason = "counter is not a local scalar";
+        return 0;
+    }
+    if (countSteps(body, info->iv) != 1) {
+        *reason = "counter is not stepped exactly once";
+        return 0;
+    }
+    tree *stepStmt = findAssignment(body, info->iv);
+    if (!isTopLevelStatement(body, stepStmt)) {
+        *reason = "counter step is conditional";
+        return 0;
+    }
+    inductionStep(stepStmt, info->iv, &info->step);
+    if (info->step == 0 || ((info->rel == RELVAL_LT || info->rel == RELVAL_LTE) != (info->step > 0))) {
+        *reason = "counter does not move toward the bound";
+        return 0;
+    }
+
+    int constantBound = constantValue(cond->children[1], &bound);
+    if (!constantBound) {
+        varInfo *b = scalarOperand(cond->children[1]);
+        if (!b || countSteps(body, b) != 0 || (b->storage == VAR_GLOBAL && containsCall(body))) {
+            *reason = "bound is not loop invariant";
+            return 0;
+        }
+    }
+    info->tripCount = -1;
+    if (constantBound && init && init->nodeKind == ASSIGNSTMT &&
+        scalarOperand(init->children[0]) == info->iv && constantValue(init->children[1], &start))
+        info->tripCount = countTrips(info, start, bound);
+    return 1;
+}
+
+static void reportUnroll(tree *loop, const char *fmt, ...) {
+    if (!cgOpts.unrollReport || reportQuiet)
+        return;
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "unroll: %s: loop at line %d: ", curFunc->name, loop->children[0]->line);
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+}
+
+static int unrollFactor(void) {
+    if (cgOpts.optLevel == 0)
+        return 1;
+    if (cgOpts.unrollFactor > 0)
+        return cgOpts.unrollFactor;
+    return cgOpts.optLevel >= 2 ? DEFAULT_UNROLL_FACTOR : 1;
+}
+
+// Fully unrolls tiny counted loops, and runs larger ones factor body
+// copies at a time followed by a remainder loop for the last iterations:
+//     while (iv rel bound - (factor - 1) * step) { body x factor }
+//     while (iv rel bound) { body }
+static void genLoop(tree *node, tree *init) {
+    tree *cond = node->children[0];
+    tree *body = node->children[1];
+    int factor = unrollFactor();
+    long long iterations = siteCount(node, PROF_ITERATIONS);
+    countedLoop info;
+    const char *reason;
+    if (factor < 2) {
+        genWhile(node, cond, body, 1, iterations);
+        return;
+    }
+    if (!analyzeCountedLoop(node, init, &info, &reason)) {
+        reportUnroll(node, "not unrolled, %s", reason);
+        genWhile(node, cond, body, 1, iterations);
+        return;
+    }
+
+    int size = treeSize(body);
+    if (info.tripCount >= 0 && info.tripCount <= FULL_UNROLL_MAX_TRIPS &&
+        (long long) info.tripCount * size <= UNROLL_BUDGET) {
+        reportUnroll(node, "fully unrolled, %d iterations", info.tripCount);
+        emitComment("Loop fully unrolled, %d iterations", info.tripCount);
+        double outer = curWeight;
+        curWeight = runsPerCall(siteCount(node, PROF_LOOP));
+        for (int i = 0; i < info.tripCount; i++) {
+            if (i > 0)
+                reportQuiet++;
+            emitCount(node, PROF_ITERATIONS, 1);
+            genStatement(body);
+            if (i > 0)
+                reportQuiet--;
+        }
+        curWeight = outer;
+        return;
+    }
+    while (factor > 1 && factor * size > UNROLL_BUDGET)
+        factor--;
+    if (factor < 2) {
+        reportUnroll(node, "not unrolled, body too large (%d nodes)", size);
+        genWhile(node, cond, body, 1, iterations);
+        return;
+    }
+    if (info.tripCount >= 0 && info.tripCount < factor) {
+        reportUnroll(node, "not unrolled, only %d iterations", info.tripCount);
+        genWhile(node, cond, body, 1, iterations);
+        return;
+    }
+
+    reportUnroll(node, "unrolled by %d with a remainder loop", factor);
+    tree *relop = stripWrappers(cond);
+    tree *limit = maketreeWithVal(ADDOP, OPVAL_SUB);
+    addChild(limit, relop->children[1]);
+    addChild(limit, maketreeWithVal(INTEGER, (factor - 1) * info.step));
+    tree *mainCond = maketreeWithVal(RELOP, relop->val);
+    addChild(mainCond, relop->children[0]);
+    addChild(mainCond, limit);
+    // The remainder loop runs about (factor - 1) / 2 times per entry
+    long long entries = siteCount(node, PROF_LOOP), rest = -1;
+    if (iterations >= 0 && entries >= 0)
+        rest = entries * (factor - 1) / 2 < iterations ? entries * (factor - 1) / 2 : iterations;
+    genWhile(node, mainCond, body, factor, rest < 0 ? -1 : iterations - rest);
+    reportQuiet++;
+    genWhile(node, cond, body, 1, rest);
+    reportQuiet--;
+}
+
+// Whether an argument passes the address of one of our own local arrays,
+// which is gone once the frame is reused
+static int passesLocalArray(tree *args) {
+    for (int i = 0; args && i < args->numChildren; i++) {
+        tree *arg = stripWrappers(args->children[i]);
+        varInfo *v = arg->nodeKind == VAR && arg->numChildren == 1 ? lookupVar(arg->children[0]->name) : NULL;
+        if (v && v->isArray && v->storage == VAR_LOCAL)
+            return 1;
+    }
+    return 0;
+}
+
+// Version of the callee that "return f(...)" jumps to when the call can
+// reuse the current frame: f's arguments must fit in the slots of our own
+// parameters. Returns NULL for an ordinary return.
+static char *tailTarget(tree *node) {
+    if (cgOpts.optLevel == 0 || inlineExit || node->numChildren == 0)
+        return NULL;
+    tree *call = stripWrappers(node->children[0]);
+    if (call->nodeKind != FUNCCALLEXPR)
+        return NULL;
+    cgNode *callee = findFunction(program, call->children[0]->name);
+    cgSite *site = findSite(program, call);
+    int numArgs = call->children[1] ? call->children[1]->numChildren : 0;
+    if (!callee || !callee->decl || callee->inlined || (site && site->folded) ||
+        numArgs > curNode->decl->children[1]->numChildren || passesLocalArray(call->children[1]))
+        return NULL;
+    return calleeLabel(call);
+}
+
+static int hasSelfTailCall(tree *node) {
+    if (!node)
+        return 0;
+    if (node->nodeKind == RETURNSTMT) {
+        char *target = tailTarget(node);
+        return target && strcmp(target, curFunc->name) == 0;
+    }
+    for (int i = 0; i < node->numChildren; i++)
+        if (hasSelfTailCall(node->children[i]))
+            return 1;
+    return 0;
+}
+
+// Overwrites our parameter slots with the callee's arguments, placed
+// where its caller would have stored them, then either loops back to the
+// top of the body or tears down the frame and jumps to the callee, which
+// returns straight to our caller
+static void genTailCall(tree *node, char *target) {
+    tree *call = stripWrappers(node->children[0]);
+    tree *args = call->children[1];
+    int numArgs = args ? args->numChildren : 0;
+    cgSpec *spec = callSpec(call);
+    int self = strcmp(target, curFunc->name) == 0;
+
+    emitBlank();
+    if (self)
+        emitComment("Self tail call");
+    else
+        emitComment("Tail call to %s", target);
+    int *regs = (int *) malloc((numArgs + 1) * sizeof(int));
+    for (int i = 0; i < numArgs; i++)
+        if (!isFixedArg(spec, i))
+            regs[i] = genExpr(args->children[i]);
+    for (int i = 0; i < numArgs; i++)
+        if (!isFixedArg(spec, i))
+            emit2(OP_SW, regOpnd(regs[i]), memOpnd(4 * (numArgs - i), REG_FP));
+    free(regs);
+
+    if (self) {
+        emit1(OP_B, labelOpnd(selfTailLabel));
+    } else {
+        emit1(OP_J, labelOpnd(prefixedName("start", target)));
+        curFunc->code.tail->tailCall = 1;
+    }
+}
+
+static void genReturn(tree *node) {
+    char *target = tailTarget(node);
+    if (target) {
+        genTailCall(node, target);
+        return;
+    }
+    if (inlineExit) {
+        if (node->numChildren > 0) {
+            int value = genExpr(node->children[0]);
+            emitComment("Set inlined return value");
+            emit2(OP_MOVE, regOpnd(inlineResult), regOpnd(value));
+        }
+        emit1(OP_B, labelOpnd(inlineExit));
+        return;
+    }
+    if (node->numChildren > 0) {
+        int value = genExpr(node->children[0]);
+        emitBlank();
+        emitComment("Set return value");
+        emit2(OP_MOVE, regOpnd(REG_V0), regOpnd(value));
+    }
+    emitComment("Jump to end of current function");
+    emit1(OP_J, labelOpnd(prefixedName("end", curFunc->name)));
+}
+
+// Counted sites of a loop nest, inner ones first, up to max of them
+static void collectCounters(tree *node, int *sites, int *num, int max) {
+    if (!node)
+        return;
+    for (int i = 0; i < node->numChildren; i++)
+        collectCounters(node->children[i], sites, num, max);
+    static const profKind kinds[] = {PROF_THEN, PROF_IF, PROF_ITERATIONS, PROF_LOOP};
+    for (int k = 0; k < 4 && *num < max; k++) {
+        int site = findProfileSite(profSites, numProfSites, node, kinds[k]);
+        if (site >= 0 && profSites[site].counted)
+            sites[(*num)++] = site;
+    }
+}
+
+// Keeps the counters of a loop nest in registers while it runs, loaded
+// before it and stored once it is done, so an increment is one addi.
+// The loop must leave only through its condition, and nothing it calls
+// may come back to the function and count in memory meanwhile. Returns
+// whether the counters are held.
+static int holdCounters(tree *loop) {
+    if (!cgOpts.profile || cgOpts.optLevel == 0 || numHeldCounters > 0 || containsKind(loop, RETURNSTMT))
+        return 0;
+    int site = findProfileSite(profSites, numProfSites, loop, PROF_ITERATIONS);
+    cgNode *owner = site >= 0 ? findFunction(program, profSites[site].func) : NULL;
+    if (!owner || (owner->recursive && containsCall(loop)))
+        return 0;
+    collectCounters(loop, heldCounters, &numHeldCounters, MAX_HELD_COUNTERS);
+    if (numHeldCounters > 0)
+        emitComment("Profile counters held in registers");
+    for (int i = 0; i < numHeldCounters; i++) {
+        int reg = nextRegister();
+        emit2(OP_LW, regOpnd(reg), counterLocation(heldCounters[i]));
+        counterRegs[heldCounters[i]] = reg;
+    }
+    return numHeldCounters > 0;
+}
+
+static void releaseCounters(void) {
+    emitComment("Profile counters stored");
+    for (int i = 0; i < numHeldCounters; i++) {
+        int site = heldCounters[i];
+        emit2(OP_SW, regOpnd(counterRegs[site]), counterLocation(site));
+        counterRegs[site] = 0;
+    }
+    numHeldCounters = 0;
+}
+
+static void genStatement(tree *node) {
+    if (!node)
+        return;
+    switch (node->nodeKind) {
+        case STATEMENTLIST:
+            for (int i = 0; i < node->numChildren; i++)
+                genStatement(node->children[i]);
+            break;
+        case ASSIGNSTMT:
+            genAssign(node);
+            trackAssignment(node);
+            prevStatement = node;
+            break;
+        case STATEMENT:
+            genExpr(node->children[0]);
+            prevStatement = NULL;
+            break;
+        case CONDSTMT:
+            prevStatement = NULL;
+            emitCount(node, PROF_IF, 1);
+            genCond(node);
+            prevStatement = NULL;
+            break;
+        case LOOPSTMT: {
+            tree *init = prevStatement;
+            prevStatement = NULL;
+            emitCount(node, PROF_LOOP, 1);
+            int held = holdCounters(node);
+            genLoop(node, init);
+            if (held)
+                releaseCounters();
+            prevStatement = NULL;
+            break;
+        }
+        case RETURNSTMT:
+            genReturn(node);
+            prevStatement = NULL;
+            break;
+        default:
+            break;
+    }
+}
+
+/* ---------- frames ---------- */
+
+static int isAssignedIn(tree *node, char *name) {
+    if (!node)
+        return 0;
+    if (node->nodeKind == ASSIGNSTMT && strcmp(node->children[0]->children[0]->name, name) == 0)
+        return 1;
+    for (int i = 0; i < node->numChildren; i++)
+        if (isAssignedIn(node->children[i], name))
+            return 1;
+    return 0;
+}
+
+// Reserves size bytes of the local area for a variable, after the last
+// one and aligned to align; returns its offset
+static int allocateLocal(char *name, int size, int align, int scalar) {
+    codeFunc *func = curFunc;
+    int offset = 4;
+    if (func->numObjects > 0) {
+        frameObject *last = &func->objects[func->numObjects - 1];
+        offset = (last->offset + last->size + align - 1) / align * align;
+    }
+    func->numLocalWords = (offset + size - 1) / 4;
+
+    func->objects = (frameObject *) realloc(func->objects, (func->numObjects + 1) * sizeof(frameObject));
+    frameObject *obj = &func->objects[func->numObjects++];
+    obj->name = name;
+    obj->offset = offset;
+    obj->size = size;
+    obj->align = align;
+    obj->scalar = scalar;
+    return offset;
+}
+
+// Locals get consecutive slots above $sp in declaration order, a byte
+// for each char and a word for each int; returns the statement list of
+// the body
+static tree *declareLocals(tree *body) {
+    tree *statements = NULL;
+    for (int i = 0; i < body->numChildren; i++) {
+        tree *child = body->children[i];
+        if (child->nodeKind == LOCALDECLLIST) {
+            for (int j = 0; j < child->numChildren; j++) {
+                tree *decl = child->children[j];
+                tree *id = decl->children[1];
+                int isArray = id->nodeKind == ARRAYDECL;
+                varInfo *v = newVar(id->name, VAR_LOCAL, decl->children[0]->type, isArray, isArray ? id->val : 1);
+                v->offset = allocateLocal(v->name, v->width * v->size, v->width, !isArray);
+                appendVar(&frameVars, v);
+            }
+        } else {
+            statements = child;
+        }
+    }
+    return statements;
+}
+
+/* ---------- inlining ---------- */
+
+static void reportInline(cgNode *node, int size, const char *fmt, ...) {
+    if (!cgOpts.inlineReport)
+        return;
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "inline: %s: %d call site%s, size %d: ", node->name, node->callSites,
+            node->callSites == 1 ? "" : "s", size);
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+}
+
+// Every call to a chosen function is expanded in place, so it is no
+// longer emitted on its own. A call costs argument stores, jal, the frame
+// setup and the register saves; small bodies cost less than that, and a
+// body with a single call site only moves. With a profile, larger bodies
+// of hot functions are copied too, and functions the run never called
+// stay out of their callers.
+static void chooseInlinedFunctions(callGraph *graph) {
+    long long maxCalls = 0;
+    for (cgNode *node = graph->funcs; node; node = node->next)
+        if (node->decl && siteCount(node->decl, PROF_CALLS) > maxCalls)
+            maxCalls = siteCount(node->decl, PROF_CALLS);
+    for (cgNode *node = graph->funcs; node; node = node->next) {
+        node->inlined = 0;
+        if (!node->decl || !node->reachable || node->callSites == 0 || strcmp(node->name, "main") == 0)
+            continue;
+        int size = treeSize(node->decl->children[2]);
+        long long calls = siteCount(node->decl, PROF_CALLS);
+        if (cgOpts.noInline)
+            reportInline(node, size, "not inlined, disabled");
+        else if (node->recursive)
+            reportInline(node, size, "not inlined, recursive");
+        else if (calls == 0)
+            reportInline(node, size, "not inlined, never called in the profile");
+        else if (size <= INLINE_SMALL_SIZE) {
+            node->inlined = 1;
+            reportInline(node, size, "inlined, small body");
+        } else if (calls >= INLINE_HOT_CALLS && calls * INLINE_HOT_SHARE >= maxCalls && size <= INLINE_HOT_SIZE) {
+            node->inlined = 1;
+            reportInline(node, size, "inlined, hot (%lld calls)", calls);
+        } else if (node->callSites == 1 && size <= INLINE_SINGLE_SITE_SIZE) {
+            node->inlined = 1;
+            reportInline(node, size, "inlined, single call site");
+        } else {
+            reportInline(node, size, "not inlined, body too large");
+        }
+    }
+}
+
+// Expands a call in the caller's frame: arguments are stored to fresh
+// local slots standing in for the parameters, the callee's locals get
+// slots of their own, and a return jumps past the body
+static int genInlineCall(tree *node, cgNode *callee) {
+    tree *args = node->children[1];
+    tree *formals = callee->decl->children[1];
+    int numArgs = args ? args->numChildren : 0;
+
+    emitBlank();
+    emitComment("Inlined call to %s", callee->name);
+    int *regs = (int *) malloc((numArgs + 1) * sizeof(int));
+    valueRange *argRanges = (valueRange *) malloc((numArgs + 1) * sizeof(valueRange));
+    int *argSizes = (int *) calloc(numArgs + 1, sizeof(int));
+    for (int i = 0; i < numArgs; i++) {
+        regs[i] = genExpr(args->children[i]);
+        // What the parameters start out with, for the bounds checks
+        tree *arg = stripWrappers(args->children[i]);
+        varInfo *array = arg->nodeKind == VAR && arg->numChildren == 1 ? lookupVar(arg->children[0]->name) : NULL;
+        if (array && array->isArray)
+            argSizes[i] = checkedSize(array);
+        argRanges[i] = exprRange(args->children[i]);
+    }
+
+    varInfo *callerVars = frameVars;
+    tree *callerPrev = prevStatement;
+    char *outerExit = inlineExit;
+    int outerResult = inlineResult;
+
+    frameVars = NULL;
+    for (int i = 0; i < numArgs; i++) {
+        tree *formal = formals->children[i];
+        tree *id = formal->children[1];
+        int isArray = id->nodeKind == ARRAYDECL;
+        varInfo *v = newVar(id->name, isArray ? VAR_REF : VAR_LOCAL, formal->children[0]->type, isArray,
+                            isArray ? argSizes[i] : 1);
+        if (!isArray)
+            v->width = 4;       // the argument is a word, as in a real call
+        v->offset = allocateLocal(v->name, 4, 4, 1);
+        emit2(OP_SW, regOpnd(regs[i]), memOpnd(v->offset, REG_SP));
+        appendVar(&frameVars, v);
+        if (rangesTracked() && !isArray)
+            setRange(v, argRanges[i]);
+    }
+    free(regs);
+    free(argRanges);
+    free(argSizes);
+
+    inlineExit = labelName(newLabel());
+    inlineResult = nextRegister();
+    prevStatement = NULL;
+    // The callee's counts are per call of the callee; this copy runs as
+    // often as the call site
+    long long callerCalls = profCalls;
+    double callerScale = profScale;
+    profCalls = siteCount(callee->decl, PROF_CALLS);
+    profScale = curWeight;
+    emitCount(callee->decl, PROF_CALLS, 1);
+    reportQuiet++;
+    genStatement(declareLocals(callee->decl->children[2]));
+    reportQuiet--;
+    profCalls = callerCalls;
+    profScale = callerScale;
+    emitLabel("%s", inlineExit);
+    emitComment("End of inlined %s", callee->name);
+    int result = inlineResult;
+
+    frameVars = callerVars;
+    prevStatement = callerPrev;
+    inlineExit = outerExit;
+    inlineResult = outerResult;
+    return result;
+}
+
+/* ---------- functions ---------- */
+
+// Frees the frame and restores the registers and $fp of the caller
+static void emitEpilogue(codeFunc *func, int frameWords) {
+    if (frameWords > 0) {
+        emitBlank();
+        emitComment("Deallocate space for %d local variables.", frameWords);
+        emit(OP_ADDI, regOpnd(REG_SP), regOpnd(REG_SP), immOpnd(4 * frameWords));
+    }
+    if (func->savedRegs) {
+        emitBlank();
+        emitComment("Reloading registers");
+        for (int r = REG_S7; r >= REG_S0; r--) {
+            if (!(func->savedRegs & (1 << r)))
+                continue;
+            emit(OP_ADDI, regOpnd(REG_SP), regOpnd(REG_SP), immOpnd(4));
+            emit2(OP_LW, regOpnd(r), memOpnd(0, REG_SP));
+        }
+    }
+    emitBlank();
+    emitComment("Setting FP back to old value");
+    emit(OP_ADDI, regOpnd(REG_SP), regOpnd(REG_SP), immOpnd(4));
+    emit2(OP_LW, regOpnd(REG_FP), memOpnd(0, REG_SP));
+}
+
+// Builds prologue and epilogue around the generated body
+static void finishFunction(codeFunc *func) {
+    instrList *code = &func->code;
+    instr *body = code->head;
+    int frameWords = func->numLocalWords + func->numSpillSlots;
+
+    // Prologue: code is appended to a scratch list then spliced in front
+    instrList saved = func->code;
+    func->code.head = func->code.tail = NULL;
+    curFunc = func;
+    emitComment("Function definition");
+    emitLabel("start%s", func->name);
+    emitComment("Setting up FP");
+    emit2(OP_SW, regOpnd(REG_FP), memOpnd(0, REG_SP));
+    emit2(OP_MOVE, regOpnd(REG_FP), regOpnd(REG_SP));
+    emit(OP_SUBI, regOpnd(REG_SP), regOpnd(REG_SP), immOpnd(4));
+    if (func->savedRegs) {
+        emitBlank();
+        emitComment("Saving registers");
+        for (int r = REG_S0; r <= REG_S7; r++) {
+            if (!(func->savedRegs & (1 << r)))
+                continue;
+            emit2(OP_SW, regOpnd(r), memOpnd(0, REG_SP));
+            emit(OP_SUBI, regOpnd(REG_SP), regOpnd(REG_SP), immOpnd(4));
+        }
+    }
+    emitBlank();
+    if (frameWords > 0) {
+        emitComment("Allocate space for %d local variables.", frameWords);
+        emit(OP_SUBI, regOpnd(REG_SP), regOpnd(REG_SP), immOpnd(4 * frameWords));
+        emitBlank();
+    }
+    instrList prologue = func->code;
+
+    // Splice prologue + body, then keep appending the epilogue
+    func->code = saved;
+    if (prologue.head) {
+        prologue.tail->next = body;
+        if (body)
+            body->prev = prologue.tail;
+        else
+            func->code.tail = prologue.tail;
+        func->code.head = prologue.head;
+    }
+
+    // Tail calls leave through their own copy of the epilogue
+    for (instr *ins = func->code.head; ins; ins = ins->next) {
+        if (ins->kind != I_OP || !ins->tailCall)
+            continue;
+        instrList body = func->code;
+        func->code.head = func->code.tail = NULL;
+        emitEpilogue(func, frameWords);
+        instrList epilogue = func->code;
+        func->code = body;
+        for (instr *e = epilogue.head; e; ) {
+            instr *next = e->next;
+            e->cold = ins->cold;
+            insertBefore(&func->code, ins, e);
+            e = next;
+        }
+    }
+
+    emitEpilogue(func, frameWords);
+    emitBlank();
+    emitComment("Return to caller");
+    emit1(OP_JR, regOpnd(REG_RA));
+    emitBlank();
+}
+
+// Moves the unlikely arms marked by genCondLaidOut after the return,
+// then drops the branches that now jump to the very next instruction
+static void placeColdRegions(codeFunc *func) {
+    instrList *code = &func->code;
+    instrList cold = {NULL, NULL};
+    for (instr *ins = code->head; ins; ) {
+        instr *next = ins->next;
+        if (ins->cold) {
+            removeInstr(code, ins);
+            appendInstr(&cold, ins);
+        }
+        ins = next;
+    }
+    if (cold.head) {
+        code->tail->next = cold.head;
+        cold.head->prev = code->tail;
+        code->tail = cold.tail;
+    }
+
+    for (instr *ins = code->head; ins; ) {
+        instr *next = ins->next;
+        if (ins->kind == I_OP && ins->op == OP_B) {
+            instr *target = next;
+            while (target && (target->kind == I_COMMENT || target->kind == I_BLANK))
+                target = target->next;
+            if (target && target->kind == I_LABEL && strcmp(target->text, ins->opnd[0].label) == 0)
+                removeInstr(code, ins);
+        }
+        ins = next;
+    }
+}
+
+// Generates the function, or its version with the parameters of spec fixed
+static void genFunction(tree *node, cgSpec *spec) {
+    codeFunc *func = (codeFunc *) calloc(1, sizeof(codeFunc));
+    func->name = spec ? spec->name : node->name;
+    curFunc = func;
+    frameVars = NULL;
+    prevStatement = NULL;
+    ranges.count = 0;
+
+    // Parameters: the caller stores argument i at $fp + 4 * (n - i)
+    tree *formals = node->children[1];
+    for (int i = 0; i < formals->numChildren; i++) {
+        tree *formal = formals->children[i];
+        tree *id = formal->children[1];
+        varInfo *v = newVar(id->name, VAR_PARAM, formal->children[0]->type, id->nodeKind == ARRAYDECL, 0);
+        v->offset = 4 * (formals->numChildren - i);
+        appendVar(&frameVars, v);
+    }
+
+    curNode = findFunction(program, node->name);
+    tree *statements = declareLocals(node->children[2]);
+    func->calls = profCalls = siteCount(node, PROF_CALLS);
+    profScale = 1;
+    curWeight = runsPerCall(profCalls);
+
+    // Callers no longer pass fixed parameters. One the body never assigns
+    // is a constant; any other starts from its value in the slot.
+    for (varInfo *v = frameVars; spec && v && v->storage == VAR_PARAM; v = v->next) {
+        int i = formals->numChildren - v->offset / 4;
+        if (!spec->known[i])
+            continue;
+        if (!isAssignedIn(statements, v->name)) {
+            v->known = 1;
+            v->value = spec->value[i];
+            continue;
+        }
+        emitComment("Fixed parameter %s", v->name);
+        int reg = nextRegister();
+        emit2(OP_LI, regOpnd(reg), immOpnd(spec->value[i]));
+        emit2(OP_SW, regOpnd(reg), varLocation(v));
+    }
+    if (hasSelfTailCall(statements)) {
+        selfTailLabel = labelName(newLabel());
+        emitLabel("%s", selfTailLabel);
+    }
+    emitCount(node, PROF_CALLS, 1);
+    genStatement(statements);
+    emitLabel("end%s", func->name);
+    curWeight = -1;
+
+    func->declaredBytes = 4 * func->numLocalWords;
+    if (cgOpts.optLevel > 0) {
+        numberValues(func);
+        hoistLoopInvariants(func);
+        eliminateDeadCode(func);
+        layoutFrame(func);
+        allocateRegisters(func);
+    } else {
+        func->savedRegs = 0;
+        for (int r = REG_S0; r <= REG_S7; r++)
+            func->savedRegs |= 1 << r;
+    }
+    finishFunction(func);
+    if (cgOpts.optLevel > 0)
+        placeColdRegions(func);
+    if (cgOpts.frameReport)
+        reportFrame(func);
+
+    codeFunc **tail = &codeFuncs;
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = func;
+}
+
+static int smallDataLimit(void) {
+    if (cgOpts.smallDataLimit >= 0)
+        return cgOpts.smallDataLimit;
+    return cgOpts.optLevel > 0 ? DEFAULT_SMALL_DATA_LIMIT : 0;
+}
+
+// Globals up to the size limit go in an area at the start of .data that
+// $gp points to, so one lw or sw reaches them instead of a la first
+static void genGlobal(tree *node) {
+    tree *id = node->children[1];
+    int isArray = id->nodeKind == ARRAYDECL;
+    varInfo *v = newVar(id->name, VAR_GLOBAL, node->children[0]->type, isArray, isArray ? id->val : 1);
+    int limit = smallDataLimit();
+    int offset = (smallDataBytes + v->width - 1) / v->width * v->width;
+    int bytes = v->width * v->size;
+    if (bytes <= limit && offset + bytes <= SMALL_DATA_MAX) {
+        v->small = 1;
+        v->offset = offset;
+        smallDataBytes = offset + bytes;
+    }
+    appendVar(&globals, v);
+}
+
+/* ---------- compile cache ---------- */
+
+// Reports come from running the passes, and profile counters are numbered
+// across the program, so those leave the cache out
+static int cacheUsable(void) {
+    return cgOpts.cacheDir && !cgOpts.profile && !cgOpts.profileUse && !cgOpts.raStats && !cgOpts.unrollReport &&
+           !cgOpts.inlineReport && !cgOpts.frameReport && !cgOpts.boundsReport;
+}
+
+static int mentionsName(tree *node, char *name) {
+    if (!node)
+        return 0;
+    if (node->name && strcmp(node->name, name) == 0)
+        return 1;
+    for (int i = 0; i < node->numChildren; i++)
+        if (mentionsName(node->children[i], name))
+            return 1;
+    return 0;
+}
+
+// What the calls in the tree were made into by the interprocedural analysis
+static cacheKey hashCallSites(cacheKey h, tree *node) {
+    if (!node)
+        return h;
+    if (node->nodeKind == FUNCCALLEXPR) {
+        cgSite *site = findSite(program, node);
+        cgNode *callee = findFunction(program, node->children[0]->name);
+        h = hashCacheInt(h, site ? site->folded : -1);
+        h = hashCacheInt(h, site ? site->value : 0);
+        if (site && site->spec) {
+            h = hashCacheString(h, site->spec->name);
+            for (int i = 0; callee && callee->decl && i < callee->decl->children[1]->numChildren; i++)
+                h = hashCacheInt(h, site->spec->known[i] ? site->spec->value[i] : LLONG_MIN);
+        }
+    }
+    for (int i = 0; i < node->numChildren; i++)
+        h = hashCallSites(h, node->children[i]);
+    return h;
+}
+
+// Everything the code of the function depends on: the options, the
+// function and, once optimizing, every function it may call, inline or
+// not, with what the analysis made of them, and the globals any of those
+// name. Without optimization the $s register the function starts from.
+static cacheKey functionKey(tree *node, cgSpec *spec) {
+    cacheKey h = hashCompiler(CACHE_KEY_START);
+    int options[5] = {cgOpts.optLevel, cgOpts.unrollFactor, cgOpts.noInline, cgOpts.smallDataLimit,
+                      cgOpts.boundsCheck};
+    h = hashCacheBytes(h, options, sizeof(options));
+    if (cgOpts.optLevel == 0)
+        h = hashCacheInt(h, regCount % NUM_SAVED_REGS);
+    if (spec) {
+        h = hashCacheString(h, spec->name);
+        for (int i = 0; i < node->children[1]->numChildren; i++)
+            h = hashCacheInt(h, spec->known[i] ? spec->value[i] : LLONG_MIN);
+    }
+
+    cgNode *self = findFunction(program, node->name);
+    int numReached = 1;
+    cgNode **reached = (cgNode **) malloc(sizeof(cgNode *));
+    reached[0] = self;
+    for (int i = 0; i < numReached && cgOpts.optLevel > 0; i++) {
+        for (int c = 0; c < reached[i]->numCallees; c++) {
+            cgNode *callee = reached[i]->callees[c];
+            int seen = 0;
+            for (int j = 0; j < numReached && !seen; j++)
+                seen = reached[j] == callee;
+            if (!seen) {
+                reached = (cgNode **) realloc(reached, (numReached + 1) * sizeof(cgNode *));
+                reached[numReached++] = callee;
+            }
+        }
+    }
+    // Line numbers only reach the code in bounds checks
+    for (int i = 0; i < numReached; i++) {
+        h = hashCacheString(h, reached[i]->name);
+        h = hashCacheTree(h, reached[i]->decl, cgOpts.boundsCheck);
+        if (cgOpts.optLevel > 0) {
+            h = hashCacheInt(h, reached[i]->inlined);
+            h = hashCacheInt(h, reached[i]->pure);
+            h = hashCallSites(h, reached[i]->decl);
+        }
+    }
+    for (varInfo *v = globals; v; v = v->next) {
+        int named = 0;
+        for (int i = 0; i < numReached && !named; i++)
+            named = mentionsName(reached[i]->decl, v->name);
+        if (!named)
+            continue;
+        int layout[6] = {v->type, v->isArray, v->size, v->width, v->offset, v->small};
+        h = hashCacheString(h, v->name);
+        h = hashCacheBytes(h, layout, sizeof(layout));
+    }
+    free(reached);
+    return h;
+}
+
+// Takes the function from the cache when it is there, otherwise generates
+// it and stores it for the next compile
+static void genCachedFunction(tree *node, cgSpec *spec) {
+    if (!cacheUsable()) {
+        genFunction(node, spec);
+        return;
+    }
+    cacheKey key = functionKey(node, spec);
+    cacheEntry entry;
+    entry.labelBase = labelCount;
+    clock_t start = clock();
+    if (loadCachedFunction(cgOpts.cacheDir, key, &entry) == 0) {
+        labelCount += entry.labels;
+        regCount += entry.registers;
+        numBoundsChecks += entry.boundsChecks;
+        codeFunc **tail = &codeFuncs;
+        while (*tail)
+            tail = &(*tail)->next;
+        *tail = entry.func;
+        cacheCounts.savedSeconds += entry.seconds - (double) (clock() - start) / CLOCKS_PER_SEC;
+        return;
+    }
+    int registers = regCount, boundsChecks = numBoundsChecks;
+    start = clock();
+    genFunction(node, spec);
+    entry.seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+    entry.func = curFunc;
+    entry.labels = labelCount - entry.labelBase;
+    entry.registers = regCount - registers;
+    entry.boundsChecks = numBoundsChecks - boundsChecks;
+    storeCachedFunction(cgOpts.cacheDir, key, &entry);
+}
+
+// Walks the left-nested declList in source order
+static void genDeclList(tree *node) {
+    if (!node)
+        return;
+    switch (node->nodeKind) {
+        case DECLLIST:
+        case DECL:
+            for (int i = 0; i < node->numChildren; i++)
+                genDeclList(node->children[i]);
+            break;
+        case VARDECL:
+            if (cgOpts.optLevel == 0 || isGlobalUsed(program, node->children[1]->name))
+                genGlobal(node);
+            break;
+        case FUNDECL: {
+            cgNode *func = findFunction(program, node->name);
+            if (cgOpts.optLevel == 0) {
+                genCachedFunction(node, NULL);
+            } else if (func->reachable && !func->inlined) {
+                if (func->generic)
+                    genCachedFunction(node, NULL);
+                for (cgSpec *spec = func->specs; spec; spec = spec->next)
+                    genCachedFunction(node, spec);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void emitSyscall(int code) {
+    emit2(OP_LI, regOpnd(REG_V0), immOpnd(code));
+    emit1(OP_SYSCALL, noOpnd());
+}
+
+// Prints text a character at a time
+static void emitPrintText(const char *text) {
+    for (const char *c = text; *c; c++) {
+        emit2(OP_LI, regOpnd(REG_A0), immOpnd(*c));
+        emitSyscall(11);
+    }
+}
+
+// Fills in the counters derived from others, then prints them in the
+// format profile.h describes once main has returned. Only $t registers
+// are used, so nothing needs saving.
+static void genProfileDump(void) {
+    codeFunc *func = (codeFunc *) calloc(1, sizeof(codeFunc));
+    func->name = PROFILE_DUMP;
+    curFunc = func;
+    emitComment("Profile dump");
+    emitLabel("%s", PROFILE_DUMP);
+    emit2(OP_LA, regOpnd(REG_T0), labelOpnd(PROFILE_COUNTS));
+    int numFuncs = 0;
+    for (int i = 0; i < numProfSites; i++) {
+        profSite *site = &profSites[i];
+        numFuncs += site->kind == PROF_CALLS;
+        if (site->counted)
+            continue;
+        emit2(OP_LW, regOpnd(REG_T0 + 2), memOpnd(4 * site->from, REG_T0));
+        if (site->minus >= 0) {
+            emit2(OP_LW, regOpnd(REG_T0 + 3), memOpnd(4 * site->minus, REG_T0));
+            emit(OP_SUB, regOpnd(REG_T0 + 2), regOpnd(REG_T0 + 2), regOpnd(REG_T0 + 3));
+        }
+        emit2(OP_SW, regOpnd(REG_T0 + 2), memOpnd(4 * i, REG_T0));
+    }
+    char text[64];
+    snprintf(text, sizeof(text), "\n#profile %d\n", numFuncs);
+    emitPrintText(text);
+
+    // A function's counters are consecutive, starting with its calls
+    for (int i = 0; i < numProfSites; ) {
+        int n = 1;
+        while (i + n < numProfSites && profSites[i + n].kind != PROF_CALLS)
+            n++;
+        emitComment("Counters of %s", profSites[i].func);
+        emitPrintText(profSites[i].func);
+        snprintf(text, sizeof(text), " %u %d\n", functionHash(profSites[i].node), n);
+        emitPrintText(text);
+        char *loop = labelName(newLabel());
+        emit2(OP_LI, regOpnd(REG_T0 + 1), immOpnd(n));
+        emitLabel("%s", loop);
+        emit2(OP_LW, regOpnd(REG_A0), memOpnd(0, REG_T0));
+        emitSyscall(1);
+        emit2(OP_LI, regOpnd(REG_A0), immOpnd('\n'));
+        emitSyscall(11);
+        emit(OP_ADDI, regOpnd(REG_T0), regOpnd(REG_T0), immOpnd(4));
+        emit(OP_SUBI, regOpnd(REG_T0 + 1), regOpnd(REG_T0 + 1), immOpnd(1));
+        emit(OP_BNE, regOpnd(REG_T0 + 1), regOpnd(REG_ZERO), labelOpnd(loop));
+        i += n;
+    }
+    emit1(OP_JR, regOpnd(REG_RA));
+    emitBlank();
+
+    codeFunc **tail = &codeFuncs;
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = func;
+}
+
+// Most called functions first, so the hot code shares cache lines and
+// pages; functions without counts keep their order at the end
+static void orderFunctionsByCalls(void) {
+    codeFunc *sorted = NULL;
+    while (codeFuncs) {
+        codeFunc *func = codeFuncs;
+        codeFuncs = func->next;
+        codeFunc **pos = &sorted;
+        while (*pos && (*pos)->calls >= func->calls)
+            pos = &(*pos)->next;
+        func->next = *pos;
+        *pos = func;
+    }
+    codeFuncs = sorted;
+}
+
+// Prints the line of the failed check, which the check left in $a0, and
+// stops the program
+static void genBoundsError(void) {
+    codeFunc *func = (codeFunc *) calloc(1, sizeof(codeFunc));
+    func->name = BOUNDS_ERROR;
+    curFunc = func;
+    emitComment("Array index out of bounds");
+    emitLabel("%s", BOUNDS_ERROR);
+    emit2(OP_MOVE, regOpnd(REG_T0), regOpnd(REG_A0));
+    emitPrintText("\nerror: array index out of bounds on line ");
+    emit2(OP_MOVE, regOpnd(REG_A0), regOpnd(REG_T0));
+    emitSyscall(1);
+    emit2(OP_LI, regOpnd(REG_A0), immOpnd('\n'));
+    emitSyscall(11);
+    emitSyscall(10);
+    emitBlank();
+
+    codeFunc **tail = &codeFuncs;
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = func;
+}
+
+void generateCode(tree *root) {
+    codeFuncs = NULL;
+    globals = NULL;
+    smallDataBytes = 0;
+    ivPointers = NULL;
+    prevStatement = NULL;
+    labelCount = 0;
+    regCount = 0;
+    numBoundsChecks = 0;
+    freeCallGraph(program);
+    program = buildCallGraph(root);
+    freeProfile(&profile);
+    haveProfile = 0;
+    if (cgOpts.profileUse && cgOpts.optLevel > 0)
+        haveProfile = loadProfile(root, cgOpts.profileUse, &profile) == 0;
+    profCalls = -1;
+    curWeight = -1;
+    if (cgOpts.optLevel > 0) {
+        chooseInlinedFunctions(program);
+        analyzeCalls(program, cgOpts.profile);
+    }
+    free(profSites);
+    profSites = NULL;
+    numProfSites = cgOpts.profile ? numberProfileSites(root, &profSites) : 0;
+    free(counterRegs);
+    counterRegs = (int *) calloc(numProfSites + 1, sizeof(int));
+    numHeldCounters = 0;
+    // Whenever there is a small data area, the counters start it
+    countersSmall = numProfSites > 0 && smallDataLimit() > 0 && 4 * numProfSites <= SMALL_DATA_MAX;
+    if (countersSmall)
+        smallDataBytes = 4 * numProfSites;
+    for (int i = 0; root && i < root->numChildren; i++)
+        genDeclList(root->children[i]);
+    if (haveProfile)
+        orderFunctionsByCalls();
+    if (numBoundsChecks > 0)
+        genBoundsError();
+    if (numProfSites > 0)
+        genProfileDump();
+    if (cacheUsable())
+        trimCache(cgOpts.cacheDir, cgOpts.cacheLimit);
+}
+
+// The small data area first, in the order its offsets were given out,
+// then the other globals and the profile counters; words are aligned.
+// The counters open the small data area instead when they are in it.
+// Returns how many items were stored in *items.
+int layoutData(dataItem **items) {
+    int numItems = (smallDataBytes > 0) + (numProfSites > 0), dataBytes = 0;
+    for (varInfo *v = globals; v; v = v->next)
+        numItems++;
+    dataItem *d = *items = (dataItem *) calloc(numItems + 1, sizeof(dataItem));
+    if (smallDataBytes > 0)
+        (d++)->label = "smalldata";
+    if (countersSmall) {
+        d->label = PROFILE_COUNTS;
+        d->bytes = 4 * numProfSites;
+        d->width = 4;
+        d->isArray = 1;
+        dataBytes = (d++)->bytes;
+    }
+    for (int small = 1; small >= 0; small--) {
+        for (varInfo *v = globals; v; v = v->next) {
+            if (v->small != small)
+                continue;
+            if (v->width == 4 && dataBytes % 4)
+                dataBytes += 4 - dataBytes % 4;
+            d->label = prefixedName("var", v->name);
+            d->offset = dataBytes;
+            d->bytes = v->width * v->size;
+            d->width = v->width;
+            d->isArray = v->isArray;
+            dataBytes += (d++)->bytes;
+        }
+    }
+    if (numProfSites > 0 && !countersSmall) {
+        d->label = PROFILE_COUNTS;
+        d->offset = (dataBytes + 3) / 4 * 4;
+        d->bytes = 4 * numProfSites;
+        d->width = 4;
+        d->isArray = 1;
+    }
+    return numItems;
+}
+
+void writeCode(FILE *out) {
+    dataItem *items;
+    int numItems = layoutData(&items);
+    fprintf(out, "# Global variable allocations:\n");
+    fprintf(out, ".data\n");
+    int dataBytes = 0;
+    for (dataItem *d = items; d < items + numItems; d++) {
+        if (d->offset > dataBytes)
+            fprintf(out, "\t.align 2\n");
+        if (d->bytes == 0)
+            fprintf(out, "%s:\n", d->label);
+        else if (d->isArray)
+            fprintf(out, "%s:\t.space %d\n", d->label, d->bytes);
+        else if (d->width == 1)
+            fprintf(out, "%s:\t.byte 0\n", d->label);
+        else
+            fprintf(out, "%s:\t.word 0\n", d->label);
+        dataBytes = d->offset + d->bytes;
+    }
+    free(items);
+
+    fprintf(out, "\n.text\n");
+    if (smallDataBytes > 0)
+        fprintf(out, "\tla $gp, smalldata\n");
+    fprintf(out, "\tjal startmain\n");
+    if (numProfSites > 0)
+        fprintf(out, "\tjal %s\n", PROFILE_DUMP);
+    fprintf(out, "\tli $v0, 10\n");
+    fprintf(out, "\tsyscall\n");
+
+    for (codeFunc *func = codeFuncs; func; func = func->next)
+        for (instr *ins = func->code.head; ins; ins = ins->next)
+            printInstr(out, ins);
+
+    fprintf(out, "# output function\n");
+    fprintf(out, "startoutput:\n");
+    fprintf(out, "\t# Put argument in the output register\n");
+    fprintf(out, "\tlw $a0, 4($sp)\n");
+    fprintf(out, "\t# print int is syscall 1\n");
+    fprintf(out, "\tli $v0, 1\n");
+    fprintf(out, "\tsyscall\n");
+    fprintf(out, "\t# jump back to caller\n");
+    fprintf(out, "\tjr $ra\n\n");
+}
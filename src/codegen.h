@@ -0,0 +1,161 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include <stdio.h>
+#include "tree.h"
+
+// MIPS register numbers used by the generator
+#define REG_ZERO 0
+#define REG_V0   2
+#define REG_A0   4
+#define REG_T0   8
+#define REG_S0   16
+#define REG_S7   23
+#define REG_T8   24
+#define REG_T9   25
+#define REG_GP   28
+#define REG_SP   29
+#define REG_FP   30
+#define REG_RA   31
+#define NUM_SAVED_REGS 8
+
+// Registers numbered from FIRST_VREG up are virtual and must be
+// rewritten by the register allocator before the code is printed.
+#define FIRST_VREG 64
+#define isVirtualReg(r) ((r) >= FIRST_VREG)
+
+// Machine operations emitted by the generator
+typedef enum opcode {
+    OP_ADD, OP_ADDI, OP_SUB, OP_SUBI, OP_MUL, OP_DIV,
+    OP_SLL, OP_SRA, OP_SRL, OP_MULT, OP_MFHI,
+    OP_SLT, OP_SLTI, OP_SLTU, OP_SLTIU, OP_XORI,
+    OP_LI, OP_LA, OP_MOVE, OP_LW, OP_SW, OP_LB, OP_SB,
+    OP_BEQ, OP_BNE, OP_B, OP_J, OP_JAL, OP_JR,
+    OP_SYSCALL,     // only in the runtime code around the functions
+    NUM_OPCODES
+} opcode;
+
+typedef enum operandKind {
+    OPD_NONE,
+    OPD_REG,        // register
+    OPD_IMM,        // immediate value
+    OPD_MEM,        // offset(base register)
+    OPD_LABEL       // code label or global variable symbol
+} operandKind;
+
+typedef struct operand {
+    operandKind kind;
+    int reg;        // register, or base register of a memory operand
+    int imm;        // immediate, or offset of a memory operand
+    char *label;
+} operand;
+
+typedef enum instrKind {
+    I_OP,           // machine instruction
+    I_LABEL,        // "name:"
+    I_COMMENT,      // "\t# text"
+    I_BLANK         // empty line
+} instrKind;
+
+typedef struct instr {
+    instrKind kind;
+    opcode op;
+    operand opnd[3];
+    char *text;     // label name or comment text
+    int cold;       // unlikely path, moved past the epilogue once the function is done
+    int tailCall;   // jump to another function's entry; the epilogue goes in front of it
+    int pureCall;   // jal to a function that stores to no global or array
+    double weight;  // runs per call of the function in the profile, -1 without one
+    struct instr *prev;
+    struct instr *next;
+} instr;
+
+typedef struct instrList {
+    instr *head;
+    instr *tail;
+} instrList;
+
+// Variable or temporary with storage in the local area of a frame
+typedef struct frameObject {
+    char *name;
+    int offset;             // bytes above $sp
+    int size;               // bytes
+    int align;
+    int scalar;             // only read and written by loads and stores of its own slot
+} frameObject;
+
+// Generated code for one function
+typedef struct codeFunc {
+    char *name;
+    instrList code;         // prologue, body and epilogue once finished
+    int numLocalWords;      // words of stack used by declared locals
+    frameObject *objects;   // what the local area holds
+    int numObjects;
+    int declaredBytes;      // size of the local area before objects shared storage
+    int numSpillSlots;      // words of stack added by the register allocator
+    int numVregs;           // virtual registers handed out so far
+    int savedRegs;          // bitmask of callee-saved registers to preserve
+    long long calls;        // calls recorded by the profile, -1 without one
+    struct codeFunc *next;
+} codeFunc;
+
+// Compiler options that affect code generation
+typedef struct codegenOptions {
+    int optLevel;           // 0: naive $s assignment, 1: linear scan, 2: graph coloring
+    int raStats;            // report register allocation statistics on stderr
+    int unrollFactor;       // body copies per unrolled iteration; 0 picks by level, 1 disables
+    int unrollReport;       // report unrolling decisions on stderr
+    int noInline;           // never expand calls in place
+    int inlineReport;       // report inlining decisions on stderr
+    int frameReport;        // report the frame size of each function on stderr
+    int smallDataLimit;     // largest global addressed from $gp, in bytes; -1 picks by level
+    int profile;            // count calls, branches and iterations, see profile.h
+    const char *profileUse; // optimize with the counts of a profiled run, NULL for none
+    int boundsCheck;        // check array indexes at run time, unless proven in bounds
+    int boundsReport;       // report the checks kept and removed on stderr
+    const char *cacheDir;   // reuse the code of unchanged functions kept there, NULL for none
+    long long cacheLimit;   // bytes the cache directory may hold
+} codegenOptions;
+
+#define DEFAULT_CACHE_LIMIT (64LL << 20)
+
+// Label or variable of the data section, as writeCode lays it out
+typedef struct dataItem {
+    char *label;
+    int offset;             // bytes from the start of the section
+    int bytes;              // 0 for a label that only marks a place
+    int width;              // bytes of a word or byte item, or of an array element
+    int isArray;
+} dataItem;
+
+extern codegenOptions cgOpts;
+extern codeFunc *codeFuncs;
+
+void generateCode(tree *root);
+void writeCode(FILE *out);
+int layoutData(dataItem **items);
+
+// Instruction list helpers shared with the optimization passes
+operand regOpnd(int reg);
+operand immOpnd(int imm);
+operand memOpnd(int offset, int reg);
+operand labelOpnd(char *label);
+operand noOpnd(void);
+int newVirtualReg(codeFunc *func);
+instr *newInstr(instrKind kind);
+instr *newOp(opcode op, operand a, operand b, operand c);
+void insertBefore(instrList *list, instr *pos, instr *ins);
+void insertAfter(instrList *list, instr *pos, instr *ins);
+void appendInstr(instrList *list, instr *ins);
+void removeInstr(instrList *list, instr *ins);
+const char *opcodeName(opcode op);
+int opDefinesFirst(opcode op);
+int instrDefs(instr *ins, int *regs);
+int instrUses(instr *ins, int *regs);
+int isBranch(instr *ins);
+int isLoad(opcode op);
+int isStore(opcode op);
+int isGlobalLocation(operand *o);
+void printInstr(FILE *out, instr *ins);
+
+#endif
@@ -0,0 +1,393 @@
+#include "dce.h"
+#include "cfg.h"
+#include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ROUNDS 8
+#define MAX_THREAD_HOPS 8
+
+/* ---------- constant folding ---------- */
+
+typedef struct constState {
+    int *numDefs;
+    char *known;
+    int *value;
+} constState;
+
+static int constOperand(constState *st, operand *o, int *value) {
+    if (o->kind == OPD_IMM) {
+        *value = o->imm;
+        return 1;
+    }
+    if (o->kind != OPD_REG)
+        return 0;
+    if (o->reg == REG_ZERO) {
+        *value = 0;
+        return 1;
+    }
+    if (!isVirtualReg(o->reg) || !st->known[o->reg - FIRST_VREG])
+        return 0;
+    *value = st->value[o->reg - FIRST_VREG];
+    return 1;
+}
+
+// Evaluates an arithmetic instruction the way the machine would
+static int evaluate(opcode op, int a, int b, int *result) {
+    unsigned ua = (unsigned) a, ub = (unsigned) b;
+    switch (op) {
+        case OP_ADD: case OP_ADDI: *result = (int) (ua + ub); return 1;
+        case OP_SUB: case OP_SUBI: *result = (int) (ua - ub); return 1;
+        case OP_MUL:               *result = (int) (ua * ub); return 1;
+        case OP_DIV:
+            if (b == 0 || (a == INT_MIN && b == -1))
+                return 0;
+            *result = a / b;
+            return 1;
+        case OP_SLL:               *result = (int) (ua << (b & 31)); return 1;
+        case OP_SRL:               *result = (int) (ua >> (b & 31)); return 1;
+        case OP_SRA:               *result = a >> (b & 31); return 1;
+        case OP_SLT: case OP_SLTI: *result = a < b; return 1;
+        case OP_SLTU: case OP_SLTIU: *result = ua < ub; return 1;
+        case OP_XORI:              *result = (int) (ua ^ (ub & 0xffff)); return 1;
+        default:
+            return 0;
+    }
+}
+
+// Replaces computations on known constants by li and resolves branches
+// whose outcome is then fixed
+static int foldConstants(codeFunc *func) {
+    constState st;
+    int n = func->numVregs + 1, regs[3];
+    st.numDefs = (int *) calloc(n, sizeof(int));
+    st.known = (char *) calloc(n, 1);
+    st.value = (int *) calloc(n, sizeof(int));
+    for (instr *ins = func->code.head; ins; ins = ins->next)
+        if (instrDefs(ins, regs) && isVirtualReg(regs[0]))
+            st.numDefs[regs[0] - FIRST_VREG]++;
+
+    int folded = 0, changed = 1;
+    while (changed) {
+        changed = 0;
+        for (instr *ins = func->code.head; ins; ins = ins->next) {
+            int a, b, result;
+            if (!instrDefs(ins, regs) || !isVirtualReg(regs[0]))
+                continue;
+            int def = regs[0] - FIRST_VREG;
+            if (st.known[def] || st.numDefs[def] != 1)
+                continue;
+            if (ins->op == OP_LI) {
+                result = ins->opnd[1].imm;
+            } else if (ins->op == OP_MOVE) {
+                if (!constOperand(&st, &ins->opnd[1], &result))
+                    continue;
+            } else if (!constOperand(&st, &ins->opnd[1], &a) || !constOperand(&st, &ins->opnd[2], &b) ||
+                       !evaluate(ins->op, a, b, &result)) {
+                continue;
+            }
+            st.known[def] = 1;
+            st.value[def] = result;
+            changed = 1;
+            if (ins->op != OP_LI) {
+                ins->op = OP_LI;
+                ins->opnd[1] = immOpnd(result);
+                ins->opnd[2] = noOpnd();
+                folded = 1;
+            }
+        }
+    }
+
+    for (instr *ins = func->code.head; ins; ) {
+        instr *next = ins->next;
+        int a, b;
+        if (ins->kind == I_OP && (ins->op == OP_BEQ || ins->op == OP_BNE) &&
+            constOperand(&st, &ins->opnd[0], &a) && constOperand(&st, &ins->opnd[1], &b)) {
+            if ((a == b) == (ins->op == OP_BEQ)) {
+                ins->op = OP_B;
+                ins->opnd[0] = ins->opnd[2];
+                ins->opnd[1] = ins->opnd[2] = noOpnd();
+            } else {
+                removeInstr(&func->code, ins);
+            }
+            folded = 1;
+        }
+        ins = next;
+    }
+    free(st.numDefs);
+    free(st.known);
+    free(st.value);
+    return folded;
+}
+
+/* ---------- branches ---------- */
+
+static char **branchTargetSlot(instr *ins) {
+    if (ins->kind != I_OP)
+        return NULL;
+    if (ins->op == OP_B || ins->op == OP_J)
+        return &ins->opnd[0].label;
+    if (ins->op == OP_BEQ || ins->op == OP_BNE)
+        return &ins->opnd[2].label;
+    return NULL;
+}
+
+static instr *findLabel(codeFunc *func, char *name) {
+    for (instr *ins = func->code.head; ins; ins = ins->next)
+        if (ins->kind == I_LABEL && strcmp(ins->text, name) == 0)
+            return ins;
+    return NULL;
+}
+
+static instr *nextOp(instr *ins) {
+    for (ins = ins->next; ins && ins->kind != I_OP; ins = ins->next)
+        ;
+    return ins;
+}
+
+// Retargets branches that land on an unconditional jump, and drops
+// branches to the label that follows them anyway. A tail call is a jump
+// only after the epilogue finishFunction puts in front of it, so nothing
+// is threaded through one.
+static int threadJumps(codeFunc *func) {
+    int changed = 0;
+    for (instr *ins = func->code.head; ins; ) {
+        instr *next = ins->next;
+        char **target = branchTargetSlot(ins);
+        if (!target || ins->tailCall) {
+            ins = next;
+            continue;
+        }
+        for (int hop = 0; hop < MAX_THREAD_HOPS; hop++) {
+            instr *label = findLabel(func, *target);
+            instr *jump = label ? nextOp(label) : NULL;
+            if (!jump || (jump->op != OP_B && jump->op != OP_J) || jump->tailCall ||
+                strcmp(jump->opnd[0].label, *target) == 0)
+                break;
+            *target = jump->opnd[0].label;
+            changed = 1;
+        }
+
+        // Cold code moves away later, so it must keep its jump back
+        for (instr *p = next; p && p->kind != I_OP; p = p->next) {
+            if (p->kind == I_LABEL && strcmp(p->text, *target) == 0 && p->cold == ins->cold) {
+                removeInstr(&func->code, ins);
+                changed = 1;
+                break;
+            }
+        }
+        ins = next;
+    }
+    return changed;
+}
+
+// Generated labels are L<n>; function entry and exit labels always stay
+static int isLocalLabel(char *name) {
+    if (name[0] != 'L' || !name[1])
+        return 0;
+    for (char *c = name + 1; *c; c++)
+        if (!isdigit((unsigned char) *c))
+            return 0;
+    return 1;
+}
+
+static void removeUnusedLabels(codeFunc *func) {
+    for (instr *ins = func->code.head; ins; ) {
+        instr *next = ins->next;
+        if (ins->kind == I_LABEL && isLocalLabel(ins->text)) {
+            int used = 0;
+            for (instr *p = func->code.head; p && !used; p = p->next) {
+                char **target = branchTargetSlot(p);
+                used = target && strcmp(*target, ins->text) == 0;
+            }
+            if (!used)
+                removeInstr(&func->code, ins);
+        }
+        ins = next;
+    }
+}
+
+/* ---------- unreachable blocks ---------- */
+
+static void markReachable(basicBlock *block, char *reached) {
+    reached[block->id] = 1;
+    for (int s = 0; s < block->numSuccs; s++)
+        if (!reached[block->succs[s]->id])
+            markReachable(block->succs[s], reached);
+}
+
+// Removes every instruction of blocks control cannot reach, such as code
+// after a return or the arm of a constant condition; labels stay until
+// removeUnusedLabels sees nothing jumps to them
+static int removeUnreachable(codeFunc *func) {
+    cfg *graph = buildCFG(func);
+    int changed = 0;
+    if (graph->numBlocks > 0) {
+        char *reached = (char *) calloc(graph->numBlocks, 1);
+        markReachable(graph->blocks[0], reached);
+        for (int i = 0; i < graph->numBlocks; i++) {
+            basicBlock *block = graph->blocks[i];
+            if (reached[i])
+                continue;
+            instr *stop = block->last->next;
+            for (instr *ins = block->first; ins != stop; ) {
+                instr *next = ins->next;
+                if (ins->kind != I_LABEL) {
+                    removeInstr(&func->code, ins);
+                    changed = 1;
+                }
+                ins = next;
+            }
+        }
+        free(reached);
+    }
+    freeCFG(graph);
+    return changed;
+}
+
+/* ---------- dead stores and results ---------- */
+
+// Frame slots whose every access is a direct load or store: scalar locals,
+// numbered by frame object, then parameters, by word above $fp. Nothing
+// outside the function reads them once it returns.
+typedef struct slotMap {
+    codeFunc *func;
+    int numSlots;
+} slotMap;
+
+static int slotOf(slotMap *map, operand *o) {
+    codeFunc *func = map->func;
+    if (o->kind != OPD_MEM || o->imm <= 0)
+        return -1;
+    if (o->reg == REG_SP) {
+        for (int i = 0; i < func->numObjects; i++)
+            if (func->objects[i].offset == o->imm && func->objects[i].scalar)
+                return i;
+        return -1;
+    }
+    if (o->reg == REG_FP && o->imm % 4 == 0)
+        return func->numObjects + o->imm / 4;
+    return -1;
+}
+
+static int isPure(opcode op) {
+    switch (op) {
+        case OP_SW: case OP_SB: case OP_MULT:
+        case OP_BEQ: case OP_BNE: case OP_B: case OP_J: case OP_JAL: case OP_JR:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+static void transferSlots(slotMap *map, instr *ins, bitset *live) {
+    int slot;
+    if (ins->kind != I_OP)
+        return;
+    if (isStore(ins->op) && (slot = slotOf(map, &ins->opnd[1])) >= 0)
+        bitsetClear(live, slot);
+    else if (isLoad(ins->op) && (slot = slotOf(map, &ins->opnd[1])) >= 0)
+        bitsetSet(live, slot);
+    else if (ins->tailCall)
+        for (slot = map->func->numObjects + 1; slot < map->numSlots; slot++)
+            bitsetSet(live, slot);      // the callee's arguments
+}
+
+// Backward liveness over frame slots, alongside the register liveness
+static bitset **slotLiveness(cfg *graph, slotMap *map) {
+    int n = graph->numBlocks;
+    bitset **liveOut = (bitset **) malloc(n * sizeof(bitset *));
+    bitset **liveIn = (bitset **) malloc(n * sizeof(bitset *));
+    for (int i = 0; i < n; i++) {
+        liveOut[i] = bitsetNew(map->numSlots);
+        liveIn[i] = bitsetNew(map->numSlots);
+    }
+    int changed = 1;
+    bitset *tmp = bitsetNew(map->numSlots);
+    while (changed) {
+        changed = 0;
+        for (int i = n - 1; i >= 0; i--) {
+            basicBlock *block = graph->blocks[i];
+            for (int s = 0; s < block->numSuccs; s++)
+                bitsetUnion(liveOut[i], liveIn[block->succs[s]->id]);
+            bitsetCopy(tmp, liveOut[i]);
+            for (instr *ins = block->last; ins; ins = ins->prev) {
+                transferSlots(map, ins, tmp);
+                if (ins == block->first)
+                    break;
+            }
+            changed |= bitsetUnion(liveIn[i], tmp);
+        }
+    }
+    bitsetFree(tmp);
+    for (int i = 0; i < n; i++)
+        bitsetFree(liveIn[i]);
+    free(liveIn);
+    return liveOut;
+}
+
+static int removeDeadInstrs(codeFunc *func) {
+    slotMap map = {func, func->numObjects + 1};
+    for (instr *ins = func->code.head; ins; ins = ins->next)
+        for (int i = 0; i < 3; i++)
+            if (ins->kind == I_OP && ins->opnd[i].kind == OPD_MEM && ins->opnd[i].reg == REG_FP &&
+                func->numObjects + ins->opnd[i].imm / 4 >= map.numSlots)
+                map.numSlots = func->numObjects + ins->opnd[i].imm / 4 + 1;
+
+    cfg *graph = buildCFG(func);
+    computeLiveness(graph);
+    bitset **slotsOut = slotLiveness(graph, &map);
+    bitset *live = bitsetNew(graph->numVregs);
+    bitset *slots = bitsetNew(map.numSlots);
+    int changed = 0, regs[3];
+
+    for (int i = 0; i < graph->numBlocks; i++) {
+        basicBlock *block = graph->blocks[i];
+        bitsetCopy(live, block->liveOut);
+        bitsetCopy(slots, slotsOut[i]);
+        instr *ins = block->last;
+        while (ins) {
+            instr *prev = ins == block->first ? NULL : ins->prev;
+            int slot, dead = 0;
+            if (ins->kind == I_OP) {
+                if (isStore(ins->op))
+                    dead = (slot = slotOf(&map, &ins->opnd[1])) >= 0 && !bitsetTest(slots, slot);
+                else if (isPure(ins->op) && instrDefs(ins, regs) && isVirtualReg(regs[0]))
+                    dead = !bitsetTest(live, regs[0] - FIRST_VREG);
+            }
+            if (dead) {
+                removeInstr(&func->code, ins);
+                changed = 1;
+            } else {
+                transferSlots(&map, ins, slots);
+                if (instrDefs(ins, regs) && isVirtualReg(regs[0]))
+                    bitsetClear(live, regs[0] - FIRST_VREG);
+                int numUses = instrUses(ins, regs);
+                for (int u = 0; u < numUses; u++)
+                    if (isVirtualReg(regs[u]))
+                        bitsetSet(live, regs[u] - FIRST_VREG);
+            }
+            ins = prev;
+        }
+    }
+
+    for (int i = 0; i < graph->numBlocks; i++)
+        bitsetFree(slotsOut[i]);
+    free(slotsOut);
+    bitsetFree(live);
+    bitsetFree(slots);
+    freeCFG(graph);
+    return changed;
+}
+
+void eliminateDeadCode(codeFunc *func) {
+    int changed = 1;
+    for (int round = 0; changed && round < MAX_ROUNDS; round++) {
+        changed = foldConstants(func);
+        changed |= threadJumps(func);
+        changed |= removeUnreachable(func);
+        changed |= removeDeadInstrs(func);
+    }
+    removeUnusedLabels(func);
+}
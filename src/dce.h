@@ -0,0 +1,13 @@
+#ifndef DCE_H
+#define DCE_H
+
+#include "codegen.h"
+
+// Folds instructions whose operands are constants, resolves branches on
+// constant conditions, threads branches that land on unconditional jumps,
+// and removes unreachable blocks, stores to locals and parameters that are
+// never read again, results nobody uses and labels nobody jumps to.
+// Runs on virtual registers, before register allocation.
+void eliminateDeadCode(codeFunc *func);
+
+#endif
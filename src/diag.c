@@ -0,0 +1,218 @@
+#include "diag.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK (64 * 1024)
+#define FNV_OFFSET_64 14695981039346656037ULL
+#define FNV_PRIME_64 1099511628211ULL
+
+int errorLimit = DEFAULT_ERROR_LIMIT;
+
+/* ---------- arena ---------- */
+
+typedef struct arenaBlock {
+    struct arenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+} arenaBlock;
+
+static arenaBlock *arena = NULL;
+
+// Never freed one by one; everything lives until the compiler exits
+static void *arenaAlloc(size_t size) {
+    size = (size + 7) & ~(size_t) 7;
+    if (!arena || arena->used + size > arena->size) {
+        size_t blockSize = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+        arenaBlock *block = (arenaBlock *) malloc(sizeof(arenaBlock) + blockSize);
+        block->next = arena;
+        block->used = 0;
+        block->size = blockSize;
+        arena = block;
+    }
+    void *p = arena->data + arena->used;
+    arena->used += size;
+    return p;
+}
+
+static char *arenaString(const char *s) {
+    size_t len = strlen(s) + 1;
+    return (char *) memcpy(arenaAlloc(len), s, len);
+}
+
+/* ---------- hashing ---------- */
+
+static unsigned long long hashBytes(unsigned long long h, const void *bytes, size_t size) {
+    const unsigned char *b = (const unsigned char *) bytes;
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ b[i]) * FNV_PRIME_64;
+    return h;
+}
+
+// Open addressing set of nonzero keys, doubled when half full. The keys
+// are stored whole, so two that land on the same slot are told apart.
+typedef struct keySet {
+    unsigned long long *keys;
+    size_t size;
+    size_t count;
+} keySet;
+
+static size_t keySlot(keySet *set, unsigned long long key) {
+    return (size_t) (hashBytes(FNV_OFFSET_64, &key, sizeof(key)) & (set->size - 1));
+}
+
+// Adds key; returns 0 when it was already there
+static int addKey(keySet *set, unsigned long long key) {
+    if (2 * (set->count + 1) > set->size) {
+        keySet grown = {NULL, set->size ? 2 * set->size : 256, 0};
+        grown.keys = (unsigned long long *) calloc(grown.size, sizeof(unsigned long long));
+        for (size_t i = 0; i < set->size; i++)
+            if (set->keys[i])
+                addKey(&grown, set->keys[i]);
+        free(set->keys);
+        *set = grown;
+    }
+    size_t i = keySlot(set, key);
+    while (set->keys[i]) {
+        if (set->keys[i] == key)
+            return 0;
+        i = (i + 1) & (set->size - 1);
+    }
+    set->keys[i] = key;
+    set->count++;
+    return 1;
+}
+
+static int hasKey(keySet *set, unsigned long long key) {
+    if (!set->size)
+        return 0;
+    for (size_t i = keySlot(set, key); set->keys[i]; i = (i + 1) & (set->size - 1))
+        if (set->keys[i] == key)
+            return 1;
+    return 0;
+}
+
+/* ---------- messages ---------- */
+
+typedef struct diagMessage {
+    const char *text;
+    int id;                     // from 1, in the order first reported
+    unsigned long long hash;
+    struct diagMessage *next;
+} diagMessage;
+
+#define MESSAGE_BUCKETS 256
+
+static diagMessage *messages[MESSAGE_BUCKETS];
+static int numMessages = 0;
+
+static diagMessage *internMessage(const char *text) {
+    unsigned long long h = hashBytes(FNV_OFFSET_64, text, strlen(text));
+    diagMessage **bucket = &messages[h % MESSAGE_BUCKETS];
+    for (diagMessage *m = *bucket; m; m = m->next)
+        if (m->hash == h && strcmp(m->text, text) == 0)
+            return m;
+    diagMessage *m = (diagMessage *) arenaAlloc(sizeof(diagMessage));
+    m->text = arenaString(text);
+    m->id = ++numMessages;
+    m->hash = h;
+    m->next = *bucket;
+    *bucket = m;
+    return m;
+}
+
+/* ---------- reporting ---------- */
+
+typedef struct diagnostic {
+    int line;
+    int col;
+    int seq;                    // order of reporting, which breaks ties
+    diagMessage *msg;
+} diagnostic;
+
+static diagnostic **pending = NULL;
+static int numPending = 0;
+static int pendingSize = 0;
+static int numReported = 0;
+static int numKept = 0;         // counted against the limit
+static int numOverLimit = 0;
+static keySet reported;         // line and message of each error
+static keySet errorLines;
+
+// Nonzero, as keys must be: the line above the id of the message, which
+// starts at 1, or the line alone with the low bit set
+#define reportKey(line, m) ((unsigned long long) (unsigned) (line) << 32 | (unsigned) (m)->id)
+#define lineKey(line) (2 * (unsigned long long) (unsigned) (line) + 1)
+
+void reportError(int line, int col, const char *message) {
+    diagMessage *m = internMessage(message);
+    if (!addKey(&reported, reportKey(line, m)))
+        return;
+    addKey(&errorLines, lineKey(line));
+    numReported++;
+    if (errorLimit > 0 && numKept >= errorLimit) {
+        numOverLimit++;
+        return;
+    }
+    numKept++;
+    diagnostic *d = (diagnostic *) arenaAlloc(sizeof(diagnostic));
+    d->line = line;
+    d->col = col;
+    d->seq = numReported;
+    d->msg = m;
+    if (numPending == pendingSize) {
+        pendingSize = pendingSize ? 2 * pendingSize : 64;
+        pending = (diagnostic **) realloc(pending, pendingSize * sizeof(diagnostic *));
+    }
+    pending[numPending++] = d;
+}
+
+void reportSyntaxError(int line, int col, const char *message) {
+    if (!hasKey(&errorLines, lineKey(line)))
+        reportError(line, col, message);
+}
+
+int errorCount(void) {
+    return numReported;
+}
+
+/* ---------- output ---------- */
+
+static void printDiagnostic(diagnostic *d) {
+    printf("error: line %d: %s\n", d->line, d->msg->text);
+}
+
+static int compareDiagnostics(const void *a, const void *b) {
+    const diagnostic *x = *(diagnostic *const *) a, *y = *(diagnostic *const *) b;
+    if (x->line != y->line)
+        return x->line < y->line ? -1 : 1;
+    if (x->col != y->col)
+        return x->col < y->col ? -1 : 1;
+    return x->seq - y->seq;
+}
+
+void flushDiagnostics(int line) {
+    if (numPending == 0)
+        return;
+    diagnostic **ready = (diagnostic **) malloc(numPending * sizeof(diagnostic *));
+    int numReady = 0, kept = 0;
+    for (int i = 0; i < numPending; i++) {
+        if (pending[i]->line < line)
+            ready[numReady++] = pending[i];
+        else
+            pending[kept++] = pending[i];
+    }
+    numPending = kept;
+    qsort(ready, numReady, sizeof(diagnostic *), compareDiagnostics);
+    for (int i = 0; i < numReady; i++)
+        printDiagnostic(ready[i]);
+    free(ready);
+}
+
+void finishDiagnostics(void) {
+    flushDiagnostics(INT_MAX);
+    if (numOverLimit > 0)
+        printf("note: %d more error%s not shown, see --error-limit\n", numOverLimit, numOverLimit == 1 ? "" : "s");
+    numOverLimit = 0;
+}
@@ -0,0 +1,34 @@
+#ifndef DIAG_H
+#define DIAG_H
+
+#include <stdio.h>
+
+// Diagnostics. Every error message is interned once, and errors are
+// kept in an arena that grows by blocks and listed for output in a
+// growable array. An error identical to one already reported on the
+// same line is dropped, found through a hash table, and so is a syntax
+// error on a line that already has an error.
+//
+// Pending errors are printed on stdout as "error: line N: message",
+// sorted by line and column and otherwise in the order they were
+// reported. The parser prints those before the line it has reached
+// after each declaration, so output streams with the parse. Past the
+// error limit errors are only counted, and a note says how many.
+
+#define DEFAULT_ERROR_LIMIT 100
+
+// Most errors to print, 0 for all of them
+extern int errorLimit;
+
+// Column 0 when only the line is known
+void reportError(int line, int col, const char *message);
+// Dropped when the line already has an error or a syntax error
+void reportSyntaxError(int line, int col, const char *message);
+// Errors reported so far, printed or not
+int errorCount(void);
+// Prints the pending errors on lines before line
+void flushDiagnostics(int line);
+// Prints every pending error, then the note on any past the limit
+void finishDiagnostics(void);
+
+#endif
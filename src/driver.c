@@ -3,20 +3,110 @@
 #include<string.h>
 #include<../src/tree.h>
 #include<../src/strtab.h>
+#include<../src/codegen.h>
+#include<../src/callgraph.h>
+#include<../src/ipa.h>
+#include<../src/mipssim.h>
+#include<../src/interp.h>
+#include<../src/x86gen.h>
+#include<../src/mipsasm.h>
+#include<../src/profile.h>
+#include<../src/cache.h>
+#include<../src/server.h>
+#include<../src/diag.h>
 
 extern int yyparse(void);
 extern FILE* yyin;
 
 void printhelp(){
-    printf("Usage: mcc [--ast] [--sym] [-h|--help] FILE\n");
+    printf("Usage: mcc [--ast] [--sym] [-O0|-O1|-O2] [--ra-stats] [--unroll=N] [--unroll-report] [--no-inline] [--inline-report] [--callgraph] [--frame-report] [--small-data=N] [--sim] [--run] [--target=mips|x86_64] [-c] [--profile] [--profile-report=FILE] [--profile-use=FILE] [--bounds-check] [--bounds-report] [--cache=DIR] [--cache-size=N] [--cache-report] [--connect=SOCKET] [--error-limit=N] [-o OUTFILE] [-h|--help] FILE\n");
+    printf("       mcc --server=SOCKET [--workers=N]\n");
+    printf("       mcc --connect=SOCKET --server-bench=N [options] FILE\n");
     printf("\t--ast:\t\tPrint a textual representation of the constructed abstract syntax tree.\n");
     printf("\t--sym:\t\tPrint a textual representation of the constructed symbol table.\n");
+    printf("\t-O0:\t\tAssign $s0-$s7 round robin without register allocation (default).\n");
+    printf("\t-O1:\t\tAllocate registers with a linear scan allocator.\n");
+    printf("\t-O2:\t\tAllocate registers with a graph coloring allocator.\n");
+    printf("\t--ra-stats:\tPrint register allocation statistics per function.\n");
+    printf("\t--unroll=N:\tUnroll counted loops N times when optimizing (default 4 at -O2, 1 disables).\n");
+    printf("\t--unroll-report:\tReport which loops were unrolled and why others were not.\n");
+    printf("\t--no-inline:\tKeep every call as a call when optimizing.\n");
+    printf("\t--inline-report:\tReport which functions were inlined and why others were not.\n");
+    printf("\t--callgraph:\tPrint the call graph and the globals no reachable function uses.\n");
+    printf("\t--frame-report:\tReport the frame size of each function and what slot sharing saved.\n");
+    printf("\t--small-data=N:\tAddress globals of at most N bytes from $gp (default 8 when optimizing, 0 disables).\n");
+    printf("\t--sim:\t\tRun the generated assembly in the built-in MIPS simulator and report instruction\n");
+    printf("\t\t\tcounts and a pipeline cycle estimate on stderr. FILE may also be a .asm file to run.\n");
+    printf("\t--run:\t\tRun the program in the bytecode interpreter instead of generating assembly.\n");
+    printf("\t--target=T:\tGenerate MIPS (default) or x86-64 assembly. The x86-64 code follows the\n");
+    printf("\t\t\tSystem V ABI, is not optimized, and links with cc into a native program.\n");
+    printf("\t-c:\t\tAssemble the MIPS code into a relocatable ELF32 object instead of writing text.\n");
+    printf("\t--profile:\tCount function calls, if outcomes and loop iterations. The program prints\n");
+    printf("\t\t\tthe counts after its own output once main returns.\n");
+    printf("\t--profile-report=FILE:\tMap the counts a profiled run printed to FILE back to source lines.\n");
+    printf("\t--profile-use=FILE:\tAt -O1 and -O2, optimize with the counts a profiled run printed to FILE:\n");
+    printf("\t\t\thot functions first and inlined more, hot arms falling through, hot code\n");
+    printf("\t\t\tfirst for registers. Counts of functions changed since are ignored.\n");
+    printf("\t--bounds-check:\tStop with an error when an array index is out of bounds. At -O1 and -O2\n");
+    printf("\t\t\tchecks the loop and if conditions already guarantee are left out.\n");
+    printf("\t--bounds-report:\tReport which array accesses are checked on stderr.\n");
+    printf("\t--cache=DIR:\tKeep the generated code of each function in DIR and reuse it while the\n");
+    printf("\t\t\tfunction, what it calls and the options stay the same. Profiles and reports\n");
+    printf("\t\t\tgenerate everything again.\n");
+    printf("\t--cache-size=N:\tRemove the least recently used code once DIR holds more than N megabytes\n");
+    printf("\t\t\t(default 64).\n");
+    printf("\t--cache-report:\tReport how many functions were reused and the time it saved on stderr.\n");
+    printf("\t--error-limit=N:\tPrint at most N errors (default 100, 0 for all) and count the rest.\n");
+    printf("\t--server=SOCKET:\tServe compile requests on the Unix domain socket SOCKET until interrupted.\n");
+    printf("\t\t\tEach request runs in a process of its own, forked from a warm server.\n");
+    printf("\t--workers=N:\tCompile up to N requests at once (default one per processor).\n");
+    printf("\t--connect=SOCKET:\tHave the server on SOCKET compile FILE, or the source on stdin when\n");
+    printf("\t\t\tFILE is -, and write its output here. Compiles locally when none answers.\n");
+    printf("\t--server-bench=N:\tTime N compiles as new processes and N through the server.\n");
+    printf("\t-o OUTFILE:\tWrite the output to OUTFILE (default out.asm, out.s for x86-64, out.o with -c).\n");
     printf("\t-h,--help:\tPrint this help information and exit.\n\n");
 }
 
-int main(int argc, char *argv[]) {
+// Program output goes to stdout, the statistics to stderr
+int runSimulator(char *path){
+    simStats stats;
+    int status = simulateFile(path, stdout, &stats);
+    printf("\n");
+    printSimStats(stderr, &stats);
+    return status == 0 ? 0 : 1;
+}
+
+// Output file when the command line names none
+static char *defaultOutput(int object, int x86){
+    return object ? "out.o" : x86 ? "out.s" : "out.asm";
+}
+
+// The output file a command line writes, found without reading the rest
+static char *outputName(int argc, char *argv[]){
+    char *outname = NULL;
+    int object = 0, x86 = 0;
+    for(int i=1; i < argc - 1; i++){
+        if(strcmp(argv[i],"-o")==0 && i + 1 < argc - 1)
+            outname = argv[++i];
+        else if(strcmp(argv[i],"-c")==0)
+            object = 1;
+        else if(strcmp(argv[i],"--target=mips")==0 || strcmp(argv[i],"--target=x86_64")==0)
+            x86 = strcmp(argv[i] + 9, "x86_64") == 0;
+    }
+    return outname ? outname : defaultOutput(object, x86);
+}
+
+static int compile(int argc, char *argv[]) {
     int p_ast = 0;
     int p_symtab = 0;
+    int p_callgraph = 0;
+    int p_sim = 0;
+    int p_run = 0;
+    int p_x86 = 0;
+    int p_object = 0;
+    int p_cachereport = 0;
+    char *profileReport = NULL;
+    char *outname = NULL;
 
     // Skip first arg (program name), then check all but last for options.
     for(int i=1; i < argc - 1; i++){
@@ -30,6 +120,75 @@ int main(int argc, char *argv[]) {
         else if(strcmp(argv[i],"--sym")==0){
             p_symtab = 1;
         }
+        else if(strcmp(argv[i],"-O0")==0 || strcmp(argv[i],"-O1")==0 || strcmp(argv[i],"-O2")==0){
+            cgOpts.optLevel = argv[i][2] - '0';
+        }
+        else if(strcmp(argv[i],"--ra-stats")==0){
+            cgOpts.raStats = 1;
+        }
+        else if(strncmp(argv[i],"--unroll=",9)==0 && atoi(argv[i] + 9) > 0){
+            cgOpts.unrollFactor = atoi(argv[i] + 9);
+        }
+        else if(strcmp(argv[i],"--unroll-report")==0){
+            cgOpts.unrollReport = 1;
+        }
+        else if(strcmp(argv[i],"--no-inline")==0){
+            cgOpts.noInline = 1;
+        }
+        else if(strcmp(argv[i],"--inline-report")==0){
+            cgOpts.inlineReport = 1;
+        }
+        else if(strcmp(argv[i],"--callgraph")==0){
+            p_callgraph = 1;
+        }
+        else if(strcmp(argv[i],"--frame-report")==0){
+            cgOpts.frameReport = 1;
+        }
+        else if(strcmp(argv[i],"--sim")==0){
+            p_sim = 1;
+        }
+        else if(strcmp(argv[i],"--run")==0){
+            p_run = 1;
+        }
+        else if(strcmp(argv[i],"--target=mips")==0 || strcmp(argv[i],"--target=x86_64")==0){
+            p_x86 = strcmp(argv[i] + 9, "x86_64") == 0;
+        }
+        else if(strncmp(argv[i],"--small-data=",13)==0 && atoi(argv[i] + 13) >= 0){
+            cgOpts.smallDataLimit = atoi(argv[i] + 13);
+        }
+        else if(strcmp(argv[i],"-c")==0){
+            p_object = 1;
+        }
+        else if(strcmp(argv[i],"--profile")==0){
+            cgOpts.profile = 1;
+        }
+        else if(strncmp(argv[i],"--profile-report=",17)==0 && argv[i][17]){
+            profileReport = argv[i] + 17;
+        }
+        else if(strncmp(argv[i],"--profile-use=",14)==0 && argv[i][14]){
+            cgOpts.profileUse = argv[i] + 14;
+        }
+        else if(strcmp(argv[i],"--bounds-check")==0){
+            cgOpts.boundsCheck = 1;
+        }
+        else if(strcmp(argv[i],"--bounds-report")==0){
+            cgOpts.boundsReport = 1;
+        }
+        else if(strncmp(argv[i],"--cache=",8)==0 && argv[i][8]){
+            cgOpts.cacheDir = argv[i] + 8;
+        }
+        else if(strncmp(argv[i],"--cache-size=",13)==0 && atoi(argv[i] + 13) > 0){
+            cgOpts.cacheLimit = (long long) atoi(argv[i] + 13) << 20;
+        }
+        else if(strcmp(argv[i],"--cache-report")==0){
+            p_cachereport = 1;
+        }
+        else if(strncmp(argv[i],"--error-limit=",14)==0 && atoi(argv[i] + 14) >= 0){
+            errorLimit = atoi(argv[i] + 14);
+        }
+        else if(strcmp(argv[i],"-o")==0 && i + 1 < argc - 1){
+            outname = argv[++i];
+        }
         else{
             printhelp();
             return 0;
@@ -37,18 +196,125 @@ int main(int argc, char *argv[]) {
 
     }
 
+    if(!outname)
+        outname = defaultOutput(p_object, p_x86);
+    if(p_x86 && (p_sim || p_object)){
+        printf("error: --sim and -c take MIPS code only\n");
+        return -1;
+    }
+    if(cgOpts.profile && (p_x86 || p_run)){
+        printf("error: --profile instruments MIPS code only\n");
+        return -1;
+    }
+    if(cgOpts.profileUse && (p_x86 || p_run)){
+        printf("error: --profile-use optimizes MIPS code only\n");
+        return -1;
+    }
+    if(cgOpts.boundsCheck && (p_x86 || p_run)){
+        printf("error: --bounds-check checks MIPS code only\n");
+        return -1;
+    }
+    if(cgOpts.cacheDir && (p_x86 || p_run)){
+        printf("error: --cache keeps MIPS code only\n");
+        return -1;
+    }
+    if(p_object && p_sim){
+        printf("error: --sim runs assembly text, not objects\n");
+        return -1;
+    }
+
+    char *source = argv[argc - 1];
+    size_t len = strlen(source);
+    if(p_sim && len > 4 && strcmp(source + len - 4, ".asm") == 0)
+        return runSimulator(source);
+
     yyin = fopen(argv[argc - 1],"r");
     if(!yyin){
         printf("error: unable to read source file %s\n",argv[argc-1]);
         return -1;
     }
 
-    if (!yyparse()){
+    int parsed = yyparse() == 0;
+    finishDiagnostics();
+    if (parsed){
         printf("Compilation finished.\n\n");
         if(p_ast)
             printAst(ast, 1);
         if(p_symtab)
             print_sym_tab();
+        if(p_callgraph && errorCount() == 0){
+            callGraph *graph = buildCallGraph(ast);
+            analyzeCalls(graph, cgOpts.profile);
+            printCallGraph(stdout, graph);
+            freeCallGraph(graph);
+        }
+        if(errorCount() == 0 && profileReport)
+            return printProfileReport(ast, profileReport, stdout) == 0 ? 0 : 1;
+        if(errorCount() == 0 && p_run){
+            // Same output as running the generated code with --sim
+            int status = runProgram(ast, source, stdout);
+            printf("\n");
+            return status == 0 ? 0 : 1;
+        }
+        if(errorCount() == 0){
+            FILE *out = fopen(outname,"w");
+            if(!out){
+                printf("error: unable to write output file %s\n",outname);
+                return -1;
+            }
+            if(p_x86){
+                generateX86(ast, out);
+                fclose(out);
+                return 0;
+            }
+            generateCode(ast);
+            if(p_cachereport)
+                printCacheReport(stderr);
+            if(p_object){
+                int status = writeObject(out);
+                fclose(out);
+                return status == 0 ? 0 : 1;
+            }
+            writeCode(out);
+            fclose(out);
+            if(p_sim)
+                return runSimulator(outname);
+        }
     }
     return 0;
 }
+
+int main(int argc, char *argv[]) {
+    char *serverSocket = NULL;
+    char *clientSocket = NULL;
+    int workers = 0;
+    int benchRuns = 0;
+
+    // The server options come out before the compile options are read
+    int n = 1;
+    for(int i=1; i < argc; i++){
+        if(strncmp(argv[i],"--server=",9)==0 && argv[i][9])
+            serverSocket = argv[i] + 9;
+        else if(strncmp(argv[i],"--workers=",10)==0 && atoi(argv[i] + 10) > 0)
+            workers = atoi(argv[i] + 10);
+        else if(strncmp(argv[i],"--connect=",10)==0 && argv[i][10])
+            clientSocket = argv[i] + 10;
+        else if(strncmp(argv[i],"--server-bench=",15)==0 && atoi(argv[i] + 15) > 0)
+            benchRuns = atoi(argv[i] + 15);
+        else
+            argv[n++] = argv[i];
+    }
+    argc = n;
+
+    if(serverSocket)
+        return runServer(serverSocket, workers, compile);
+    if(clientSocket && argc > 1){
+        if(benchRuns)
+            return benchServer(clientSocket, benchRuns, argc, argv, outputName(argc, argv));
+        int fd = connectServer(clientSocket);
+        if(fd >= 0)
+            return runClient(fd, argc, argv, outputName(argc, argv), 0);
+        fprintf(stderr, "warning: no compile server on %s, compiling here\n", clientSocket);
+    }
+    return compile(argc, argv);
+}
@@ -0,0 +1,394 @@
+#include "frame.h"
+#include "cfg.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_ARRAY -1
+#define MANY_ARRAYS -2          // derived from more than one array
+
+typedef struct frameState {
+    codeFunc *func;
+    int numObjects;
+    int numInstrs;
+    instr **code;               // instructions in layout order
+    char *interferes;           // numObjects x numObjects
+    int *from;                  // per vreg: the array whose address it holds
+    int *slotFrom;              // per object: the array whose address a scalar slot holds
+    int *lo, *hi;               // instructions between which an array is in use, lo > hi if never
+} frameState;
+
+// Object covering $sp + offset, or -1
+static int objectAt(codeFunc *func, int offset) {
+    for (int i = 0; i < func->numObjects; i++)
+        if (offset >= func->objects[i].offset && offset < func->objects[i].offset + func->objects[i].size)
+            return i;
+    return -1;
+}
+
+// Scalar object a load or store reads or writes, or -1
+static int scalarAccess(codeFunc *func, instr *ins) {
+    if (ins->kind != I_OP || (!isLoad(ins->op) && !isStore(ins->op)))
+        return -1;
+    operand *o = &ins->opnd[1];
+    if (o->kind != OPD_MEM || o->reg != REG_SP)
+        return -1;
+    int obj = objectAt(func, o->imm);
+    return obj >= 0 && func->objects[obj].scalar ? obj : -1;
+}
+
+// Array object an addi takes the address of, or -1
+static int addressTaken(codeFunc *func, instr *ins) {
+    if (ins->kind != I_OP || ins->op != OP_ADDI || ins->opnd[0].reg == REG_SP ||
+        ins->opnd[1].reg != REG_SP || ins->opnd[2].kind != OPD_IMM)
+        return -1;
+    int obj = objectAt(func, ins->opnd[2].imm);
+    return obj >= 0 && !func->objects[obj].scalar ? obj : -1;
+}
+
+static void interfere(frameState *st, int a, int b) {
+    if (a == b)
+        return;
+    st->interferes[a * st->numObjects + b] = 1;
+    st->interferes[b * st->numObjects + a] = 1;
+}
+
+static int merge(int a, int b) {
+    if (a == NO_ARRAY || a == b)
+        return b;
+    if (b == NO_ARRAY)
+        return a;
+    return MANY_ARRAYS;
+}
+
+/* ---------- arrays ---------- */
+
+static int derivedFrom(frameState *st, int reg) {
+    return isVirtualReg(reg) ? st->from[reg - FIRST_VREG] : NO_ARRAY;
+}
+
+// Follows array addresses through arithmetic on them and through the
+// scalar slots an inlined call keeps an array argument in
+static void traceAddresses(frameState *st) {
+    codeFunc *func = st->func;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int k = 0; k < st->numInstrs; k++) {
+            instr *ins = st->code[k];
+            int regs[3], src = NO_ARRAY, obj;
+            if (ins->kind != I_OP)
+                continue;
+            if ((obj = addressTaken(func, ins)) >= 0) {
+                src = obj;
+            } else if (isLoad(ins->op) && (obj = scalarAccess(func, ins)) >= 0) {
+                src = st->slotFrom[obj];
+            } else if (isStore(ins->op) && (obj = scalarAccess(func, ins)) >= 0) {
+                int stored = merge(st->slotFrom[obj], derivedFrom(st, ins->opnd[0].reg));
+                changed |= stored != st->slotFrom[obj];
+                st->slotFrom[obj] = stored;
+                continue;
+            } else if (ins->op == OP_ADD || ins->op == OP_ADDI || ins->op == OP_SUB ||
+                       ins->op == OP_SUBI || ins->op == OP_MOVE) {
+                int numUses = instrUses(ins, regs);
+                for (int u = 0; u < numUses; u++)
+                    src = merge(src, derivedFrom(st, regs[u]));
+            }
+            if (src == NO_ARRAY || !instrDefs(ins, regs) || !isVirtualReg(regs[0]))
+                continue;
+            int *dst = &st->from[regs[0] - FIRST_VREG];
+            if (merge(*dst, src) != *dst) {
+                *dst = merge(*dst, src);
+                changed = 1;
+            }
+        }
+    }
+}
+
+static void extendRange(frameState *st, int array, int from, int to) {
+    if (array == NO_ARRAY)
+        return;
+    for (int i = 0; i < st->numObjects; i++) {
+        if (st->func->objects[i].scalar || (array != MANY_ARRAYS && array != i))
+            continue;
+        if (from < st->lo[i])
+            st->lo[i] = from;
+        if (to > st->hi[i])
+            st->hi[i] = to;
+    }
+}
+
+static char *branchTarget(instr *ins) {
+    if (ins->op == OP_B || ins->op == OP_J)
+        return ins->opnd[0].label;
+    if (ins->op == OP_BEQ || ins->op == OP_BNE)
+        return ins->opnd[2].label;
+    return NULL;
+}
+
+// An array is in use from the first instruction touching its address to
+// the last, up to the next call when the address is passed as an
+// argument, and through every loop that touches it anywhere
+static void findArrayRanges(frameState *st) {
+    codeFunc *func = st->func;
+    for (int k = 0; k < st->numInstrs; k++) {
+        instr *ins = st->code[k];
+        int regs[3], obj;
+        if (ins->kind != I_OP)
+            continue;
+        for (int i = 0; i < 3; i++)
+            if (ins->opnd[i].kind == OPD_MEM && ins->opnd[i].reg == REG_SP &&
+                (obj = objectAt(func, ins->opnd[i].imm)) >= 0 && !func->objects[obj].scalar)
+                extendRange(st, obj, k, k);
+        extendRange(st, addressTaken(func, ins), k, k);
+        if ((obj = scalarAccess(func, ins)) >= 0)
+            extendRange(st, st->slotFrom[obj], k, k);
+        int numUses = instrUses(ins, regs);
+        for (int u = 0; u < numUses; u++)
+            extendRange(st, derivedFrom(st, regs[u]), k, k);
+        if (instrDefs(ins, regs))
+            extendRange(st, derivedFrom(st, regs[0]), k, k);
+
+        // An address stored anywhere but a slot of our own is an argument
+        if (isStore(ins->op) && scalarAccess(func, ins) < 0 && derivedFrom(st, ins->opnd[0].reg) != NO_ARRAY) {
+            int call = k;
+            while (call < st->numInstrs - 1 && !(st->code[call]->kind == I_OP && st->code[call]->op == OP_JAL))
+                call++;
+            extendRange(st, derivedFrom(st, ins->opnd[0].reg), k, call);
+        }
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int k = 0; k < st->numInstrs; k++) {
+            char *target;
+            if (!isBranch(st->code[k]) || !(target = branchTarget(st->code[k])))
+                continue;
+            int header = k;
+            while (header >= 0 && !(st->code[header]->kind == I_LABEL && strcmp(st->code[header]->text, target) == 0))
+                header--;
+            if (header < 0)
+                continue;
+            for (int i = 0; i < st->numObjects; i++) {
+                if (st->lo[i] > st->hi[i] || st->lo[i] > k || st->hi[i] < header)
+                    continue;
+                if (st->lo[i] > header || st->hi[i] < k) {
+                    st->lo[i] = st->lo[i] < header ? st->lo[i] : header;
+                    st->hi[i] = st->hi[i] > k ? st->hi[i] : k;
+                    changed = 1;
+                }
+            }
+        }
+    }
+}
+
+/* ---------- interference ---------- */
+
+static void transferScalars(codeFunc *func, instr *ins, bitset *live) {
+    int obj = scalarAccess(func, ins);
+    if (obj < 0)
+        return;
+    if (isStore(ins->op))
+        bitsetClear(live, obj);
+    else
+        bitsetSet(live, obj);
+}
+
+// Arrays in use at instruction k conflict with every scalar live there
+static void occupy(frameState *st, int k, bitset *live) {
+    for (int a = 0; a < st->numObjects; a++) {
+        if (st->lo[a] > k || st->hi[a] < k)
+            continue;
+        for (int s = 0; s < st->numObjects; s++)
+            if (bitsetTest(live, s))
+                interfere(st, a, s);
+    }
+}
+
+// Backward liveness over the scalar slots. A store conflicts with every
+// other scalar live past it.
+static void findInterference(frameState *st) {
+    codeFunc *func = st->func;
+    cfg *graph = buildCFG(func);
+    int n = graph->numBlocks;
+    bitset **liveIn = (bitset **) malloc(n * sizeof(bitset *));
+    bitset **liveOut = (bitset **) malloc(n * sizeof(bitset *));
+    for (int i = 0; i < n; i++) {
+        liveIn[i] = bitsetNew(st->numObjects);
+        liveOut[i] = bitsetNew(st->numObjects);
+    }
+    bitset *live = bitsetNew(st->numObjects);
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = n - 1; i >= 0; i--) {
+            basicBlock *block = graph->blocks[i];
+            for (int s = 0; s < block->numSuccs; s++)
+                bitsetUnion(liveOut[i], liveIn[block->succs[s]->id]);
+            bitsetCopy(live, liveOut[i]);
+            for (instr *ins = block->last; ins; ins = ins->prev) {
+                transferScalars(func, ins, live);
+                if (ins == block->first)
+                    break;
+            }
+            changed |= bitsetUnion(liveIn[i], live);
+        }
+    }
+
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+        basicBlock *block = graph->blocks[i];
+        while (k < st->numInstrs && st->code[k] != block->first)
+            k++;
+        int last = k;
+        while (last < st->numInstrs - 1 && st->code[last] != block->last)
+            last++;
+        bitsetCopy(live, liveOut[i]);
+        for (int j = last; j >= k; j--) {
+            instr *ins = st->code[j];
+            int obj = scalarAccess(func, ins);
+            occupy(st, j, live);
+            if (obj >= 0 && isStore(ins->op)) {
+                for (int s = 0; s < st->numObjects; s++)
+                    if (bitsetTest(live, s))
+                        interfere(st, obj, s);
+                bitsetSet(live, obj);
+                occupy(st, j, live);
+            }
+            transferScalars(func, ins, live);
+            occupy(st, j, live);
+        }
+    }
+
+    // Arrays in use at the same time
+    for (int a = 0; a < st->numObjects; a++)
+        for (int b = a + 1; b < st->numObjects; b++)
+            if (st->lo[a] <= st->hi[a] && st->lo[b] <= st->hi[b] &&
+                st->lo[a] <= st->hi[b] && st->lo[b] <= st->hi[a])
+                interfere(st, a, b);
+
+    for (int i = 0; i < n; i++) {
+        bitsetFree(liveIn[i]);
+        bitsetFree(liveOut[i]);
+    }
+    free(liveIn);
+    free(liveOut);
+    bitsetFree(live);
+    freeCFG(graph);
+}
+
+/* ---------- placement ---------- */
+
+static int alignUp(int offset, int align) {
+    return (offset + align - 1) / align * align;
+}
+
+// Largest alignment first, then largest size, each object at the lowest
+// offset clear of the objects it conflicts with. Returns the end of the area.
+static int placeObjects(frameState *st, int *offset) {
+    frameObject *objects = st->func->objects;
+    int n = st->numObjects, end = 4;
+    int *order = (int *) malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        int j = i;
+        while (j > 0 && (objects[order[j - 1]].align < objects[i].align ||
+                         (objects[order[j - 1]].align == objects[i].align &&
+                          objects[order[j - 1]].size < objects[i].size))) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+    for (int i = 0; i < n; i++) {
+        int obj = order[i];
+        int at = alignUp(4, objects[obj].align);
+        for (int j = 0; j < i; j++) {
+            int other = order[j];
+            if (st->interferes[obj * n + other] && at < offset[other] + objects[other].size &&
+                offset[other] < at + objects[obj].size) {
+                at = alignUp(offset[other] + objects[other].size, objects[obj].align);
+                j = -1;         // check the new position against everything again
+            }
+        }
+        offset[obj] = at;
+        if (at + objects[obj].size > end)
+            end = at + objects[obj].size;
+    }
+    free(order);
+    return end;
+}
+
+static void relocate(codeFunc *func, operand *o, int *offset) {
+    int obj = objectAt(func, o->imm);
+    if (obj >= 0)
+        o->imm += offset[obj] - func->objects[obj].offset;
+}
+
+void layoutFrame(codeFunc *func) {
+    frameState st;
+    st.func = func;
+    st.numObjects = func->numObjects;
+    if (st.numObjects < 2)
+        return;
+    st.numInstrs = 0;
+    for (instr *ins = func->code.head; ins; ins = ins->next)
+        st.numInstrs++;
+    st.code = (instr **) malloc(st.numInstrs * sizeof(instr *));
+    int k = 0;
+    for (instr *ins = func->code.head; ins; ins = ins->next)
+        st.code[k++] = ins;
+    st.interferes = (char *) calloc(st.numObjects * st.numObjects, 1);
+    st.from = (int *) malloc(func->numVregs * sizeof(int));
+    for (int i = 0; i < func->numVregs; i++)
+        st.from[i] = NO_ARRAY;
+    st.slotFrom = (int *) malloc(st.numObjects * sizeof(int));
+    st.lo = (int *) malloc(st.numObjects * sizeof(int));
+    st.hi = (int *) malloc(st.numObjects * sizeof(int));
+    for (int i = 0; i < st.numObjects; i++) {
+        st.slotFrom[i] = NO_ARRAY;
+        st.lo[i] = st.numInstrs;
+        st.hi[i] = -1;
+    }
+
+    traceAddresses(&st);
+    findArrayRanges(&st);
+    findInterference(&st);
+
+    int *offset = (int *) malloc(st.numObjects * sizeof(int));
+    int end = placeObjects(&st, offset);
+    for (k = 0; k < st.numInstrs; k++) {
+        instr *ins = st.code[k];
+        if (ins->kind != I_OP)
+            continue;
+        for (int i = 0; i < 3; i++)
+            if (ins->opnd[i].kind == OPD_MEM && ins->opnd[i].reg == REG_SP)
+                relocate(func, &ins->opnd[i], offset);
+        if (ins->op == OP_ADDI && ins->opnd[0].reg != REG_SP && ins->opnd[1].reg == REG_SP &&
+            ins->opnd[2].kind == OPD_IMM)
+            relocate(func, &ins->opnd[2], offset);
+    }
+    for (int i = 0; i < st.numObjects; i++)
+        func->objects[i].offset = offset[i];
+
+    func->numLocalWords = (end - 1) / 4;
+
+    free(offset);
+    free(st.code);
+    free(st.interferes);
+    free(st.from);
+    free(st.slotFrom);
+    free(st.lo);
+    free(st.hi);
+}
+
+void reportFrame(codeFunc *func) {
+    int saved = 0;
+    for (int r = REG_S0; r <= REG_S7; r++)
+        saved += (func->savedRegs >> r) & 1;
+    int locals = 4 * func->numLocalWords;
+    int spills = 4 * func->numSpillSlots;
+    fprintf(stderr, "frame: %s: %d object%s, locals %d bytes (%d before sharing), %d bytes of spills, "
+            "%d callee-saved, %d bytes in all\n",
+            func->name, func->numObjects, func->numObjects == 1 ? "" : "s", locals, func->declaredBytes, spills, saved,
+            4 + 4 * saved + locals + spills);
+}
@@ -0,0 +1,16 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "codegen.h"
+
+// Lays out the local area of a frame again so that locals whose contents
+// are never needed at the same time share storage: scalars by liveness of
+// their slots, arrays by the stretch of code that touches them. Rewrites
+// the $sp offsets in the body and shrinks numLocalWords. Runs on virtual
+// registers, before register allocation adds the spill slots.
+void layoutFrame(codeFunc *func);
+
+// Prints the frame size of a finished function on stderr
+void reportFrame(codeFunc *func);
+
+#endif
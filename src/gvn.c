@@ -0,0 +1,352 @@
+#include "gvn.h"
+#include "cfg.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_BUCKETS 256
+
+// An operation and its source operands; loads are keyed by their location
+typedef struct valueKey {
+    opcode op;
+    operand a;
+    operand b;
+} valueKey;
+
+typedef struct valueEntry {
+    valueKey key;
+    int value;                  // register holding the value
+    int valid;                  // cleared when a store or call may change a load
+    int next;                   // next entry in the same bucket, -1 at the end
+} valueEntry;
+
+// Hash table scoped along the dominator tree: entries are only appended
+// and invalidated, so leaving a block undoes its work by truncating the
+// entry array and revalidating what it killed
+typedef struct valueTable {
+    valueEntry *entries;
+    int numEntries;
+    int capEntries;
+    int *kills;
+    int numKills;
+    int capKills;
+    int buckets[NUM_BUCKETS];
+} valueTable;
+
+typedef struct gvnState {
+    codeFunc *func;
+    cfg *graph;
+    valueTable table;
+    int *numDefs;
+    int *replace;               // vreg index -> register to use instead, 0 if none
+    instr **dead;
+    int numDead;
+    int capDead;
+    basicBlock ***children;     // dominator tree
+    int *numChildren;
+} gvnState;
+
+static unsigned hashOperand(operand *o) {
+    unsigned h = o->kind * 7919u + o->reg * 31u + (unsigned) o->imm;
+    if (o->kind == OPD_LABEL)
+        for (char *c = o->label; *c; c++)
+            h = h * 31u + (unsigned char) *c;
+    return h;
+}
+
+static unsigned hashKey(valueKey *key) {
+    return (key->op * 131u + hashOperand(&key->a) * 17u + hashOperand(&key->b)) % NUM_BUCKETS;
+}
+
+static int sameOperand(operand *a, operand *b) {
+    if (a->kind != b->kind)
+        return 0;
+    switch (a->kind) {
+        case OPD_REG:   return a->reg == b->reg;
+        case OPD_IMM:   return a->imm == b->imm;
+        case OPD_MEM:   return a->reg == b->reg && a->imm == b->imm;
+        case OPD_LABEL: return strcmp(a->label, b->label) == 0;
+        default:        return 1;
+    }
+}
+
+static int lookupValue(valueTable *t, valueKey *key) {
+    for (int i = t->buckets[hashKey(key)]; i >= 0; i = t->entries[i].next) {
+        valueEntry *e = &t->entries[i];
+        if (e->valid && e->key.op == key->op && sameOperand(&e->key.a, &key->a) && sameOperand(&e->key.b, &key->b))
+            return e->value;
+    }
+    return 0;
+}
+
+static void addValue(valueTable *t, valueKey *key, int value) {
+    if (t->numEntries == t->capEntries) {
+        t->capEntries = t->capEntries ? 2 * t->capEntries : 64;
+        t->entries = (valueEntry *) realloc(t->entries, t->capEntries * sizeof(valueEntry));
+    }
+    unsigned h = hashKey(key);
+    valueEntry *e = &t->entries[t->numEntries];
+    e->key = *key;
+    e->value = value;
+    e->valid = 1;
+    e->next = t->buckets[h];
+    t->buckets[h] = t->numEntries++;
+}
+
+static void killEntry(valueTable *t, int i) {
+    if (t->numKills == t->capKills) {
+        t->capKills = t->capKills ? 2 * t->capKills : 64;
+        t->kills = (int *) realloc(t->kills, t->capKills * sizeof(int));
+    }
+    t->entries[i].valid = 0;
+    t->kills[t->numKills++] = i;
+}
+
+static void restoreTable(valueTable *t, int numEntries, int numKills) {
+    while (t->numKills > numKills)
+        t->entries[t->kills[--t->numKills]].valid = 1;
+    while (t->numEntries > numEntries) {
+        valueEntry *e = &t->entries[--t->numEntries];
+        t->buckets[hashKey(&e->key)] = e->next;
+    }
+}
+
+/* ---------- memory ---------- */
+
+// Scalar variables are named by a global symbol or a $gp/$sp/$fp offset; array
+// elements are reached through computed addresses, and mC cannot take the
+// address of a scalar, so the two never alias.
+static int isArrayLocation(operand *o) {
+    return o->kind == OPD_MEM && o->reg != REG_GP && o->reg != REG_SP && o->reg != REG_FP;
+}
+
+// A value one instruction can recreate
+static int isCheap(valueKey *key) {
+    return key->op == OP_LI || key->op == OP_LA || isLoad(key->op) ||
+           (key->op == OP_ADDI && (key->a.reg == REG_SP || key->a.reg == REG_GP));
+}
+
+// Invalidates the loads a store to loc may change
+static void killStore(valueTable *t, operand *loc) {
+    for (int i = 0; i < t->numEntries; i++) {
+        valueEntry *e = &t->entries[i];
+        if (!e->valid || !isLoad(e->key.op))
+            continue;
+        if (isArrayLocation(loc) ? isArrayLocation(&e->key.a) : sameOperand(loc, &e->key.a))
+            killEntry(t, i);
+    }
+}
+
+// A callee can write globals and arrays but never this function's frame.
+// Outside loops cheap values are dropped as well: keeping one across the
+// call would take a callee-saved register, whose save and restore cost
+// more than recomputing it once.
+static void killCall(valueTable *t, int inLoop, int pure) {
+    for (int i = 0; i < t->numEntries; i++) {
+        valueEntry *e = &t->entries[i];
+        if (!e->valid)
+            continue;
+        if ((!pure && isLoad(e->key.op) && (isGlobalLocation(&e->key.a) || isArrayLocation(&e->key.a))) ||
+            (!inLoop && isCheap(&e->key)))
+            killEntry(t, i);
+    }
+}
+
+static void killMemoryEffects(valueTable *t, basicBlock *block, instr *ins) {
+    if (ins->kind != I_OP)
+        return;
+    if (isStore(ins->op))
+        killStore(t, &ins->opnd[1]);
+    else if (ins->op == OP_JAL)
+        killCall(t, block->loopDepth > 0, ins->pureCall);
+}
+
+// Applies the stores and calls of every block that can run between b's
+// immediate dominator and b, such as the arms of an if or a loop body
+static void killRegion(gvnState *st, basicBlock *b) {
+    char *visited = (char *) calloc(st->graph->numBlocks, 1);
+    basicBlock **stack = (basicBlock **) malloc(st->graph->numBlocks * sizeof(basicBlock *));
+    int top = 0;
+    for (int p = 0; p < b->numPreds; p++) {
+        basicBlock *pred = b->preds[p];
+        if (pred != b->idom && !visited[pred->id]) {
+            visited[pred->id] = 1;
+            stack[top++] = pred;
+        }
+    }
+    while (top > 0) {
+        basicBlock *block = stack[--top];
+        for (instr *ins = block->first; ins; ins = ins->next) {
+            killMemoryEffects(&st->table, block, ins);
+            if (ins == block->last)
+                break;
+        }
+        for (int p = 0; p < block->numPreds; p++) {
+            basicBlock *pred = block->preds[p];
+            if (pred != b->idom && !visited[pred->id]) {
+                visited[pred->id] = 1;
+                stack[top++] = pred;
+            }
+        }
+    }
+    free(stack);
+    free(visited);
+}
+
+/* ---------- numbering ---------- */
+
+static int resolve(gvnState *st, int reg) {
+    while (isVirtualReg(reg) && st->replace[reg - FIRST_VREG])
+        reg = st->replace[reg - FIRST_VREG];
+    return reg;
+}
+
+static void rewriteUses(gvnState *st, instr *ins) {
+    if (ins->kind != I_OP)
+        return;
+    for (int i = 0; i < 3; i++) {
+        operand *o = &ins->opnd[i];
+        if ((o->kind == OPD_REG && !(i == 0 && opDefinesFirst(ins->op))) || o->kind == OPD_MEM)
+            o->reg = resolve(st, o->reg);
+    }
+}
+
+// A register whose value cannot change once set
+static int isValueReg(gvnState *st, int reg) {
+    if (reg == REG_ZERO || reg == REG_GP || reg == REG_SP || reg == REG_FP)
+        return 1;
+    return isVirtualReg(reg) && st->numDefs[reg - FIRST_VREG] == 1;
+}
+
+static int isNumbered(opcode op) {
+    switch (op) {
+        case OP_ADD: case OP_ADDI: case OP_SUB: case OP_SUBI: case OP_MUL: case OP_DIV:
+        case OP_SLL: case OP_SRA: case OP_SRL:
+        case OP_SLT: case OP_SLTI: case OP_SLTU: case OP_SLTIU: case OP_XORI:
+        case OP_LI: case OP_LA: case OP_LW: case OP_LB:
+            return 1;
+        default:
+            // mfhi depends on the preceding mult through HI
+            return 0;
+    }
+}
+
+static void markDead(gvnState *st, instr *ins) {
+    if (st->numDead == st->capDead) {
+        st->capDead = st->capDead ? 2 * st->capDead : 64;
+        st->dead = (instr **) realloc(st->dead, st->capDead * sizeof(instr *));
+    }
+    st->dead[st->numDead++] = ins;
+}
+
+static void numberInstr(gvnState *st, basicBlock *block, instr *ins) {
+    int regs[3];
+    rewriteUses(st, ins);
+    if (ins->kind != I_OP)
+        return;
+    killMemoryEffects(&st->table, block, ins);
+
+    if (ins->op == OP_SW) {
+        // The stored register now holds the variable's value
+        if (isValueReg(st, ins->opnd[0].reg) && isVirtualReg(ins->opnd[0].reg) &&
+            (ins->opnd[1].kind == OPD_LABEL || isValueReg(st, ins->opnd[1].reg))) {
+            valueKey key = {OP_LW, ins->opnd[1], noOpnd()};
+            addValue(&st->table, &key, ins->opnd[0].reg);
+        }
+        return;
+    }
+
+    if (!instrDefs(ins, regs) || !isVirtualReg(regs[0]) || st->numDefs[regs[0] - FIRST_VREG] != 1)
+        return;
+    int def = regs[0];
+    int numUses = instrUses(ins, regs);
+    for (int u = 0; u < numUses; u++)
+        if (!isValueReg(st, regs[u]))
+            return;
+
+    if (ins->op == OP_MOVE && isVirtualReg(ins->opnd[1].reg)) {
+        st->replace[def - FIRST_VREG] = ins->opnd[1].reg;
+        markDead(st, ins);
+        return;
+    }
+    if (!isNumbered(ins->op))
+        return;
+
+    valueKey key = {ins->op, ins->opnd[1], ins->opnd[2]};
+    if ((ins->op == OP_ADD || ins->op == OP_MUL) && key.a.reg > key.b.reg) {
+        key.a = ins->opnd[2];
+        key.b = ins->opnd[1];
+    }
+    int value = lookupValue(&st->table, &key);
+    if (value) {
+        st->replace[def - FIRST_VREG] = value;
+        markDead(st, ins);
+    } else {
+        addValue(&st->table, &key, def);
+    }
+}
+
+static void numberBlock(gvnState *st, basicBlock *block) {
+    int numEntries = st->table.numEntries;
+    int numKills = st->table.numKills;
+    if (block->numPreds != 1 || block->preds[0] != block->idom)
+        killRegion(st, block);
+    for (instr *ins = block->first; ins; ins = ins->next) {
+        numberInstr(st, block, ins);
+        if (ins == block->last)
+            break;
+    }
+    for (int i = 0; i < st->numChildren[block->id]; i++)
+        numberBlock(st, st->children[block->id][i]);
+    restoreTable(&st->table, numEntries, numKills);
+}
+
+void numberValues(codeFunc *func) {
+    gvnState st;
+    memset(&st, 0, sizeof(st));
+    st.func = func;
+    st.graph = buildCFG(func);
+    computeDominators(st.graph);
+    int n = st.graph->numBlocks;
+    if (n == 0) {
+        freeCFG(st.graph);
+        return;
+    }
+    for (int i = 0; i < NUM_BUCKETS; i++)
+        st.table.buckets[i] = -1;
+
+    st.numDefs = (int *) calloc(func->numVregs + 1, sizeof(int));
+    st.replace = (int *) calloc(func->numVregs + 1, sizeof(int));
+    int regs[3];
+    for (instr *ins = func->code.head; ins; ins = ins->next)
+        if (instrDefs(ins, regs) && isVirtualReg(regs[0]))
+            st.numDefs[regs[0] - FIRST_VREG]++;
+
+    st.children = (basicBlock ***) calloc(n, sizeof(basicBlock **));
+    st.numChildren = (int *) calloc(n, sizeof(int));
+    for (int i = 0; i < n; i++) {
+        basicBlock *idom = st.graph->blocks[i]->idom;
+        if (!idom)
+            continue;
+        st.children[idom->id] = (basicBlock **) realloc(st.children[idom->id], (st.numChildren[idom->id] + 1) * sizeof(basicBlock *));
+        st.children[idom->id][st.numChildren[idom->id]++] = st.graph->blocks[i];
+    }
+
+    numberBlock(&st, st.graph->blocks[0]);
+
+    // Uses outside the dominator walk (unreachable code) still need renaming
+    for (instr *ins = func->code.head; ins; ins = ins->next)
+        rewriteUses(&st, ins);
+    for (int i = 0; i < st.numDead; i++)
+        removeInstr(&func->code, st.dead[i]);
+
+    for (int i = 0; i < n; i++)
+        free(st.children[i]);
+    free(st.children);
+    free(st.numChildren);
+    free(st.numDefs);
+    free(st.replace);
+    free(st.dead);
+    free(st.table.entries);
+    free(st.table.kills);
+    freeCFG(st.graph);
+}
@@ -0,0 +1,13 @@
+#ifndef GVN_H
+#define GVN_H
+
+#include "codegen.h"
+
+// Dominator based value numbering: an instruction recomputing a value that
+// is already held in a register along every path is deleted and its
+// result renamed. Covers arithmetic, constants, addresses and loads, with
+// stores forwarded to later loads of the same variable. Runs on virtual
+// registers, before register allocation.
+void numberValues(codeFunc *func);
+
+#endif
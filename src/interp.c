@@ -0,0 +1,735 @@
+#include "interp.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define STACK_WORDS (2 << 20)       // 8MB of frames, the simulator's stack size
+#define CALL_DEPTH_LIMIT (1 << 20)
+
+// Operands a, b and c are frame slots, counted from the frame pointer,
+// unless marked K (an immediate), G (a global address) or T (an
+// instruction index). Addresses index the interpreter's memory words.
+typedef enum bcOp {
+    BC_HALT,
+    BC_LI,                                          // a = K b
+    BC_MOV,                                         // a = b
+    BC_SEXT8,                                       // a = b as a signed byte
+    BC_ADD, BC_SUB, BC_MUL, BC_DIV,                 // a = b op c
+    BC_ADDK, BC_SUBK, BC_MULK, BC_DIVK,             // a = b op K c
+    BC_LE, BC_LT, BC_GT, BC_GE, BC_EQ, BC_NE,       // a = b rel c, in RELVAL order
+    BC_LEK, BC_LTK, BC_GTK, BC_GEK, BC_EQK, BC_NEK, // a = b rel K c
+    BC_BLE, BC_BLT, BC_BGT, BC_BGE, BC_BEQ, BC_BNE, // if a rel b go to T c
+    BC_BLEK, BC_BLTK, BC_BGTK, BC_BGEK, BC_BEQK, BC_BNEK,   // if a rel K b go to T c
+    BC_JMP,                                         // go to T c
+    BC_JZ, BC_JNZ,                                  // if a is zero, or not, go to T c
+    BC_LDG,                                         // a = global G b
+    BC_STG,                                         // global G b = a
+    BC_LDL, BC_LDGX, BC_LDP,    // a = element c of the local array at slot b,
+                                // the global array at G b, the array whose address is in b
+    BC_STL, BC_STGX, BC_STP,    // the same element = a
+    BC_ADDR,                                        // a = address of slot b
+    BC_CALL,                    // call function c with its frame at slot b, result in a
+    BC_RET,                                         // return a
+    BC_RETV,                                        // return without a value
+    BC_OUT,                                         // print a
+    NUM_BC_OPS
+} bcOp;
+
+typedef struct bcInstr {
+    const void *handler;    // code of the operation, filled in before running
+    int op;
+    int a, b, c;
+} bcInstr;
+
+typedef enum bcVarKind {
+    BV_SLOT,                // scalar local or parameter
+    BV_GLOBAL,
+    BV_LOCAL_ARRAY,         // elements from slot addr up
+    BV_GLOBAL_ARRAY,
+    BV_ARRAY_PARAM          // slot holding the address of the elements
+} bcVarKind;
+
+typedef struct bcVar {
+    char *name;
+    bcVarKind kind;
+    int addr;               // frame slot or global address
+    int isChar;             // stores keep a signed byte, as sb and lb do
+} bcVar;
+
+typedef struct bcFunc {
+    char *name;
+    tree *decl;
+    int entry;              // first instruction
+    int numParams;          // slots 0 up, filled in by the caller
+    int localsEnd;          // locals up to here, cleared on entry
+    int frameSize;          // slots including temporaries
+} bcFunc;
+
+typedef struct bcProgram {
+    bcInstr *code;
+    int *lines;             // source line of each instruction, for errors
+    int numCode, capCode;
+    bcFunc *funcs;
+    int numFuncs;
+    bcVar *globals;
+    int numGlobals;
+    int globalWords;
+} bcProgram;
+
+// Function being lowered
+typedef struct bcScope {
+    bcProgram *prog;
+    bcFunc *func;
+    bcVar *vars;            // parameters, then locals
+    int numVars;
+    int nextTemp;           // temporaries are a stack above the locals
+    int line;               // line of the statement being lowered
+} bcScope;
+
+typedef struct bcReturn {
+    bcInstr *ret;           // instruction after the call
+    int *fp;
+} bcReturn;
+
+// Operand order turned around, and the negated test
+static const int mirroredRel[] = {RELVAL_GTE, RELVAL_GT, RELVAL_LT, RELVAL_LTE, RELVAL_EQ, RELVAL_NEQ};
+static const int invertedRel[] = {RELVAL_GT, RELVAL_GTE, RELVAL_LTE, RELVAL_LT, RELVAL_NEQ, RELVAL_EQ};
+
+/* ---------- lowering ---------- */
+
+static int emit(bcScope *s, int op, int a, int b, int c) {
+    bcProgram *p = s->prog;
+    if (p->numCode == p->capCode) {
+        p->capCode = p->capCode ? 2 * p->capCode : 256;
+        p->code = (bcInstr *) realloc(p->code, p->capCode * sizeof(bcInstr));
+        p->lines = (int *) realloc(p->lines, p->capCode * sizeof(int));
+    }
+    bcInstr *ins = &p->code[p->numCode];
+    ins->handler = NULL;
+    ins->op = op;
+    ins->a = a;
+    ins->b = b;
+    ins->c = c;
+    p->lines[p->numCode] = s->line;
+    return p->numCode++;
+}
+
+static int newTemp(bcScope *s) {
+    int slot = s->nextTemp++;
+    if (s->nextTemp > s->func->frameSize)
+        s->func->frameSize = s->nextTemp;
+    return slot;
+}
+
+static int target(bcScope *s, int dest) {
+    return dest >= 0 ? dest : newTemp(s);
+}
+
+static bcVar *findVar(bcScope *s, char *name) {
+    for (int i = 0; i < s->numVars; i++)
+        if (strcmp(s->vars[i].name, name) == 0)
+            return &s->vars[i];
+    for (int i = 0; i < s->prog->numGlobals; i++)
+        if (strcmp(s->prog->globals[i].name, name) == 0)
+            return &s->prog->globals[i];
+    return NULL;
+}
+
+static int findFunc(bcProgram *p, char *name) {
+    for (int i = 0; i < p->numFuncs; i++)
+        if (strcmp(p->funcs[i].name, name) == 0)
+            return i;
+    return -1;
+}
+
+static tree *unwrap(tree *node) {
+    while ((node->nodeKind == EXPRESSION || node->nodeKind == FACTOR) && node->numChildren == 1)
+        node = node->children[0];
+    return node;
+}
+
+static int isConstant(tree *node, int *value) {
+    node = unwrap(node);
+    if (node->nodeKind != INTEGER && node->nodeKind != CHAR)
+        return 0;
+    *value = node->val;
+    return 1;
+}
+
+static int lowerExpr(bcScope *s, tree *node, int dest);
+
+// A scalar local is read in its own slot; anything else lands in dest, or
+// in a new temporary when dest is -1
+static int lowerVar(bcScope *s, tree *node, int dest) {
+    static const bcOp loads[] = {0, 0, BC_LDL, BC_LDGX, BC_LDP};
+    bcVar *v = findVar(s, node->children[0]->name);
+    if (node->numChildren == 1) {
+        switch (v->kind) {
+            case BV_SLOT:
+            case BV_ARRAY_PARAM:
+                if (dest < 0)
+                    return v->addr;
+                emit(s, BC_MOV, dest, v->addr, 0);
+                return dest;
+            case BV_GLOBAL:
+                dest = target(s, dest);
+                emit(s, BC_LDG, dest, v->addr, 0);
+                return dest;
+            case BV_LOCAL_ARRAY:
+                dest = target(s, dest);
+                emit(s, BC_ADDR, dest, v->addr, 0);
+                return dest;
+            default:
+                dest = target(s, dest);
+                emit(s, BC_LI, dest, v->addr, 0);
+                return dest;
+        }
+    }
+    int mark = s->nextTemp;
+    int index = lowerExpr(s, node->children[1], -1);
+    s->nextTemp = mark;
+    dest = target(s, dest);
+    emit(s, loads[v->kind], dest, v->addr, index);
+    return dest;
+}
+
+// Arguments are evaluated left to right into consecutive temporaries,
+// which become the first slots of the callee's frame
+static int lowerCall(bcScope *s, tree *node, int dest) {
+    char *name = node->children[0]->name;
+    tree *args = node->children[1];
+    int numArgs = args ? args->numChildren : 0;
+    int mark = s->nextTemp;
+
+    if (strcmp(name, "output") == 0) {
+        int value = lowerExpr(s, args->children[0], -1);
+        emit(s, BC_OUT, value, 0, 0);
+        s->nextTemp = mark;
+        return value;
+    }
+
+    int argBase = s->nextTemp;
+    for (int i = 0; i < numArgs; i++)
+        newTemp(s);
+    for (int i = 0; i < numArgs; i++) {
+        int inner = s->nextTemp;
+        lowerExpr(s, args->children[i], argBase + i);
+        s->nextTemp = inner;
+    }
+    s->nextTemp = mark;
+    dest = target(s, dest);
+    emit(s, BC_CALL, dest, argBase, findFunc(s->prog, name));
+    return dest;
+}
+
+// Same results as the generated code: 32-bit wraparound, division
+// truncating toward zero. A constant operand goes in the instruction.
+static int lowerBinary(bcScope *s, tree *node, int dest) {
+    static const int arith[] = {BC_ADD, BC_SUB, BC_MUL, BC_DIV};
+    tree *l = node->children[0];
+    tree *r = node->children[1];
+    int mark = s->nextTemp, k, left, right;
+    int op = node->nodeKind == RELOP ? BC_LE + node->val : arith[node->val];
+    int opK = node->nodeKind == RELOP ? BC_LEK + node->val : op + (BC_ADDK - BC_ADD);
+
+    if (isConstant(r, &k) && (op != BC_DIV || (k != 0 && k != -1))) {
+        left = lowerExpr(s, l, -1);
+        s->nextTemp = mark;
+        dest = target(s, dest);
+        emit(s, opK, dest, left, k);
+        return dest;
+    }
+    if (isConstant(l, &k) && (node->nodeKind == RELOP || op == BC_ADD || op == BC_MUL)) {
+        right = lowerExpr(s, r, -1);
+        s->nextTemp = mark;
+        dest = target(s, dest);
+        emit(s, node->nodeKind == RELOP ? BC_LEK + mirroredRel[node->val] : opK, dest, right, k);
+        return dest;
+    }
+    left = lowerExpr(s, l, -1);
+    right = lowerExpr(s, r, -1);
+    s->nextTemp = mark;
+    dest = target(s, dest);
+    emit(s, op, dest, left, right);
+    return dest;
+}
+
+static int lowerExpr(bcScope *s, tree *node, int dest) {
+    node = unwrap(node);
+    switch (node->nodeKind) {
+        case INTEGER:
+        case CHAR:
+            dest = target(s, dest);
+            emit(s, BC_LI, dest, node->val, 0);
+            return dest;
+        case VAR:
+            return lowerVar(s, node, dest);
+        case FUNCCALLEXPR:
+            return lowerCall(s, node, dest);
+        case ADDOP:
+        case MULOP:
+        case RELOP:
+            return lowerBinary(s, node, dest);
+        default:
+            return target(s, dest);
+    }
+}
+
+// Emits a branch taken when cond is true, or false, and returns it so the
+// caller can fill in the target
+static int lowerBranch(bcScope *s, tree *cond, int whenTrue) {
+    tree *node = unwrap(cond);
+    int mark = s->nextTemp, k, at;
+    if (node->nodeKind == RELOP) {
+        int rel = whenTrue ? node->val : invertedRel[node->val];
+        tree *l = node->children[0];
+        tree *r = node->children[1];
+        if (isConstant(r, &k)) {
+            at = emit(s, BC_BLEK + rel, lowerExpr(s, l, -1), k, -1);
+        } else if (isConstant(l, &k)) {
+            at = emit(s, BC_BLEK + mirroredRel[rel], lowerExpr(s, r, -1), k, -1);
+        } else {
+            int left = lowerExpr(s, l, -1);
+            at = emit(s, BC_BLE + rel, left, lowerExpr(s, r, -1), -1);
+        }
+    } else {
+        at = emit(s, whenTrue ? BC_JNZ : BC_JZ, lowerExpr(s, node, -1), 0, -1);
+    }
+    s->nextTemp = mark;
+    return at;
+}
+
+// The right side is evaluated before the index, as in the generated code
+static void lowerAssign(bcScope *s, tree *node) {
+    static const bcOp stores[] = {0, 0, BC_STL, BC_STGX, BC_STP};
+    tree *var = node->children[0];
+    bcVar *v = findVar(s, var->children[0]->name);
+    if (v->kind == BV_SLOT) {
+        lowerExpr(s, node->children[1], v->addr);
+        if (v->isChar)
+            emit(s, BC_SEXT8, v->addr, v->addr, 0);
+        return;
+    }
+    int value = lowerExpr(s, node->children[1], -1);
+    if (v->isChar) {
+        int byte = newTemp(s);
+        emit(s, BC_SEXT8, byte, value, 0);
+        value = byte;
+    }
+    if (v->kind == BV_GLOBAL)
+        emit(s, BC_STG, value, v->addr, 0);
+    else
+        emit(s, stores[v->kind], value, v->addr, lowerExpr(s, var->children[1], -1));
+}
+
+static void lowerStmt(bcScope *s, tree *node) {
+    if (!node)
+        return;
+    bcProgram *p = s->prog;
+    s->line = node->line;
+    switch (node->nodeKind) {
+        case STATEMENTLIST:
+            for (int i = 0; i < node->numChildren; i++)
+                lowerStmt(s, node->children[i]);
+            break;
+        case ASSIGNSTMT:
+            lowerAssign(s, node);
+            break;
+        case STATEMENT:
+            lowerExpr(s, node->children[0], -1);
+            break;
+        case CONDSTMT: {
+            int skip = lowerBranch(s, node->children[0], 0);
+            lowerStmt(s, node->children[1]);
+            if (node->numChildren > 2) {
+                int end = emit(s, BC_JMP, 0, 0, -1);
+                p->code[skip].c = p->numCode;
+                lowerStmt(s, node->children[2]);
+                p->code[end].c = p->numCode;
+            } else {
+                p->code[skip].c = p->numCode;
+            }
+            break;
+        }
+        case LOOPSTMT: {
+            // Test at the bottom: one branch per iteration
+            int enter = emit(s, BC_JMP, 0, 0, -1);
+            int body = p->numCode;
+            lowerStmt(s, node->children[1]);
+            p->code[enter].c = p->numCode;
+            s->line = node->line;
+            // lowerBranch may grow p->code, so index it only afterwards
+            int back = lowerBranch(s, node->children[0], 1);
+            p->code[back].c = body;
+            break;
+        }
+        case RETURNSTMT:
+            if (node->numChildren > 0)
+                emit(s, BC_RET, lowerExpr(s, node->children[0], -1), 0, 0);
+            else
+                emit(s, BC_RETV, 0, 0, 0);
+            break;
+        default:
+            break;
+    }
+    s->nextTemp = s->func->localsEnd;
+}
+
+static bcVar *addVar(bcScope *s, tree *decl, bcVarKind scalar, bcVarKind array, int addr) {
+    tree *id = decl->children[1];
+    bcVar *v = &s->vars[s->numVars++];
+    v->name = id->name;
+    v->kind = id->nodeKind == ARRAYDECL ? array : scalar;
+    v->addr = addr;
+    v->isChar = decl->children[0]->type == DT_CHAR;
+    return v;
+}
+
+static void lowerFunction(bcProgram *p, bcFunc *func) {
+    tree *formals = func->decl->children[1];
+    tree *body = func->decl->children[2];
+    int numVars = formals->numChildren;
+    for (int i = 0; i < body->numChildren; i++)
+        if (body->children[i]->nodeKind == LOCALDECLLIST)
+            numVars += body->children[i]->numChildren;
+    bcScope s = {p, func, (bcVar *) calloc(numVars + 1, sizeof(bcVar)), 0, 0, func->decl->line};
+
+    // A scalar parameter is passed as a full word even when it is a char
+    for (int i = 0; i < formals->numChildren; i++) {
+        bcVar *v = addVar(&s, formals->children[i], BV_SLOT, BV_ARRAY_PARAM, i);
+        if (v->kind == BV_SLOT)
+            v->isChar = 0;
+    }
+    func->numParams = formals->numChildren;
+
+    int slot = func->numParams;
+    tree *statements = NULL;
+    for (int i = 0; i < body->numChildren; i++) {
+        tree *child = body->children[i];
+        if (child->nodeKind != LOCALDECLLIST) {
+            statements = child;
+            continue;
+        }
+        for (int j = 0; j < child->numChildren; j++) {
+            tree *id = child->children[j]->children[1];
+            addVar(&s, child->children[j], BV_SLOT, BV_LOCAL_ARRAY, slot);
+            slot += id->nodeKind == ARRAYDECL ? id->val : 1;
+        }
+    }
+    func->localsEnd = func->frameSize = s.nextTemp = slot;
+    func->entry = p->numCode;
+    lowerStmt(&s, statements);
+    emit(&s, BC_RETV, 0, 0, 0);
+    free(s.vars);
+}
+
+// Walks the left-nested declList in source order
+static void collectDecls(bcProgram *p, tree *node) {
+    if (!node)
+        return;
+    switch (node->nodeKind) {
+        case PROGRAM:
+        case DECLLIST:
+        case DECL:
+            for (int i = 0; i < node->numChildren; i++)
+                collectDecls(p, node->children[i]);
+            break;
+        case VARDECL: {
+            tree *id = node->children[1];
+            p->globals = (bcVar *) realloc(p->globals, (p->numGlobals + 1) * sizeof(bcVar));
+            bcVar *v = &p->globals[p->numGlobals++];
+            v->name = id->name;
+            v->kind = id->nodeKind == ARRAYDECL ? BV_GLOBAL_ARRAY : BV_GLOBAL;
+            v->addr = p->globalWords;
+            v->isChar = node->children[0]->type == DT_CHAR;
+            p->globalWords += id->nodeKind == ARRAYDECL ? id->val : 1;
+            break;
+        }
+        case FUNDECL:
+            p->funcs = (bcFunc *) realloc(p->funcs, (p->numFuncs + 1) * sizeof(bcFunc));
+            memset(&p->funcs[p->numFuncs], 0, sizeof(bcFunc));
+            p->funcs[p->numFuncs].name = node->name;
+            p->funcs[p->numFuncs++].decl = node;
+            break;
+        default:
+            break;
+    }
+}
+
+/* ---------- execution ---------- */
+
+// Direct threading: each instruction holds the address of its operation's
+// code and every operation ends by jumping to the next one's. Compilers
+// without label addresses get a switch.
+#ifdef __GNUC__
+#define TARGET(op) L_##op:
+#define DISPATCH() goto *ip->handler
+#else
+#define TARGET(op) case BC_##op:
+#define DISPATCH() goto dispatch
+#endif
+#define NEXT() do { ip++; DISPATCH(); } while (0)
+#define JUMP(t) do { ip = code + (t); DISPATCH(); } while (0)
+#define BRANCH(cond) do { if (cond) JUMP(ip->c); NEXT(); } while (0)
+
+// Element c of an array whose first word is at base, or a bad address
+#define ELEMENT(base) (addr = (unsigned) (base) + (unsigned) fp[ip->c], addr < memWords ? mem + addr : NULL)
+
+static int execute(bcProgram *prog, const char *path, FILE *out) {
+#ifdef __GNUC__
+    static const void *handlers[NUM_BC_OPS] = {
+        [BC_HALT] = &&L_HALT, [BC_LI] = &&L_LI, [BC_MOV] = &&L_MOV, [BC_SEXT8] = &&L_SEXT8,
+        [BC_ADD] = &&L_ADD, [BC_SUB] = &&L_SUB, [BC_MUL] = &&L_MUL, [BC_DIV] = &&L_DIV,
+        [BC_ADDK] = &&L_ADDK, [BC_SUBK] = &&L_SUBK, [BC_MULK] = &&L_MULK, [BC_DIVK] = &&L_DIVK,
+        [BC_LE] = &&L_LE, [BC_LT] = &&L_LT, [BC_GT] = &&L_GT,
+        [BC_GE] = &&L_GE, [BC_EQ] = &&L_EQ, [BC_NE] = &&L_NE,
+        [BC_LEK] = &&L_LEK, [BC_LTK] = &&L_LTK, [BC_GTK] = &&L_GTK,
+        [BC_GEK] = &&L_GEK, [BC_EQK] = &&L_EQK, [BC_NEK] = &&L_NEK,
+        [BC_BLE] = &&L_BLE, [BC_BLT] = &&L_BLT, [BC_BGT] = &&L_BGT,
+        [BC_BGE] = &&L_BGE, [BC_BEQ] = &&L_BEQ, [BC_BNE] = &&L_BNE,
+        [BC_BLEK] = &&L_BLEK, [BC_BLTK] = &&L_BLTK, [BC_BGTK] = &&L_BGTK,
+        [BC_BGEK] = &&L_BGEK, [BC_BEQK] = &&L_BEQK, [BC_BNEK] = &&L_BNEK,
+        [BC_JMP] = &&L_JMP, [BC_JZ] = &&L_JZ, [BC_JNZ] = &&L_JNZ,
+        [BC_LDG] = &&L_LDG, [BC_STG] = &&L_STG,
+        [BC_LDL] = &&L_LDL, [BC_LDGX] = &&L_LDGX, [BC_LDP] = &&L_LDP,
+        [BC_STL] = &&L_STL, [BC_STGX] = &&L_STGX, [BC_STP] = &&L_STP,
+        [BC_ADDR] = &&L_ADDR, [BC_CALL] = &&L_CALL, [BC_RET] = &&L_RET,
+        [BC_RETV] = &&L_RETV, [BC_OUT] = &&L_OUT
+    };
+    for (int i = 0; i < prog->numCode; i++)
+        prog->code[i].handler = handlers[prog->code[i].op];
+#endif
+
+    unsigned memWords = prog->globalWords + STACK_WORDS;
+    int *mem = (int *) calloc(memWords, sizeof(int));
+    int *memEnd = mem + memWords;
+    int capCalls = 1024, depth = 0, status = 0;
+    bcReturn *calls = (bcReturn *) malloc(capCalls * sizeof(bcReturn));
+    bcInstr *code = prog->code;
+    bcInstr *ip = code;
+    int *fp = mem + prog->globalWords;
+    const char *error = NULL;
+    unsigned addr;
+    int *p;
+
+#ifdef __GNUC__
+    DISPATCH();
+#else
+dispatch:
+    switch (ip->op) {
+#endif
+    TARGET(HALT)
+        goto done;
+    TARGET(LI)
+        fp[ip->a] = ip->b;
+        NEXT();
+    TARGET(MOV)
+        fp[ip->a] = fp[ip->b];
+        NEXT();
+    TARGET(SEXT8)
+        fp[ip->a] = (signed char) fp[ip->b];
+        NEXT();
+    TARGET(ADD)
+        fp[ip->a] = (int) ((unsigned) fp[ip->b] + (unsigned) fp[ip->c]);
+        NEXT();
+    TARGET(SUB)
+        fp[ip->a] = (int) ((unsigned) fp[ip->b] - (unsigned) fp[ip->c]);
+        NEXT();
+    TARGET(MUL)
+        fp[ip->a] = (int) ((unsigned) fp[ip->b] * (unsigned) fp[ip->c]);
+        NEXT();
+    TARGET(DIV)
+        if (fp[ip->c] == 0) {
+            error = "division by zero";
+            goto fail;
+        }
+        // INT_MIN / -1 wraps, as div does
+        fp[ip->a] = fp[ip->c] == -1 ? (int) (0u - (unsigned) fp[ip->b]) : fp[ip->b] / fp[ip->c];
+        NEXT();
+    TARGET(ADDK)
+        fp[ip->a] = (int) ((unsigned) fp[ip->b] + (unsigned) ip->c);
+        NEXT();
+    TARGET(SUBK)
+        fp[ip->a] = (int) ((unsigned) fp[ip->b] - (unsigned) ip->c);
+        NEXT();
+    TARGET(MULK)
+        fp[ip->a] = (int) ((unsigned) fp[ip->b] * (unsigned) ip->c);
+        NEXT();
+    TARGET(DIVK)
+        fp[ip->a] = fp[ip->b] / ip->c;
+        NEXT();
+    TARGET(LE)
+        fp[ip->a] = fp[ip->b] <= fp[ip->c];
+        NEXT();
+    TARGET(LT)
+        fp[ip->a] = fp[ip->b] < fp[ip->c];
+        NEXT();
+    TARGET(GT)
+        fp[ip->a] = fp[ip->b] > fp[ip->c];
+        NEXT();
+    TARGET(GE)
+        fp[ip->a] = fp[ip->b] >= fp[ip->c];
+        NEXT();
+    TARGET(EQ)
+        fp[ip->a] = fp[ip->b] == fp[ip->c];
+        NEXT();
+    TARGET(NE)
+        fp[ip->a] = fp[ip->b] != fp[ip->c];
+        NEXT();
+    TARGET(LEK)
+        fp[ip->a] = fp[ip->b] <= ip->c;
+        NEXT();
+    TARGET(LTK)
+        fp[ip->a] = fp[ip->b] < ip->c;
+        NEXT();
+    TARGET(GTK)
+        fp[ip->a] = fp[ip->b] > ip->c;
+        NEXT();
+    TARGET(GEK)
+        fp[ip->a] = fp[ip->b] >= ip->c;
+        NEXT();
+    TARGET(EQK)
+        fp[ip->a] = fp[ip->b] == ip->c;
+        NEXT();
+    TARGET(NEK)
+        fp[ip->a] = fp[ip->b] != ip->c;
+        NEXT();
+    TARGET(BLE)
+        BRANCH(fp[ip->a] <= fp[ip->b]);
+    TARGET(BLT)
+        BRANCH(fp[ip->a] < fp[ip->b]);
+    TARGET(BGT)
+        BRANCH(fp[ip->a] > fp[ip->b]);
+    TARGET(BGE)
+        BRANCH(fp[ip->a] >= fp[ip->b]);
+    TARGET(BEQ)
+        BRANCH(fp[ip->a] == fp[ip->b]);
+    TARGET(BNE)
+        BRANCH(fp[ip->a] != fp[ip->b]);
+    TARGET(BLEK)
+        BRANCH(fp[ip->a] <= ip->b);
+    TARGET(BLTK)
+        BRANCH(fp[ip->a] < ip->b);
+    TARGET(BGTK)
+        BRANCH(fp[ip->a] > ip->b);
+    TARGET(BGEK)
+        BRANCH(fp[ip->a] >= ip->b);
+    TARGET(BEQK)
+        BRANCH(fp[ip->a] == ip->b);
+    TARGET(BNEK)
+        BRANCH(fp[ip->a] != ip->b);
+    TARGET(JMP)
+        JUMP(ip->c);
+    TARGET(JZ)
+        BRANCH(fp[ip->a] == 0);
+    TARGET(JNZ)
+        BRANCH(fp[ip->a] != 0);
+    TARGET(LDG)
+        fp[ip->a] = mem[ip->b];
+        NEXT();
+    TARGET(STG)
+        mem[ip->b] = fp[ip->a];
+        NEXT();
+    TARGET(LDL)
+        if (!(p = ELEMENT(fp - mem + ip->b)))
+            goto badAddress;
+        fp[ip->a] = *p;
+        NEXT();
+    TARGET(LDGX)
+        if (!(p = ELEMENT(ip->b)))
+            goto badAddress;
+        fp[ip->a] = *p;
+        NEXT();
+    TARGET(LDP)
+        if (!(p = ELEMENT(fp[ip->b])))
+            goto badAddress;
+        fp[ip->a] = *p;
+        NEXT();
+    TARGET(STL)
+        if (!(p = ELEMENT(fp - mem + ip->b)))
+            goto badAddress;
+        *p = fp[ip->a];
+        NEXT();
+    TARGET(STGX)
+        if (!(p = ELEMENT(ip->b)))
+            goto badAddress;
+        *p = fp[ip->a];
+        NEXT();
+    TARGET(STP)
+        if (!(p = ELEMENT(fp[ip->b])))
+            goto badAddress;
+        *p = fp[ip->a];
+        NEXT();
+    TARGET(ADDR)
+        fp[ip->a] = (int) (fp - mem) + ip->b;
+        NEXT();
+    TARGET(CALL) {
+        bcFunc *func = &prog->funcs[ip->c];
+        int *frame = fp + ip->b;
+        if (frame + func->frameSize > memEnd || depth == CALL_DEPTH_LIMIT) {
+            error = "stack overflow";
+            goto fail;
+        }
+        if (depth == capCalls) {
+            capCalls *= 2;
+            calls = (bcReturn *) realloc(calls, capCalls * sizeof(bcReturn));
+        }
+        calls[depth].ret = ip + 1;
+        calls[depth++].fp = fp;
+        memset(frame + func->numParams, 0, (func->localsEnd - func->numParams) * sizeof(int));
+        fp = frame;
+        JUMP(func->entry);
+    }
+    TARGET(RET) {
+        // The call's a operand names the caller's slot for the result
+        int value = fp[ip->a];
+        ip = calls[--depth].ret;
+        fp = calls[depth].fp;
+        fp[ip[-1].a] = value;
+        DISPATCH();
+    }
+    TARGET(RETV)
+        ip = calls[--depth].ret;
+        fp = calls[depth].fp;
+        DISPATCH();
+    TARGET(OUT)
+        fprintf(out, "%d", fp[ip->a]);
+        NEXT();
+#ifndef __GNUC__
+    }
+#endif
+
+badAddress:
+    error = "array element outside memory";
+fail:
+    fprintf(stderr, "run: %s:%d: %s\n", path, prog->lines[ip - code], error);
+    status = -1;
+done:
+    free(calls);
+    free(mem);
+    return status;
+}
+
+int runProgram(tree *program, const char *path, FILE *out) {
+    bcProgram prog;
+    memset(&prog, 0, sizeof(prog));
+    collectDecls(&prog, program);
+
+    int status = -1;
+    int entry = findFunc(&prog, "main");
+    if (entry < 0) {
+        fprintf(stderr, "run: %s: no main function\n", path);
+    } else {
+        // main is called like any other function, and returns to a halt
+        bcScope top = {&prog, NULL, NULL, 0, 0, 0};
+        emit(&top, BC_CALL, 0, 0, entry);
+        emit(&top, BC_HALT, 0, 0, 0);
+        for (int i = 0; i < prog.numFuncs; i++)
+            lowerFunction(&prog, &prog.funcs[i]);
+        status = execute(&prog, path, out);
+    }
+    free(prog.code);
+    free(prog.lines);
+    free(prog.funcs);
+    free(prog.globals);
+    return status;
+}
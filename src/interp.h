@@ -0,0 +1,14 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+#include <stdio.h>
+#include "tree.h"
+
+// Runs a checked program without generating assembly. The AST is lowered
+// to a register bytecode whose operands are slots of a flat frame array,
+// and executed by a direct-threaded interpreter. Program output goes to
+// out and matches what the MIPS code prints. Returns 0 when main returns,
+// otherwise prints the error on stderr and returns -1.
+int runProgram(tree *program, const char *path, FILE *out);
+
+#endif
@@ -0,0 +1,536 @@
+#include "ipa.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EVAL_STEP_LIMIT 100000      // statements and expressions per folded call
+#define EVAL_DEPTH_LIMIT 100        // calls nested inside a folded call
+#define MAX_CLONES 4                // specialized copies of one function
+#define CLONE_SIZE_LIMIT 300        // AST nodes of a body worth copying
+
+/* ---------- effects ---------- */
+
+static int isArrayParam(tree *decl, char *name) {
+    tree *formals = decl->children[1];
+    for (int i = 0; i < formals->numChildren; i++) {
+        tree *id = formals->children[i]->children[1];
+        if (strcmp(id->name, name) == 0)
+            return id->nodeKind == ARRAYDECL;
+    }
+    return 0;
+}
+
+// A store to a global or through an array parameter is visible to the
+// caller; any global read keeps the result from being known in advance
+static void scanEffects(tree *decl, tree *node, int *pure, int *foldable) {
+    if (!node)
+        return;
+    if (node->nodeKind == ASSIGNSTMT) {
+        char *name = node->children[0]->children[0]->name;
+        if (!isLocalName(decl, name) || isArrayParam(decl, name))
+            *pure = 0;
+    } else if (node->nodeKind == VAR && !isLocalName(decl, node->children[0]->name)) {
+        *foldable = 0;
+    }
+    for (int i = 0; i < node->numChildren; i++)
+        scanEffects(decl, node->children[i], pure, foldable);
+}
+
+// Starts from each body's own effects, then clears the flags of every
+// function that calls one without them until nothing changes. output has
+// no body and is neither, and nothing is with profile counters.
+static void markPureFunctions(callGraph *graph, int profiled) {
+    for (cgNode *node = graph->funcs; node; node = node->next) {
+        node->pure = node->foldable = 0;
+        if (!node->decl || profiled)
+            continue;
+        int pure = 1, foldable = 1;
+        scanEffects(node->decl, node->decl->children[2], &pure, &foldable);
+        tree *formals = node->decl->children[1];
+        for (int i = 0; i < formals->numChildren; i++)
+            if (formals->children[i]->children[1]->nodeKind == ARRAYDECL)
+                foldable = 0;
+        node->pure = pure;
+        node->foldable = pure && foldable;
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (cgNode *node = graph->funcs; node; node = node->next) {
+            for (int i = 0; i < node->numCallees; i++) {
+                cgNode *callee = node->callees[i];
+                if (node->pure && !callee->pure) {
+                    node->pure = node->foldable = 0;
+                    changed = 1;
+                }
+                if (node->foldable && !callee->foldable) {
+                    node->foldable = 0;
+                    changed = 1;
+                }
+            }
+        }
+    }
+}
+
+/* ---------- compile-time evaluation ---------- */
+
+typedef struct evalVar {
+    char *name;
+    int size;                   // elements, 1 for a scalar
+    int isArray;
+    int isChar;                 // stored as a signed byte
+    int *data;
+    char *set;                  // element has been assigned
+} evalVar;
+
+typedef struct evalFrame {
+    evalVar *vars;
+    int numVars;
+} evalFrame;
+
+typedef enum evalStatus {
+    EVAL_NEXT,                  // go on with the following statement
+    EVAL_RETURN,
+    EVAL_FAIL                   // not foldable: unknown value, trap or too long
+} evalStatus;
+
+static int evalSteps;
+
+static int evalExpr(callGraph *graph, evalFrame *frame, tree *node, int depth, int *value);
+static int evalCall(callGraph *graph, evalFrame *frame, tree *call, int depth, int *value, int *hasValue);
+
+static evalVar *findEvalVar(evalFrame *frame, char *name) {
+    for (int i = 0; frame && i < frame->numVars; i++)
+        if (strcmp(frame->vars[i].name, name) == 0)
+            return &frame->vars[i];
+    return NULL;
+}
+
+// Resolves a var node to its storage and element; fails outside the bounds
+static int evalLocation(callGraph *graph, evalFrame *frame, tree *node, int depth, evalVar **var, int *index) {
+    *var = findEvalVar(frame, node->children[0]->name);
+    *index = 0;
+    if (!*var)
+        return 0;
+    if (node->numChildren > 1) {
+        if (!(*var)->isArray || !evalExpr(graph, frame, node->children[1], depth, index))
+            return 0;
+        return *index >= 0 && *index < (*var)->size;
+    }
+    return !(*var)->isArray;
+}
+
+// Same results as the generated code: 32-bit wraparound, division
+// truncating toward zero
+static int evalExpr(callGraph *graph, evalFrame *frame, tree *node, int depth, int *value) {
+    int left, right, hasValue, index;
+    evalVar *var;
+    if (!node || ++evalSteps > EVAL_STEP_LIMIT)
+        return 0;
+    switch (node->nodeKind) {
+        case EXPRESSION:
+        case FACTOR:
+            return node->numChildren == 1 && evalExpr(graph, frame, node->children[0], depth, value);
+        case INTEGER:
+        case CHAR:
+            *value = node->val;
+            return 1;
+        case VAR:
+            if (!evalLocation(graph, frame, node, depth, &var, &index) || !var->set[index])
+                return 0;
+            *value = var->data[index];
+            return 1;
+        case FUNCCALLEXPR:
+            return evalCall(graph, frame, node, depth, value, &hasValue) && hasValue;
+        case ADDOP:
+        case MULOP:
+        case RELOP:
+            if (!evalExpr(graph, frame, node->children[0], depth, &left) ||
+                !evalExpr(graph, frame, node->children[1], depth, &right))
+                return 0;
+            if (node->nodeKind == RELOP) {
+                switch (node->val) {
+                    case RELVAL_LTE: *value = left <= right; break;
+                    case RELVAL_LT:  *value = left < right; break;
+                    case RELVAL_GT:  *value = left > right; break;
+                    case RELVAL_GTE: *value = left >= right; break;
+                    case RELVAL_EQ:  *value = left == right; break;
+                    default:         *value = left != right; break;
+                }
+                return 1;
+            }
+            switch (node->val) {
+                case OPVAL_ADD: *value = (int) ((unsigned) left + (unsigned) right); return 1;
+                case OPVAL_SUB: *value = (int) ((unsigned) left - (unsigned) right); return 1;
+                case OPVAL_MUL: *value = (int) ((unsigned) left * (unsigned) right); return 1;
+                default:
+                    if (right == 0 || (left == INT_MIN && right == -1))
+                        return 0;
+                    *value = left / right;
+                    return 1;
+            }
+        default:
+            return 0;
+    }
+}
+
+static evalStatus execStmt(callGraph *graph, evalFrame *frame, tree *node, int depth, int *value, int *hasValue) {
+    int cond, index, result, has;
+    evalVar *var;
+    if (!node)
+        return EVAL_NEXT;
+    if (++evalSteps > EVAL_STEP_LIMIT)
+        return EVAL_FAIL;
+    switch (node->nodeKind) {
+        case STATEMENTLIST:
+            for (int i = 0; i < node->numChildren; i++) {
+                evalStatus status = execStmt(graph, frame, node->children[i], depth, value, hasValue);
+                if (status != EVAL_NEXT)
+                    return status;
+            }
+            return EVAL_NEXT;
+        case ASSIGNSTMT:
+            if (!evalExpr(graph, frame, node->children[1], depth, &result) ||
+                !evalLocation(graph, frame, node->children[0], depth, &var, &index))
+                return EVAL_FAIL;
+            var->data[index] = var->isChar ? (signed char) result : result;
+            var->set[index] = 1;
+            return EVAL_NEXT;
+        case STATEMENT: {
+            // A call to a void function has no value but may still be run
+            tree *expr = node->children[0];
+            while ((expr->nodeKind == EXPRESSION || expr->nodeKind == FACTOR) && expr->numChildren == 1)
+                expr = expr->children[0];
+            if (expr->nodeKind == FUNCCALLEXPR)
+                return evalCall(graph, frame, expr, depth, &result, &has) ? EVAL_NEXT : EVAL_FAIL;
+            return evalExpr(graph, frame, expr, depth, &result) ? EVAL_NEXT : EVAL_FAIL;
+        }
+        case CONDSTMT:
+            if (!evalExpr(graph, frame, node->children[0], depth, &cond))
+                return EVAL_FAIL;
+            if (cond)
+                return execStmt(graph, frame, node->children[1], depth, value, hasValue);
+            return node->numChildren > 2 ? execStmt(graph, frame, node->children[2], depth, value, hasValue) : EVAL_NEXT;
+        case LOOPSTMT:
+            for (;;) {
+                if (!evalExpr(graph, frame, node->children[0], depth, &cond))
+                    return EVAL_FAIL;
+                if (!cond)
+                    return EVAL_NEXT;
+                evalStatus status = execStmt(graph, frame, node->children[1], depth, value, hasValue);
+                if (status != EVAL_NEXT)
+                    return status;
+            }
+        case RETURNSTMT:
+            *hasValue = node->numChildren > 0;
+            if (*hasValue && !evalExpr(graph, frame, node->children[0], depth, value))
+                return EVAL_FAIL;
+            return EVAL_RETURN;
+        default:
+            return EVAL_FAIL;
+    }
+}
+
+// Runs a call to a foldable function on a frame of its own; arguments
+// are evaluated in the caller's frame, which is NULL at the top level
+static int evalCall(callGraph *graph, evalFrame *frame, tree *call, int depth, int *value, int *hasValue) {
+    cgNode *callee = findFunction(graph, call->children[0]->name);
+    if (!callee || !callee->foldable || depth >= EVAL_DEPTH_LIMIT)
+        return 0;
+    tree *args = call->children[1];
+    tree *formals = callee->decl->children[1];
+    tree *body = callee->decl->children[2];
+    int numArgs = args ? args->numChildren : 0;
+    if (numArgs != formals->numChildren)
+        return 0;
+
+    int numVars = numArgs;
+    for (int i = 0; i < body->numChildren; i++)
+        if (body->children[i]->nodeKind == LOCALDECLLIST)
+            numVars += body->children[i]->numChildren;
+    evalFrame calleeFrame = {(evalVar *) calloc(numVars + 1, sizeof(evalVar)), 0};
+    int ok = 1;
+    for (int i = 0; i < numArgs && ok; i++) {
+        evalVar *v = &calleeFrame.vars[calleeFrame.numVars++];
+        v->name = formals->children[i]->children[1]->name;
+        v->size = 1;
+        v->data = (int *) malloc(sizeof(int));
+        v->set = (char *) malloc(1);
+        v->set[0] = ok = evalExpr(graph, frame, args->children[i], depth, v->data);
+    }
+
+    tree *statements = NULL;
+    for (int i = 0; i < body->numChildren && ok; i++) {
+        tree *child = body->children[i];
+        if (child->nodeKind != LOCALDECLLIST) {
+            statements = child;
+            continue;
+        }
+        for (int j = 0; j < child->numChildren; j++) {
+            tree *id = child->children[j]->children[1];
+            evalVar *v = &calleeFrame.vars[calleeFrame.numVars++];
+            v->name = id->name;
+            v->isArray = id->nodeKind == ARRAYDECL;
+            v->isChar = child->children[j]->children[0]->type == DT_CHAR;
+            v->size = v->isArray ? id->val : 1;
+            v->data = (int *) calloc(v->size, sizeof(int));
+            v->set = (char *) calloc(v->size, 1);
+        }
+    }
+
+    *hasValue = 0;
+    if (ok)
+        ok = execStmt(graph, &calleeFrame, statements, depth + 1, value, hasValue) != EVAL_FAIL;
+    for (int i = 0; i < calleeFrame.numVars; i++) {
+        free(calleeFrame.vars[i].data);
+        free(calleeFrame.vars[i].set);
+    }
+    free(calleeFrame.vars);
+    return ok;
+}
+
+static int foldCall(callGraph *graph, tree *call, int *value) {
+    int hasValue;
+    evalSteps = 0;
+    return evalCall(graph, NULL, call, 0, value, &hasValue) && hasValue;
+}
+
+static int constantArg(callGraph *graph, tree *arg, int *value) {
+    evalSteps = 0;
+    return evalExpr(graph, NULL, arg, 0, value);
+}
+
+/* ---------- call sites ---------- */
+
+#define ARG_UNKNOWN  0
+#define ARG_CONSTANT 1
+#define ARG_SAME     2              // recursive call passing the parameter on unchanged
+
+// Arguments of one call to a function that may get a specialized version
+typedef struct argSignature {
+    cgSite *site;
+    cgNode *caller;
+    cgNode *callee;
+    int *kind;
+    int *value;
+    struct argSignature *next;
+} argSignature;
+
+static int isAssigned(tree *node, char *name) {
+    if (!node)
+        return 0;
+    if (node->nodeKind == ASSIGNSTMT && strcmp(node->children[0]->children[0]->name, name) == 0)
+        return 1;
+    for (int i = 0; i < node->numChildren; i++)
+        if (isAssigned(node->children[i], name))
+            return 1;
+    return 0;
+}
+
+static int isParamPassedOn(cgNode *caller, cgNode *callee, tree *arg, int i) {
+    if (caller != callee)
+        return 0;
+    while ((arg->nodeKind == EXPRESSION || arg->nodeKind == FACTOR) && arg->numChildren == 1)
+        arg = arg->children[0];
+    tree *formal = callee->decl->children[1]->children[i];
+    return arg->nodeKind == VAR && arg->numChildren == 1 &&
+           formal->children[1]->nodeKind != ARRAYDECL &&
+           strcmp(arg->children[0]->name, formal->children[1]->name) == 0 &&
+           !isAssigned(callee->decl->children[2], arg->children[0]->name);
+}
+
+static void collectSites(callGraph *graph, cgNode *caller, tree *node, argSignature **sigs) {
+    if (!node)
+        return;
+    if (node->nodeKind == FUNCCALLEXPR) {
+        cgNode *callee = findFunction(graph, node->children[0]->name);
+        cgSite *site = (cgSite *) calloc(1, sizeof(cgSite));
+        site->call = node;
+        site->next = graph->sites;
+        graph->sites = site;
+        if (callee->foldable && foldCall(graph, node, &site->value)) {
+            site->folded = 1;
+            return;
+        }
+        if (callee->decl && !callee->inlined) {
+            tree *args = node->children[1];
+            int numArgs = args ? args->numChildren : 0;
+            argSignature *sig = (argSignature *) calloc(1, sizeof(argSignature));
+            sig->site = site;
+            sig->caller = caller;
+            sig->callee = callee;
+            sig->kind = (int *) calloc(numArgs + 1, sizeof(int));
+            sig->value = (int *) calloc(numArgs + 1, sizeof(int));
+            for (int i = 0; i < numArgs; i++) {
+                if (constantArg(graph, args->children[i], &sig->value[i]))
+                    sig->kind[i] = ARG_CONSTANT;
+                else if (isParamPassedOn(caller, callee, args->children[i], i))
+                    sig->kind[i] = ARG_SAME;
+            }
+            sig->next = *sigs;
+            *sigs = sig;
+        }
+    }
+    for (int i = 0; i < node->numChildren; i++)
+        collectSites(graph, caller, node->children[i], sigs);
+}
+
+// Functions reached only through folded calls are no longer needed
+static void markLive(callGraph *graph, tree *node, char *live) {
+    if (!node)
+        return;
+    if (node->nodeKind == FUNCCALLEXPR) {
+        cgSite *site = findSite(graph, node);
+        if (site && site->folded)
+            return;
+        cgNode *callee = findFunction(graph, node->children[0]->name);
+        if (!live[callee->index]) {
+            live[callee->index] = 1;
+            if (callee->decl)
+                markLive(graph, callee->decl->children[2], live);
+        }
+    }
+    for (int i = 0; i < node->numChildren; i++)
+        markLive(graph, node->children[i], live);
+}
+
+/* ---------- specialization ---------- */
+
+static int isCallTo(argSignature *sig, cgNode *node) {
+    return sig->callee == node && sig->caller->reachable;
+}
+
+static cgSpec *newSpec(cgNode *node, char *name, int numParams) {
+    cgSpec *spec = (cgSpec *) calloc(1, sizeof(cgSpec));
+    spec->name = name;
+    spec->known = (int *) calloc(numParams + 1, sizeof(int));
+    spec->value = (int *) calloc(numParams + 1, sizeof(int));
+    cgSpec **tail = &node->specs;
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = spec;
+    return spec;
+}
+
+static int bodySize(tree *node) {
+    if (!node)
+        return 0;
+    int size = 1;
+    for (int i = 0; i < node->numChildren; i++)
+        size += bodySize(node->children[i]);
+    return size;
+}
+
+static int sameConstants(cgSpec *spec, argSignature *sig, int numParams) {
+    for (int i = 0; i < numParams; i++) {
+        if (spec->known[i] != (sig->kind[i] == ARG_CONSTANT))
+            return 0;
+        if (spec->known[i] && spec->value[i] != sig->value[i])
+            return 0;
+    }
+    return 1;
+}
+
+// A parameter every call agrees on is fixed in the function itself.
+// Otherwise a non-recursive function gets a clone per distinct set of
+// constant arguments, up to MAX_CLONES, and the remaining calls keep
+// the generic version.
+static void specialize(cgNode *node, argSignature *sigs) {
+    int numParams = node->decl->children[1]->numChildren;
+    int numSites = 0;
+    for (argSignature *sig = sigs; sig; sig = sig->next)
+        numSites += isCallTo(sig, node);
+    if (numSites == 0) {
+        node->generic = 0;      // every call was folded
+        return;
+    }
+
+    int anyKnown = 0;
+    int *known = (int *) calloc(numParams + 1, sizeof(int));
+    int *value = (int *) calloc(numParams + 1, sizeof(int));
+    for (int i = 0; i < numParams; i++) {
+        int agree = 1, have = 0;
+        for (argSignature *sig = sigs; sig && agree; sig = sig->next) {
+            if (!isCallTo(sig, node) || sig->kind[i] == ARG_SAME)
+                continue;
+            if (sig->kind[i] == ARG_UNKNOWN || (have && sig->value[i] != value[i]))
+                agree = 0;
+            value[i] = sig->value[i];
+            have = 1;
+        }
+        known[i] = agree && have;
+        anyKnown |= known[i];
+    }
+    if (anyKnown) {
+        cgSpec *spec = newSpec(node, node->name, numParams);
+        memcpy(spec->known, known, numParams * sizeof(int));
+        memcpy(spec->value, value, numParams * sizeof(int));
+        for (argSignature *sig = sigs; sig; sig = sig->next)
+            if (isCallTo(sig, node))
+                sig->site->spec = spec;
+        node->generic = 0;
+    } else if (!node->recursive && bodySize(node->decl->children[2]) <= CLONE_SIZE_LIMIT) {
+        int clones = 0;
+        node->generic = 0;
+        for (argSignature *sig = sigs; sig; sig = sig->next) {
+            if (!isCallTo(sig, node))
+                continue;
+            int constants = 0;
+            for (int i = 0; i < numParams; i++)
+                constants += sig->kind[i] == ARG_CONSTANT;
+            cgSpec *spec = node->specs;
+            while (spec && !sameConstants(spec, sig, numParams))
+                spec = spec->next;
+            if (!spec && constants > 0 && clones < MAX_CLONES) {
+                char *name = (char *) malloc(strlen(node->name) + 16);
+                sprintf(name, "%s.%d", node->name, ++clones);
+                spec = newSpec(node, name, numParams);
+                for (int i = 0; i < numParams; i++) {
+                    spec->known[i] = sig->kind[i] == ARG_CONSTANT;
+                    spec->value[i] = sig->value[i];
+                }
+            }
+            sig->site->spec = spec;
+            if (!spec)
+                node->generic = 1;
+        }
+    }
+    free(known);
+    free(value);
+}
+
+void analyzeCalls(callGraph *graph, int profiled) {
+    markPureFunctions(graph, profiled);
+
+    argSignature *sigs = NULL;
+    for (cgNode *node = graph->funcs; node; node = node->next)
+        if (node->reachable && node->decl)
+            collectSites(graph, node, node->decl->children[2], &sigs);
+
+    cgNode *main = findFunction(graph, "main");
+    if (main && main->decl) {
+        int numFuncs = 0;
+        for (cgNode *node = graph->funcs; node; node = node->next)
+            numFuncs++;
+        char *live = (char *) calloc(numFuncs, 1);
+        live[main->index] = 1;
+        markLive(graph, main->decl->children[2], live);
+        for (cgNode *node = graph->funcs; node; node = node->next)
+            node->reachable &= live[node->index];
+        free(live);
+    }
+
+    for (cgNode *node = graph->funcs; node; node = node->next)
+        if (node->reachable && node->decl && !node->inlined && strcmp(node->name, "main") != 0)
+            specialize(node, sigs);
+
+    while (sigs) {
+        argSignature *sig = sigs;
+        sigs = sig->next;
+        free(sig->kind);
+        free(sig->value);
+        free(sig);
+    }
+}
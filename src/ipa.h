@@ -0,0 +1,14 @@
+#ifndef IPA_H
+#define IPA_H
+
+#include "callgraph.h"
+
+// Interprocedural analysis over the call graph. Marks pure and foldable
+// functions, evaluates calls to foldable functions whose arguments are
+// all constants, and gives functions versions with the parameters fixed
+// that every call, or a group of calls, passes the same constant.
+// Functions marked inlined are left to the inliner. Profiled functions
+// count their calls, so none of them is pure.
+void analyzeCalls(callGraph *graph, int profiled);
+
+#endif
@@ -0,0 +1,237 @@
+#include "licm.h"
+#include <stdlib.h>
+#include <string.h>
+
+// A while loop in the instruction list: the header label and the branch
+// that jumps back to it
+typedef struct loopRange {
+    instr *header;
+    instr *backEdge;
+    int size;                   // instructions from header to back edge
+} loopRange;
+
+typedef struct licmState {
+    codeFunc *func;
+    int *numDefs;               // definitions of each vreg in the function
+    char *invariant;            // vreg is computed by an invariant instruction
+    char *hoist;                // vreg's definition will be hoisted
+} licmState;
+
+static char *branchTarget(instr *ins) {
+    if (ins->op == OP_B || ins->op == OP_J)
+        return ins->opnd[0].label;
+    if (ins->op == OP_BEQ || ins->op == OP_BNE)
+        return ins->opnd[2].label;
+    return NULL;
+}
+
+static int isLabel(instr *ins, char *name) {
+    return ins->kind == I_LABEL && strcmp(ins->text, name) == 0;
+}
+
+// Backward branches close loops. A loop is only kept if nothing outside
+// it jumps to one of its labels, so the code just above the header runs
+// exactly once on entry.
+static int findLoops(codeFunc *func, loopRange **loops) {
+    int count = 0;
+    *loops = NULL;
+    for (instr *ins = func->code.head; ins; ins = ins->next) {
+        char *target;
+        if (!isBranch(ins) || !(target = branchTarget(ins)))
+            continue;
+        instr *header = NULL;
+        int size = 0;
+        for (instr *p = ins; p; p = p->prev, size++) {
+            if (isLabel(p, target)) {
+                header = p;
+                break;
+            }
+        }
+        if (!header)
+            continue;
+
+        int entered = 0;
+        for (instr *p = func->code.head; p && !entered; p = p->next) {
+            if (p == header) {
+                p = ins;
+                continue;
+            }
+            char *t;
+            if (isBranch(p) && (t = branchTarget(p)))
+                for (instr *q = header; q != ins->next && !entered; q = q->next)
+                    entered = isLabel(q, t);
+        }
+        if (entered)
+            continue;
+
+        *loops = (loopRange *) realloc(*loops, (count + 1) * sizeof(loopRange));
+        (*loops)[count].header = header;
+        (*loops)[count].backEdge = ins;
+        (*loops)[count].size = size;
+        count++;
+    }
+    return count;
+}
+
+// Inner loops first, so their invariants can move on out of outer loops
+static int compareLoops(const void *a, const void *b) {
+    return ((loopRange *) a)->size - ((loopRange *) b)->size;
+}
+
+static int sameLocation(operand *a, operand *b) {
+    if (a->kind != b->kind)
+        return 0;
+    if (a->kind == OPD_LABEL)
+        return strcmp(a->label, b->label) == 0;
+    return a->kind == OPD_MEM && a->reg == b->reg && a->imm == b->imm;
+}
+
+// A scalar variable slot: a global symbol or a $gp/$sp/$fp relative
+// slot. Array elements are reached through computed addresses instead.
+static int isScalarLocation(operand *o) {
+    return isGlobalLocation(o) ||
+           (o->kind == OPD_MEM && (o->reg == REG_SP || o->reg == REG_FP));
+}
+
+static int isInvariantReg(licmState *st, int reg, char *definedInLoop) {
+    if (reg == REG_ZERO || reg == REG_GP || reg == REG_SP || reg == REG_FP)
+        return 1;
+    if (!isVirtualReg(reg))
+        return 0;
+    return !definedInLoop[reg - FIRST_VREG] || st->invariant[reg - FIRST_VREG];
+}
+
+// Whether a load from o can be done once before the loop
+static int isInvariantLoad(instr *header, instr *backEdge, operand *o) {
+    if (!isScalarLocation(o))
+        return 0;
+    for (instr *ins = header; ins != backEdge->next; ins = ins->next) {
+        if (ins->kind != I_OP)
+            continue;
+        if (isStore(ins->op) && sameLocation(&ins->opnd[1], o))
+            return 0;
+        // A callee may store to globals but cannot reach our frame
+        if (ins->op == OP_JAL && !ins->pureCall && isGlobalLocation(o))
+            return 0;
+    }
+    return 1;
+}
+
+static int isHoistable(opcode op) {
+    switch (op) {
+        case OP_ADD: case OP_ADDI: case OP_SUB: case OP_SUBI: case OP_MUL:
+        case OP_SLL: case OP_SRA: case OP_SRL:
+        case OP_SLT: case OP_SLTI: case OP_SLTU: case OP_SLTIU: case OP_XORI:
+        case OP_LI: case OP_LA: case OP_MOVE: case OP_LW: case OP_LB:
+            return 1;
+        default:
+            // div may trap and mult/mfhi communicate through HI
+            return 0;
+    }
+}
+
+static int hoistLoop(licmState *st, loopRange *loop) {
+    int n = st->func->numVregs;
+    char *definedInLoop = (char *) calloc(n + 1, 1);
+    int regs[3];
+    for (instr *ins = loop->header; ins != loop->backEdge->next; ins = ins->next)
+        if (instrDefs(ins, regs) && isVirtualReg(regs[0]))
+            definedInLoop[regs[0] - FIRST_VREG] = 1;
+    memset(st->invariant, 0, n);
+    memset(st->hoist, 0, n);
+
+    // Mark invariant definitions until nothing changes
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (instr *ins = loop->header; ins != loop->backEdge->next; ins = ins->next) {
+            if (ins->kind != I_OP || !isHoistable(ins->op) || !instrDefs(ins, regs) || !isVirtualReg(regs[0]))
+                continue;
+            int def = regs[0] - FIRST_VREG;
+            if (st->invariant[def] || st->numDefs[def] != 1)
+                continue;
+            int ok = 1;
+            int numUses = instrUses(ins, regs);
+            for (int u = 0; u < numUses && ok; u++)
+                ok = isInvariantReg(st, regs[u], definedInLoop);
+            if (ok && isLoad(ins->op))
+                ok = isInvariantLoad(loop->header, loop->backEdge, &ins->opnd[1]);
+            if (ok) {
+                st->invariant[def] = 1;
+                changed = 1;
+            }
+        }
+    }
+
+    // Constants only move along with an invariant that uses them; on their
+    // own they would just tie up a register for the whole loop
+    for (instr *ins = loop->header; ins != loop->backEdge->next; ins = ins->next) {
+        if (!instrDefs(ins, regs) || !isVirtualReg(regs[0]) || !st->invariant[regs[0] - FIRST_VREG])
+            continue;
+        if (ins->op != OP_LI)
+            st->hoist[regs[0] - FIRST_VREG] = 1;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        for (instr *ins = loop->header; ins != loop->backEdge->next; ins = ins->next) {
+            if (!instrDefs(ins, regs) || !isVirtualReg(regs[0]) || !st->hoist[regs[0] - FIRST_VREG])
+                continue;
+            int numUses = instrUses(ins, regs);
+            for (int u = 0; u < numUses; u++)
+                if (isVirtualReg(regs[u]) && st->invariant[regs[u] - FIRST_VREG])
+                    st->hoist[regs[u] - FIRST_VREG] = 1;
+        }
+    }
+
+    // Move the marked definitions, in order, to just above the header.
+    // There they run on entry to the loop, so they are placed and weighted
+    // like the code in front of it, not like the arm they came from.
+    instr *entry = loop->header->prev;
+    while (entry && entry->kind != I_OP)
+        entry = entry->prev;
+    int moved = 0;
+    instr *ins = loop->header;
+    while (ins != loop->backEdge->next) {
+        instr *next = ins->next;
+        if (instrDefs(ins, regs) && isVirtualReg(regs[0]) && st->hoist[regs[0] - FIRST_VREG]) {
+            if (!moved) {
+                instr *comment = newInstr(I_COMMENT);
+                comment->text = strdup("Loop invariants");
+                insertBefore(&st->func->code, loop->header, comment);
+            }
+            removeInstr(&st->func->code, ins);
+            insertBefore(&st->func->code, loop->header, ins);
+            ins->cold = loop->header->cold;
+            ins->weight = entry ? entry->weight : -1;
+            moved++;
+        }
+        ins = next;
+    }
+    free(definedInLoop);
+    return moved;
+}
+
+void hoistLoopInvariants(codeFunc *func) {
+    loopRange *loops;
+    int numLoops = findLoops(func, &loops);
+    if (numLoops == 0)
+        return;
+    qsort(loops, numLoops, sizeof(loopRange), compareLoops);
+
+    licmState st;
+    st.func = func;
+    st.numDefs = (int *) calloc(func->numVregs + 1, sizeof(int));
+    st.invariant = (char *) calloc(func->numVregs + 1, 1);
+    st.hoist = (char *) calloc(func->numVregs + 1, 1);
+    int regs[3];
+    for (instr *ins = func->code.head; ins; ins = ins->next)
+        if (instrDefs(ins, regs) && isVirtualReg(regs[0]))
+            st.numDefs[regs[0] - FIRST_VREG]++;
+
+    for (int i = 0; i < numLoops; i++)
+        hoistLoop(&st, &loops[i]);
+
+    free(st.numDefs);
+    free(st.invariant);
+    free(st.hoist);
+    free(loops);
+}
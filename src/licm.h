@@ -0,0 +1,13 @@
+#ifndef LICM_H
+#define LICM_H
+
+#include "codegen.h"
+
+// Moves computations whose operands do not change inside a while loop to
+// just before the loop header: address computations, constants feeding
+// them, and loads of scalars that the loop never stores to (globals only
+// when the loop makes no calls). Runs on virtual registers, before
+// register allocation.
+void hoistLoopInvariants(codeFunc *func);
+
+#endif
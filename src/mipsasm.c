@@ -0,0 +1,635 @@
+#include "mipsasm.h"
+#include "codegen.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REG_AT 1
+
+// Primary opcodes and SPECIAL function codes of the MIPS32 encoding
+#define MIPS_SPECIAL  0x00
+#define MIPS_J        0x02
+#define MIPS_JAL      0x03
+#define MIPS_BEQ      0x04
+#define MIPS_BNE      0x05
+#define MIPS_ADDI     0x08
+#define MIPS_ADDIU    0x09
+#define MIPS_SLTI     0x0a
+#define MIPS_SLTIU    0x0b
+#define MIPS_ORI      0x0d
+#define MIPS_XORI     0x0e
+#define MIPS_LUI      0x0f
+#define MIPS_SPECIAL2 0x1c
+#define MIPS_LB       0x20
+#define MIPS_LW       0x23
+#define MIPS_SB       0x28
+#define MIPS_SW       0x2b
+
+#define FUNCT_SLL     0x00
+#define FUNCT_SRL     0x02
+#define FUNCT_SRA     0x03
+#define FUNCT_JR      0x08
+#define FUNCT_SYSCALL 0x0c
+#define FUNCT_MFHI    0x10
+#define FUNCT_MFLO    0x12
+#define FUNCT_MULT    0x18
+#define FUNCT_DIV     0x1a
+#define FUNCT_ADD     0x20
+#define FUNCT_ADDU    0x21
+#define FUNCT_SUB     0x22
+#define FUNCT_SLT     0x2a
+#define FUNCT_SLTU    0x2b
+#define FUNCT2_MUL    0x02
+
+// ELF32 constants
+#define ELF_HEADER_SIZE 52
+#define SECTION_HEADER_SIZE 40
+#define SYMBOL_SIZE 16
+#define REL_SIZE 8
+#define ET_REL 1
+#define EM_MIPS 8
+#define EF_MIPS_ARCH_32 0x50000000u
+#define EF_MIPS_ABI_O32 0x00001000u
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB 2
+#define SHT_STRTAB 3
+#define SHT_REL 9
+#define SHF_WRITE 1
+#define SHF_ALLOC 2
+#define SHF_EXECINSTR 4
+#define STB_LOCAL 0
+#define STB_GLOBAL 1
+#define STT_NOTYPE 0
+#define STT_OBJECT 1
+#define STT_FUNC 2
+#define STT_SECTION 3
+#define R_MIPS_26 4
+#define R_MIPS_HI16 5
+#define R_MIPS_LO16 6
+
+// Sections, in header order; the first symbols are those of .text and .data
+enum { SEC_NULL, SEC_TEXT, SEC_REL_TEXT, SEC_DATA, SEC_SYMTAB, SEC_STRTAB, SEC_SHSTRTAB, NUM_SECTIONS };
+enum { SYM_NULL, SYM_TEXT, SYM_DATA, NUM_LOCAL_SYMS };
+
+typedef struct asmItem {
+    instr *ins;             // operation or label
+    int addr;               // bytes from the start of .text
+    int far;                // branch to a target out of reach of 16 bits
+} asmItem;
+
+typedef struct asmReloc {
+    int offset;
+    int type;
+    int symbol;             // SYM_TEXT or SYM_DATA; the addend is in the instruction
+} asmReloc;
+
+typedef struct asmState {
+    asmItem *items;
+    int numItems;
+    dataItem *data;
+    int numData;
+    uint32_t *words;        // NULL while sizing
+    int numWords;
+    asmReloc *relocs;
+    int numRelocs;
+    int checkReach;         // label addresses are known well enough to find far branches
+    int changed;            // a branch became far during this pass
+    int error;
+} asmState;
+
+typedef struct byteBuffer {
+    unsigned char *bytes;
+    int size, cap;
+} byteBuffer;
+
+/* ---------- encoding ---------- */
+
+static int fits16(int value) {
+    return value >= -32768 && value <= 32767;
+}
+
+static uint32_t rType(int rs, int rt, int rd, int sa, int funct) {
+    return (uint32_t) rs << 21 | (uint32_t) rt << 16 | (uint32_t) rd << 11 | (uint32_t) sa << 6 | (uint32_t) funct;
+}
+
+static uint32_t iType(int op, int rs, int rt, int imm) {
+    return (uint32_t) op << 26 | (uint32_t) rs << 21 | (uint32_t) rt << 16 | ((uint32_t) imm & 0xffff);
+}
+
+static void put(asmState *st, uint32_t word) {
+    if (st->words)
+        st->words[st->numWords] = word;
+    st->numWords++;
+}
+
+// Relocates the next word put
+static void reloc(asmState *st, int type, int symbol) {
+    if (!st->words)
+        return;
+    asmReloc *r = &st->relocs[st->numRelocs++];
+    r->offset = 4 * st->numWords;
+    r->type = type;
+    r->symbol = symbol;
+}
+
+// Address of a label and the section it is in
+static int findLabel(asmState *st, char *name, int *symbol) {
+    for (int i = 0; i < st->numItems; i++) {
+        instr *ins = st->items[i].ins;
+        if (ins->kind == I_LABEL && strcmp(ins->text, name) == 0) {
+            *symbol = SYM_TEXT;
+            return st->items[i].addr;
+        }
+    }
+    for (int i = 0; i < st->numData; i++) {
+        if (strcmp(st->data[i].label, name) == 0) {
+            *symbol = SYM_DATA;
+            return st->data[i].offset;
+        }
+    }
+    if (st->words && !st->error) {
+        fprintf(stderr, "error: undefined label %s\n", name);
+        st->error = 1;
+    }
+    *symbol = SYM_TEXT;
+    return 0;
+}
+
+static void loadImmediate(asmState *st, int reg, int value) {
+    if (fits16(value)) {
+        put(st, iType(MIPS_ADDIU, 0, reg, value));
+    } else if ((unsigned) value <= 0xffff) {
+        put(st, iType(MIPS_ORI, 0, reg, value));
+    } else {
+        put(st, iType(MIPS_LUI, 0, reg, (int) ((unsigned) value >> 16)));
+        if (value & 0xffff)
+            put(st, iType(MIPS_ORI, reg, reg, value));
+    }
+}
+
+// An immediate out of range goes through $at
+static void immediateOp(asmState *st, int op, int funct, int rd, int rs, int value) {
+    if (fits16(value)) {
+        put(st, iType(op, rs, rd, value));
+    } else {
+        loadImmediate(st, REG_AT, value);
+        put(st, rType(rs, REG_AT, rd, 0, funct));
+    }
+}
+
+// Second operand of a three-operand op: a register, or an immediate in $at
+static int sourceReg(asmState *st, operand *o) {
+    if (o->kind == OPD_REG)
+        return o->reg;
+    if (o->imm == 0)
+        return REG_ZERO;
+    loadImmediate(st, REG_AT, o->imm);
+    return REG_AT;
+}
+
+// lui and the low half of a label's address, the low half sign-extended
+// by the instruction that takes it
+static void labelHigh(asmState *st, int reg, char *label, int *low, int *symbol) {
+    unsigned addr = (unsigned) findLabel(st, label, symbol);
+    reloc(st, R_MIPS_HI16, *symbol);
+    put(st, iType(MIPS_LUI, 0, reg, (int) ((addr + 0x8000) >> 16)));
+    *low = (int) (addr & 0xffff);
+}
+
+static void memoryOp(asmState *st, int op, int rt, operand *o) {
+    int low, symbol;
+    if (o->kind == OPD_LABEL) {
+        labelHigh(st, REG_AT, o->label, &low, &symbol);
+        reloc(st, R_MIPS_LO16, symbol);
+        put(st, iType(op, REG_AT, rt, low));
+    } else if (fits16(o->imm)) {
+        put(st, iType(op, o->reg, rt, o->imm));
+    } else {
+        put(st, iType(MIPS_LUI, 0, REG_AT, (int) (((unsigned) o->imm + 0x8000) >> 16)));
+        put(st, rType(REG_AT, o->reg, REG_AT, 0, FUNCT_ADDU));
+        put(st, iType(op, REG_AT, rt, o->imm));
+    }
+}
+
+static void jump(asmState *st, int op, char *label) {
+    int symbol;
+    unsigned addr = (unsigned) findLabel(st, label, &symbol);
+    reloc(st, R_MIPS_26, symbol);
+    put(st, (uint32_t) op << 26 | (addr >> 2 & 0x3ffffff));
+    put(st, 0);
+}
+
+// A far branch jumps over a jump to the target: bne a, b, 1f; nop; j L; nop; 1:
+static void branch(asmState *st, asmItem *item, int op, int rs, int rt, char *label) {
+    int symbol;
+    int offset = (findLabel(st, label, &symbol) - 4 * (st->numWords + 1)) / 4;
+    if (!st->words && st->checkReach && !item->far && !fits16(offset)) {
+        item->far = 1;
+        st->changed = 1;
+    }
+    if (item->far) {
+        if (rs != REG_ZERO || rt != REG_ZERO) {
+            put(st, iType(op == MIPS_BEQ ? MIPS_BNE : MIPS_BEQ, rs, rt, 3));
+            put(st, 0);
+        }
+        jump(st, MIPS_J, label);
+    } else {
+        put(st, iType(op, rs, rt, offset));
+        put(st, 0);
+    }
+}
+
+static void encode(asmState *st, asmItem *item) {
+    instr *ins = item->ins;
+    operand *a = &ins->opnd[0], *b = &ins->opnd[1], *c = &ins->opnd[2];
+    int low, symbol;
+    switch (ins->op) {
+        case OP_ADD:
+            if (c->kind == OPD_REG)
+                put(st, rType(b->reg, c->reg, a->reg, 0, FUNCT_ADD));
+            else
+                immediateOp(st, MIPS_ADDI, FUNCT_ADD, a->reg, b->reg, c->imm);
+            break;
+        case OP_ADDI:
+            immediateOp(st, MIPS_ADDI, FUNCT_ADD, a->reg, b->reg, c->imm);
+            break;
+        case OP_SUB:
+        case OP_SUBI:
+            if (c->kind == OPD_REG)
+                put(st, rType(b->reg, c->reg, a->reg, 0, FUNCT_SUB));
+            else if (c->imm > -32768 && c->imm <= 32768)
+                put(st, iType(MIPS_ADDI, b->reg, a->reg, -c->imm));
+            else
+                put(st, rType(b->reg, sourceReg(st, c), a->reg, 0, FUNCT_SUB));
+            break;
+        case OP_MUL: {
+            int rt = sourceReg(st, c);
+            put(st, (uint32_t) MIPS_SPECIAL2 << 26 | rType(b->reg, rt, a->reg, 0, FUNCT2_MUL));
+            break;
+        }
+        case OP_DIV: {
+            int rt = sourceReg(st, c);
+            put(st, rType(b->reg, rt, 0, 0, FUNCT_DIV));
+            put(st, rType(0, 0, a->reg, 0, FUNCT_MFLO));
+            break;
+        }
+        case OP_SLL:
+            put(st, rType(0, b->reg, a->reg, c->imm & 31, FUNCT_SLL));
+            break;
+        case OP_SRA:
+            put(st, rType(0, b->reg, a->reg, c->imm & 31, FUNCT_SRA));
+            break;
+        case OP_SRL:
+            put(st, rType(0, b->reg, a->reg, c->imm & 31, FUNCT_SRL));
+            break;
+        case OP_MULT:
+            put(st, rType(a->reg, b->reg, 0, 0, FUNCT_MULT));
+            break;
+        case OP_MFHI:
+            put(st, rType(0, 0, a->reg, 0, FUNCT_MFHI));
+            break;
+        case OP_SLT:
+        case OP_SLTI:
+            if (c->kind == OPD_REG)
+                put(st, rType(b->reg, c->reg, a->reg, 0, FUNCT_SLT));
+            else
+                immediateOp(st, MIPS_SLTI, FUNCT_SLT, a->reg, b->reg, c->imm);
+            break;
+        case OP_SLTU:
+        case OP_SLTIU:
+            if (c->kind == OPD_REG)
+                put(st, rType(b->reg, c->reg, a->reg, 0, FUNCT_SLTU));
+            else
+                immediateOp(st, MIPS_SLTIU, FUNCT_SLTU, a->reg, b->reg, c->imm);
+            break;
+        case OP_XORI:
+            put(st, iType(MIPS_XORI, b->reg, a->reg, c->imm));
+            break;
+        case OP_LI:
+            loadImmediate(st, a->reg, b->imm);
+            break;
+        case OP_LA:
+            if (b->kind == OPD_LABEL) {
+                labelHigh(st, a->reg, b->label, &low, &symbol);
+                reloc(st, R_MIPS_LO16, symbol);
+                put(st, iType(MIPS_ADDIU, a->reg, a->reg, low));
+            } else {
+                immediateOp(st, MIPS_ADDIU, FUNCT_ADDU, a->reg, b->reg, b->imm);
+            }
+            break;
+        case OP_MOVE:
+            put(st, rType(b->reg, REG_ZERO, a->reg, 0, FUNCT_ADDU));
+            break;
+        case OP_LW:
+            memoryOp(st, MIPS_LW, a->reg, b);
+            break;
+        case OP_SW:
+            memoryOp(st, MIPS_SW, a->reg, b);
+            break;
+        case OP_LB:
+            memoryOp(st, MIPS_LB, a->reg, b);
+            break;
+        case OP_SB:
+            memoryOp(st, MIPS_SB, a->reg, b);
+            break;
+        case OP_BEQ:
+        case OP_BNE: {
+            int rt = sourceReg(st, b);
+            branch(st, item, ins->op == OP_BEQ ? MIPS_BEQ : MIPS_BNE, a->reg, rt, c->label);
+            break;
+        }
+        case OP_B:
+            branch(st, item, MIPS_BEQ, REG_ZERO, REG_ZERO, a->label);
+            break;
+        case OP_J:
+            jump(st, MIPS_J, a->label);
+            break;
+        case OP_JAL:
+            jump(st, MIPS_JAL, a->label);
+            break;
+        case OP_JR:
+            put(st, rType(a->reg, 0, 0, 0, FUNCT_JR));
+            put(st, 0);
+            break;
+        case OP_SYSCALL:
+            put(st, FUNCT_SYSCALL);
+            break;
+        default:
+            break;
+    }
+}
+
+// One pass over the code: places the labels and encodes the operations,
+// or only counts their words while st->words is NULL
+static void assemble(asmState *st) {
+    st->numWords = 0;
+    st->numRelocs = 0;
+    for (int i = 0; i < st->numItems; i++) {
+        asmItem *item = &st->items[i];
+        item->addr = 4 * st->numWords;
+        if (item->ins->kind == I_OP)
+            encode(st, item);
+    }
+}
+
+/* ---------- the program ---------- */
+
+static void addItems(asmState *st, instrList *list) {
+    for (instr *ins = list->head; ins; ins = ins->next) {
+        if (ins->kind != I_OP && ins->kind != I_LABEL)
+            continue;
+        st->items = (asmItem *) realloc(st->items, (st->numItems + 1) * sizeof(asmItem));
+        memset(&st->items[st->numItems], 0, sizeof(asmItem));
+        st->items[st->numItems++].ins = ins;
+    }
+}
+
+static instr *newLabel(char *name) {
+    instr *ins = newInstr(I_LABEL);
+    ins->text = name;
+    return ins;
+}
+
+// The code writeCode prints before and after the functions
+static void runtimeCode(instrList *startup, instrList *output, int hasSmallData, int hasProfile) {
+    if (hasSmallData)
+        appendInstr(startup, newOp(OP_LA, regOpnd(REG_GP), labelOpnd("smalldata"), noOpnd()));
+    appendInstr(startup, newOp(OP_JAL, labelOpnd("startmain"), noOpnd(), noOpnd()));
+    if (hasProfile)
+        appendInstr(startup, newOp(OP_JAL, labelOpnd("profiledump"), noOpnd(), noOpnd()));
+    appendInstr(startup, newOp(OP_LI, regOpnd(REG_V0), immOpnd(10), noOpnd()));
+    appendInstr(startup, newOp(OP_SYSCALL, noOpnd(), noOpnd(), noOpnd()));
+
+    appendInstr(output, newLabel("startoutput"));
+    appendInstr(output, newOp(OP_LW, regOpnd(REG_A0), memOpnd(4, REG_SP), noOpnd()));
+    appendInstr(output, newOp(OP_LI, regOpnd(REG_V0), immOpnd(1), noOpnd()));
+    appendInstr(output, newOp(OP_SYSCALL, noOpnd(), noOpnd(), noOpnd()));
+    appendInstr(output, newOp(OP_JR, regOpnd(REG_RA), noOpnd(), noOpnd()));
+}
+
+static void freeList(instrList *list) {
+    instr *next;
+    for (instr *ins = list->head; ins; ins = next) {
+        next = ins->next;
+        free(ins);
+    }
+}
+
+/* ---------- ELF ---------- */
+
+static void reserve(byteBuffer *buf, int bytes) {
+    if (buf->size + bytes > buf->cap) {
+        buf->cap = 2 * (buf->size + bytes);
+        buf->bytes = (unsigned char *) realloc(buf->bytes, buf->cap);
+    }
+}
+
+static void putBytes(byteBuffer *buf, const void *bytes, int size) {
+    reserve(buf, size);
+    memcpy(buf->bytes + buf->size, bytes, size);
+    buf->size += size;
+}
+
+static void put8(byteBuffer *buf, unsigned value) {
+    unsigned char byte = (unsigned char) value;
+    putBytes(buf, &byte, 1);
+}
+
+static void put16(byteBuffer *buf, unsigned value) {
+    put8(buf, value);
+    put8(buf, value >> 8);
+}
+
+static void put32(byteBuffer *buf, uint32_t value) {
+    put16(buf, value);
+    put16(buf, value >> 16);
+}
+
+static void align(byteBuffer *buf, int to) {
+    while (buf->size % to)
+        put8(buf, 0);
+}
+
+// Appends a NUL-terminated name and returns its offset
+static int addString(byteBuffer *strtab, const char *s) {
+    int offset = strtab->size;
+    putBytes(strtab, s, (int) strlen(s) + 1);
+    return offset;
+}
+
+static void addSymbol(byteBuffer *symtab, int name, int value, int size, int bind, int type, int section) {
+    put32(symtab, name);
+    put32(symtab, value);
+    put32(symtab, size);
+    put8(symtab, bind << 4 | type);
+    put8(symtab, 0);
+    put16(symtab, section);
+}
+
+typedef struct sectionHeader {
+    int name, type, flags, offset, size, link, info, align, entsize;
+} sectionHeader;
+
+// The profile dump routine is the one function without a start label
+static int isFunctionLabel(instr *ins) {
+    return ins->kind == I_LABEL && (strncmp(ins->text, "start", 5) == 0 || strcmp(ins->text, "profiledump") == 0 ||
+                                    strcmp(ins->text, "boundserror") == 0);
+}
+
+// Functions are the start labels, sized up to the next one; globals are
+// the data items. __start marks the startup code.
+static int buildSymbols(asmState *st, byteBuffer *symtab, byteBuffer *strtab) {
+    int textBytes = 4 * st->numWords;
+    addString(strtab, "");
+    addSymbol(symtab, 0, 0, 0, STB_LOCAL, STT_NOTYPE, 0);
+    addSymbol(symtab, 0, 0, 0, STB_LOCAL, STT_SECTION, SEC_TEXT);
+    addSymbol(symtab, 0, 0, 0, STB_LOCAL, STT_SECTION, SEC_DATA);
+    addSymbol(symtab, addString(strtab, "__start"), 0, 0, STB_GLOBAL, STT_FUNC, SEC_TEXT);
+    for (int i = 0; i < st->numItems; i++) {
+        instr *ins = st->items[i].ins;
+        if (!isFunctionLabel(ins))
+            continue;
+        int end = textBytes;
+        for (int j = i + 1; j < st->numItems && end == textBytes; j++)
+            if (isFunctionLabel(st->items[j].ins))
+                end = st->items[j].addr;
+        addSymbol(symtab, addString(strtab, ins->text), st->items[i].addr, end - st->items[i].addr,
+                  STB_GLOBAL, STT_FUNC, SEC_TEXT);
+    }
+    for (int i = 0; i < st->numData; i++) {
+        dataItem *d = &st->data[i];
+        addSymbol(symtab, addString(strtab, d->label), d->offset, d->bytes,
+                  STB_GLOBAL, d->bytes ? STT_OBJECT : STT_NOTYPE, SEC_DATA);
+    }
+    return NUM_LOCAL_SYMS;
+}
+
+static void writeElf(FILE *out, asmState *st) {
+    byteBuffer file = {0}, symtab = {0}, strtab = {0}, shstrtab = {0};
+    sectionHeader sh[NUM_SECTIONS];
+    memset(sh, 0, sizeof(sh));
+    int firstGlobal = buildSymbols(st, &symtab, &strtab);
+    int dataBytes = 0;
+    for (int i = 0; i < st->numData; i++)
+        if (st->data[i].offset + st->data[i].bytes > dataBytes)
+            dataBytes = st->data[i].offset + st->data[i].bytes;
+
+    addString(&shstrtab, "");
+    sh[SEC_TEXT].name = addString(&shstrtab, ".text");
+    sh[SEC_REL_TEXT].name = addString(&shstrtab, ".rel.text");
+    sh[SEC_DATA].name = addString(&shstrtab, ".data");
+    sh[SEC_SYMTAB].name = addString(&shstrtab, ".symtab");
+    sh[SEC_STRTAB].name = addString(&shstrtab, ".strtab");
+    sh[SEC_SHSTRTAB].name = addString(&shstrtab, ".shstrtab");
+
+    reserve(&file, ELF_HEADER_SIZE);
+    file.size = ELF_HEADER_SIZE;
+
+    sh[SEC_TEXT] = (sectionHeader) {sh[SEC_TEXT].name, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, file.size, 4 * st->numWords, 0, 0, 4, 0};
+    for (int i = 0; i < st->numWords; i++)
+        put32(&file, st->words[i]);
+
+    align(&file, 4);
+    sh[SEC_DATA] = (sectionHeader) {sh[SEC_DATA].name, SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, file.size, dataBytes, 0, 0, 4, 0};
+    for (int i = 0; i < dataBytes; i++)
+        put8(&file, 0);
+
+    align(&file, 4);
+    sh[SEC_REL_TEXT] = (sectionHeader) {sh[SEC_REL_TEXT].name, SHT_REL, 0, file.size, REL_SIZE * st->numRelocs,
+                                        SEC_SYMTAB, SEC_TEXT, 4, REL_SIZE};
+    for (int i = 0; i < st->numRelocs; i++) {
+        put32(&file, st->relocs[i].offset);
+        put32(&file, (uint32_t) st->relocs[i].symbol << 8 | st->relocs[i].type);
+    }
+
+    sh[SEC_SYMTAB] = (sectionHeader) {sh[SEC_SYMTAB].name, SHT_SYMTAB, 0, file.size, symtab.size,
+                                      SEC_STRTAB, firstGlobal, 4, SYMBOL_SIZE};
+    putBytes(&file, symtab.bytes, symtab.size);
+    sh[SEC_STRTAB] = (sectionHeader) {sh[SEC_STRTAB].name, SHT_STRTAB, 0, file.size, strtab.size, 0, 0, 1, 0};
+    putBytes(&file, strtab.bytes, strtab.size);
+    sh[SEC_SHSTRTAB] = (sectionHeader) {sh[SEC_SHSTRTAB].name, SHT_STRTAB, 0, file.size, shstrtab.size, 0, 0, 1, 0};
+    putBytes(&file, shstrtab.bytes, shstrtab.size);
+
+    align(&file, 4);
+    int sectionHeaders = file.size;
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        put32(&file, sh[i].name);
+        put32(&file, sh[i].type);
+        put32(&file, sh[i].flags);
+        put32(&file, 0);
+        put32(&file, sh[i].offset);
+        put32(&file, sh[i].size);
+        put32(&file, sh[i].link);
+        put32(&file, sh[i].info);
+        put32(&file, sh[i].align);
+        put32(&file, sh[i].entsize);
+    }
+
+    // The header goes in last, once the section header offset is known
+    byteBuffer header = {0};
+    static const unsigned char ident[16] = {0x7f, 'E', 'L', 'F', 1, 1, 1};   // 32-bit, little-endian, version 1
+    putBytes(&header, ident, 16);
+    put16(&header, ET_REL);
+    put16(&header, EM_MIPS);
+    put32(&header, 1);
+    put32(&header, 0);                  // entry
+    put32(&header, 0);                  // program headers
+    put32(&header, sectionHeaders);
+    put32(&header, EF_MIPS_ARCH_32 | EF_MIPS_ABI_O32);
+    put16(&header, ELF_HEADER_SIZE);
+    put16(&header, 0);
+    put16(&header, 0);
+    put16(&header, SECTION_HEADER_SIZE);
+    put16(&header, NUM_SECTIONS);
+    put16(&header, SEC_SHSTRTAB);
+    memcpy(file.bytes, header.bytes, ELF_HEADER_SIZE);
+
+    fwrite(file.bytes, 1, file.size, out);
+    free(file.bytes);
+    free(header.bytes);
+    free(symtab.bytes);
+    free(strtab.bytes);
+    free(shstrtab.bytes);
+}
+
+static int hasDataItem(asmState *st, const char *label) {
+    for (int i = 0; i < st->numData; i++)
+        if (strcmp(st->data[i].label, label) == 0)
+            return 1;
+    return 0;
+}
+
+int writeObject(FILE *out) {
+    asmState st;
+    instrList startup = {NULL, NULL}, output = {NULL, NULL};
+    memset(&st, 0, sizeof(st));
+    st.numData = layoutData(&st.data);
+    runtimeCode(&startup, &output, hasDataItem(&st, "smalldata"), hasDataItem(&st, "profilecounts"));
+    addItems(&st, &startup);
+    for (codeFunc *func = codeFuncs; func; func = func->next)
+        addItems(&st, &func->code);
+    addItems(&st, &output);
+
+    // Size with every branch near, then make far the ones that do not
+    // reach until nothing changes; code only grows, so this ends
+    assemble(&st);
+    st.checkReach = 1;
+    do {
+        st.changed = 0;
+        assemble(&st);
+    } while (st.changed);
+
+    st.words = (uint32_t *) calloc(st.numWords + 1, sizeof(uint32_t));
+    st.relocs = (asmReloc *) calloc(st.numWords + 1, sizeof(asmReloc));
+    assemble(&st);
+    if (!st.error)
+        writeElf(out, &st);
+
+    free(st.words);
+    free(st.relocs);
+    free(st.items);
+    free(st.data);
+    freeList(&startup);
+    freeList(&output);
+    return st.error ? -1 : 0;
+}
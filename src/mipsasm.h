@@ -0,0 +1,15 @@
+#ifndef MIPSASM_H
+#define MIPSASM_H
+
+#include <stdio.h>
+
+// Integrated assembler. Encodes the generated functions, with the startup
+// and output code writeCode prints around them, as MIPS32 machine code and
+// writes a relocatable little-endian ELF32 object: .text, .rel.text, .data
+// and a symbol table with the functions and globals. Pseudo-instructions
+// expand as an assembler would, a branch whose target is out of reach
+// becomes a jump, and every branch and jump gets a nop in its delay slot.
+// Returns 0, or -1 after printing the error on stderr.
+int writeObject(FILE *out);
+
+#endif
@@ -0,0 +1,525 @@
+#include "mipssim.h"
+#include "codegen.h"
+#include <ctype.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Memory map of SPIM, which the generated code is written for
+#define TEXT_BASE 0x00400000u
+#define DATA_BASE 0x10010000u
+#define GP_INIT   0x10008000u
+#define STACK_TOP 0x7ffffffcu
+#define STACK_SIZE (8u << 20)
+#define STACK_BASE (STACK_TOP + 4 - STACK_SIZE)
+
+#define STEP_LIMIT 4000000000L      // instructions before the program is assumed to loop
+
+// Extra cycles of the pipeline model beyond one per machine instruction
+#define LOAD_USE_STALL 1            // a loaded value reaches the next instruction a cycle late
+#define TAKEN_BRANCH_PENALTY 1      // branches resolve in decode, the fetched instruction is lost
+#define MUL_STALL 2                 // multiplier latency
+#define DIV_STALL 32                // iterative divider
+
+#define MAX_LINE 1024
+
+typedef struct simInstr {
+    int op;
+    operand opnd[3];
+    int line;
+} simInstr;
+
+typedef struct simLabel {
+    char *name;
+    unsigned value;             // data address or instruction index
+    int isText;
+} simLabel;
+
+typedef struct simMachine {
+    const char *path;
+    simInstr *code;
+    int numCode, capCode;
+    simLabel *labels;
+    int numLabels, capLabels;
+    unsigned char *data;
+    unsigned dataSize, capData;
+    unsigned char *stack;
+    int regs[32];
+    int hi;
+} simMachine;
+
+static const char *regAliases[32] = {
+    "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+    "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+    "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+    "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"
+};
+
+static void simError(simMachine *m, int line, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "sim: %s:%d: ", m->path, line);
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+}
+
+/* ---------- parsing ---------- */
+
+static char *trim(char *s) {
+    while (isspace((unsigned char) *s))
+        s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char) end[-1]))
+        *--end = '\0';
+    return s;
+}
+
+static int parseReg(const char *s) {
+    if (*s++ != '$')
+        return -1;
+    if (isdigit((unsigned char) *s)) {
+        int r = atoi(s);
+        return r < 32 ? r : -1;
+    }
+    for (int r = 0; r < 32; r++)
+        if (strcmp(s, regAliases[r]) == 0)
+            return r;
+    return -1;
+}
+
+static int isNumber(const char *s) {
+    if (*s == '-' || *s == '+')
+        s++;
+    return isdigit((unsigned char) *s);
+}
+
+static int parseOperand(char *s, operand *o) {
+    char *paren = strchr(s, '(');
+    if (*s == '$') {
+        o->kind = OPD_REG;
+        return (o->reg = parseReg(s)) >= 0;
+    }
+    if (paren) {
+        char *close = strchr(paren, ')');
+        if (!close)
+            return 0;
+        *paren = *close = '\0';
+        o->kind = OPD_MEM;
+        o->imm = *trim(s) ? (int) strtol(s, NULL, 0) : 0;
+        return (o->reg = parseReg(trim(paren + 1))) >= 0;
+    }
+    if (isNumber(s)) {
+        o->kind = OPD_IMM;
+        o->imm = (int) strtol(s, NULL, 0);
+        return 1;
+    }
+    o->kind = OPD_LABEL;
+    o->label = strdup(s);
+    return 1;
+}
+
+static void addLabel(simMachine *m, char *name, unsigned value, int isText) {
+    if (m->numLabels == m->capLabels) {
+        m->capLabels = m->capLabels ? 2 * m->capLabels : 64;
+        m->labels = (simLabel *) realloc(m->labels, m->capLabels * sizeof(simLabel));
+    }
+    simLabel *label = &m->labels[m->numLabels++];
+    label->name = strdup(name);
+    label->value = value;
+    label->isText = isText;
+}
+
+static simLabel *findLabel(simMachine *m, char *name) {
+    for (int i = 0; i < m->numLabels; i++)
+        if (strcmp(m->labels[i].name, name) == 0)
+            return &m->labels[i];
+    return NULL;
+}
+
+static void growData(simMachine *m, unsigned size) {
+    if (size > m->capData) {
+        m->capData = size > 2 * m->capData ? size : 2 * m->capData;
+        m->data = (unsigned char *) realloc(m->data, m->capData);
+    }
+    memset(m->data + m->dataSize, 0, size - m->dataSize);
+    m->dataSize = size;
+}
+
+static int parseDirective(simMachine *m, char *s, int line) {
+    char *arg = s;
+    while (*arg && !isspace((unsigned char) *arg))
+        arg++;
+    if (*arg)
+        *arg++ = '\0';
+    int value = (int) strtol(trim(arg), NULL, 0);
+    if (strcmp(s, ".word") == 0) {
+        growData(m, (m->dataSize + 3) / 4 * 4 + 4);
+        memcpy(m->data + m->dataSize - 4, &value, 4);
+    } else if (strcmp(s, ".byte") == 0) {
+        growData(m, m->dataSize + 1);
+        m->data[m->dataSize - 1] = (unsigned char) value;
+    } else if (strcmp(s, ".space") == 0 && value >= 0) {
+        growData(m, m->dataSize + value);
+    } else if (strcmp(s, ".align") == 0 && value >= 0 && value < 16) {
+        growData(m, (m->dataSize + (1u << value) - 1) / (1u << value) * (1u << value));
+    } else {
+        simError(m, line, "unsupported directive %s", s);
+        return 0;
+    }
+    return 1;
+}
+
+static int parseInstr(simMachine *m, char *s, int line) {
+    char *args = s;
+    while (*args && !isspace((unsigned char) *args))
+        args++;
+    if (*args)
+        *args++ = '\0';
+
+    simInstr ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.line = line;
+    ins.op = -1;
+    for (int op = 0; op < NUM_OPCODES && ins.op < 0; op++)
+        if (strcmp(s, opcodeName((opcode) op)) == 0)
+            ins.op = op;
+    if (ins.op < 0) {
+        simError(m, line, "unsupported instruction %s", s);
+        return 0;
+    }
+    int n = 0;
+    for (char *tok = strtok(args, ","); tok; tok = strtok(NULL, ",")) {
+        if (n == 3 || !parseOperand(trim(tok), &ins.opnd[n++])) {
+            simError(m, line, "bad operand %s", tok);
+            return 0;
+        }
+    }
+
+    if (m->numCode == m->capCode) {
+        m->capCode = m->capCode ? 2 * m->capCode : 256;
+        m->code = (simInstr *) realloc(m->code, m->capCode * sizeof(simInstr));
+    }
+    m->code[m->numCode++] = ins;
+    return 1;
+}
+
+static int loadProgram(simMachine *m, FILE *in) {
+    char buf[MAX_LINE];
+    int line = 0, inText = 1;
+    while (fgets(buf, sizeof(buf), in)) {
+        line++;
+        char *hash = strchr(buf, '#');
+        if (hash)
+            *hash = '\0';
+        char *s = trim(buf);
+        char *colon = strchr(s, ':');
+        if (colon && !strchr(s, '(')) {
+            *colon = '\0';
+            if (findLabel(m, trim(s))) {
+                simError(m, line, "label %s defined twice", trim(s));
+                return 0;
+            }
+            char *name = trim(s);
+            s = trim(colon + 1);
+            if (!inText && strncmp(s, ".word", 5) == 0)
+                growData(m, (m->dataSize + 3) / 4 * 4);     // the label goes with the aligned word
+            addLabel(m, name, inText ? (unsigned) m->numCode : DATA_BASE + m->dataSize, inText);
+        }
+        if (!*s)
+            continue;
+        if (strcmp(s, ".data") == 0 || strcmp(s, ".text") == 0) {
+            inText = s[1] == 't';
+            continue;
+        }
+        if (!(*s == '.' ? parseDirective(m, s, line) : parseInstr(m, s, line)))
+            return 0;
+    }
+
+    for (int i = 0; i < m->numCode; i++) {
+        for (int j = 0; j < 3; j++) {
+            operand *o = &m->code[i].opnd[j];
+            if (o->kind != OPD_LABEL)
+                continue;
+            simLabel *label = findLabel(m, o->label);
+            if (!label) {
+                simError(m, m->code[i].line, "undefined label %s", o->label);
+                return 0;
+            }
+            o->imm = (int) label->value;
+        }
+    }
+    return 1;
+}
+
+/* ---------- execution ---------- */
+
+static unsigned char *memAt(simMachine *m, unsigned addr, unsigned size) {
+    if (addr >= DATA_BASE && addr - DATA_BASE + size <= m->dataSize)
+        return m->data + (addr - DATA_BASE);
+    if (addr >= STACK_BASE && addr - STACK_BASE + size <= STACK_SIZE)
+        return m->stack + (addr - STACK_BASE);
+    return NULL;
+}
+
+static unsigned effectiveAddress(simMachine *m, operand *o) {
+    if (o->kind == OPD_LABEL)
+        return (unsigned) o->imm;
+    return (unsigned) m->regs[o->reg] + (unsigned) o->imm;
+}
+
+// Machine instructions the assembler turns an instruction into
+static int expansion(simInstr *ins) {
+    switch (ins->op) {
+        case OP_LA:
+            return 2;
+        case OP_LI:
+            return ins->opnd[1].imm >= -32768 && ins->opnd[1].imm <= 65535 ? 1 : 2;
+        case OP_ADDI:
+        case OP_SUBI:
+            return ins->opnd[2].imm >= -32768 && ins->opnd[2].imm <= 32767 ? 1 : 3;
+        case OP_DIV:
+            return 2;           // div and mflo
+        case OP_LW: case OP_SW: case OP_LB: case OP_SB:
+            return ins->opnd[1].kind == OPD_LABEL ? 2 : 1;
+        default:
+            return 1;
+    }
+}
+
+static simClass classOf(int op) {
+    switch (op) {
+        case OP_MUL: case OP_MULT: case OP_MFHI:
+            return SIM_MUL;
+        case OP_DIV:
+            return SIM_DIV;
+        case OP_LW: case OP_LB:
+            return SIM_LOAD;
+        case OP_SW: case OP_SB:
+            return SIM_STORE;
+        case OP_BEQ: case OP_BNE:
+            return SIM_BRANCH;
+        case OP_B: case OP_J:
+            return SIM_JUMP;
+        case OP_JAL:
+            return SIM_CALL;
+        case OP_JR:
+            return SIM_RETURN;
+        case OP_SYSCALL:
+            return SIM_SYSCALL;
+        default:
+            return SIM_ALU;
+    }
+}
+
+static int readsReg(simInstr *ins, int reg) {
+    for (int i = 0; i < 3; i++) {
+        operand *o = &ins->opnd[i];
+        if (o->kind == OPD_MEM && o->reg == reg)
+            return 1;
+        if (o->kind == OPD_REG && o->reg == reg && (i > 0 || !opDefinesFirst((opcode) ins->op)))
+            return 1;
+    }
+    // syscall reads $v0 and $a0
+    return ins->op == OP_SYSCALL && (reg == REG_V0 || reg == REG_A0);
+}
+
+static int operandValue(simMachine *m, operand *o) {
+    return o->kind == OPD_REG ? m->regs[o->reg] : o->imm;
+}
+
+static int run(simMachine *m, FILE *out, simStats *stats) {
+    int pc = 0, loadedReg = 0;
+    unsigned minSp = STACK_TOP;
+    m->regs[REG_GP] = (int) GP_INIT;
+    m->regs[REG_SP] = (int) STACK_TOP;
+
+    while (pc < m->numCode) {
+        simInstr *ins = &m->code[pc++];
+        operand *a = &ins->opnd[0], *b = &ins->opnd[1], *c = &ins->opnd[2];
+        int taken = 0, loads = 0;
+        unsigned char *p;
+
+        if (++stats->instrs > STEP_LIMIT) {
+            simError(m, ins->line, "stopped after %ld instructions", STEP_LIMIT);
+            return -1;
+        }
+        stats->byClass[classOf(ins->op)]++;
+        stats->machineInstrs += expansion(ins);
+        if (loadedReg && readsReg(ins, loadedReg))
+            stats->loadUseStalls++;
+
+        switch (ins->op) {
+            case OP_ADD:  m->regs[a->reg] = (int) ((unsigned) m->regs[b->reg] + (unsigned) operandValue(m, c)); break;
+            case OP_ADDI: m->regs[a->reg] = (int) ((unsigned) m->regs[b->reg] + (unsigned) c->imm); break;
+            case OP_SUB:  m->regs[a->reg] = (int) ((unsigned) m->regs[b->reg] - (unsigned) operandValue(m, c)); break;
+            case OP_SUBI: m->regs[a->reg] = (int) ((unsigned) m->regs[b->reg] - (unsigned) c->imm); break;
+            case OP_MUL:
+                m->regs[a->reg] = (int) ((unsigned) m->regs[b->reg] * (unsigned) operandValue(m, c));
+                stats->mulDivStalls += MUL_STALL;
+                break;
+            case OP_MULT: {
+                long long product = (long long) m->regs[a->reg] * m->regs[b->reg];
+                m->hi = (int) (product >> 32);
+                stats->mulDivStalls += MUL_STALL;
+                break;
+            }
+            case OP_MFHI: m->regs[a->reg] = m->hi; break;
+            case OP_DIV: {
+                int divisor = operandValue(m, c);
+                if (divisor == 0) {
+                    simError(m, ins->line, "division by zero");
+                    return -1;
+                }
+                int dividend = m->regs[b->reg];
+                m->regs[a->reg] = dividend == INT_MIN && divisor == -1 ? INT_MIN : dividend / divisor;
+                stats->mulDivStalls += DIV_STALL;
+                break;
+            }
+            case OP_SLL:  m->regs[a->reg] = (int) ((unsigned) m->regs[b->reg] << (c->imm & 31)); break;
+            case OP_SRA:  m->regs[a->reg] = m->regs[b->reg] >> (c->imm & 31); break;
+            case OP_SRL:  m->regs[a->reg] = (int) ((unsigned) m->regs[b->reg] >> (c->imm & 31)); break;
+            case OP_SLT:  m->regs[a->reg] = m->regs[b->reg] < operandValue(m, c); break;
+            case OP_SLTI: m->regs[a->reg] = m->regs[b->reg] < c->imm; break;
+            case OP_SLTU: m->regs[a->reg] = (unsigned) m->regs[b->reg] < (unsigned) operandValue(m, c); break;
+            case OP_SLTIU: m->regs[a->reg] = (unsigned) m->regs[b->reg] < (unsigned) c->imm; break;
+            case OP_XORI: m->regs[a->reg] = m->regs[b->reg] ^ (c->imm & 0xffff); break;
+            case OP_LI:   m->regs[a->reg] = b->imm; break;
+            case OP_LA:   m->regs[a->reg] = (int) effectiveAddress(m, b); break;
+            case OP_MOVE: m->regs[a->reg] = m->regs[b->reg]; break;
+            case OP_LW:
+            case OP_SW: {
+                unsigned addr = effectiveAddress(m, b);
+                if (addr % 4 || !(p = memAt(m, addr, 4))) {
+                    simError(m, ins->line, "bad word address 0x%08x", addr);
+                    return -1;
+                }
+                if (ins->op == OP_LW) {
+                    memcpy(&m->regs[a->reg], p, 4);
+                    loads = 1;
+                } else {
+                    memcpy(p, &m->regs[a->reg], 4);
+                }
+                break;
+            }
+            case OP_LB:
+            case OP_SB: {
+                unsigned addr = effectiveAddress(m, b);
+                if (!(p = memAt(m, addr, 1))) {
+                    simError(m, ins->line, "bad byte address 0x%08x", addr);
+                    return -1;
+                }
+                if (ins->op == OP_LB) {
+                    m->regs[a->reg] = (signed char) *p;
+                    loads = 1;
+                } else {
+                    *p = (unsigned char) m->regs[a->reg];
+                }
+                break;
+            }
+            case OP_BEQ:
+            case OP_BNE:
+                if ((m->regs[a->reg] == operandValue(m, b)) == (ins->op == OP_BEQ)) {
+                    pc = c->imm;
+                    taken = 1;
+                }
+                break;
+            case OP_B:
+            case OP_J:
+                pc = a->imm;
+                taken = 1;
+                break;
+            case OP_JAL:
+                m->regs[REG_RA] = (int) (TEXT_BASE + 4u * pc);
+                pc = a->imm;
+                taken = 1;
+                break;
+            case OP_JR: {
+                unsigned target = (unsigned) m->regs[a->reg];
+                if (target < TEXT_BASE || target % 4 || (target - TEXT_BASE) / 4 > (unsigned) m->numCode) {
+                    simError(m, ins->line, "jump to bad address 0x%08x", target);
+                    return -1;
+                }
+                pc = (int) ((target - TEXT_BASE) / 4);
+                taken = 1;
+                break;
+            }
+            case OP_SYSCALL:
+                switch (m->regs[REG_V0]) {
+                    case 1:
+                        fprintf(out, "%d", m->regs[REG_A0]);
+                        break;
+                    case 11:
+                        fputc(m->regs[REG_A0] & 0xff, out);
+                        break;
+                    case 10:
+                        pc = m->numCode;
+                        break;
+                    default:
+                        simError(m, ins->line, "unsupported syscall %d", m->regs[REG_V0]);
+                        return -1;
+                }
+                break;
+            default:
+                simError(m, ins->line, "unsupported instruction %s", opcodeName((opcode) ins->op));
+                return -1;
+        }
+        m->regs[REG_ZERO] = 0;
+        stats->takenBranches += taken;
+        loadedReg = loads && a->reg != REG_ZERO ? a->reg : 0;
+        if ((unsigned) m->regs[REG_SP] < minSp)
+            minSp = (unsigned) m->regs[REG_SP];
+    }
+    stats->maxStackBytes = STACK_TOP - minSp;
+    return 0;
+}
+
+int simulateFile(const char *path, FILE *out, simStats *stats) {
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "sim: unable to read %s\n", path);
+        return -1;
+    }
+    simMachine m;
+    memset(&m, 0, sizeof(m));
+    m.path = path;
+    memset(stats, 0, sizeof(*stats));
+    int ok = loadProgram(&m, in);
+    fclose(in);
+    int status = -1;
+    if (ok) {
+        m.stack = (unsigned char *) calloc(STACK_SIZE, 1);
+        status = run(&m, out, stats);
+    }
+    stats->cycles = stats->machineInstrs + LOAD_USE_STALL * stats->loadUseStalls +
+                    TAKEN_BRANCH_PENALTY * stats->takenBranches + stats->mulDivStalls;
+
+    for (int i = 0; i < m.numCode; i++)
+        for (int j = 0; j < 3; j++)
+            if (m.code[i].opnd[j].kind == OPD_LABEL)
+                free(m.code[i].opnd[j].label);
+    for (int i = 0; i < m.numLabels; i++)
+        free(m.labels[i].name);
+    free(m.code);
+    free(m.labels);
+    free(m.data);
+    free(m.stack);
+    return status;
+}
+
+void printSimStats(FILE *out, simStats *stats) {
+    static const char *classNames[NUM_SIM_CLASSES] = {
+        "alu", "mul", "div", "load", "store", "branch", "jump", "call", "return", "syscall"
+    };
+    fprintf(out, "sim: %ld instructions (%ld after pseudo-instruction expansion), %ld cycles, CPI %.2f\n",
+            stats->instrs, stats->machineInstrs, stats->cycles,
+            stats->machineInstrs ? (double) stats->cycles / stats->machineInstrs : 0.0);
+    fprintf(out, "sim: ");
+    for (int i = 0; i < NUM_SIM_CLASSES; i++)
+        fprintf(out, "%s%s %ld", i ? ", " : "", classNames[i], stats->byClass[i]);
+    fprintf(out, "\n");
+    fprintf(out, "sim: %ld load-use stalls, %ld taken branches, %ld multiply/divide stall cycles, "
+            "%ld bytes of stack\n",
+            stats->loadUseStalls, stats->takenBranches, stats->mulDivStalls, stats->maxStackBytes);
+}
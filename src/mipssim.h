@@ -0,0 +1,40 @@
+#ifndef MIPSSIM_H
+#define MIPSSIM_H
+
+#include <stdio.h>
+
+// Instruction classes counted by the simulator
+typedef enum simClass {
+    SIM_ALU,            // arithmetic, logic, compares, li, la, move
+    SIM_MUL,            // mul and mult/mfhi
+    SIM_DIV,
+    SIM_LOAD,
+    SIM_STORE,
+    SIM_BRANCH,         // beq, bne
+    SIM_JUMP,           // b, j
+    SIM_CALL,           // jal
+    SIM_RETURN,         // jr
+    SIM_SYSCALL,
+    NUM_SIM_CLASSES
+} simClass;
+
+typedef struct simStats {
+    long instrs;                    // assembly instructions executed
+    long byClass[NUM_SIM_CLASSES];
+    long machineInstrs;             // after the assembler expands pseudo-instructions
+    long loadUseStalls;
+    long takenBranches;             // taken branches and jumps, each flushing one fetch
+    long mulDivStalls;
+    long cycles;                    // estimate for a five-stage pipeline with forwarding
+    long maxStackBytes;             // deepest $sp reached below its initial value
+} simStats;
+
+// Runs an assembly file written by mcc: the .data directives and the
+// instructions the code generator emits, with the print int, print char
+// and exit syscalls. Program output goes to out. Returns 0 when the
+// program exits normally, otherwise prints the error on stderr and
+// returns -1.
+int simulateFile(const char *path, FILE *out, simStats *stats);
+void printSimStats(FILE *out, simStats *stats);
+
+#endif
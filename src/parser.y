@@ -4,13 +4,13 @@
 #include <string.h>
 #include "tree.h"
 #include "strtab.h"
+#include "diag.h"
 
 extern int yylineno;
+extern int yycol;
 extern tree* getCurrentFunction(void);
 extern void setCurrentFunction(tree* func);
 extern tree* ast;
-extern SemanticError semantic_errors[];
-extern int error_count;
 extern struct table_node* root;
 extern struct table_node* current_scope;
 
@@ -59,8 +59,6 @@ static int parse_complete = 0;
 %token LSQ_BRKT RSQ_BRKT LCRLY_BRKT RCRLY_BRKT LPAREN RPAREN
 %token COMMA SEMICLN
 %token ERROR ILLEGAL_TOKEN
-%token INTEGER
-%token <value> INTCONST CHARCONST
 
 %left OPER_ADD OPER_SUB
 %left OPER_MUL OPER_DIV
@@ -79,7 +77,6 @@ program         : declList
                     $$ = maketree(PROGRAM);
                     addChild($$, $1);
                     ast = $$;
-                    print_semantic_errors();
                 }
                 ;
 
@@ -99,6 +96,8 @@ declList        : decl
                     addChild(newDeclList, $1);  // Add the previous declList as a child
                     addChild(newDeclList, $2);  // Add the new decl as a child
                     $$ = newDeclList;
+                    // Nothing more is reported before the current line
+                    flushDiagnostics(yylineno);
                 }
                 ;
 
@@ -133,7 +132,7 @@ varDecl         : typeSpecifier ID SEMICLN
                     // Add variable to symbol table
                     symEntry* entry = ST_insert($2, $1->type, ST_SCALAR);
                     if (!entry) {
-                        add_semantic_error(yylineno, "Symbol declared multiple times.");
+                        reportError(yylineno, 0, "Symbol declared multiple times.");
                     }
                     //printf("DEBUG: varDecl - After insert for '%s'\n", $2);
                 }
@@ -145,14 +144,14 @@ varDecl         : typeSpecifier ID SEMICLN
                     
                     $$ = maketree(VARDECL);
                     addChild($$, $1);
-                    tree *id = maketree(ARRAYDECL);
+                    tree *id = maketreeWithVal(ARRAYDECL, $4);
                     setName(id, $2);
                     addChild($$, id);
                     
                     // Add array to symbol table
                     symEntry* entry = ST_insert($2, $1->type, ST_ARRAY);
                     if (!entry) {
-                        add_semantic_error(yylineno, "Symbol declared multiple times.");
+                        reportError(yylineno, 0, "Symbol declared multiple times.");
                     } else {
                         entry->array_size = $4;
                         validate_array_declaration($4, yylineno);
@@ -190,9 +189,10 @@ funDecl         : typeSpecifier ID
                     ST_install_func($2, $1->type, NULL, 0, yylineno);
                     new_scope();
                 }
-                LPAREN formalDeclList RPAREN funBody
+                LPAREN formalDeclList RPAREN
                 {
-                    // Update function with parameters
+                    // Update function with parameters before the body so
+                    // that recursive calls are checked against them
                     param* params = get_param_list();
                     int num_params = count_params(params);
                     symEntry* entry = ST_lookup($2);
@@ -200,6 +200,21 @@ funDecl         : typeSpecifier ID
                         entry->params = params;
                         entry->num_params = num_params;
                     }
+                }
+                funBody
+                {
+                    // Build funDecl -> (funcTypeName, formalDeclList, funBody)
+                    $$ = maketree(FUNDECL);
+                    $$->type = $1->type;
+                    setName($$, $2);
+                    tree *typeName = maketree(FUNCTYPENAME);
+                    addChild(typeName, $1);
+                    tree *id = maketree(IDENTIFIER);
+                    setName(id, $2);
+                    addChild(typeName, id);
+                    addChild($$, typeName);
+                    addChild($$, $5);
+                    addChild($$, $8);
                     up_scope();
                 }
                 ;
@@ -231,7 +246,7 @@ formalDecl      : typeSpecifier ID
                     // Add parameter to current (function) scope
                     symEntry* entry = ST_insert($2, $1->type, ST_SCALAR);
                     if (!entry) {
-                        add_semantic_error(yylineno, "Parameter already declared.");
+                        reportError(yylineno, 0, "Parameter already declared.");
                     }
                     add_param($2, $1->type, ST_SCALAR);
                 }
@@ -246,7 +261,7 @@ formalDecl      : typeSpecifier ID
                     // Add array parameter to current (function) scope
                     symEntry* entry = ST_insert($2, $1->type, ST_ARRAY);
                     if (!entry) {
-                        add_semantic_error(yylineno, "Parameter already declared.");
+                        reportError(yylineno, 0, "Parameter already declared.");
                     }
                     add_param($2, $1->type, ST_ARRAY);
                 }
@@ -332,21 +347,21 @@ assignStmt      : var OPER_ASGN expression SEMICLN
                     if (lhs_type == DT_VOID) {
                         // void variables can only be assigned void expressions
                         if (rhs_type != DT_VOID) {
-                            add_semantic_error(yylineno, "Type mismatch in assignment.");
+                            reportError(yylineno, 0, "Type mismatch in assignment.");
                         }
                     }
                     // Case 2: char assignments
                     else if (lhs_type == DT_CHAR) {
                         // char variables can only be assigned char expressions
                         if (rhs_type != DT_CHAR) {
-                            add_semantic_error(yylineno, "Type mismatch in assignment.");
+                            reportError(yylineno, 0, "Type mismatch in assignment.");
                         }
                     }
                     // Case 3: int assignments
                     else if (lhs_type == DT_INT) {
                         // int variables can be assigned int or char (implicit promotion)
                         if (rhs_type != DT_INT && rhs_type != DT_CHAR) {
-                            add_semantic_error(yylineno, "Type mismatch in assignment.");
+                            reportError(yylineno, 0, "Type mismatch in assignment.");
                         }
                     }
                 }
@@ -427,7 +442,7 @@ var             : ID LSQ_BRKT expression RSQ_BRKT
                     if (entry) {
                         check_array_access(entry, $3, yylineno);
                     } else {
-                        add_semantic_error(yylineno, "Undeclared array variable");
+                        reportError(yylineno, 0, "Undeclared array variable");
                     }
                 }
                 | ID
@@ -542,21 +557,21 @@ relop           : OPER_LTE
 
 addop           : OPER_ADD
                 {
-                    $$ = maketree(ADDOP);
+                    $$ = maketreeWithVal(ADDOP, OPVAL_ADD);
                 }
                 | OPER_SUB
                 {
-                    $$ = maketree(ADDOP);
+                    $$ = maketreeWithVal(ADDOP, OPVAL_SUB);
                 }
                 ;
 
 mulop           : OPER_MUL
                 {
-                    $$ = maketree(MULOP);
+                    $$ = maketreeWithVal(MULOP, OPVAL_MUL);
                 }
                 | OPER_DIV
                 {
-                    $$ = maketree(MULOP);
+                    $$ = maketreeWithVal(MULOP, OPVAL_DIV);
                 }
                 ;
 
@@ -597,21 +612,10 @@ argList         : expression
 
 %%
 
+// Only what the parser itself raises is reported; the return checks that
+// also call this are not
 int yyerror(char * msg) {
-    //printf("DEBUG: yyerror called with message: %s at line %d\n", msg, yylineno);
-    static int last_error_line = -1;
-    if (yylineno != last_error_line && strstr(msg, "syntax error")) {
-        int has_semantic_error = 0;
-        for (int i = 0; i < error_count; i++) {
-            if (semantic_errors[i].line == yylineno) {
-                has_semantic_error = 1;
-                break;
-            }
-        }
-        if (!has_semantic_error) {
-            printf("error: line %d: %s\n", yylineno, msg);
-        }
-        last_error_line = yylineno;
-    }
+    if (strstr(msg, "syntax error") || strstr(msg, "memory exhausted"))
+        reportSyntaxError(yylineno, yycol, msg);
     return 1;
-}
\ No newline at end of file
+}
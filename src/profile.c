@@ -0,0 +1,322 @@
+#include "profile.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PROFILE_LINE 256
+
+// Count of the function body, arm or loop body being walked
+typedef struct profRegion {
+    int from;
+    int minus;
+} profRegion;
+
+static int addSite(profSite **sites, int *numSites, profKind kind, tree *node, char *func, int line) {
+    *sites = (profSite *) realloc(*sites, (*numSites + 1) * sizeof(profSite));
+    profSite *site = &(*sites)[*numSites];
+    site->kind = kind;
+    site->node = node;
+    site->func = func;
+    site->line = line;
+    site->counted = 1;
+    site->from = site->minus = -1;
+    return (*numSites)++;
+}
+
+static int containsReturn(tree *node) {
+    if (!node)
+        return 0;
+    if (node->nodeKind == RETURNSTMT)
+        return 1;
+    for (int i = 0; i < node->numChildren; i++)
+        if (containsReturn(node->children[i]))
+            return 1;
+    return 0;
+}
+
+// A site reached every time its region runs takes the region's count
+static int addStatementSite(profSite **sites, int *numSites, profKind kind, tree *node, char *func,
+                            profRegion region, int mayHaveLeft) {
+    // The condition is reduced on the line of the if or while itself; the
+    // statement only once its body is done
+    int i = addSite(sites, numSites, kind, node, func, node->children[0]->line);
+    if (!mayHaveLeft) {
+        (*sites)[i].counted = 0;
+        (*sites)[i].from = region.from;
+        (*sites)[i].minus = region.minus;
+    }
+    return i;
+}
+
+// Walks the statements of a region in source order; *mayHaveLeft is set
+// once one of them may have returned
+static void collectStatements(tree *node, char *func, profRegion region, int *mayHaveLeft,
+                              profSite **sites, int *numSites) {
+    if (!node)
+        return;
+    switch (node->nodeKind) {
+        case STATEMENTLIST:
+            for (int i = 0; i < node->numChildren; i++)
+                collectStatements(node->children[i], func, region, mayHaveLeft, sites, numSites);
+            return;
+        case CONDSTMT: {
+            int runs = addStatementSite(sites, numSites, PROF_IF, node, func, region, *mayHaveLeft);
+            int then = addSite(sites, numSites, PROF_THEN, node, func, node->children[0]->line);
+            profRegion thenArm = {then, -1}, elseArm = {runs, then};
+            int left = 0;
+            collectStatements(node->children[1], func, thenArm, &left, sites, numSites);
+            left = 0;
+            if (node->numChildren > 2)
+                collectStatements(node->children[2], func, elseArm, &left, sites, numSites);
+            break;
+        }
+        case LOOPSTMT: {
+            addStatementSite(sites, numSites, PROF_LOOP, node, func, region, *mayHaveLeft);
+            int iterations = addSite(sites, numSites, PROF_ITERATIONS, node, func, node->children[0]->line);
+            profRegion body = {iterations, -1};
+            int left = 0;
+            collectStatements(node->children[1], func, body, &left, sites, numSites);
+            break;
+        }
+        default:
+            break;
+    }
+    *mayHaveLeft |= containsReturn(node);
+}
+
+// Walks the left-nested declList in source order
+static void collectFunctions(tree *node, profSite **sites, int *numSites) {
+    if (!node)
+        return;
+    switch (node->nodeKind) {
+        case PROGRAM:
+        case DECLLIST:
+        case DECL:
+            for (int i = 0; i < node->numChildren; i++)
+                collectFunctions(node->children[i], sites, numSites);
+            break;
+        case FUNDECL: {
+            // Line of the type in front of the name
+            int calls = addSite(sites, numSites, PROF_CALLS, node, node->name, node->children[0]->children[0]->line);
+            profRegion body = {calls, -1};
+            int left = 0;
+            tree *funBody = node->children[2];
+            for (int i = 0; i < funBody->numChildren; i++)
+                if (funBody->children[i]->nodeKind == STATEMENTLIST)
+                    collectStatements(funBody->children[i], node->name, body, &left, sites, numSites);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+int numberProfileSites(tree *root, profSite **sites) {
+    int numSites = 0;
+    *sites = NULL;
+    collectFunctions(root, sites, &numSites);
+    return numSites;
+}
+
+int findProfileSite(profSite *sites, int numSites, tree *node, profKind kind) {
+    for (int i = 0; i < numSites; i++)
+        if (sites[i].node == node && sites[i].kind == kind)
+            return i;
+    return -1;
+}
+
+/* ---------- source hash ---------- */
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+static unsigned hashBytes(unsigned h, const void *bytes, size_t size) {
+    const unsigned char *b = (const unsigned char *) bytes;
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ b[i]) * FNV_PRIME;
+    return h;
+}
+
+static unsigned hashTree(unsigned h, tree *node) {
+    int fields[4] = {-1, 0, 0, 0};
+    if (node) {
+        fields[0] = node->nodeKind;
+        fields[1] = node->numChildren;
+        fields[2] = node->val;
+        fields[3] = node->type;
+    }
+    h = hashBytes(h, fields, sizeof(fields));
+    if (!node)
+        return h;
+    if (node->name)
+        h = hashBytes(h, node->name, strlen(node->name) + 1);
+    for (int i = 0; i < node->numChildren; i++)
+        h = hashTree(h, node->children[i]);
+    return h;
+}
+
+// FNV-1a over the kinds, values and names of the function's tree, so
+// comments and moved lines leave it alone
+unsigned functionHash(tree *fundecl) {
+    return hashTree(FNV_OFFSET, fundecl);
+}
+
+/* ---------- reading ---------- */
+
+// Skips the program's own output up to the "#profile F" line; returns F,
+// or -1. The program prints digits and minus signs, so the marker always
+// starts a line.
+static int findProfile(FILE *in) {
+    char buf[MAX_PROFILE_LINE];
+    int n;
+    while (fgets(buf, sizeof(buf), in))
+        if (sscanf(buf, "#profile %d", &n) == 1 && n >= 0)
+            return n;
+    return -1;
+}
+
+int loadProfile(tree *root, const char *path, profileData *data) {
+    data->numSites = numberProfileSites(root, &data->sites);
+    data->counts = (long long *) malloc((data->numSites + 1) * sizeof(long long));
+    char *seen = (char *) calloc(data->numSites + 1, 1);
+    for (int i = 0; i < data->numSites; i++)
+        data->counts[i] = -1;
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "warning: unable to read profile %s, ignoring it\n", path);
+        free(seen);
+        return -1;
+    }
+    int numFuncs = findProfile(in);
+    if (numFuncs < 0) {
+        fprintf(stderr, "warning: %s holds no profile, ignoring it\n", path);
+        fclose(in);
+        free(seen);
+        return -1;
+    }
+
+    for (int f = 0; f < numFuncs; f++) {
+        char name[MAX_PROFILE_LINE];
+        unsigned hash;
+        int n;
+        if (fscanf(in, "%255s %u %d", name, &hash, &n) != 3 || n < 1) {
+            fprintf(stderr, "warning: %s is cut short, ignoring the rest\n", path);
+            break;
+        }
+        long long *counts = (long long *) malloc(n * sizeof(long long));
+        int ok = 1;
+        for (int i = 0; i < n && ok; i++)
+            ok = fscanf(in, "%lld", &counts[i]) == 1;
+        if (!ok) {
+            fprintf(stderr, "warning: %s is cut short, ignoring the rest\n", path);
+            free(counts);
+            break;
+        }
+        int first = -1;
+        for (int i = 0; i < data->numSites && first < 0; i++)
+            if (data->sites[i].kind == PROF_CALLS && strcmp(data->sites[i].func, name) == 0)
+                first = i;
+        if (first >= 0) {
+            seen[first] = 1;
+            int numSites = 1;
+            while (first + numSites < data->numSites && data->sites[first + numSites].kind != PROF_CALLS)
+                numSites++;
+            if (hash != functionHash(data->sites[first].node) || n != numSites) {
+                fprintf(stderr, "warning: %s: %s changed since the profile was recorded, ignoring its counts\n",
+                        path, name);
+            } else {
+                for (int i = 0; i < n; i++)
+                    data->counts[first + i] = counts[i];
+            }
+        }
+        free(counts);
+    }
+    fclose(in);
+    for (int i = 0; i < data->numSites; i++)
+        if (data->sites[i].kind == PROF_CALLS && !seen[i])
+            fprintf(stderr, "warning: %s has no counts for %s\n", path, data->sites[i].func);
+    free(seen);
+    return 0;
+}
+
+long long profileCount(profileData *data, tree *node, profKind kind) {
+    int site = findProfileSite(data->sites, data->numSites, node, kind);
+    return site < 0 ? -1 : data->counts[site];
+}
+
+void freeProfile(profileData *data) {
+    free(data->sites);
+    free(data->counts);
+    data->sites = NULL;
+    data->counts = NULL;
+    data->numSites = 0;
+}
+
+/* ---------- report ---------- */
+
+static long long *reportCounts;
+
+// Most calls first, then source order; functions without counts last
+static int compareCalls(const void *a, const void *b) {
+    int i = *(const int *) a, j = *(const int *) b;
+    if (reportCounts[i] != reportCounts[j])
+        return reportCounts[i] < reportCounts[j] ? 1 : -1;
+    return i - j;
+}
+
+int printProfileReport(tree *root, const char *path, FILE *out) {
+    profileData data;
+    if (loadProfile(root, path, &data) < 0) {
+        freeProfile(&data);
+        return -1;
+    }
+    profSite *sites = data.sites;
+    long long *counts = data.counts;
+    int numSites = data.numSites;
+
+    int numFuncs = 0;
+    int *funcs = (int *) malloc((numSites + 1) * sizeof(int));
+    for (int i = 0; i < numSites; i++)
+        if (sites[i].kind == PROF_CALLS)
+            funcs[numFuncs++] = i;
+    reportCounts = counts;
+    qsort(funcs, numFuncs, sizeof(int), compareCalls);
+    fprintf(out, "Functions by calls:\n");
+    for (int f = 0; f < numFuncs; f++) {
+        if (counts[funcs[f]] < 0)
+            fprintf(out, "  %-20s %12s\n", sites[funcs[f]].func, "no counts");
+        else
+            fprintf(out, "  %-20s %12lld\n", sites[funcs[f]].func, counts[funcs[f]]);
+    }
+
+    fprintf(out, "Sites by line:\n");
+    for (int i = 0; i < numSites; i++) {
+        profSite *site = &sites[i];
+        if (counts[i] < 0) {
+            if (site->kind == PROF_CALLS)
+                fprintf(out, "  %5d  function %s: no counts\n", site->line, site->func);
+            continue;
+        }
+        switch (site->kind) {
+            case PROF_CALLS:
+                fprintf(out, "  %5d  function %s: %lld call%s\n", site->line, site->func, counts[i],
+                        counts[i] == 1 ? "" : "s");
+                break;
+            case PROF_IF:
+                // The then arm is the next counter
+                fprintf(out, "  %5d    if: %lld runs, then %lld, else %lld\n", site->line,
+                        counts[i], counts[i + 1], counts[i] - counts[i + 1]);
+                break;
+            case PROF_LOOP:
+                fprintf(out, "  %5d    while: %lld entries, %lld iterations", site->line, counts[i], counts[i + 1]);
+                if (counts[i] > 0)
+                    fprintf(out, ", %.1f per entry", (double) counts[i + 1] / counts[i]);
+                fprintf(out, "\n");
+                break;
+            default:
+                break;
+        }
+    }
+    free(funcs);
+    freeProfile(&data);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include "tree.h"
+
+// Profiling counters. With --profile every function, if statement and
+// while loop gets counters, numbered in source order: a function has one
+// for its calls, an if one for the times it ran and one for its then arm,
+// a while one for the times it was entered and one for its iterations.
+// Once main returns the program prints, after its own output, a newline
+// and "#profile F" for its F functions, then for each function in source
+// order a line "name hash n" and its n counts one per line. The hash is
+// functionHash, which tells whether the counts still fit the source.
+//
+// Only calls, then arms and iterations are counted as they happen. An if
+// or while runs as often as the function body, arm or loop body around it
+// unless a return may have left that earlier, so its counter is filled in
+// from the enclosing one before the counts are printed.
+//
+// When optimizing, the counter table opens the $gp addressed area, so an
+// increment needs no la, and the counters of a loop nest that neither
+// returns nor can call back into its function stay in registers while it
+// runs. The code generator does both.
+
+typedef enum profKind {
+    PROF_CALLS,
+    PROF_IF,
+    PROF_THEN,
+    PROF_LOOP,
+    PROF_ITERATIONS
+} profKind;
+
+typedef struct profSite {
+    profKind kind;
+    tree *node;                 // FUNDECL, CONDSTMT or LOOPSTMT
+    char *func;                 // function the site belongs to
+    int line;
+    int counted;                // the code adds to the counter; otherwise it is
+    int from;                   // set to counter from minus counter minus,
+    int minus;                  // or from alone when minus is -1
+} profSite;
+
+// Counts of a profiled run for the sites of the current program
+typedef struct profileData {
+    profSite *sites;
+    int numSites;
+    long long *counts;          // -1 for the sites of a function without counts
+} profileData;
+
+// Numbers the counters of the program; returns how many were stored in *sites
+int numberProfileSites(tree *root, profSite **sites);
+// Counter of the site, or -1 when the node has none of that kind
+int findProfileSite(profSite *sites, int numSites, tree *node, profKind kind);
+unsigned functionHash(tree *fundecl);
+// Reads the counts a profiled run printed to path. A function missing from
+// the profile or changed since it was recorded keeps no counts, with a
+// warning on stderr. Returns -1, also with a warning, when path holds no
+// profile at all; data is set up either way.
+int loadProfile(tree *root, const char *path, profileData *data);
+// Recorded count of a site, or -1
+long long profileCount(profileData *data, tree *node, profKind kind);
+void freeProfile(profileData *data);
+// Lists the counts by source line, the most called functions first.
+// Returns 0, or -1 when path holds no profile.
+int printProfileReport(tree *root, const char *path, FILE *out);
+
+#endif
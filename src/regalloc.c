@@ -0,0 +1,590 @@
+#include "regalloc.h"
+#include "cfg.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Allocation order: caller-saved temporaries first, so values that do not
+// live across a call never cost a save/restore in the prologue.
+static const int allocOrder[] = {
+    8, 9, 10, 11, 12, 13, 14, 15, 24, 25,       // $t0-$t9
+    16, 17, 18, 19, 20, 21, 22, 23              // $s0-$s7
+};
+#define NUM_ALLOC_REGS 18
+#define MAX_LOOP_WEIGHT_DEPTH 6
+
+#define isCalleeSaved(r) ((r) >= REG_S0 && (r) <= REG_S7)
+
+typedef struct raState {
+    codeFunc *func;
+    cfg *graph;
+    int n;                  // number of virtual registers
+    int *color;             // physical register per vreg, 0 if spilled
+    int *crossCall;         // vreg is live across a jal
+    double *cost;           // loop weighted number of occurrences
+    int profiled;           // the costs come from profile counts
+    char *noSpill;          // vregs created by spill code
+    int noSpillSize;
+    int *spilled;
+    int numSpilled;
+    int coalesced;
+    int spills;
+} raState;
+
+static int numAllowed(raState *st, int v) {
+    return st->crossCall[v] ? NUM_SAVED_REGS : NUM_ALLOC_REGS;
+}
+
+static int isSpillable(raState *st, int v) {
+    return v >= st->noSpillSize || !st->noSpill[v];
+}
+
+static double loopWeight(int depth) {
+    double w = 1;
+    if (depth > MAX_LOOP_WEIGHT_DEPTH)
+        depth = MAX_LOOP_WEIGHT_DEPTH;
+    while (depth-- > 0)
+        w *= 10;
+    return w;
+}
+
+// Calls f for every member of a bitset
+#define FOR_EACH_BIT(set, var, body) \
+    for (int w_ = 0; w_ < ((set)->size + 31) / 32; w_++) { \
+        unsigned bits_ = (set)->bits[w_]; \
+        while (bits_) { \
+            int var = w_ * 32 + __builtin_ctz(bits_); \
+            bits_ &= bits_ - 1; \
+            body \
+        } \
+    }
+
+// Runs of a block per call: the profile's count where the code generator
+// had one, otherwise a guess from the loop nesting
+static double blockWeight(raState *st, basicBlock *block) {
+    double weight = -1;
+    for (instr *ins = block->first; ins; ins = ins->next) {
+        if (ins->kind == I_OP && ins->weight > weight)
+            weight = ins->weight;
+        if (ins == block->last)
+            break;
+    }
+    if (weight < 0)
+        return loopWeight(block->loopDepth);
+    st->profiled = 1;
+    return weight;
+}
+
+// Spill costs and live-across-call flags shared by both allocators
+static void computeCosts(raState *st) {
+    int regs[3];
+    bitset *live = bitsetNew(st->n);
+    for (int b = 0; b < st->graph->numBlocks; b++) {
+        basicBlock *block = st->graph->blocks[b];
+        double weight = blockWeight(st, block);
+        bitsetCopy(live, block->liveOut);
+        for (instr *ins = block->last; ins; ins = ins->prev) {
+            if (ins->kind == I_OP) {
+                if (ins->op == OP_JAL)
+                    FOR_EACH_BIT(live, v, { st->crossCall[v] = 1; });
+                if (instrDefs(ins, regs) && isVirtualReg(regs[0])) {
+                    st->cost[regs[0] - FIRST_VREG] += weight;
+                    bitsetClear(live, regs[0] - FIRST_VREG);
+                }
+                int numUses = instrUses(ins, regs);
+                for (int u = 0; u < numUses; u++) {
+                    if (!isVirtualReg(regs[u]))
+                        continue;
+                    st->cost[regs[u] - FIRST_VREG] += weight;
+                    bitsetSet(live, regs[u] - FIRST_VREG);
+                }
+            }
+            if (ins == block->first)
+                break;
+        }
+    }
+    bitsetFree(live);
+}
+
+/* ---------- graph coloring ---------- */
+
+typedef struct igraph {
+    int n;
+    bitset **edges;
+    int **adj;              // neighbor lists, may hold stale (coalesced) entries
+    int *adjCount;
+    int *adjCap;
+    int *alias;             // coalesced node representative
+    int (*moves)[2];
+    int numMoves;
+} igraph;
+
+static int findAlias(igraph *ig, int v) {
+    while (ig->alias[v] != v)
+        v = ig->alias[v];
+    return v;
+}
+
+static int interferes(igraph *ig, int a, int b) {
+    return bitsetTest(ig->edges[a], b);
+}
+
+static void addInterference(igraph *ig, int a, int b) {
+    if (a == b || interferes(ig, a, b))
+        return;
+    bitsetSet(ig->edges[a], b);
+    bitsetSet(ig->edges[b], a);
+    for (int k = 0; k < 2; k++) {
+        int x = k ? b : a, y = k ? a : b;
+        if (ig->adjCount[x] == ig->adjCap[x]) {
+            ig->adjCap[x] = ig->adjCap[x] ? 2 * ig->adjCap[x] : 8;
+            ig->adj[x] = (int *) realloc(ig->adj[x], ig->adjCap[x] * sizeof(int));
+        }
+        ig->adj[x][ig->adjCount[x]++] = y;
+    }
+}
+
+static igraph *buildInterference(raState *st) {
+    int regs[3];
+    igraph *ig = (igraph *) calloc(1, sizeof(igraph));
+    ig->n = st->n;
+    ig->edges = (bitset **) malloc(st->n * sizeof(bitset *));
+    ig->adj = (int **) calloc(st->n, sizeof(int *));
+    ig->adjCount = (int *) calloc(st->n, sizeof(int));
+    ig->adjCap = (int *) calloc(st->n, sizeof(int));
+    ig->alias = (int *) malloc(st->n * sizeof(int));
+    for (int v = 0; v < st->n; v++) {
+        ig->edges[v] = bitsetNew(st->n);
+        ig->alias[v] = v;
+    }
+
+    bitset *live = bitsetNew(st->n);
+    for (int b = 0; b < st->graph->numBlocks; b++) {
+        basicBlock *block = st->graph->blocks[b];
+        bitsetCopy(live, block->liveOut);
+        for (instr *ins = block->last; ins; ins = ins->prev) {
+            if (ins->kind == I_OP && instrDefs(ins, regs) && isVirtualReg(regs[0])) {
+                int d = regs[0] - FIRST_VREG;
+                int moveSrc = -1;
+                if (ins->op == OP_MOVE && isVirtualReg(ins->opnd[1].reg)) {
+                    moveSrc = ins->opnd[1].reg - FIRST_VREG;
+                    ig->moves = realloc(ig->moves, (ig->numMoves + 1) * sizeof(*ig->moves));
+                    ig->moves[ig->numMoves][0] = d;
+                    ig->moves[ig->numMoves][1] = moveSrc;
+                    ig->numMoves++;
+                }
+                // A move does not make its source and destination interfere
+                FOR_EACH_BIT(live, v, {
+                    if (v != moveSrc)
+                        addInterference(ig, d, v);
+                });
+                bitsetClear(live, d);
+            }
+            int numUses = instrUses(ins, regs);
+            for (int u = 0; u < numUses; u++)
+                if (isVirtualReg(regs[u]))
+                    bitsetSet(live, regs[u] - FIRST_VREG);
+            if (ins == block->first)
+                break;
+        }
+    }
+    bitsetFree(live);
+    return ig;
+}
+
+static void freeInterference(igraph *ig) {
+    for (int v = 0; v < ig->n; v++) {
+        bitsetFree(ig->edges[v]);
+        free(ig->adj[v]);
+    }
+    free(ig->edges);
+    free(ig->adj);
+    free(ig->adjCount);
+    free(ig->adjCap);
+    free(ig->alias);
+    free(ig->moves);
+    free(ig);
+}
+
+// Current neighbors of a representative node
+static int degree(igraph *ig, int v) {
+    int d = 0;
+    for (int i = 0; i < ig->adjCount[v]; i++) {
+        int x = ig->adj[v][i];
+        if (ig->alias[x] == x && interferes(ig, v, x))
+            d++;
+    }
+    return d;
+}
+
+// Briggs: merging is safe when the combined node has fewer than K
+// neighbors of significant degree.
+static int briggsSafe(raState *st, igraph *ig, int a, int b) {
+    int k = (st->crossCall[a] || st->crossCall[b]) ? NUM_SAVED_REGS : NUM_ALLOC_REGS;
+    int significant = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        int v = pass ? b : a;
+        for (int i = 0; i < ig->adjCount[v]; i++) {
+            int x = ig->adj[v][i];
+            if (ig->alias[x] != x || !interferes(ig, v, x))
+                continue;
+            if (pass && interferes(ig, a, x))
+                continue;       // counted already as a neighbor of a
+            if (degree(ig, x) >= numAllowed(st, x))
+                significant++;
+        }
+    }
+    return significant < k;
+}
+
+static void coalesceMoves(raState *st, igraph *ig) {
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int m = 0; m < ig->numMoves; m++) {
+            int a = findAlias(ig, ig->moves[m][0]);
+            int b = findAlias(ig, ig->moves[m][1]);
+            if (a == b || interferes(ig, a, b) || !briggsSafe(st, ig, a, b))
+                continue;
+            if (!isSpillable(st, b) && isSpillable(st, a)) {
+                int t = a; a = b; b = t;
+            }
+            ig->alias[b] = a;
+            for (int i = 0; i < ig->adjCount[b]; i++) {
+                int x = ig->adj[b][i];
+                if (ig->alias[x] == x && interferes(ig, b, x))
+                    addInterference(ig, a, x);
+            }
+            st->crossCall[a] |= st->crossCall[b];
+            st->cost[a] += st->cost[b];
+            st->coalesced++;
+            changed = 1;
+        }
+    }
+}
+
+static void colorGraph(raState *st) {
+    igraph *ig = buildInterference(st);
+    coalesceMoves(st, ig);
+
+    int n = st->n;
+    int *deg = (int *) malloc(n * sizeof(int));
+    char *removed = (char *) calloc(n, 1);
+    int *stack = (int *) malloc(n * sizeof(int));
+    int top = 0, remaining = 0;
+    for (int v = 0; v < n; v++) {
+        if (ig->alias[v] == v) {
+            deg[v] = degree(ig, v);
+            remaining++;
+        } else {
+            removed[v] = 1;
+        }
+    }
+
+    // Simplify, pushing the cheapest spill candidate optimistically when stuck
+    while (remaining > 0) {
+        int pick = -1;
+        for (int v = 0; v < n && pick < 0; v++)
+            if (!removed[v] && deg[v] < numAllowed(st, v))
+                pick = v;
+        if (pick < 0) {
+            double best = 0;
+            for (int v = 0; v < n; v++) {
+                if (removed[v])
+                    continue;
+                double metric = isSpillable(st, v) ? st->cost[v] / (deg[v] + 1) : 1e300;
+                if (pick < 0 || metric < best) {
+                    pick = v;
+                    best = metric;
+                }
+            }
+        }
+        removed[pick] = 1;
+        remaining--;
+        stack[top++] = pick;
+        for (int i = 0; i < ig->adjCount[pick]; i++) {
+            int x = ig->adj[pick][i];
+            if (!removed[x] && ig->alias[x] == x && interferes(ig, pick, x))
+                deg[x]--;
+        }
+    }
+
+    // Select colors in reverse order
+    for (int v = 0; v < n; v++)
+        st->color[v] = -1;
+    while (top > 0) {
+        int v = stack[--top];
+        int taken = 0;
+        for (int i = 0; i < ig->adjCount[v]; i++) {
+            int x = ig->adj[v][i];
+            if (ig->alias[x] == x && interferes(ig, v, x) && st->color[x] > 0)
+                taken |= 1 << st->color[x];
+        }
+        st->color[v] = 0;
+        for (int i = 0; i < NUM_ALLOC_REGS; i++) {
+            int r = allocOrder[i];
+            if (st->crossCall[v] && !isCalleeSaved(r))
+                continue;
+            if (!(taken & (1 << r))) {
+                st->color[v] = r;
+                break;
+            }
+        }
+    }
+
+    // Coalesced nodes take the color of their representative; a spilled
+    // representative spills every member.
+    for (int v = 0; v < n; v++) {
+        int rep = findAlias(ig, v);
+        if (rep != v)
+            st->color[v] = st->color[rep];
+        if (st->color[v] == 0)
+            st->spilled[st->numSpilled++] = v;
+    }
+
+    free(deg);
+    free(removed);
+    free(stack);
+    freeInterference(ig);
+}
+
+/* ---------- linear scan ---------- */
+
+static int *intervalStart;
+
+static int compareStart(const void *a, const void *b) {
+    return intervalStart[*(const int *) a] - intervalStart[*(const int *) b];
+}
+
+static void linearScan(raState *st) {
+    int n = st->n, regs[3], pos = 0;
+    int *start = (int *) malloc(n * sizeof(int));
+    int *end = (int *) malloc(n * sizeof(int));
+    int *calls = NULL, numCalls = 0;
+    for (int v = 0; v < n; v++) {
+        start[v] = INT_MAX;
+        end[v] = -1;
+        st->color[v] = -1;
+    }
+#define EXTEND(v, p) do { if ((p) < start[v]) start[v] = (p); if ((p) > end[v]) end[v] = (p); } while (0)
+
+    // One conservative interval per vreg, widened over whole blocks it is live through
+    for (int b = 0; b < st->graph->numBlocks; b++) {
+        basicBlock *block = st->graph->blocks[b];
+        int blockStart = pos;
+        for (instr *ins = block->first; ins; ins = ins->next) {
+            if (ins->kind == I_OP) {
+                int numUses = instrUses(ins, regs);
+                for (int u = 0; u < numUses; u++)
+                    if (isVirtualReg(regs[u]))
+                        EXTEND(regs[u] - FIRST_VREG, pos);
+                if (instrDefs(ins, regs) && isVirtualReg(regs[0]))
+                    EXTEND(regs[0] - FIRST_VREG, pos);
+                if (ins->op == OP_JAL) {
+                    calls = (int *) realloc(calls, (numCalls + 1) * sizeof(int));
+                    calls[numCalls++] = pos;
+                }
+            }
+            pos++;
+            if (ins == block->last)
+                break;
+        }
+        FOR_EACH_BIT(block->liveIn, v, { EXTEND(v, blockStart); });
+        FOR_EACH_BIT(block->liveOut, v, { EXTEND(v, pos - 1); });
+    }
+#undef EXTEND
+
+    int *order = (int *) malloc(n * sizeof(int));
+    int count = 0;
+    for (int v = 0; v < n; v++) {
+        if (end[v] < 0)
+            continue;
+        for (int c = 0; c < numCalls; c++)
+            if (start[v] < calls[c] && calls[c] < end[v])
+                st->crossCall[v] = 1;
+        order[count++] = v;
+    }
+    intervalStart = start;
+    qsort(order, count, sizeof(int), compareStart);
+
+    int owner[32];
+    for (int r = 0; r < 32; r++)
+        owner[r] = -1;
+    for (int i = 0; i < count; i++) {
+        int v = order[i];
+        for (int r = 0; r < 32; r++)
+            if (owner[r] >= 0 && end[owner[r]] < start[v])
+                owner[r] = -1;
+
+        int reg = 0;
+        for (int k = 0; k < NUM_ALLOC_REGS && !reg; k++) {
+            int r = allocOrder[k];
+            if (owner[r] < 0 && (!st->crossCall[v] || isCalleeSaved(r)))
+                reg = r;
+        }
+        if (!reg) {
+            // Steal from the active interval that ends last, or with a
+            // profile from the one used least
+            int victim = -1;
+            for (int k = 0; k < NUM_ALLOC_REGS; k++) {
+                int r = allocOrder[k];
+                int u = owner[r];
+                if (u < 0 || !isSpillable(st, u) || (st->crossCall[v] && !isCalleeSaved(r)))
+                    continue;
+                if (victim < 0 || (st->profiled ? st->cost[u] < st->cost[victim] : end[u] > end[victim]))
+                    victim = u;
+            }
+            int steal = victim >= 0 && (st->profiled ? st->cost[victim] < st->cost[v] : end[victim] > end[v]);
+            if (victim >= 0 && (steal || !isSpillable(st, v))) {
+                reg = st->color[victim];
+                st->color[victim] = 0;
+                st->spilled[st->numSpilled++] = victim;
+            } else {
+                st->color[v] = 0;
+                st->spilled[st->numSpilled++] = v;
+                continue;
+            }
+        }
+        st->color[v] = reg;
+        owner[reg] = v;
+    }
+
+    free(start);
+    free(end);
+    free(calls);
+    free(order);
+}
+
+/* ---------- rewriting ---------- */
+
+static void replaceReg(instr *ins, int from, int to, int defs) {
+    for (int i = 0; i < 3; i++) {
+        operand *o = &ins->opnd[i];
+        int isDef = i == 0 && o->kind == OPD_REG && opDefinesFirst(ins->op);
+        if ((o->kind == OPD_REG || o->kind == OPD_MEM) && o->reg == from && isDef == defs)
+            o->reg = to;
+    }
+}
+
+static void markNoSpill(raState *st, int v) {
+    if (v >= st->noSpillSize) {
+        int size = 2 * v + 16;
+        st->noSpill = (char *) realloc(st->noSpill, size);
+        memset(st->noSpill + st->noSpillSize, 0, size - st->noSpillSize);
+        st->noSpillSize = size;
+    }
+    st->noSpill[v] = 1;
+}
+
+// Gives the vreg a frame slot, loading before each use and storing after each def
+static void insertSpillCode(raState *st, int v) {
+    codeFunc *func = st->func;
+    int reg = v + FIRST_VREG, regs[3];
+    int offset = 4 * (func->numLocalWords + func->numSpillSlots + 1);
+    func->numSpillSlots++;
+
+    for (instr *ins = func->code.head; ins; ins = ins->next) {
+        if (ins->kind != I_OP)
+            continue;
+        int used = 0, defined = 0;
+        int numUses = instrUses(ins, regs);
+        for (int u = 0; u < numUses; u++)
+            used |= regs[u] == reg;
+        defined = instrDefs(ins, regs) && regs[0] == reg;
+        if (!used && !defined)
+            continue;
+
+        int tmp = newVirtualReg(func);
+        markNoSpill(st, tmp - FIRST_VREG);
+        // The load and store go wherever ins goes, out of line with a cold arm
+        if (used) {
+            instr *load = newOp(OP_LW, regOpnd(tmp), memOpnd(offset, REG_SP), noOpnd());
+            load->cold = ins->cold;
+            load->weight = ins->weight;
+            insertBefore(&func->code, ins, load);
+            replaceReg(ins, reg, tmp, 0);
+        }
+        if (defined) {
+            replaceReg(ins, reg, tmp, 1);
+            instr *store = newOp(OP_SW, regOpnd(tmp), memOpnd(offset, REG_SP), noOpnd());
+            store->cold = ins->cold;
+            store->weight = ins->weight;
+            insertAfter(&func->code, ins, store);
+            ins = store;
+        }
+    }
+    st->spills++;
+}
+
+static void rewriteRegisters(raState *st) {
+    codeFunc *func = st->func;
+    instr *next;
+    func->savedRegs = 0;
+    for (instr *ins = func->code.head; ins; ins = next) {
+        next = ins->next;
+        if (ins->kind != I_OP)
+            continue;
+        for (int i = 0; i < 3; i++) {
+            operand *o = &ins->opnd[i];
+            if ((o->kind == OPD_REG || o->kind == OPD_MEM) && isVirtualReg(o->reg))
+                o->reg = st->color[o->reg - FIRST_VREG];
+            if ((o->kind == OPD_REG || o->kind == OPD_MEM) && isCalleeSaved(o->reg))
+                func->savedRegs |= 1 << o->reg;
+        }
+        // Coalesced copies become no-ops
+        if (ins->op == OP_MOVE && ins->opnd[0].reg == ins->opnd[1].reg)
+            removeInstr(&func->code, ins);
+    }
+}
+
+void allocateRegisters(codeFunc *func) {
+    raState st;
+    memset(&st, 0, sizeof(st));
+    st.func = func;
+
+    for (;;) {
+        st.n = func->numVregs;
+        st.graph = buildCFG(func);
+        computeLiveness(st.graph);
+        st.color = (int *) calloc(st.n + 1, sizeof(int));
+        st.crossCall = (int *) calloc(st.n + 1, sizeof(int));
+        st.cost = (double *) calloc(st.n + 1, sizeof(double));
+        st.spilled = (int *) malloc((st.n + 1) * sizeof(int));
+        st.numSpilled = 0;
+        st.coalesced = 0;
+        computeCosts(&st);
+
+        if (cgOpts.optLevel >= 2)
+            colorGraph(&st);
+        else
+            linearScan(&st);
+        freeCFG(st.graph);
+
+        if (st.numSpilled == 0)
+            break;
+        for (int i = 0; i < st.numSpilled; i++)
+            insertSpillCode(&st, st.spilled[i]);
+        free(st.color);
+        free(st.crossCall);
+        free(st.cost);
+        free(st.spilled);
+    }
+
+    rewriteRegisters(&st);
+
+    if (cgOpts.raStats) {
+        int saved = 0;
+        for (int r = REG_S0; r <= REG_S7; r++)
+            saved += (func->savedRegs >> r) & 1;
+        fprintf(stderr, "regalloc: %s: %s, %d vregs, %d moves coalesced, %d spilled, %d callee-saved\n",
+                func->name, cgOpts.optLevel >= 2 ? "graph coloring" : "linear scan",
+                st.n, st.coalesced, st.spills, saved);
+    }
+
+    free(st.color);
+    free(st.crossCall);
+    free(st.cost);
+    free(st.spilled);
+    free(st.noSpill);
+}
@@ -0,0 +1,12 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include "codegen.h"
+
+// Replaces the virtual registers of a generated function with $t/$s
+// registers, inserting spill code into extra frame slots where needed.
+// -O1 uses a linear scan over live intervals, -O2 Chaitin/Briggs style
+// graph coloring with conservative move coalescing.
+void allocateRegisters(codeFunc *func);
+
+#endif
@@ -0,0 +1,515 @@
+#include "server.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_FRAME (64 << 20)        // largest frame a peer may send
+#define CHUNK 4096
+#define MAX_WORKERS 256
+#define LISTEN_BACKLOG 128
+
+/* ---------- frames ---------- */
+
+static int writeAll(int fd, const void *buf, size_t size) {
+    const char *p = (const char *) buf;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int readAll(int fd, void *buf, size_t size) {
+    char *p = (char *) buf;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int sendFrame(int fd, char kind, const void *data, uint32_t size) {
+    if (writeAll(fd, &kind, 1) < 0 || writeAll(fd, &size, sizeof(size)) < 0)
+        return -1;
+    return writeAll(fd, data, size);
+}
+
+static int sendString(int fd, char kind, const char *s) {
+    return sendFrame(fd, kind, s, strlen(s));
+}
+
+// Reads a frame into *data, zero-terminated for the frames that are text
+static int recvFrame(int fd, char *kind, char **data, uint32_t *size) {
+    if (readAll(fd, kind, 1) < 0 || readAll(fd, size, sizeof(*size)) < 0 || *size > MAX_FRAME)
+        return -1;
+    *data = (char *) malloc(*size + 1);
+    if (readAll(fd, *data, *size) < 0) {
+        free(*data);
+        return -1;
+    }
+    (*data)[*size] = '\0';
+    return 0;
+}
+
+/* ---------- requests ---------- */
+
+static char *tempName(const char *what) {
+    const char *dir = getenv("TMPDIR");
+    char *path = (char *) malloc(strlen(dir ? dir : "/tmp") + strlen(what) + 16);
+    sprintf(path, "%s/mcc-%s-XXXXXX", dir ? dir : "/tmp", what);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        free(path);
+        return NULL;
+    }
+    close(fd);
+    return path;
+}
+
+// Runs in the child: the compile's output goes to the pipes and outPath
+// instead of the output file the command line names
+static void compileRequest(char *dir, char **args, int numArgs, char *sourcePath, char *outPath, int out, int err,
+                           compileFunc compile) {
+    dup2(out, STDOUT_FILENO);
+    dup2(err, STDERR_FILENO);
+    close(out);
+    close(err);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if (dir && chdir(dir) != 0) {
+        printf("error: unable to enter directory %s\n", dir);
+        exit(255);
+    }
+    char **argv = (char **) malloc((numArgs + 4) * sizeof(char *));
+    int argc = 0;
+    argv[argc++] = "mcc";
+    for (int i = 0; i < numArgs - 1; i++) {
+        if (strcmp(args[i], "-o") == 0 && i + 1 < numArgs - 1)
+            i++;
+        else
+            argv[argc++] = args[i];
+    }
+    argv[argc++] = "-o";
+    argv[argc++] = outPath;
+    argv[argc++] = sourcePath ? sourcePath : args[numArgs - 1];
+    argv[argc] = NULL;
+    exit(compile(argc, argv) & 0xff);
+}
+
+// Sends what the child prints on out and err as it comes
+static void relayOutput(int conn, int out, int err) {
+    struct pollfd fds[2] = {{out, POLLIN, 0}, {err, POLLIN, 0}};
+    char buf[CHUNK];
+    int open = 2;
+    while (open > 0) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                open--;
+            } else {
+                // A client that went away still has its compile finished
+                sendFrame(conn, i == 0 ? 'O' : 'E', buf, n);
+            }
+        }
+    }
+}
+
+static void sendOutputFile(int conn, const char *path) {
+    FILE *in = fopen(path, "rb");
+    char buf[CHUNK];
+    size_t n;
+    while (in && (n = fread(buf, 1, sizeof(buf), in)) > 0)
+        sendFrame(conn, 'F', buf, n);
+    if (in)
+        fclose(in);
+}
+
+static void serveRequest(int conn, compileFunc compile) {
+    char *dir = NULL, *source = NULL, **args = NULL;
+    int numArgs = 0;
+    uint32_t sourceSize = 0;
+    char kind, *data;
+    uint32_t size;
+    for (;;) {
+        if (recvFrame(conn, &kind, &data, &size) < 0)
+            goto done;
+        if (kind == 'R') {
+            free(data);
+            break;
+        }
+        if (kind == 'D') {
+            free(dir);
+            dir = data;
+        } else if (kind == 'A') {
+            args = (char **) realloc(args, (numArgs + 1) * sizeof(char *));
+            args[numArgs++] = data;
+        } else if (kind == 'S') {
+            free(source);
+            source = data;
+            sourceSize = size;
+        } else {
+            free(data);
+        }
+    }
+
+    int status = 255;
+    char *outPath = tempName("out"), *sourcePath = NULL;
+    int out[2], err[2];
+    if (source && (sourcePath = tempName("src"))) {
+        FILE *f = fopen(sourcePath, "wb");
+        if (!f || fwrite(source, 1, sourceSize, f) != sourceSize) {
+            unlink(sourcePath);
+            free(sourcePath);
+            sourcePath = NULL;
+        }
+        if (f)
+            fclose(f);
+    }
+    if (numArgs == 0 || !outPath || (source && !sourcePath) || pipe(out) < 0) {
+        sendString(conn, 'E', "error: the compile server cannot take this request\n");
+    } else if (pipe(err) < 0) {
+        close(out[0]);
+        close(out[1]);
+        sendString(conn, 'E', "error: the compile server cannot take this request\n");
+    } else {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(conn);
+            close(out[0]);
+            close(err[0]);
+            compileRequest(dir, args, numArgs, sourcePath, outPath, out[1], err[1], compile);
+        }
+        close(out[1]);
+        close(err[1]);
+        if (pid < 0) {
+            close(out[0]);
+            close(err[0]);
+            sendString(conn, 'E', "error: the compile server is out of processes\n");
+        } else {
+            relayOutput(conn, out[0], err[0]);
+            int wstatus;
+            while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR)
+                ;
+            if (WIFEXITED(wstatus)) {
+                status = WEXITSTATUS(wstatus);
+                sendOutputFile(conn, outPath);
+            } else {
+                char msg[64];
+                snprintf(msg, sizeof(msg), "error: the compiler stopped on signal %d\n", WTERMSIG(wstatus));
+                sendString(conn, 'E', msg);
+            }
+        }
+    }
+    int32_t exitStatus = status;
+    sendFrame(conn, 'X', &exitStatus, sizeof(exitStatus));
+    if (outPath)
+        unlink(outPath);
+    if (sourcePath)
+        unlink(sourcePath);
+    free(outPath);
+    free(sourcePath);
+
+done:
+    for (int i = 0; i < numArgs; i++)
+        free(args[i]);
+    free(args);
+    free(dir);
+    free(source);
+}
+
+/* ---------- server ---------- */
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stopServer(int sig) {
+    (void) sig;
+    stopping = 1;
+}
+
+static void runWorker(int listener, compileFunc compile) {
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    for (;;) {
+        int conn = accept(listener, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            exit(1);
+        }
+        serveRequest(conn, compile);
+        close(conn);
+    }
+}
+
+static int listenOn(const char *socketPath) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "error: socket path %s is too long\n", socketPath);
+        return -1;
+    }
+    strcpy(addr.sun_path, socketPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("error: socket");
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        // A socket file left behind by a server that is gone is replaced,
+        // unless a server still answers on it
+        int inUse = errno == EADDRINUSE;
+        int other = inUse ? connectServer(socketPath) : -1;
+        if (other >= 0) {
+            close(other);
+            close(fd);
+            fprintf(stderr, "error: a compile server already listens on %s\n", socketPath);
+            return -1;
+        }
+        if (!inUse || unlink(socketPath) < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            perror("error: bind");
+            close(fd);
+            return -1;
+        }
+    }
+    // Only the owner may connect, before anyone can: a request runs a
+    // compile as the server's user, reading and writing any file it can
+    if (chmod(socketPath, 0600) < 0) {
+        perror("error: chmod");
+        close(fd);
+        unlink(socketPath);
+        return -1;
+    }
+    if (listen(fd, LISTEN_BACKLOG) < 0) {
+        perror("error: listen");
+        close(fd);
+        unlink(socketPath);
+        return -1;
+    }
+    return fd;
+}
+
+static pid_t startWorker(int listener, compileFunc compile) {
+    pid_t pid = fork();
+    if (pid == 0)
+        runWorker(listener, compile);
+    return pid;
+}
+
+int runServer(const char *socketPath, int workers, compileFunc compile) {
+    if (workers <= 0)
+        workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers <= 0)
+        workers = 1;
+    if (workers > MAX_WORKERS)
+        workers = MAX_WORKERS;
+    int listener = listenOn(socketPath);
+    if (listener < 0)
+        return -1;
+
+    // Without SA_RESTART, so waitpid returns when a signal stops the server
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stopServer;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    pid_t pool[MAX_WORKERS];
+    for (int i = 0; i < workers; i++)
+        pool[i] = startWorker(listener, compile);
+    fprintf(stderr, "mcc: serving on %s with %d worker%s\n", socketPath, workers, workers == 1 ? "" : "s");
+
+    // A worker that dies is replaced
+    while (!stopping) {
+        pid_t pid = wait(NULL);
+        for (int i = 0; i < workers && pid > 0 && !stopping; i++)
+            if (pool[i] == pid)
+                pool[i] = startWorker(listener, compile);
+    }
+    for (int i = 0; i < workers; i++)
+        if (pool[i] > 0)
+            kill(pool[i], SIGTERM);
+    while (wait(NULL) > 0 || errno == EINTR)
+        ;
+    close(listener);
+    unlink(socketPath);
+    return 0;
+}
+
+/* ---------- client ---------- */
+
+int connectServer(const char *socketPath) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, socketPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// The whole of stdin, for FILE "-"
+static char *readInput(uint32_t *size) {
+    size_t used = 0, room = CHUNK;
+    char *buf = (char *) malloc(room);
+    size_t n;
+    while ((n = fread(buf + used, 1, room - used, stdin)) > 0) {
+        used += n;
+        if (used == room && room < MAX_FRAME)
+            buf = (char *) realloc(buf, room *= 2);
+    }
+    *size = (uint32_t) used;
+    return buf;
+}
+
+int runClient(int fd, int argc, char *argv[], const char *outname, int quiet) {
+    char cwd[4096];
+    signal(SIGPIPE, SIG_IGN);
+    int ok = getcwd(cwd, sizeof(cwd)) && sendString(fd, 'D', cwd) == 0;
+    for (int i = 1; i < argc && ok; i++)
+        ok = sendString(fd, 'A', argv[i]) == 0;
+    if (ok && argc > 1 && strcmp(argv[argc - 1], "-") == 0) {
+        uint32_t size;
+        char *source = readInput(&size);
+        ok = sendFrame(fd, 'S', source, size) == 0;
+        free(source);
+    }
+    ok = ok && sendFrame(fd, 'R', "", 0) == 0;
+
+    FILE *out = NULL;
+    int status = -1;
+    char kind, *data;
+    uint32_t size;
+    while (ok && recvFrame(fd, &kind, &data, &size) == 0) {
+        if (kind == 'O' && !quiet) {
+            fwrite(data, 1, size, stdout);
+            fflush(stdout);
+        } else if (kind == 'E' && !quiet) {
+            fwrite(data, 1, size, stderr);
+        } else if (kind == 'F') {
+            if (!out && !(out = fopen(outname, "wb"))) {
+                fprintf(stderr, "error: unable to write output file %s\n", outname);
+                ok = 0;
+            }
+            if (out)
+                fwrite(data, 1, size, out);
+        } else if (kind == 'X' && size == sizeof(int32_t)) {
+            int32_t exitStatus;
+            memcpy(&exitStatus, data, sizeof(exitStatus));
+            status = exitStatus;
+            ok = 0;
+        }
+        free(data);
+    }
+    if (out)
+        fclose(out);
+    close(fd);
+    if (status < 0)
+        fprintf(stderr, "error: the compile server closed the connection\n");
+    return status;
+}
+
+/* ---------- benchmark ---------- */
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Runs a new mcc process with the command line, its printing dropped
+static int spawnCompile(char *argv[]) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execv("/proc/self/exe", argv);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    int wstatus;
+    if (pid < 0 || waitpid(pid, &wstatus, 0) < 0)
+        return -1;
+    return WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1;
+}
+
+static void printTimes(const char *what, double *times, int runs) {
+    double total = 0, fastest = times[0];
+    for (int i = 0; i < runs; i++) {
+        total += times[i];
+        fastest = times[i] < fastest ? times[i] : fastest;
+    }
+    printf("%-18s %d runs, mean %.3f ms, fastest %.3f ms\n", what, runs, 1000 * total / runs, 1000 * fastest);
+}
+
+int benchServer(const char *socketPath, int runs, int argc, char *argv[], const char *outname) {
+    double *spawned = (double *) malloc(runs * sizeof(double));
+    double *served = (double *) malloc(runs * sizeof(double));
+    char **args = (char **) malloc((argc + 1) * sizeof(char *));
+    memcpy(args, argv, argc * sizeof(char *));
+    args[argc] = NULL;
+    int status = 0;
+    for (int i = 0; i < runs && status == 0; i++) {
+        double start = now();
+        if (spawnCompile(args) < 0)
+            status = -1;
+        spawned[i] = now() - start;
+    }
+    for (int i = 0; i < runs && status == 0; i++) {
+        double start = now();
+        int fd = connectServer(socketPath);
+        if (fd < 0 || runClient(fd, argc, argv, outname, 1) < 0)
+            status = -1;
+        served[i] = now() - start;
+    }
+    if (status == 0) {
+        printTimes("process per file:", spawned, runs);
+        printTimes("warm server:", served, runs);
+    } else {
+        fprintf(stderr, "error: the benchmark could not run its compiles\n");
+    }
+    free(spawned);
+    free(served);
+    free(args);
+    return status;
+}
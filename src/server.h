@@ -0,0 +1,43 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+// Compile server. mcc --server=SOCKET starts once, so the symbol table is
+// set up and the program is loaded and paged in, then leaves a pool of
+// worker processes accepting on a Unix domain socket. A worker forks for
+// each request and compiles in the child, which starts from the server's
+// untouched state and leaves nothing behind for the next request.
+//
+// The server trusts whoever can connect as much as its own user: a
+// request names files to read and write, relative to a directory it also
+// names, and the compile does so with the server's permissions. So the
+// socket is made readable and writable by its owner only, and should be
+// put in a directory other users cannot replace it in. A client trusts
+// the server to be what it connects to, and writes the file it answers.
+//
+// Both directions are a series of frames: a kind byte, a 4-byte length
+// in host order and that many bytes. A request is
+//   'D' the client's working directory, which relative paths refer to
+//   'A' one argument, the command line as mcc takes it, FILE last
+//   'S' optional source text, compiled instead of reading FILE
+//   'R' end of the request
+// and the answer is
+//   'O', 'E' what the compile printed on stdout and stderr, as it comes
+//   'F' the output file, in chunks, when one was written
+//   'X' the exit status as a 4-byte int
+
+typedef int (*compileFunc)(int argc, char *argv[]);
+
+// Serves until interrupted with workers processes, or one per processor
+// when workers is 0. Returns a status for main.
+int runServer(const char *socketPath, int workers, compileFunc compile);
+// Connected socket, or -1 when no server listens on socketPath
+int connectServer(const char *socketPath);
+// Sends the command line over fd, prints what the compile printed and
+// writes the output file to outname; quiet drops the printing. Returns
+// the compile's exit status, or -1 when the connection broke.
+int runClient(int fd, int argc, char *argv[], const char *outname, int quiet);
+// Times runs compiles of the command line as new mcc processes and as
+// requests to the server, and prints both on stdout
+int benchServer(const char *socketPath, int runs, int argc, char *argv[], const char *outname);
+
+#endif
@@ -1,4 +1,5 @@
 #include "strtab.h"
+#include "diag.h"
 #include "tree.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,10 +15,6 @@ table_node* current_scope = NULL;
 static param* working_list_head = NULL;
 static param* working_list_tail = NULL;
 
-// Define the global variables (not the types, which are in the header)
-SemanticError semantic_errors[MAX_ERRORS] = {0};
-int error_count = 0;
-static int errors_printed = 0;
 
 // Hash function
 static int hash(char *id) {
@@ -357,45 +354,15 @@ void init_symbol_table(void) {
         }
         memset(root, 0, sizeof(table_node));
         current_scope = root;
-    }
-}
 
-// Adds a semantic error to the error array with the given line number and message.
-void add_semantic_error(int line, const char* message) {
-    if (error_count < MAX_ERRORS) {
-        semantic_errors[error_count].line = line;
-        strncpy(semantic_errors[error_count].message, message, MAX_ERROR_LENGTH - 1);
-        semantic_errors[error_count].message[MAX_ERROR_LENGTH - 1] = '\0';
-        error_count++;
+        // Built-in output(int) routine, provided by the code generator
+        add_param("value", DT_INT, ST_SCALAR);
+        symEntry* output = ST_insert("output", DT_VOID, ST_FUNC);
+        param* params = get_param_list();
+        ST_set_function_info(output, DT_VOID, params, count_params(params));
     }
 }
 
-// Validates array access by checking if the index expression is valid and within bounds
-void print_semantic_errors(void) {
-    // Sort errors by line number
-    for (int i = 0; i < error_count - 1; i++) {
-        for (int j = 0; j < error_count - i - 1; j++) {
-            if (semantic_errors[j].line > semantic_errors[j + 1].line) {
-                SemanticError temp = semantic_errors[j];
-                semantic_errors[j] = semantic_errors[j + 1];
-                semantic_errors[j + 1] = temp;
-            }
-        }
-    }
-    
-    // Print sorted errors
-    for (int i = 0; i < error_count; i++) {
-        printf("error: line %d: %s\n", 
-               semantic_errors[i].line, 
-               semantic_errors[i].message);
-    }
-}
-
-// Helper function to be called before yyparse returns
-void init_error_handling(void) {
-    atexit(print_semantic_errors);
-}
-
 static void check_expression_index(tree* node, symEntry* entry, int line) {
     // Check for non-integer operands first
     for (int i = 0; i < node->numChildren; i++) {
@@ -403,11 +370,11 @@ static void check_expression_index(tree* node, symEntry* entry, int line) {
         if (child->nodeKind == IDENTIFIER) {
             symEntry* id_entry = ST_lookup(child->name);
             if (id_entry && (id_entry->data_type == DT_CHAR || id_entry->data_type == DT_VOID)) {
-                add_semantic_error(line, "Array indexed using non-integer expression.");
+                reportError(line, 0, "Array indexed using non-integer expression.");
                 return;
             }
         } else if (child->nodeKind == CHAR) {
-            add_semantic_error(line, "Array indexed using non-integer expression.");
+            reportError(line, 0, "Array indexed using non-integer expression.");
             return;
         }
     }
@@ -426,7 +393,7 @@ static void check_expression_index(tree* node, symEntry* entry, int line) {
     }
     
     if (is_constant && total >= entry->array_size) {
-        add_semantic_error(line, "Statically sized array indexed with constant, out-of-bounds expression.");
+        reportError(line, 0, "Statically sized array indexed with constant, out-of-bounds expression.");
     }
 }
 
@@ -443,6 +410,17 @@ static int is_integer_expr(tree* node) {
             symEntry* entry = ST_lookup(node->name);
             return (entry && entry->data_type == DT_INT);
         }
+
+        // Scalar or element access: the type of the named variable
+        case VAR:
+            return is_integer_expr(node->children[0]);
+
+        case FUNCCALLEXPR:
+            return getExpressionType(node) == DT_INT;
+
+        // Comparisons yield 0 or 1
+        case RELOP:
+            return 1;
             
         case EXPRESSION:
         case ADDEXPR:
@@ -492,13 +470,13 @@ static int evaluate_constant(tree* node) {
             return 0;
             
         case ADDOP:
-            if (node->val == 0) // Addition
+            if (node->val == OPVAL_ADD) // Addition
                 return evaluate_constant(node->children[0]) + evaluate_constant(node->children[1]);
             else // Subtraction
                 return evaluate_constant(node->children[0]) - evaluate_constant(node->children[1]);
             
         case MULOP:
-            if (node->val == 0) // Multiplication
+            if (node->val == OPVAL_MUL) // Multiplication
                 return evaluate_constant(node->children[0]) * evaluate_constant(node->children[1]);
             else // Division
                 return evaluate_constant(node->children[0]) / evaluate_constant(node->children[1]);
@@ -554,12 +532,12 @@ void check_array_access(symEntry* entry, struct treenode* index_expr, int line)
     //printf("DEBUG: Checking array access on line %d\n", line);
     
     if (!entry || entry->sym_type != ST_ARRAY) {
-        add_semantic_error(line, "Non-array identifier used as an array.");
+        reportError(line, 0, "Non-array identifier used as an array.");
         return;
     }
 
     if (!is_integer_expr(index_expr)) {
-        add_semantic_error(line, "Array indexed using non-integer expression.");
+        reportError(line, 0, "Array indexed using non-integer expression.");
         return;
     }
 
@@ -570,7 +548,7 @@ void check_array_access(symEntry* entry, struct treenode* index_expr, int line)
             int value = evaluate_constant(index_expr);
             //printf("DEBUG: Evaluated constant index: %d\n", value);
             if (value >= entry->array_size) {
-                add_semantic_error(line, "Statically sized array indexed with constant, out-of-bounds expression.");
+                reportError(line, 0, "Statically sized array indexed with constant, out-of-bounds expression.");
                 return;
             }
         }
@@ -580,7 +558,7 @@ void check_array_access(symEntry* entry, struct treenode* index_expr, int line)
 // Update array declaration validation
 void validate_array_declaration(int size, int line) {
     if (size == 0) {
-        add_semantic_error(line, "Array variable declared with size of zero.");
+        reportError(line, 0, "Array variable declared with size of zero.");
     }
 }
 
@@ -591,7 +569,7 @@ void ST_install_func(char* name, enum dataType type, param* params, int num_para
     
     if (entry) {
         // Function already exists - error
-        add_semantic_error(line, "Symbol declared multiple times.");
+        reportError(line, 0, "Symbol declared multiple times.");
         return;
     }
     
@@ -607,7 +585,7 @@ void check_function_call(char* func_name, tree* args, int line) {
     // Special case for main - always returns int and takes no arguments
     if (strcmp(func_name, "main") == 0) {
         if (args && args->numChildren > 0) {
-            add_semantic_error(line, "Too many arguments provided in function call.");
+            reportError(line, 0, "Too many arguments provided in function call.");
         }
         return;  // Return immediately for main
     }
@@ -615,7 +593,7 @@ void check_function_call(char* func_name, tree* args, int line) {
     symEntry* func_entry = ST_lookup(func_name);
     if (!func_entry) {
         
-        add_semantic_error(line, "Undefined function");
+        reportError(line, 0, "Undefined function");
         return;
     }
 
@@ -623,11 +601,11 @@ void check_function_call(char* func_name, tree* args, int line) {
     
     // Check argument counts
     if (provided_args < func_entry->num_params) {
-        add_semantic_error(line, "Too few arguments provided in function call.");
+        reportError(line, 0, "Too few arguments provided in function call.");
         return;
     }
     if (provided_args > func_entry->num_params) {
-        add_semantic_error(line, "Too many arguments provided in function call.");
+        reportError(line, 0, "Too many arguments provided in function call.");
         return;
     }
 
@@ -652,7 +630,9 @@ void check_function_call(char* func_name, tree* args, int line) {
                 if (arg->children[0]->numChildren > 0 && 
                     arg->children[0]->children[0]->nodeKind == 28) { // VAR
                     tree* var_node = arg->children[0]->children[0];
-                    if (var_node->numChildren > 0) {
+                    // Only a bare name passes the variable itself; an
+                    // indexed element is checked as a scalar expression
+                    if (var_node->numChildren == 1) {
                         //printf("DEBUG: Looking up identifier: %s\n", var_node->children[0]->name);
                         arg_entry = ST_lookup(var_node->children[0]->name);
                     }
@@ -672,12 +652,12 @@ void check_function_call(char* func_name, tree* args, int line) {
         if (param_ptr->symbol_type == ST_ARRAY) {
             // Must have a symbol table entry for arrays
             if (!arg_entry || arg_entry->sym_type != ST_ARRAY) {
-                add_semantic_error(line, "Argument type mismatch in function call.");
+                reportError(line, 0, "Argument type mismatch in function call.");
                 return;
             }
             // Check array element type matches
             if (param_ptr->data_type != arg_entry->data_type) {
-                add_semantic_error(line, "Argument type mismatch in function call.");
+                reportError(line, 0, "Argument type mismatch in function call.");
                 return;
             }
         }
@@ -685,13 +665,13 @@ void check_function_call(char* func_name, tree* args, int line) {
         else {
             // If argument is an array but parameter isn't
             if (arg_entry && arg_entry->sym_type == ST_ARRAY) {
-                add_semantic_error(line, "Argument type mismatch in function call.");
+                reportError(line, 0, "Argument type mismatch in function call.");
                 return;
             }
             // Check types match (including void)
             dataType arg_type = arg_entry ? arg_entry->data_type : getExpressionType(arg);
             if (param_ptr->data_type != arg_type) {
-                add_semantic_error(line, "Argument type mismatch in function call.");
+                reportError(line, 0, "Argument type mismatch in function call.");
                 return;
             }
         }
@@ -702,14 +682,14 @@ void check_function_call(char* func_name, tree* args, int line) {
 
 void validate_array_index(tree* index_expr, int line) {
     if (!is_integer_expr(index_expr)) {
-        add_semantic_error(line, "Array index must be an integer expression");
+        reportError(line, 0, "Array index must be an integer expression");
         return;
     }
     
     if (is_constant_expr(index_expr)) {
         int value = evaluate_constant(index_expr);
         if (value < 0) {
-            add_semantic_error(line, "Array index cannot be negative");
+            reportError(line, 0, "Array index cannot be negative");
         }
     }
 }
@@ -19,8 +19,6 @@ typedef enum dataType {
 #define MAXIDS 1000
 #define GLOBAL_SCOPE 0
 #define LOCAL_SCOPE 1
-#define MAX_ERRORS 100
-#define MAX_ERROR_LENGTH 256
 
 // Symbol types for symbol table entries
 typedef enum symbolType {
@@ -78,8 +76,6 @@ void print_sym_tab(void);
 int ST_get_info(char *id, dataType *type, enum symbolType *symbol_type, int *scope);
 int get_param_count(char *func_id);
 void init_symbol_table(void);
-void add_semantic_error(int line, const char* message);
-void print_semantic_errors(void);
 void check_array_access(symEntry* entry, tree* index_expr, int line);
 void check_function_call(char* func_name, tree* args, int line);
 void validate_array_index(tree* index_expr, int line);
@@ -88,16 +84,8 @@ param* get_param_list(void);
 int count_params(param* params);
 void ST_install_func(char* name, enum dataType type, param* params, int num_params, int line);
 
-// Define SemanticError type
-typedef struct {
-    int line;
-    char message[MAX_ERROR_LENGTH];
-} SemanticError;
-
 // Declare externals
 extern table_node* root;
 extern table_node* current_scope;
-extern SemanticError semantic_errors[MAX_ERRORS];
-extern int error_count;
 
 #endif
@@ -1,5 +1,6 @@
 #include "tree.h"
 #include "strtab.h"
+#include "diag.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,8 +38,10 @@ tree *maketree(int kind) {
       tree *this = (tree *) malloc(sizeof(struct treenode));
       this->nodeKind = kind;
       this->numChildren = 0;
+      this->val = 0;
       this->name = NULL;
       this->type = DT_VOID;
+      this->line = yylineno;
       return this;
 }
 
@@ -51,6 +54,7 @@ tree* maketreeWithVal(int kind, int val) {
     this->val = val;
     this->name = NULL;
     this->type = DT_VOID;
+    this->line = yylineno;
 
     // Map token values to node kinds directly
     switch(kind) {
@@ -239,7 +243,7 @@ enum dataType getExpressionType(tree* node) {
         case IDENTIFIER: {
             symEntry* entry = ST_lookup(node->name);
             if (!entry) {
-                add_semantic_error(yylineno, "Undeclared variable");
+                reportError(yylineno, 0, "Undeclared variable");
                 return DT_VOID;
             }
             return entry->data_type;
@@ -251,7 +255,7 @@ enum dataType getExpressionType(tree* node) {
                 if (id_node && id_node->nodeKind == IDENTIFIER) {
                     symEntry* entry = ST_lookup(id_node->name);
                     if (!entry) {
-                        add_semantic_error(yylineno, "Undeclared variable");
+                        reportError(yylineno, 0, "Undeclared variable");
                         return DT_VOID;
                     }
                     return entry->data_type;
@@ -260,6 +264,10 @@ enum dataType getExpressionType(tree* node) {
             return DT_VOID;
         }
             
+        // Comparisons yield 0 or 1
+        case RELOP:
+            return DT_INT;
+
         case ADDOP:
         case MULOP: {
             enum dataType left = getExpressionType(node->children[0]);
@@ -44,6 +44,20 @@ typedef enum {
     FUNCTYPENAME
 } NodeKind;
 
+// Operator values stored in addop/mulop nodes (indices into ops[] in tree.c)
+#define OPVAL_ADD 0
+#define OPVAL_SUB 1
+#define OPVAL_MUL 2
+#define OPVAL_DIV 3
+
+// Operator values stored in relop nodes
+#define RELVAL_LTE 0
+#define RELVAL_LT  1
+#define RELVAL_GT  2
+#define RELVAL_GTE 3
+#define RELVAL_EQ  4
+#define RELVAL_NEQ 5
+
 // Tree node structure
 struct treenode {
     NodeKind nodeKind;
@@ -52,6 +66,7 @@ struct treenode {
     int val;
     char *name;
     dataType type;
+    int line;           // source line the node was reduced on
 };
 
 // Function declarations
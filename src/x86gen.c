@@ -0,0 +1,480 @@
+#include "x86gen.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_ARG_REGS 6
+#define MAX_OPERAND 64
+
+static const char *argRegs32[NUM_ARG_REGS] = {"edi", "esi", "edx", "ecx", "r8d", "r9d"};
+static const char *argRegs64[NUM_ARG_REGS] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+
+// Condition codes in RELVAL order, and the negated test
+static const char *condCodes[] = {"le", "l", "g", "ge", "e", "ne"};
+static const int invertedRel[] = {RELVAL_GT, RELVAL_GTE, RELVAL_LTE, RELVAL_LT, RELVAL_NEQ, RELVAL_EQ};
+
+typedef enum xStorage {
+    XS_FRAME,               // at offset(%rbp)
+    XS_GLOBAL,              // at var<name>(%rip)
+    XS_POINTER              // array parameter: its address is at offset(%rbp)
+} xStorage;
+
+typedef struct xVar {
+    char *name;
+    xStorage storage;
+    int isArray;
+    int width;              // bytes of a value or element: 1 for char, except scalar parameters
+    int size;               // elements, 1 for a scalar
+    int offset;             // from %rbp
+} xVar;
+
+static FILE *out;
+static xVar *globals;
+static int numGlobals;
+static xVar *frameVars;     // parameters and locals of the function being generated
+static int numFrameVars;
+static int numLabels;
+static int pushDepth;       // quadwords pushed below the frame, for call alignment
+
+static int newLabel(void) {
+    return numLabels++;
+}
+
+static xVar *lookupVar(char *name) {
+    for (int i = 0; i < numFrameVars; i++)
+        if (strcmp(frameVars[i].name, name) == 0)
+            return &frameVars[i];
+    for (int i = 0; i < numGlobals; i++)
+        if (strcmp(globals[i].name, name) == 0)
+            return &globals[i];
+    return NULL;
+}
+
+static tree *unwrap(tree *node) {
+    while ((node->nodeKind == EXPRESSION || node->nodeKind == FACTOR) && node->numChildren == 1)
+        node = node->children[0];
+    return node;
+}
+
+static void push(void) {
+    fprintf(out, "\tpushq %%rax\n");
+    pushDepth++;
+}
+
+static void pop(const char *reg) {
+    fprintf(out, "\tpopq %%%s\n", reg);
+    pushDepth--;
+}
+
+// Memory operand of a scalar
+static char *scalarOperand(xVar *v, char *buf) {
+    if (v->storage == XS_GLOBAL)
+        snprintf(buf, MAX_OPERAND, "var%s(%%rip)", v->name);
+    else
+        snprintf(buf, MAX_OPERAND, "%d(%%rbp)", v->offset);
+    return buf;
+}
+
+// A constant or a word-sized scalar can be used where it is without
+// going through %eax
+static int simpleOperand(tree *node, char *buf) {
+    node = unwrap(node);
+    if (node->nodeKind == INTEGER || node->nodeKind == CHAR) {
+        snprintf(buf, MAX_OPERAND, "$%d", node->val);
+        return 1;
+    }
+    if (node->nodeKind != VAR || node->numChildren > 1)
+        return 0;
+    xVar *v = lookupVar(node->children[0]->name);
+    if (v->isArray || v->width != 4)
+        return 0;
+    scalarOperand(v, buf);
+    return 1;
+}
+
+static void genExpr(tree *node);
+
+// Leaves the element's memory operand in buf. The index goes to %rdx and
+// the base, unless it is in the frame, to %rcx; %eax is kept when the
+// index is simple.
+static char *genElement(xVar *v, tree *index, char *buf) {
+    char opnd[MAX_OPERAND];
+    if (simpleOperand(index, opnd)) {
+        fprintf(out, opnd[0] == '$' ? "\tmovq %s, %%rdx\n" : "\tmovslq %s, %%rdx\n", opnd);
+    } else {
+        genExpr(index);
+        fprintf(out, "\tmovslq %%eax, %%rdx\n");
+    }
+    if (v->storage == XS_FRAME) {
+        snprintf(buf, MAX_OPERAND, "%d(%%rbp,%%rdx,%d)", v->offset, v->width);
+        return buf;
+    }
+    if (v->storage == XS_GLOBAL)
+        fprintf(out, "\tleaq var%s(%%rip), %%rcx\n", v->name);
+    else
+        fprintf(out, "\tmovq %d(%%rbp), %%rcx\n", v->offset);
+    snprintf(buf, MAX_OPERAND, "(%%rcx,%%rdx,%d)", v->width);
+    return buf;
+}
+
+static void genLoad(xVar *v, const char *opnd) {
+    fprintf(out, v->width == 1 ? "\tmovsbl %s, %%eax\n" : "\tmovl %s, %%eax\n", opnd);
+}
+
+static void genStore(xVar *v, const char *opnd) {
+    fprintf(out, v->width == 1 ? "\tmovb %%al, %s\n" : "\tmovl %%eax, %s\n", opnd);
+}
+
+// An array name on its own is its address, in %rax
+static void genVar(tree *node) {
+    char buf[MAX_OPERAND];
+    xVar *v = lookupVar(node->children[0]->name);
+    if (node->numChildren > 1) {
+        genLoad(v, genElement(v, node->children[1], buf));
+    } else if (!v->isArray) {
+        genLoad(v, scalarOperand(v, buf));
+    } else if (v->storage == XS_FRAME) {
+        fprintf(out, "\tleaq %d(%%rbp), %%rax\n", v->offset);
+    } else if (v->storage == XS_GLOBAL) {
+        fprintf(out, "\tleaq var%s(%%rip), %%rax\n", v->name);
+    } else {
+        fprintf(out, "\tmovq %d(%%rbp), %%rax\n", v->offset);
+    }
+}
+
+// Arguments are evaluated left to right. The first six are pushed and
+// popped into their registers; the rest are stored straight into the
+// space reserved for them below. %rsp is 16-byte aligned at the call.
+static void genCall(tree *node) {
+    char *name = node->children[0]->name;
+    tree *args = node->children[1];
+    int numArgs = args ? args->numChildren : 0;
+    int numStack = numArgs > NUM_ARG_REGS ? numArgs - NUM_ARG_REGS : 0;
+    int pad = (pushDepth + numStack) % 2 ? 8 : 0;
+
+    if (pad + numStack > 0) {
+        fprintf(out, "\tsubq $%d, %%rsp\n", pad + 8 * numStack);
+        pushDepth += pad / 8 + numStack;
+    }
+    for (int i = 0; i < numArgs; i++) {
+        genExpr(args->children[i]);
+        if (i < NUM_ARG_REGS)
+            push();
+        else
+            fprintf(out, "\tmovq %%rax, %d(%%rsp)\n", 8 * i);     // above the six pushed
+    }
+    for (int i = (numArgs < NUM_ARG_REGS ? numArgs : NUM_ARG_REGS) - 1; i >= 0; i--)
+        pop(argRegs64[i]);
+    fprintf(out, "\tcall start%s\n", name);
+    if (pad + numStack > 0) {
+        fprintf(out, "\taddq $%d, %%rsp\n", pad + 8 * numStack);
+        pushDepth -= pad / 8 + numStack;
+    }
+}
+
+// Left operand in %eax, right one in src
+static void genArith(int op, const char *src) {
+    switch (op) {
+        case OPVAL_ADD:
+            fprintf(out, "\taddl %s, %%eax\n", src);
+            break;
+        case OPVAL_SUB:
+            fprintf(out, "\tsubl %s, %%eax\n", src);
+            break;
+        case OPVAL_MUL:
+            fprintf(out, "\timull %s, %%eax\n", src);
+            break;
+        default:
+            if (strcmp(src, "%ecx") != 0)
+                fprintf(out, "\tmovl %s, %%ecx\n", src);
+            fprintf(out, "\tcltd\n");
+            fprintf(out, "\tidivl %%ecx\n");
+            break;
+    }
+}
+
+// Evaluates both operands, leaving the left in %eax and returning where
+// the right one is
+static const char *genOperands(tree *node, char *buf) {
+    if (simpleOperand(node->children[1], buf)) {
+        genExpr(node->children[0]);
+        return buf;
+    }
+    genExpr(node->children[0]);
+    push();
+    genExpr(node->children[1]);
+    fprintf(out, "\tmovl %%eax, %%ecx\n");
+    pop("rax");
+    return "%ecx";
+}
+
+static void genExpr(tree *node) {
+    char buf[MAX_OPERAND];
+    node = unwrap(node);
+    switch (node->nodeKind) {
+        case INTEGER:
+        case CHAR:
+            fprintf(out, "\tmovl $%d, %%eax\n", node->val);
+            break;
+        case VAR:
+            genVar(node);
+            break;
+        case FUNCCALLEXPR:
+            genCall(node);
+            break;
+        case ADDOP:
+        case MULOP: {
+            const char *src = genOperands(node, buf);
+            genArith(node->val, src);
+            break;
+        }
+        case RELOP:
+            fprintf(out, "\tcmpl %s, %%eax\n", genOperands(node, buf));
+            fprintf(out, "\tset%s %%al\n", condCodes[node->val]);
+            fprintf(out, "\tmovzbl %%al, %%eax\n");
+            break;
+        default:
+            break;
+    }
+}
+
+// Jumps to label when cond is true, or false
+static void genBranch(tree *cond, int whenTrue, int label) {
+    char buf[MAX_OPERAND];
+    tree *node = unwrap(cond);
+    if (node->nodeKind == RELOP) {
+        fprintf(out, "\tcmpl %s, %%eax\n", genOperands(node, buf));
+        fprintf(out, "\tj%s .L%d\n", condCodes[whenTrue ? node->val : invertedRel[node->val]], label);
+    } else {
+        genExpr(node);
+        fprintf(out, "\ttestl %%eax, %%eax\n");
+        fprintf(out, "\tj%s .L%d\n", whenTrue ? "ne" : "e", label);
+    }
+}
+
+// The right side is evaluated before the index, as in the MIPS code
+static void genAssign(tree *node) {
+    char buf[MAX_OPERAND];
+    tree *var = node->children[0];
+    xVar *v = lookupVar(var->children[0]->name);
+    genExpr(node->children[1]);
+    if (var->numChildren == 1) {
+        genStore(v, scalarOperand(v, buf));
+    } else if (simpleOperand(var->children[1], buf)) {
+        genStore(v, genElement(v, var->children[1], buf));
+    } else {
+        push();
+        genElement(v, var->children[1], buf);
+        pop("rax");
+        genStore(v, buf);
+    }
+}
+
+static void genStatement(tree *node) {
+    if (!node)
+        return;
+    switch (node->nodeKind) {
+        case STATEMENTLIST:
+            for (int i = 0; i < node->numChildren; i++)
+                genStatement(node->children[i]);
+            break;
+        case ASSIGNSTMT:
+            genAssign(node);
+            break;
+        case STATEMENT:
+            genExpr(node->children[0]);
+            break;
+        case CONDSTMT: {
+            int elseLabel = newLabel();
+            genBranch(node->children[0], 0, elseLabel);
+            genStatement(node->children[1]);
+            if (node->numChildren > 2) {
+                int endLabel = newLabel();
+                fprintf(out, "\tjmp .L%d\n", endLabel);
+                fprintf(out, ".L%d:\n", elseLabel);
+                genStatement(node->children[2]);
+                fprintf(out, ".L%d:\n", endLabel);
+            } else {
+                fprintf(out, ".L%d:\n", elseLabel);
+            }
+            break;
+        }
+        case LOOPSTMT: {
+            // Test at the bottom: one branch per iteration
+            int bodyLabel = newLabel();
+            int testLabel = newLabel();
+            fprintf(out, "\tjmp .L%d\n", testLabel);
+            fprintf(out, ".L%d:\n", bodyLabel);
+            genStatement(node->children[1]);
+            fprintf(out, ".L%d:\n", testLabel);
+            genBranch(node->children[0], 1, bodyLabel);
+            break;
+        }
+        case RETURNSTMT:
+            if (node->numChildren > 0)
+                genExpr(node->children[0]);
+            fprintf(out, "\tleave\n");
+            fprintf(out, "\tret\n");
+            break;
+        default:
+            break;
+    }
+}
+
+// Places a variable below the ones already in the frame
+static int allocateFrame(int *frameBytes, int bytes, int align) {
+    *frameBytes = (*frameBytes + bytes + align - 1) / align * align;
+    return -*frameBytes;
+}
+
+static xVar *newFrameVar(tree *decl, xStorage storage) {
+    tree *id = decl->children[1];
+    xVar *v = &frameVars[numFrameVars++];
+    v->name = id->name;
+    v->storage = storage;
+    v->isArray = id->nodeKind == ARRAYDECL;
+    v->width = decl->children[0]->type == DT_CHAR ? 1 : 4;
+    v->size = v->isArray && storage == XS_FRAME ? id->val : 1;
+    return v;
+}
+
+static void genFunction(tree *node) {
+    tree *formals = node->children[1];
+    tree *body = node->children[2];
+    int numVars = formals->numChildren, frameBytes = 0;
+    for (int i = 0; i < body->numChildren; i++)
+        if (body->children[i]->nodeKind == LOCALDECLLIST)
+            numVars += body->children[i]->numChildren;
+    frameVars = (xVar *) calloc(numVars + 1, sizeof(xVar));
+    numFrameVars = 0;
+    pushDepth = 0;
+
+    // Register parameters are stored in the frame; the caller leaves the
+    // rest above the return address. A scalar parameter is a full word
+    // even when it is a char, as on MIPS.
+    for (int i = 0; i < formals->numChildren; i++) {
+        xVar *v = newFrameVar(formals->children[i], XS_FRAME);
+        if (v->isArray)
+            v->storage = XS_POINTER;
+        else
+            v->width = 4;
+        if (i >= NUM_ARG_REGS)
+            v->offset = 16 + 8 * (i - NUM_ARG_REGS);
+        else
+            v->offset = v->isArray ? allocateFrame(&frameBytes, 8, 8) : allocateFrame(&frameBytes, 4, 4);
+    }
+    tree *statements = NULL;
+    for (int i = 0; i < body->numChildren; i++) {
+        tree *child = body->children[i];
+        if (child->nodeKind != LOCALDECLLIST) {
+            statements = child;
+            continue;
+        }
+        for (int j = 0; j < child->numChildren; j++) {
+            xVar *v = newFrameVar(child->children[j], XS_FRAME);
+            v->offset = allocateFrame(&frameBytes, v->width * v->size, v->width);
+        }
+    }
+    frameBytes = (frameBytes + 15) / 16 * 16;
+
+    fprintf(out, "\n# Function definition for %s\n", node->name);
+    fprintf(out, "start%s:\n", node->name);
+    fprintf(out, "\tpushq %%rbp\n");
+    fprintf(out, "\tmovq %%rsp, %%rbp\n");
+    if (frameBytes > 0)
+        fprintf(out, "\tsubq $%d, %%rsp\n", frameBytes);
+    for (int i = 0; i < formals->numChildren && i < NUM_ARG_REGS; i++) {
+        xVar *v = &frameVars[i];
+        if (v->isArray)
+            fprintf(out, "\tmovq %%%s, %d(%%rbp)\n", argRegs64[i], v->offset);
+        else
+            fprintf(out, "\tmovl %%%s, %d(%%rbp)\n", argRegs32[i], v->offset);
+    }
+    genStatement(statements);
+    fprintf(out, "\tleave\n");
+    fprintf(out, "\tret\n");
+    free(frameVars);
+    frameVars = NULL;
+    numFrameVars = 0;
+}
+
+static void genGlobal(tree *node) {
+    tree *id = node->children[1];
+    globals = (xVar *) realloc(globals, (numGlobals + 1) * sizeof(xVar));
+    xVar *v = &globals[numGlobals++];
+    v->name = id->name;
+    v->storage = XS_GLOBAL;
+    v->isArray = id->nodeKind == ARRAYDECL;
+    v->width = node->children[0]->type == DT_CHAR ? 1 : 4;
+    v->size = v->isArray ? id->val : 1;
+    v->offset = 0;
+}
+
+// Walks the left-nested declList in source order
+static void genDeclList(tree *node) {
+    if (!node)
+        return;
+    switch (node->nodeKind) {
+        case PROGRAM:
+        case DECLLIST:
+        case DECL:
+            for (int i = 0; i < node->numChildren; i++)
+                genDeclList(node->children[i]);
+            break;
+        case VARDECL:
+            genGlobal(node);
+            break;
+        case FUNDECL:
+            genFunction(node);
+            break;
+        default:
+            break;
+    }
+}
+
+void generateX86(tree *root, FILE *file) {
+    out = file;
+    globals = NULL;
+    numGlobals = 0;
+    numLabels = 0;
+
+    fprintf(out, "# x86-64 code generated by mcc\n");
+    fprintf(out, "\t.text\n");
+    genDeclList(root);
+
+    fprintf(out, "\n# output function\n");
+    fprintf(out, "startoutput:\n");
+    fprintf(out, "\tpushq %%rbp\n");
+    fprintf(out, "\tmovq %%rsp, %%rbp\n");
+    fprintf(out, "\tmovl %%edi, %%esi\n");
+    fprintf(out, "\tleaq .Loutputformat(%%rip), %%rdi\n");
+    fprintf(out, "\txorl %%eax, %%eax\n");
+    fprintf(out, "\tcall printf@PLT\n");
+    fprintf(out, "\tleave\n");
+    fprintf(out, "\tret\n");
+
+    fprintf(out, "\n\t.globl main\n");
+    fprintf(out, "main:\n");
+    fprintf(out, "\tpushq %%rbp\n");
+    fprintf(out, "\tmovq %%rsp, %%rbp\n");
+    fprintf(out, "\tcall startmain\n");
+    fprintf(out, "\txorl %%eax, %%eax\n");
+    fprintf(out, "\tleave\n");
+    fprintf(out, "\tret\n");
+
+    fprintf(out, "\n\t.section .rodata\n");
+    fprintf(out, ".Loutputformat:\n");
+    fprintf(out, "\t.string \"%%d\"\n");
+
+    if (numGlobals > 0)
+        fprintf(out, "\n\t.bss\n");
+    for (int i = 0; i < numGlobals; i++) {
+        xVar *v = &globals[i];
+        if (v->width > 1)
+            fprintf(out, "\t.align %d\n", v->width);
+        fprintf(out, "var%s:\n", v->name);
+        fprintf(out, "\t.zero %d\n", v->width * v->size);
+    }
+    fprintf(out, "\n\t.section .note.GNU-stack,\"\",@progbits\n");
+    free(globals);
+    globals = NULL;
+}
@@ -0,0 +1,14 @@
+#ifndef X86GEN_H
+#define X86GEN_H
+
+#include <stdio.h>
+#include "tree.h"
+
+// Writes the program as x86-64 assembly in GNU as syntax, following the
+// System V calling convention. The file carries its own main, which calls
+// the program's main, and an output routine over printf, so it links with
+// cc alone. Functions and globals get the start and var prefixes of the
+// MIPS code. No optimization is done.
+void generateX86(tree *root, FILE *out);
+
+#endif
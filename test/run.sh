@@ -0,0 +1,200 @@
+#!/bin/sh
+# Runs the test cases with the compiler given as the first argument:
+#     test/run.sh ./mcc
+#
+# Each test/cases/NAME.mC is compiled with the options on its first line
+# when that line is a comment "/* mcc: OPTIONS */", and with none
+# otherwise. Then
+#   exp/NAME.exp  starting with "error" is compared with what mcc printed
+#                 on stdout, and otherwise with the generated assembly,
+#                 or the object with -c
+#   exp/NAME.out  is compared with stdout, for cases run with --sim
+#                 or --run or printing a report
+#   exp/NAME.err  is compared with stderr
+# whichever of them exist, and at least one must. After that the
+# programs in bench and cases are run with --run, with --sim at -O0, -O1
+# and -O2 and natively when the host allows, and the outputs compared.
+
+if [ $# -lt 1 ]; then
+    echo "usage: $0 MCC" >&2
+    exit 2
+fi
+case $1 in
+    /*) mcc=$1 ;;
+    *) mcc=$(pwd)/$1 ;;
+esac
+cd "$(dirname "$0")" || exit 2
+tmp=$(mktemp -d) || exit 2
+trap 'rm -rf "$tmp"' EXIT
+
+pass=0
+fail=0
+
+check() {
+    if cmp -s "$1" "$2"; then
+        return 0
+    fi
+    echo "FAIL $name: $3 differs from $2"
+    diff "$2" "$1" | head -10
+    return 1
+}
+
+for case in cases/*.mC; do
+    name=$(basename "$case" .mC)
+    opts=$(sed -n '1s|^/\* mcc: \(.*\) \*/$|\1|p' "$case")
+    rm -f "$tmp/out.asm"
+    $mcc $opts -o "$tmp/out.asm" "$case" > "$tmp/stdout" 2> "$tmp/stderr"
+    ok=1
+    if [ ! -f "exp/$name.exp" ] && [ ! -f "exp/$name.out" ] && [ ! -f "exp/$name.err" ]; then
+        echo "FAIL $name: nothing in exp to compare with"
+        ok=0
+    fi
+    if [ -f "exp/$name.exp" ]; then
+        if head -1 "exp/$name.exp" | grep -q '^error'; then
+            check "$tmp/stdout" "exp/$name.exp" stdout || ok=0
+        else
+            check "$tmp/out.asm" "exp/$name.exp" assembly || ok=0
+        fi
+    fi
+    if [ -f "exp/$name.out" ]; then
+        check "$tmp/stdout" "exp/$name.out" stdout || ok=0
+    fi
+    if [ -f "exp/$name.err" ]; then
+        check "$tmp/stderr" "exp/$name.err" stderr || ok=0
+    fi
+    if [ $ok = 1 ]; then
+        pass=$((pass + 1))
+    else
+        fail=$((fail + 1))
+    fi
+done
+
+# The interpreter and the simulated code must print the same. Cases that
+# stop with an error, make objects or check bounds are left out, and
+# cases written for -O1 or -O2 are not run at -O0, whose comparisons
+# subtract and which makes no tail calls. On an x86-64 host
+# with cc the --target=x86_64 code is linked and run too. That backend
+# does not optimize, so it is built once, and it makes no tail calls,
+# so it gets a larger stack.
+native=0
+if [ "$(uname -m)" = x86_64 ] && command -v cc > /dev/null; then
+    native=1
+fi
+for case in bench/*.mC cases/*.mC; do
+    name=$(basename "$case" .mC)
+    opts=$(sed -n '1s|^/\* mcc: \(.*\) \*/$|\1|p' "$case")
+    if [ -f "exp/$name.exp" ] && head -1 "exp/$name.exp" | grep -q '^error'; then
+        continue
+    fi
+    case " $opts " in
+        *" -c "*|*" --bounds-check "*) continue ;;
+    esac
+    levels="-O0 -O1 -O2"
+    case " $opts " in
+        *" -O1 "*|*" -O2 "*) levels="-O1 -O2" ;;
+    esac
+    $mcc --run "$case" > "$tmp/run" 2>&1
+    ok=1
+    for level in $levels; do
+        $mcc $level --sim -o "$tmp/out.asm" "$case" > "$tmp/sim" 2> /dev/null
+        if ! cmp -s "$tmp/sim" "$tmp/run"; then
+            echo "FAIL $name: $level --sim differs from --run"
+            diff "$tmp/run" "$tmp/sim" | head -10
+            ok=0
+        fi
+    done
+    if [ $native = 1 ]; then
+        # No "Compilation finished." and no final newline from the program
+        sed 1,2d "$tmp/run" > "$tmp/expected"
+        rm -f "$tmp/prog"
+        $mcc --target=x86_64 -o "$tmp/out.s" "$case" > /dev/null 2>&1 &&
+            cc -o "$tmp/prog" "$tmp/out.s" &&
+            { (ulimit -s 65536 2> /dev/null; "$tmp/prog"); echo; } > "$tmp/native"
+        if ! cmp -s "$tmp/native" "$tmp/expected"; then
+            echo "FAIL $name: --target=x86_64 differs from --run"
+            diff "$tmp/expected" "$tmp/native" | head -10
+            ok=0
+        fi
+    fi
+    if [ $ok = 1 ]; then
+        pass=$((pass + 1))
+    else
+        fail=$((fail + 1))
+    fi
+done
+
+# Code from --cache must be what a compile without it makes, whether the
+# cache is cold or warm. One cache serves every case, so functions that
+# several of them share come from the cache on the first compile too.
+for case in bench/*.mC cases/*.mC; do
+    name=$(basename "$case" .mC)
+    opts=$(sed -n '1s|^/\* mcc: \(.*\) \*/$|\1|p' "$case")
+    if [ -f "exp/$name.exp" ] && head -1 "exp/$name.exp" | grep -q '^error'; then
+        continue
+    fi
+    flags=
+    case " $opts " in
+        *" -c "*) flags="$flags -c" ;;
+    esac
+    case " $opts " in
+        *" --bounds-check "*) flags="$flags --bounds-check" ;;
+    esac
+    ok=1
+    for level in -O0 -O1 -O2; do
+        $mcc $level $flags -o "$tmp/plain" "$case" > /dev/null 2>&1
+        for run in cold warm; do
+            rm -f "$tmp/cached"
+            $mcc $level $flags --cache="$tmp/cache" -o "$tmp/cached" "$case" > /dev/null 2>&1
+            if ! cmp -s "$tmp/cached" "$tmp/plain"; then
+                echo "FAIL $name: $level$flags with a $run cache differs"
+                ok=0
+            fi
+        done
+    done
+    if [ $ok = 1 ]; then
+        pass=$((pass + 1))
+    else
+        fail=$((fail + 1))
+    fi
+done
+
+# Through --server and --connect every case must give what the same
+# compile gives locally: output file, stdout, stderr and exit status.
+$mcc --server="$tmp/sock" --workers=2 > /dev/null 2>&1 &
+server=$!
+trap 'kill $server 2> /dev/null; rm -rf "$tmp"' EXIT
+tries=0
+while [ ! -S "$tmp/sock" ] && [ $tries -lt 50 ]; do
+    sleep 0.1
+    tries=$((tries + 1))
+done
+if [ -S "$tmp/sock" ]; then
+    for case in cases/*.mC; do
+        name=$(basename "$case" .mC)
+        opts=$(sed -n '1s|^/\* mcc: \(.*\) \*/$|\1|p' "$case")
+        rm -f "$tmp/local" "$tmp/remote"
+        $mcc $opts -o "$tmp/local" "$case" > "$tmp/stdout" 2> "$tmp/stderr"
+        echo "exit $?" >> "$tmp/stdout"
+        $mcc --connect="$tmp/sock" $opts -o "$tmp/remote" "$case" > "$tmp/rstdout" 2> "$tmp/rstderr"
+        echo "exit $?" >> "$tmp/rstdout"
+        ok=1
+        if [ -f "$tmp/local" ] || [ -f "$tmp/remote" ]; then
+            check "$tmp/remote" "$tmp/local" "output file through the server" || ok=0
+        fi
+        check "$tmp/rstdout" "$tmp/stdout" "stdout through the server" || ok=0
+        check "$tmp/rstderr" "$tmp/stderr" "stderr through the server" || ok=0
+        if [ $ok = 1 ]; then
+            pass=$((pass + 1))
+        else
+            fail=$((fail + 1))
+        fi
+    done
+else
+    echo "FAIL: no compile server on $tmp/sock"
+    fail=$((fail + 1))
+fi
+kill $server 2> /dev/null
+wait $server 2> /dev/null
+
+echo "$pass passed, $fail failed"
+[ $fail = 0 ]